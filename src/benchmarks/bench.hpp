@@ -0,0 +1,41 @@
+//
+//  bench.hpp
+//  futurerestore
+//
+
+#ifndef bench_hpp
+#define bench_hpp
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * Timing for the benchmark executables. Each one is a plain program that prints one line per measurement,
+ * they aren't run by ctest. An optional first argument scales the amount of work, e.g. 0.1 for a quick check.
+ */
+namespace bench {
+    inline double scale(int argc, const char *argv[]) {
+        double factor = (argc > 1) ? atof(argv[1]) : 1.0;
+        return (factor > 0) ? factor : 1.0;
+    }
+
+    // seconds per call of fn, called iterations times after one warm-up call
+    template<typename F>
+    double secondsPerCall(size_t iterations, F fn) {
+        fn();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            fn();
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / (double) iterations;
+    }
+
+    // keeps the compiler from dropping work whose result nothing reads
+    template<typename T>
+    inline void keep(const T &value) {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+}
+
+#endif /* bench_hpp */
@@ -0,0 +1,83 @@
+//
+//  digest_stream_bench.cpp
+//  futurerestore benchmarks
+//
+//  Throughput of each digest and of the combinations futurerestore asks for, in one multi_digest_stream pass
+//  and as one pass per digest over the same bytes.
+//
+
+#include <libgeneral/macros.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "bench.hpp"
+#include "../digest_stream.hpp"
+
+namespace {
+    constexpr size_t chunkSize = 1 << 20;     // what digestStream reads at a time
+
+    const char *typeName(int type) {
+        switch (type) {
+            case 0: return "SHA384";
+            case 1: return "SHA256";
+            case 2: return "SHA512";
+            case 3: return "SHA1";
+            default: return "?";
+        }
+    }
+
+    std::string comboName(const std::vector<int> &types) {
+        std::string name;
+        for (int type: types) {
+            if (!name.empty()) name += "+";
+            name += typeName(type);
+        }
+        return name;
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    double scale = bench::scale(argc, argv);
+    // larger than any cache, like a firmware component or filesystem coming off disk
+    size_t size = (size_t) (256 * scale + 1) * chunkSize;
+    std::vector<unsigned char> data(size);
+    uint32_t state = 0x12345678;
+    for (auto &byte: data) {
+        state = state * 1664525 + 1013904223;
+        byte = (unsigned char) (state >> 24);
+    }
+    double gigabytes = (double) size / 1e9;
+    printf("%.0f MB in %zu KiB chunks, GB/s of input\n", (double) size / 1e6, chunkSize >> 10);
+
+    std::vector<std::vector<int>> combinations = {
+            {3}, {1}, {0}, {2},
+            {3, 0},             // digestsOf for a component shared by SHA1 and SHA384 manifests
+            {1, 0},
+            {3, 1, 0, 2},
+    };
+    for (const auto &types: combinations) {
+        double onePass = bench::secondsPerCall(3, [&] {
+            multi_digest_stream stream(types);
+            for (size_t off = 0; off < size; off += chunkSize) {
+                stream.update(data.data() + off, chunkSize);
+            }
+            bench::keep(stream.finish());
+        });
+        if (types.size() == 1) {
+            printf("%-28s %7.2f GB/s\n", comboName(types).c_str(), gigabytes / onePass);
+            continue;
+        }
+        double separate = bench::secondsPerCall(3, [&] {
+            for (int type: types) {
+                digest_stream stream(type);
+                for (size_t off = 0; off < size; off += chunkSize) {
+                    stream.update(data.data() + off, chunkSize);
+                }
+                bench::keep(stream.finish());
+            }
+        });
+        printf("%-28s %7.2f GB/s in one pass, %7.2f GB/s in %zu passes\n", comboName(types).c_str(),
+               gigabytes / onePass, gigabytes / separate, types.size());
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+//
+//  manifest_index_bench.cpp
+//  futurerestore benchmarks
+//
+//  Component lookups the way downloadLatest* do them: once parsing the manifest for every call,
+//  and through manifest_index.
+//
+
+#include <libgeneral/macros.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <plist/plist.h>
+#include "bench.hpp"
+#include "../futurerestore.hpp"
+#include "../manifest_index.hpp"
+
+namespace {
+    const char *components[] = {
+            "AppleLogo", "BatteryCharging0", "BatteryCharging1", "BatteryFull", "BatteryLow0", "BatteryLow1",
+            "DeviceTree", "KernelCache", "LLB", "RecoveryMode", "RestoreDeviceTree", "RestoreKernelCache",
+            "RestoreLogo", "RestoreRamDisk", "RestoreSEP", "RestoreTrustCache", "SEP", "StaticTrustCache", "iBEC",
+            "iBSS", "iBoot", "OS", "BasebandFirmware", "Rap,RTKitOS", "ANE", "AOP", "AVE", "GFX", "ISP", "PMP",
+    };
+    constexpr size_t identities = 40;           // boards times erase/update, about what a recent universal manifest has
+
+    std::string boardConfig(size_t board) {
+        return "d" + std::to_string(10 + board) + "ap";
+    }
+
+    // what getBuildidentityWithBoardconfig and the lookups read, filler digests
+    std::string syntheticManifest() {
+        plist_t manifest = plist_new_dict();
+        plist_t buildIdentities = plist_new_array();
+        for (size_t i = 0; i < identities; i++) {
+            plist_t identity = plist_new_dict();
+            plist_t info = plist_new_dict();
+            plist_dict_set_item(info, "DeviceClass", plist_new_string(boardConfig(i / 2).c_str()));
+            plist_dict_set_item(info, "RestoreBehavior", plist_new_string((i % 2) ? "Update" : "Erase"));
+            plist_dict_set_item(info, "Variant", plist_new_string((i % 2) ? "Customer Upgrade Install (IPSW)"
+                                                                          : "Customer Erase Install (IPSW)"));
+            plist_dict_set_item(identity, "Info", info);
+            plist_t elements = plist_new_dict();
+            for (const char *component: components) {
+                plist_t elem = plist_new_dict();
+                std::string digest(48, (char) (i + strlen(component)));
+                plist_dict_set_item(elem, "Digest", plist_new_data(digest.data(), digest.size()));
+                plist_t elemInfo = plist_new_dict();
+                std::string path = "Firmware/all_flash/" + std::string(component) + "." + boardConfig(i / 2) +
+                                   ".RELEASE.im4p";
+                plist_dict_set_item(elemInfo, "Path", plist_new_string(path.c_str()));
+                plist_dict_set_item(elem, "Info", elemInfo);
+                plist_dict_set_item(elements, component, elem);
+            }
+            plist_dict_set_item(identity, "Manifest", elements);
+            plist_array_append_item(buildIdentities, identity);
+        }
+        plist_dict_set_item(manifest, "BuildIdentities", buildIdentities);
+        char *xml = nullptr;
+        uint32_t xmlSize = 0;
+        plist_to_xml(manifest, &xml, &xmlSize);
+        std::string result(xml, xmlSize);
+        free(xml);
+        plist_free(manifest);
+        return result;
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    double scale = bench::scale(argc, argv);
+    std::string manifest = syntheticManifest();
+    // the last board's update identity, the worst case for the linear identity search
+    std::string board = boardConfig(identities / 2 - 1);
+    // a restore asks for path and digest of the boot chain and SEP, and whether a few optional components exist
+    std::vector<const char *> fetched = {"iBSS", "iBEC", "RestoreSEP", "SEP", "DeviceTree", "KernelCache",
+                                         "RestoreRamDisk", "BasebandFirmware"};
+    std::vector<const char *> optional = {"RestoreTrustCache", "StaticTrustCache", "Rap,RTKitOS", "Missing"};
+    size_t lookups = fetched.size() * 2 + optional.size();
+    printf("synthetic manifest: %zu identities of %zu components, %.1f MB of XML, %zu lookups per restore\n",
+           identities, sizeof(components) / sizeof(*components), (double) manifest.size() / 1e6, lookups);
+
+    double perCall = bench::secondsPerCall((size_t) (20 * scale) + 1, [&] {
+        for (const char *component: fetched) {
+            char *path = futurerestore::getPathOfElementInManifest(component, manifest.c_str(), board.c_str(), 1);
+            unsigned char *digest = futurerestore::getDigestOfElementInManifest(component, manifest.c_str(),
+                                                                                board.c_str(), 1);
+            bench::keep(path);
+            bench::keep(digest);
+            free(path);
+            free(digest);
+        }
+        for (const char *component: optional) {
+            bench::keep(futurerestore::elemExists(component, manifest.c_str(), board.c_str(), 1));
+        }
+    });
+    // including the one parse and indexing the identity, as every restore pays for them once
+    double indexed = bench::secondsPerCall((size_t) (200 * scale) + 1, [&] {
+        manifest_index index(manifest.c_str());
+        for (const char *component: fetched) {
+            bench::keep(index.getPathOfElement(component, board.c_str(), 1));
+            bench::keep(index.getDigestOfElement(component, board.c_str(), 1));
+        }
+        for (const char *component: optional) {
+            bench::keep(index.elemExists(component, board.c_str(), 1));
+        }
+    });
+    manifest_index index(manifest.c_str());
+    index.getBuildIdentity(board.c_str(), 1);
+    double probe = bench::secondsPerCall((size_t) (1000000 * scale) + 1, [&] {
+        bench::keep(index.getPathOfElement("KernelCache", board.c_str(), 1));
+    });
+
+    printf("per-call parsing:  %9.3f ms per restore, %9.3f ms per lookup\n", perCall * 1e3, perCall * 1e3 / lookups);
+    printf("manifest_index:    %9.3f ms per restore, %9.3f ms per lookup\n", indexed * 1e3, indexed * 1e3 / lookups);
+    printf("indexed lookup:    %9.1f ns once the identity is indexed\n", probe * 1e9);
+    printf("speedup:           %9.1fx\n", perCall / indexed);
+    return 0;
+}
@@ -0,0 +1,164 @@
+//
+//  ticket_loading_bench.cpp
+//  futurerestore benchmarks
+//
+//  Loading a directory of 10k synthetic .shsh2 files the way loadAPTickets does, one file after another
+//  and on a thread_pool, and matching a nonce against the loaded ticket_table.
+//
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <plist/plist.h>
+#include <zlib.h>
+#include "bench.hpp"
+#include "../futurerestore.hpp"
+#include "../thread_pool.hpp"
+#include "../ticket_table.hpp"
+#include "../tests/test.hpp"
+
+namespace {
+    std::string derLength(size_t size) {
+        if (size < 0x80) return std::string(1, (char) size);
+        std::string bytes;
+        for (; size; size >>= 8) bytes.insert(bytes.begin(), (char) (size & 0xff));
+        return std::string(1, (char) (0x80 | bytes.size())) + bytes;
+    }
+
+    std::string der(const std::string &tag, const std::string &content) {
+        return tag + derLength(content.size()) + content;
+    }
+
+    // constructed private tag holding a SEQUENCE { IA5String name, value }, like the properties of an IM4M
+    std::string property(const char *name, const std::string &value) {
+        uint32_t number = (uint32_t) name[0] << 24 | (uint32_t) name[1] << 16 | (uint32_t) name[2] << 8 | (uint32_t) name[3];
+        std::string tag(1, (char) 0xff);
+        std::string base128;
+        for (; number; number >>= 7) base128.insert(base128.begin(), (char) ((number & 0x7f) | (base128.empty() ? 0 : 0x80)));
+        tag += base128;
+        return der(tag, der("\x30", der("\x16", name) + value));
+    }
+
+    std::string derInteger(uint64_t value) {
+        std::string bytes;
+        for (; value; value >>= 8) bytes.insert(bytes.begin(), (char) (value & 0xff));
+        if (bytes.empty() || (bytes[0] & 0x80)) bytes.insert(bytes.begin(), '\0');
+        return der("\x02", bytes);
+    }
+
+    // an IM4M with the properties ticket_table reads, filler where the signature and certificates go
+    std::string im4m(size_t i, uint64_t ecid) {
+        std::string nonce(32, '\0');
+        for (size_t b = 0; b < sizeof(i); b++) nonce[b] = (char) (i >> (8 * b));
+        std::string manp = property("MANP", der("\x31", property("BNCH", der("\x04", nonce)) +
+                                                       property("ECID", derInteger(ecid))));
+        std::string manb = property("MANB", der("\x31", manp));
+        return der("\x30", der("\x16", "IM4M") + derInteger(0) + der("\x31", manb) + der("\x04", std::string(256, 's')) +
+                           der("\x30", der("\x04", std::string(3500, 'c'))));
+    }
+
+    std::string base64(const std::string &data) {
+        static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        for (size_t i = 0; i < data.size(); i += 3) {
+            uint32_t chunk = (uint8_t) data[i] << 16;
+            if (i + 1 < data.size()) chunk |= (uint8_t) data[i + 1] << 8;
+            if (i + 2 < data.size()) chunk |= (uint8_t) data[i + 2];
+            out += alphabet[chunk >> 18];
+            out += alphabet[(chunk >> 12) & 0x3f];
+            out += (i + 1 < data.size()) ? alphabet[(chunk >> 6) & 0x3f] : '=';
+            out += (i + 2 < data.size()) ? alphabet[chunk & 0x3f] : '=';
+        }
+        return out;
+    }
+
+    void writeTicket(const std::string &path, size_t i) {
+        std::string plist = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                            "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" "
+                            "\"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+                            "<plist version=\"1.0\">\n<dict>\n"
+                            "\t<key>ApImg4Ticket</key>\n\t<data>" + base64(im4m(i, 0x1a2b3c4d5e6f)) + "</data>\n"
+                            "\t<key>generator</key>\n\t<string>0x" + std::to_string(1111111111111111 + i) + "</string>\n"
+                            "</dict>\n</plist>\n";
+        gzFile out = gzopen(path.c_str(), "wb");
+        retassure(out, "failed to create %s\n", path.c_str());
+        gzwrite(out, plist.data(), (unsigned) plist.size());
+        gzclose(out);
+    }
+
+    void freeTicket(futurerestore::loaded_ticket &ticket) {
+        safeFreeCustom(ticket.apticket, plist_free);
+        safeFree(ticket.im4m);
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    double scale = bench::scale(argc, argv);
+    size_t count = (size_t) (10000 * scale) + 1;
+    tests::temp_dir dir;
+    retassure(!dir.path().empty(), "failed to create a temporary directory\n");
+    for (size_t i = 0; i < count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "%06zu.shsh2", i);
+        writeTicket(dir.file(name), i);
+    }
+    printf("%zu synthetic tickets\n", count);
+
+    std::vector<std::string> paths;
+    double expand = bench::secondsPerCall(1, [&] {
+        paths = futurerestore::expandAPTicketPaths({dir.path().c_str()});
+    });
+    retassure(paths.size() == count, "expected %zu tickets, found %zu\n", count, paths.size());
+
+    std::vector<futurerestore::loaded_ticket> loaded(count);
+    double sequential = bench::secondsPerCall(1, [&] {
+        for (size_t i = 0; i < count; i++) {
+            freeTicket(loaded[i]);
+            loaded[i] = futurerestore::loadAPTicket(paths[i], true, false);
+        }
+    });
+    size_t threads = std::min(count, thread_pool::defaultThreadCount());
+    std::atomic<size_t> failures{0};
+    double parallel = bench::secondsPerCall(1, [&] {
+        thread_pool pool(threads);
+        for (size_t i = 0; i < count; i++) {
+            pool.enqueue([&, i] {
+                freeTicket(loaded[i]);
+                try {
+                    loaded[i] = futurerestore::loadAPTicket(paths[i], true, false);
+                } catch (tihmstar::exception &) {
+                    failures++;
+                }
+            });
+        }
+        pool.wait();
+    });
+    retassure(!failures, "%zu tickets failed to load\n", failures.load());
+
+    ticket_table tickets;
+    double table = bench::secondsPerCall(1, [&] {
+        tickets = ticket_table();
+        for (const auto &ticket: loaded) {
+            tickets.add(ticket.nonce.data(), ticket.nonce.size(), ticket.ecid, ticket.generator);
+        }
+    });
+    const auto &last = loaded.back().nonce;
+    double lookup = bench::secondsPerCall(100000, [&] {
+        bench::keep(tickets.find(last.data(), last.size()));
+    });
+    size_t withNonce = (size_t) std::count_if(loaded.begin(), loaded.end(), [](const futurerestore::loaded_ticket &t) {
+        return !t.nonce.empty();
+    });
+    for (auto &ticket: loaded) freeTicket(ticket);
+
+    printf("expanding the directory: %8.1f ms\n", expand * 1e3);
+    printf("loading one by one:      %8.1f ms, %6.1f us per ticket\n", sequential * 1e3, sequential * 1e6 / count);
+    printf("loading on %2zu threads:  %8.1f ms, %6.1f us per ticket\n", threads, parallel * 1e3, parallel * 1e6 / count);
+    printf("filling ticket_table:    %8.1f ms\n", table * 1e3);
+    printf("matching a nonce:        %8.1f ns\n", lookup * 1e9);
+    printf("%zu of %zu tickets had a BNCH\n", withNonce, count);
+    return 0;
+}
@@ -0,0 +1,271 @@
+//
+//  blob_checker.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <img4tool/img4tool.hpp>
+#include "blob_checker.hpp"
+
+extern "C" {
+#include "common.h"
+#include "ipsw.h"
+}
+
+using namespace tihmstar;
+
+namespace {
+    std::string stringValue(plist_t dict, const char *key) {
+        plist_t node = dict ? plist_dict_get_item(dict, key) : nullptr;
+        if (!node || plist_get_node_type(node) != PLIST_STRING) return "";
+        char *str = nullptr;
+        plist_get_string_val(node, &str);
+        std::string ret = str ? str : "";
+        safeFree(str);
+        return ret;
+    }
+
+    std::string hexString(const std::string &bytes) {
+        static const char digits[] = "0123456789abcdef";
+        std::string ret;
+        ret.reserve(bytes.size() * 2);
+        for (unsigned char c: bytes) {
+            ret.push_back(digits[c >> 4]);
+            ret.push_back(digits[c & 0xf]);
+        }
+        return ret;
+    }
+
+    bool endsWith(const std::string &str, const char *suffix) {
+        size_t len = strlen(suffix);
+        return str.size() >= len && !strcasecmp(str.c_str() + str.size() - len, suffix);
+    }
+}
+
+blob_checker::blob_checker(bool updateInstall) : _updateInstall(updateInstall) {}
+
+blob_checker::~blob_checker() {
+    for (auto &t: _tickets) {
+        safeFreeCustom(t.loaded.apticket, plist_free);
+        safeFree(t.loaded.im4m);
+    }
+    for (auto &fw: _firmwares) {
+        safeFreeCustom(fw.manifest, plist_free);
+    }
+}
+
+void blob_checker::addTickets(const std::vector<const char *> &apticketPaths, size_t threads) {
+    std::vector<std::string> paths = futurerestore::expandAPTicketPaths(apticketPaths);
+    size_t first = _tickets.size();
+    _tickets.resize(first + paths.size());
+    thread_pool pool(std::min(paths.size(), threads));
+    for (size_t i = 0; i < paths.size(); i++) {
+        ticket &t = _tickets[first + i];
+        t.path = paths[i];
+        pool.enqueue([this, &t] {
+            try {
+                // doRestore only validates IMG4 tickets against the BuildManifest, 32-bit ones fail here
+                t.loaded = futurerestore::loadAPTicket(t.path, true, _updateInstall);
+                t.signatureValid = img4tool::isIM4MSignatureValid({t.loaded.im4m, t.loaded.im4mSize});
+            } catch (tihmstar::exception &e) {
+                t.loadError = e.what();
+            }
+        });
+    }
+    pool.wait();
+}
+
+void blob_checker::loadFirmware(firmware &fw) {
+    if (endsWith(fw.path, ".plist")) {
+        fw.manifest = futurerestore::loadPlistFromFile(fw.path.c_str());
+    } else {
+        int unused = 0;
+        retassure(!ipsw_extract_build_manifest(fw.path.c_str(), &fw.manifest, &unused),
+                  "failed to extract BuildManifest from %s\n", fw.path.c_str());
+    }
+    retassure(fw.manifest, "failed to load BuildManifest from %s\n", fw.path.c_str());
+    fw.version = stringValue(fw.manifest, "ProductVersion");
+    fw.build = stringValue(fw.manifest, "ProductBuildVersion");
+}
+
+void blob_checker::addFirmwares(const std::vector<std::string> &paths, size_t threads) {
+    size_t first = _firmwares.size();
+    _firmwares.resize(first + paths.size());
+    thread_pool pool(std::min(paths.size(), threads));
+    for (size_t i = 0; i < paths.size(); i++) {
+        firmware &fw = _firmwares[first + i];
+        fw.path = paths[i];
+        pool.enqueue([&fw] {
+            try {
+                loadFirmware(fw);
+            } catch (tihmstar::exception &e) {
+                fw.loadError = e.what();
+            }
+        });
+    }
+    pool.wait();
+}
+
+void blob_checker::writeRow(FILE *out, const std::vector<std::string> &fields) {
+    std::string row;
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (i) row.push_back(',');
+        const std::string &field = fields[i];
+        if (field.find_first_of(",\"\n") == std::string::npos) {
+            row += field;
+            continue;
+        }
+        row.push_back('"');
+        for (char c: field) {
+            if (c == '"') row.push_back('"');
+            row.push_back(c);
+        }
+        row.push_back('"');
+    }
+    row.push_back('\n');
+    fwrite(row.data(), 1, row.size(), out);
+}
+
+size_t blob_checker::run(FILE *out, size_t threads) const {
+    std::mutex outLock;
+    std::atomic<size_t> compatible{0};
+    writeRow(out, {"ticket", "ecid", "signature", "firmware", "version", "build", "result", "device_class",
+                   "variant", "error"});
+    fflush(out);
+
+    thread_pool pool(std::min(_tickets.size() * _firmwares.size(), threads));
+    for (const ticket &t: _tickets) {
+        for (const firmware &fw: _firmwares) {
+            pool.enqueue([&t, &fw, &outLock, &compatible, out] {
+                char ecid[32]{};
+                snprintf(ecid, sizeof(ecid), "%" PRIu64, t.loaded.ecid);
+                std::string result;
+                std::string failure = !t.loadError.empty() ? t.loadError : fw.loadError;
+                plist_t identity = nullptr;
+                if (failure.empty()) {
+                    try {
+                        identity = img4tool::getBuildIdentityForIm4m({t.loaded.im4m, t.loaded.im4mSize}, fw.manifest);
+                    } catch (tihmstar::exception &) {
+                        //
+                    }
+                    if (identity) {
+                        result = "match";
+                    } else {
+                        // the same fallback doRestore uses when there is no exact match
+                        try {
+                            identity = img4tool::getBuildIdentityForIm4m({t.loaded.im4m, t.loaded.im4mSize},
+                                                                         fw.manifest,
+                                                                         {"RestoreRamDisk", "RestoreTrustCache"});
+                        } catch (tihmstar::exception &) {
+                            //
+                        }
+                        result = identity ? "match-ignoring-ramdisk" : "no-match";
+                    }
+                    if (identity && !t.loaded.ecid) {
+                        // doRestore refuses a ticket it can't read an ECID from
+                        result = "no-ecid";
+                        identity = nullptr;
+                    }
+                } else {
+                    result = "error";
+                }
+                if (identity) compatible++;
+                plist_t identityInfo = identity ? plist_dict_get_item(identity, "Info") : nullptr;
+                std::vector<std::string> row = {
+                        t.path, t.loadError.empty() ? ecid : "",
+                        t.loadError.empty() ? (t.signatureValid ? "valid" : "invalid") : "",
+                        fw.path, fw.version, fw.build, result,
+                        stringValue(identityInfo, "DeviceClass"), stringValue(identityInfo, "Variant"), failure
+                };
+                std::unique_lock<std::mutex> lk(outLock);
+                writeRow(out, row);
+                fflush(out);
+            });
+        }
+    }
+    pool.wait();
+
+    info("Checked %zu signing tickets against %zu firmwares, %zu compatible pairs\n", _tickets.size(),
+         _firmwares.size(), (size_t) compatible);
+    return compatible;
+}
+
+size_t blob_checker::auditGenerators(FILE *out, size_t threads) const {
+    // libraries tend to reuse a handful of generators, so each (generator, nonce size) is hashed once
+    std::vector<std::pair<uint64_t, size_t>> keys;
+    std::vector<size_t> keyOf(_tickets.size(), (size_t) -1);
+    {
+        std::map<std::pair<uint64_t, size_t>, size_t> keyIndex;
+        for (size_t i = 0; i < _tickets.size(); i++) {
+            const ticket &t = _tickets[i];
+            size_t nonceSize = t.loaded.nonce.size();
+            if (!t.loadError.empty() || !t.loaded.generator || (nonceSize != 20 && nonceSize != 32)) continue;
+            auto inserted = keyIndex.emplace(std::make_pair(t.loaded.generator, nonceSize), keys.size());
+            if (inserted.second) keys.push_back(inserted.first->first);
+            keyOf[i] = inserted.first->second;
+        }
+    }
+
+    // a single hash is far cheaper than handing it to a worker, so the pool gets batches
+    static constexpr size_t batchSize = 4096;
+    std::vector<std::string> expected(keys.size());
+    {
+        thread_pool pool(std::min((keys.size() + batchSize - 1) / batchSize, threads));
+        for (size_t first = 0; first < keys.size(); first += batchSize) {
+            pool.enqueue([&keys, &expected, first] {
+                for (size_t i = first; i < std::min(first + batchSize, keys.size()); i++) {
+                    try {
+                        expected[i] = futurerestore::nonceForGenerator(keys[i].first, keys[i].second);
+                    } catch (tihmstar::exception &) {
+                        // left empty, reported as an error below
+                    }
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    writeRow(out, {"ticket", "ecid", "generator", "nonce", "expected_nonce", "result", "error"});
+    size_t flagged = 0;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < _tickets.size(); i++) {
+        const ticket &t = _tickets[i];
+        char ecid[32]{};
+        char generator[32]{};
+        std::string result;
+        if (!t.loadError.empty()) {
+            result = "error";
+        } else {
+            snprintf(ecid, sizeof(ecid), "%" PRIu64, t.loaded.ecid);
+            if (t.loaded.generator) snprintf(generator, sizeof(generator), "0x%016" PRIx64, t.loaded.generator);
+            if (t.loaded.nonce.empty()) {
+                result = "no-nonce";
+            } else if (!t.loaded.generator) {
+                result = "no-generator";
+            } else if (keyOf[i] == (size_t) -1) {
+                result = "unknown-nonce-size";
+            } else if (expected[keyOf[i]].empty()) {
+                result = "error";
+            } else if (expected[keyOf[i]] == t.loaded.nonce) {
+                result = "ok";
+            } else {
+                result = "mismatch";
+                mismatches++;
+            }
+        }
+        if (result != "ok") flagged++;
+        writeRow(out, {t.path, ecid, generator, hexString(t.loaded.nonce),
+                       keyOf[i] != (size_t) -1 ? hexString(expected[keyOf[i]]) : "", result, t.loadError});
+    }
+    fflush(out);
+
+    info("Audited %zu signing tickets (%zu distinct generators), %zu flagged, %zu with a generator that doesn't "
+         "produce their nonce\n", _tickets.size(), keys.size(), flagged, mismatches);
+    return flagged;
+}
@@ -0,0 +1,64 @@
+//
+//  blob_checker.hpp
+//  futurerestore
+//
+
+#ifndef blob_checker_hpp
+#define blob_checker_hpp
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <plist/plist.h>
+#include "futurerestore.hpp"
+#include "thread_pool.hpp"
+
+/*
+ * Device-free check of saved signing tickets against firmwares.
+ * Every ticket and manifest is parsed once, then each (ticket, firmware) pair runs the BuildIdentity and ECID
+ * checks doRestore does before a restore. Pairs are checked on a thread pool and written as CSV rows as soon as
+ * they are decided, so rows come out in no particular order.
+ * The generator audit needs no firmwares, it checks that each ticket's generator produces the nonce it was
+ * signed for, the same check enterPwnRecovery makes after setting the generator on a device.
+ */
+class blob_checker {
+    struct ticket {
+        std::string path;
+        futurerestore::loaded_ticket loaded;
+        bool signatureValid = false;
+        std::string loadError;
+    };
+    struct firmware {
+        std::string path;
+        plist_t manifest = nullptr;
+        std::string version;
+        std::string build;
+        std::string loadError;
+    };
+
+    bool _updateInstall;
+    std::vector<ticket> _tickets;
+    std::vector<firmware> _firmwares;
+
+    static void loadFirmware(firmware &fw);
+    static void writeRow(FILE *out, const std::vector<std::string> &fields);
+
+public:
+    explicit blob_checker(bool updateInstall = false);
+    blob_checker(const blob_checker &) = delete;
+    blob_checker &operator=(const blob_checker &) = delete;
+    ~blob_checker();
+
+    // same paths as -t, directories and globs included; unreadable tickets show up as errors in the matrix
+    void addTickets(const std::vector<const char *> &apticketPaths, size_t threads = thread_pool::defaultThreadCount());
+    // iPSWs or BuildManifest.plist files
+    void addFirmwares(const std::vector<std::string> &paths, size_t threads = thread_pool::defaultThreadCount());
+
+    // writes the header and one row per pair to out, returns the number of pairs the ticket can restore
+    size_t run(FILE *out, size_t threads = thread_pool::defaultThreadCount()) const;
+    // writes one CSV row per ticket saying whether its generator hashes to its BNCH, returns the number of tickets
+    // flagged, i.e. every row that isn't "ok"
+    size_t auditGenerators(FILE *out, size_t threads = thread_pool::defaultThreadCount()) const;
+};
+
+#endif /* blob_checker_hpp */
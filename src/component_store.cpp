@@ -0,0 +1,167 @@
+//
+//  component_store.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "component_store.hpp"
+#include "digest_stream.hpp"
+#include "thread_pool.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+using namespace tihmstar;
+
+component_store::component_store(std::string root, digest_index *index, uint64_t budget)
+        : _root(std::move(root)), _index(index), _budget(budget) {
+    retassure(!_root.empty(), "%s: got empty store root\n", __func__);
+    retassure(_index, "%s: got no digest index\n", __func__);
+    mkdir_with_parents((_root + "/staging").c_str(), 0755);
+}
+
+std::string component_store::hexDigest(const unsigned char *digest, size_t digestSize) {
+    retassure(digest && digestSize, "%s: got empty digest\n", __func__);
+    static const char hexChars[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(digestSize * 2);
+    for (size_t i = 0; i < digestSize; i++) {
+        hex.push_back(hexChars[digest[i] >> 4]);
+        hex.push_back(hexChars[digest[i] & 0xf]);
+    }
+    return hex;
+}
+
+std::string component_store::pathFor(const unsigned char *digest, size_t digestSize) const {
+    std::string hex = hexDigest(digest, digestSize);
+    return _root + "/" + hex.substr(0, 2) + "/" + hex;
+}
+
+std::string component_store::newStagingFile(const unsigned char *digest, size_t digestSize) const {
+    std::string path = _root + "/staging/" + hexDigest(digest, digestSize) + ".XXXXXX";
+    int fd = mkstemp(&path[0]);
+    retassure(fd >= 0, "%s: failed to create a staging file in %s/staging\n", __func__, _root.c_str());
+    close(fd);
+    return path;
+}
+
+bool component_store::lookup(const unsigned char *digest, size_t digestSize) {
+    std::string path = pathFor(digest, digestSize);
+    // one stat if the index knows the file, a full rehash if it was never verified or changed behind our back
+    if (!_index->matches(path, std::string((const char *) digest, digestSize))) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lk(_lock);
+    _pinned.insert(path);
+    return true;
+}
+
+std::vector<uint8_t> component_store::lookupAll(const std::vector<std::string> &digests, size_t threads) {
+    std::vector<uint8_t> found(digests.size(), 0);
+    if (digests.empty()) return found;
+    thread_pool pool(std::min(threads, digests.size()));
+    for (size_t i = 0; i < digests.size(); i++) {
+        pool.enqueue([this, &digests, &found, i] {
+            try {
+                found[i] = lookup((const unsigned char *) digests[i].data(), digests[i].size());
+            } catch (tihmstar::exception &e) {
+                debug("%s: %s\n", __func__, e.what());
+            }
+        });
+    }
+    pool.wait();
+    return found;
+}
+
+void component_store::commit(const unsigned char *digest, size_t digestSize, const std::string &stagingPath) {
+    std::string path = pathFor(digest, digestSize);
+    int type = digest_stream::typeForDigestSize(digestSize);
+    retassure(type >= 0, "%s: unsupported digest size %zu\n", __func__, digestSize);
+    struct stat st{};
+    retassure(!stat(stagingPath.c_str(), &st), "%s: %s is missing\n", __func__, stagingPath.c_str());
+
+    mkdir_with_parents(path.substr(0, path.find_last_of('/')).c_str(), 0755);
+    if (rename(stagingPath.c_str(), path.c_str())) {
+        // windows won't rename over an existing file
+        remove(path.c_str());
+        retassure(!rename(stagingPath.c_str(), path.c_str()), "%s: failed to move %s into the store\n", __func__,
+                  stagingPath.c_str());
+    }
+    _index->record(path, type, std::string((const char *) digest, digestSize));
+    std::unique_lock<std::mutex> lk(_lock);
+    _pinned.insert(path);
+}
+
+void component_store::evict() {
+    // a download in progress keeps touching its file, anything untouched for a day was abandoned by a crashed run
+    std::string stagingPath = _root + "/staging";
+    if (DIR *stagingDir = opendir(stagingPath.c_str())) {
+        while (struct dirent *file = readdir(stagingDir)) {
+            if (file->d_name[0] == '.') continue;
+            std::string filePath = stagingPath + "/" + file->d_name;
+            struct stat st{};
+            if (!stat(filePath.c_str(), &st) && S_ISREG(st.st_mode) && st.st_mtime < time(nullptr) - 24 * 60 * 60) {
+                remove(filePath.c_str());
+            }
+        }
+        closedir(stagingDir);
+    }
+
+    struct cached_file {
+        std::string path;
+        uint64_t size;
+        int64_t lastUsed;
+    };
+    std::vector<cached_file> files;
+    uint64_t total = 0;
+
+    DIR *rootDir = opendir(_root.c_str());
+    if (!rootDir) return;
+    cleanup([&] {
+        safeFreeCustom(rootDir, closedir);
+    });
+    while (struct dirent *bucket = readdir(rootDir)) {
+        if (strlen(bucket->d_name) != 2) continue;
+        std::string bucketPath = _root + "/" + bucket->d_name;
+        DIR *bucketDir = opendir(bucketPath.c_str());
+        if (!bucketDir) continue;
+        while (struct dirent *file = readdir(bucketDir)) {
+            if (file->d_name[0] == '.' || strchr(file->d_name, '.')) continue;
+            std::string filePath = bucketPath + "/" + file->d_name;
+            struct stat st{};
+            if (stat(filePath.c_str(), &st) || !S_ISREG(st.st_mode)) continue;
+            int64_t lastUsed = _index->lastUsed(filePath);
+            files.push_back({filePath, (uint64_t) st.st_size, lastUsed >= 0 ? lastUsed : (int64_t) st.st_mtime});
+            total += (uint64_t) st.st_size;
+        }
+        closedir(bucketDir);
+    }
+    if (total <= _budget) return;
+
+    std::sort(files.begin(), files.end(), [](const cached_file &a, const cached_file &b) {
+        return a.lastUsed < b.lastUsed;
+    });
+    std::unique_lock<std::mutex> lk(_lock);
+    for (const cached_file &f: files) {
+        if (total <= _budget) break;
+        if (_pinned.count(f.path)) continue;
+        if (!remove(f.path.c_str())) {
+            _index->forget(f.path);
+            debug("Evicted %s from component cache\n", f.path.c_str());
+            total -= f.size;
+        }
+    }
+    if (total > _budget) {
+        info("Component cache is %llu MiB, over its %llu MiB budget with files needed for this restore\n",
+             (unsigned long long) (total >> 20), (unsigned long long) (_budget >> 20));
+    }
+}
@@ -0,0 +1,62 @@
+//
+//  component_store.hpp
+//  futurerestore
+//
+
+#ifndef component_store_hpp
+#define component_store_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "digest_index.hpp"
+
+/*
+ * Content addressed cache for firmware components, keyed by the component's manifest Digest.
+ * Files live at <root>/<first two hex chars>/<hex digest>, so components of any number of
+ * versions and devices can be cached side by side.
+ * A file only enters the store after its contents were checked against the digest, the verified
+ * digest is recorded in the digest index. A lookup hit is trusted without rehashing as long as
+ * the index still has the file's stat data, anything else is hashed again before use.
+ * Everything looked up or committed during this run is pinned and never evicted.
+ */
+class component_store {
+    std::string _root;
+    digest_index *_index;
+    uint64_t _budget;
+    std::mutex _lock;
+    std::unordered_set<std::string> _pinned;
+
+    static std::string hexDigest(const unsigned char *digest, size_t digestSize);
+
+public:
+    static constexpr uint64_t defaultBudget = 8ULL << 30;
+
+    component_store(std::string root, digest_index *index, uint64_t budget = defaultBudget);
+    component_store(const component_store &) = delete;
+    component_store &operator=(const component_store &) = delete;
+
+    const std::string &root() const {return _root;}
+    uint64_t budget() const {return _budget;}
+    void setBudget(uint64_t budget) {_budget = budget;}
+
+    std::string pathFor(const unsigned char *digest, size_t digestSize) const;
+    // creates an empty, uniquely named file for a download to land in before commit() moves it into place,
+    // so sessions and processes fetching the same component never write to the same file
+    std::string newStagingFile(const unsigned char *digest, size_t digestSize) const;
+
+    // true if the component is cached, marks it as recently used
+    bool lookup(const unsigned char *digest, size_t digestSize);
+    // lookup() for many raw digests at once, files that need rehashing are hashed concurrently
+    std::vector<uint8_t> lookupAll(const std::vector<std::string> &digests, size_t threads);
+    // moves stagingPath into the store, the caller must have checked it against digest already.
+    // Concurrent commits of one digest all succeed, the last rename wins with identical contents.
+    void commit(const unsigned char *digest, size_t digestSize, const std::string &stagingPath);
+    // removes least recently used unpinned files until the store fits the budget, and staging files left behind
+    void evict();
+};
+
+#endif /* component_store_hpp */
@@ -0,0 +1,180 @@
+//
+//  device_backend.cpp
+//  futurerestore
+//
+
+#include <cstring>
+#include "device_backend.hpp"
+#include "device_state_machine.hpp"
+
+extern "C" {
+#include "common.h"
+#include "idevicerestore.h"
+#include "normal.h"
+#include "recovery.h"
+#include "dfu.h"
+#include "restore.h"
+void irecv_event_cb(const irecv_device_event_t *event, void *userdata);
+void idevice_event_cb(const idevice_event_t *event, void *userdata);
+}
+
+namespace {
+    int currentMode(struct idevicerestore_client_t *client) {
+        mutex_lock(&client->device_event_mutex);
+        int mode = client->mode ? client->mode->index : _MODE_UNKNOWN;
+        mutex_unlock(&client->device_event_mutex);
+        return mode;
+    }
+
+    // with the mode from before the event, a device that left and came back in the same mode still counts
+    void countRemoval(struct idevicerestore_client_t *client, int modeBefore) {
+        if (modeBefore == _MODE_UNKNOWN) return;
+        mutex_lock(&client->device_event_mutex);
+        client_event_source::deviceRemoved(client);
+        cond_signal(&client->device_event_cond);
+        mutex_unlock(&client->device_event_mutex);
+    }
+}
+
+void usb_device_backend::deliverIrecvEvent(const irecv_device_event_t *event, struct idevicerestore_client_t *client) {
+    int modeBefore = currentMode(client);
+    irecv_event_cb(event, client);
+    // other devices on the bus come and go as well, only the client's own counts
+    if (event->type == IRECV_DEVICE_REMOVE && event->device_info && client->ecid &&
+        event->device_info->ecid == client->ecid) {
+        countRemoval(client, modeBefore);
+    }
+}
+
+void usb_device_backend::deliverIdeviceEvent(const idevice_event_t *event, struct idevicerestore_client_t *client) {
+    int modeBefore = currentMode(client);
+    idevice_event_cb(event, client);
+    if (event->event == IDEVICE_DEVICE_REMOVE && event->udid && client->udid && !strcmp(event->udid, client->udid)) {
+        countRemoval(client, modeBefore);
+    }
+}
+
+void usb_device_backend::irecvCallback(const irecv_device_event_t *event, void *userdata) {
+    deliverIrecvEvent(event, (struct idevicerestore_client_t *) userdata);
+}
+
+void usb_device_backend::ideviceCallback(const idevice_event_t *event, void *userdata) {
+    deliverIdeviceEvent(event, (struct idevicerestore_client_t *) userdata);
+}
+
+int usb_device_backend::checkMode(struct idevicerestore_client_t *client) {
+    return check_mode(client);
+}
+
+bool usb_device_backend::isImage4Supported(struct idevicerestore_client_t *client) {
+    return is_image4_supported(client);
+}
+
+int usb_device_backend::getPreflightInfo(struct idevicerestore_client_t *client, plist_t *info) {
+    return normal_get_preflight_info(client, info);
+}
+
+void usb_device_backend::subscribeEvents(struct idevicerestore_client_t *client) {
+    irecv_device_event_subscribe(&client->irecv_e_ctx, irecvCallback, client);
+    // a subscription per client, the global idevice_event_subscribe only takes one and sessions run side by side
+    idevice_events_subscribe((idevice_subscription_context_t *) &client->idevice_e_ctx, ideviceCallback, client);
+}
+
+void usb_device_backend::unsubscribeEvents(struct idevicerestore_client_t *client) {
+    if (client->irecv_e_ctx) {
+        irecv_device_event_unsubscribe(client->irecv_e_ctx);
+        client->irecv_e_ctx = nullptr;
+    }
+    if (client->idevice_e_ctx) {
+        idevice_events_unsubscribe((idevice_subscription_context_t) client->idevice_e_ctx);
+        client->idevice_e_ctx = nullptr;
+    }
+}
+
+int usb_device_backend::connect(struct idevicerestore_client_t *client, int mode) {
+    return (mode == _MODE_DFU) ? dfu_client_new(client) : recovery_client_new(client);
+}
+
+void usb_device_backend::disconnect(struct idevicerestore_client_t *client) {
+    dfu_client_free(client);
+    recovery_client_free(client);
+}
+
+void usb_device_backend::close(struct idevicerestore_client_t *client) {
+    disconnect(client);
+}
+
+int usb_device_backend::setConfiguration(struct idevicerestore_client_t *client, int configuration) {
+    return irecv_usb_set_configuration(client->dfu->client, configuration);
+}
+
+irecv_error_t usb_device_backend::sendBuffer(struct idevicerestore_client_t *client, const unsigned char *data,
+                                             size_t size) {
+    return irecv_send_buffer(client->dfu->client, (unsigned char *) data, (unsigned long) size, 1);
+}
+
+irecv_error_t usb_device_backend::bootBuffer(struct idevicerestore_client_t *client, const unsigned char *data,
+                                             size_t size) {
+    irecv_error_t err = irecv_send_buffer(client->dfu->client, (unsigned char *) data, (unsigned long) size, 1);
+    if (err != IRECV_E_SUCCESS) return err;
+    if ((err = irecv_send_command_breq(client->dfu->client, "go", 1)) != IRECV_E_SUCCESS) return err;
+    irecv_usb_control_transfer(client->dfu->client, 0x21, 1, 0, 0, nullptr, 0, 5000);
+    return IRECV_E_SUCCESS;
+}
+
+irecv_error_t usb_device_backend::sendCommand(struct idevicerestore_client_t *client, const char *command) {
+    return irecv_send_command(client->recovery ? client->recovery->client : client->dfu->client, command);
+}
+
+irecv_error_t usb_device_backend::getEnv(struct idevicerestore_client_t *client, const char *name, char **value) {
+    return irecv_getenv(client->recovery->client, name, value);
+}
+
+irecv_error_t usb_device_backend::setEnv(struct idevicerestore_client_t *client, const char *name,
+                                         const char *value) {
+    return irecv_setenv(client->recovery->client, name, value);
+}
+
+irecv_error_t usb_device_backend::saveEnv(struct idevicerestore_client_t *client) {
+    return irecv_saveenv(client->recovery->client);
+}
+
+int usb_device_backend::setAutoboot(struct idevicerestore_client_t *client, bool enable) {
+    return recovery_set_autoboot(client, enable);
+}
+
+int usb_device_backend::enterRecovery(struct idevicerestore_client_t *client) {
+    return normal_enter_recovery(client);
+}
+
+int usb_device_backend::reset(struct idevicerestore_client_t *client) {
+    return recovery_send_reset(client);
+}
+
+int usb_device_backend::getApNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) {
+    // get_ap_nonce logs the nonce, callers print it themselves
+    if (client->mode == MODE_RECOVERY) return recovery_get_ap_nonce(client, nonce, nonceSize);
+    return get_ap_nonce(client, nonce, nonceSize);
+}
+
+int usb_device_backend::getSepNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) {
+    return get_sep_nonce(client, nonce, nonceSize);
+}
+
+int usb_device_backend::sendComponent(struct idevicerestore_client_t *client, plist_t build_identity,
+                                      const char *component) {
+    return dfu_send_component(client, build_identity, component);
+}
+
+int usb_device_backend::sendIBEC(struct idevicerestore_client_t *client, plist_t build_identity) {
+    return recovery_send_ibec(client, build_identity);
+}
+
+int usb_device_backend::enterRestore(struct idevicerestore_client_t *client, plist_t build_identity) {
+    return recovery_enter_restore(client, build_identity);
+}
+
+int usb_device_backend::restore(struct idevicerestore_client_t *client, plist_t build_identity,
+                                const char *filesystem) {
+    return restore_device(client, build_identity, filesystem);
+}
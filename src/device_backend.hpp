@@ -0,0 +1,102 @@
+//
+//  device_backend.hpp
+//  futurerestore
+//
+
+#ifndef device_backend_hpp
+#define device_backend_hpp
+
+#include <cstddef>
+#include <libirecovery.h>
+#include <plist/plist.h>
+
+struct idevicerestore_client_t;
+
+/*
+ * The device calls futurerestore makes between finding a device and restoring it.
+ * Return values follow the libirecovery/idevicerestore call each method stands in for.
+ * Mode changes are reported the way idevicerestore's event callbacks do it: client->mode is set and
+ * device_event_cond signalled with device_event_mutex held, so device_state_machine works with any backend.
+ */
+class device_backend {
+public:
+    virtual ~device_backend() = default;
+
+    virtual int checkMode(struct idevicerestore_client_t *client) = 0;
+    virtual bool isImage4Supported(struct idevicerestore_client_t *client) = 0;
+    virtual int getPreflightInfo(struct idevicerestore_client_t *client, plist_t *info) = 0;
+    virtual void subscribeEvents(struct idevicerestore_client_t *client) = 0;
+    virtual void unsubscribeEvents(struct idevicerestore_client_t *client) = 0;
+
+    // mode is _MODE_DFU or _MODE_RECOVERY
+    virtual int connect(struct idevicerestore_client_t *client, int mode) = 0;
+    virtual void disconnect(struct idevicerestore_client_t *client) = 0;
+    // last call before client is freed
+    virtual void close(struct idevicerestore_client_t *client) = 0;
+    virtual int setConfiguration(struct idevicerestore_client_t *client, int configuration) = 0;
+
+    // sends an image over the DFU connection, images sent in DFU mode boot once the transfer finishes
+    virtual irecv_error_t sendBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) = 0;
+    // sends an image over the DFU connection and tells iBoot to jump to it
+    virtual irecv_error_t bootBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) = 0;
+    virtual irecv_error_t sendCommand(struct idevicerestore_client_t *client, const char *command) = 0;
+    virtual irecv_error_t getEnv(struct idevicerestore_client_t *client, const char *name, char **value) = 0;
+    virtual irecv_error_t setEnv(struct idevicerestore_client_t *client, const char *name, const char *value) = 0;
+    virtual irecv_error_t saveEnv(struct idevicerestore_client_t *client) = 0;
+    virtual int setAutoboot(struct idevicerestore_client_t *client, bool enable) = 0;
+    virtual int enterRecovery(struct idevicerestore_client_t *client) = 0;
+    virtual int reset(struct idevicerestore_client_t *client) = 0;
+    // the nonce is malloc'd and owned by the caller
+    virtual int getApNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) = 0;
+    virtual int getSepNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) = 0;
+
+    // idevicerestore's own senders, build_identity picks the images
+    virtual int sendComponent(struct idevicerestore_client_t *client, plist_t build_identity, const char *component) = 0;
+    virtual int sendIBEC(struct idevicerestore_client_t *client, plist_t build_identity) = 0;
+    virtual int enterRestore(struct idevicerestore_client_t *client, plist_t build_identity) = 0;
+    virtual int restore(struct idevicerestore_client_t *client, plist_t build_identity, const char *filesystem) = 0;
+};
+
+/*
+ * A real device, over libirecovery and idevicerestore.
+ */
+class usb_device_backend : public device_backend {
+    static void irecvCallback(const irecv_device_event_t *event, void *userdata);
+    static void ideviceCallback(const idevice_event_t *event, void *userdata);
+
+protected:
+    // idevicerestore's event callbacks, also counting removals of the client's device for client_event_source
+    static void deliverIrecvEvent(const irecv_device_event_t *event, struct idevicerestore_client_t *client);
+    static void deliverIdeviceEvent(const idevice_event_t *event, struct idevicerestore_client_t *client);
+
+public:
+    int checkMode(struct idevicerestore_client_t *client) override;
+    bool isImage4Supported(struct idevicerestore_client_t *client) override;
+    int getPreflightInfo(struct idevicerestore_client_t *client, plist_t *info) override;
+    void subscribeEvents(struct idevicerestore_client_t *client) override;
+    void unsubscribeEvents(struct idevicerestore_client_t *client) override;
+
+    int connect(struct idevicerestore_client_t *client, int mode) override;
+    void disconnect(struct idevicerestore_client_t *client) override;
+    void close(struct idevicerestore_client_t *client) override;
+    int setConfiguration(struct idevicerestore_client_t *client, int configuration) override;
+
+    irecv_error_t sendBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) override;
+    irecv_error_t bootBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) override;
+    irecv_error_t sendCommand(struct idevicerestore_client_t *client, const char *command) override;
+    irecv_error_t getEnv(struct idevicerestore_client_t *client, const char *name, char **value) override;
+    irecv_error_t setEnv(struct idevicerestore_client_t *client, const char *name, const char *value) override;
+    irecv_error_t saveEnv(struct idevicerestore_client_t *client) override;
+    int setAutoboot(struct idevicerestore_client_t *client, bool enable) override;
+    int enterRecovery(struct idevicerestore_client_t *client) override;
+    int reset(struct idevicerestore_client_t *client) override;
+    int getApNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) override;
+    int getSepNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) override;
+
+    int sendComponent(struct idevicerestore_client_t *client, plist_t build_identity, const char *component) override;
+    int sendIBEC(struct idevicerestore_client_t *client, plist_t build_identity) override;
+    int enterRestore(struct idevicerestore_client_t *client, plist_t build_identity) override;
+    int restore(struct idevicerestore_client_t *client, plist_t build_identity, const char *filesystem) override;
+};
+
+#endif /* device_backend_hpp */
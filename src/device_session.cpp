@@ -0,0 +1,705 @@
+//
+//  device_session.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <sys/stat.h>
+#include "device_session.hpp"
+#include "device_state_machine.hpp"
+
+extern "C" {
+#include "common.h"
+#include "idevicerestore.h"
+#include "recovery.h"
+#include "dfu.h"
+}
+
+using namespace tihmstar;
+
+static const char *sessionHeader = "# futurerestore device session\n";
+
+// libirecovery hands progress callbacks no userdata, the recorder is found by the connection reporting progress
+static std::mutex transferRecordersLock;
+static std::unordered_map<irecv_client_t, recording_device_backend *> transferRecorders;
+
+static std::string toHex(const void *data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (size_t i = 0; i < size; i++) {
+        uint8_t byte = ((const uint8_t *) data)[i];
+        hex.push_back(digits[byte >> 4]);
+        hex.push_back(digits[byte & 0xf]);
+    }
+    return hex;
+}
+
+static bool fromHex(const std::string &hex, std::string &bytes) {
+    if (hex.size() % 2) return false;
+    auto nibble = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    bytes.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        int high = nibble(hex[i]);
+        int low = nibble(hex[i + 1]);
+        if (high < 0 || low < 0) return false;
+        bytes.push_back((char) ((high << 4) | low));
+    }
+    return true;
+}
+
+// the whole field has to be the number, a damaged capture fails on the line that is broken
+static bool parseUnsigned(const std::string &field, int base, uint64_t &value) {
+    if (field.empty() || !isxdigit((unsigned char) field[0])) return false;
+    char *end = nullptr;
+    errno = 0;
+    unsigned long long parsed = strtoull(field.c_str(), &end, base);
+    if (errno || *end) return false;
+    value = parsed;
+    return true;
+}
+
+static bool parseInt(const std::string &field, int &value) {
+    if (field.empty()) return false;
+    char *end = nullptr;
+    errno = 0;
+    long parsed = strtol(field.c_str(), &end, 10);
+    if (errno || *end || parsed < INT_MIN || parsed > INT_MAX) return false;
+    value = (int) parsed;
+    return true;
+}
+
+#pragma mark device_session_record
+
+device_session_record device_session_record::parse(const std::string &line) {
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, '\t')) fields.push_back(field);
+    retassure(fields.size() >= 3, "malformed session record: %s\n", line.c_str());
+
+    device_session_record record;
+    retassure(parseUnsigned(fields[1], 10, record.time), "bad time in session record: %s\n", line.c_str());
+    if (fields[0] == "call") {
+        retassure(fields.size() == 7, "malformed call record: %s\n", line.c_str());
+        record.kind = call;
+        record.name = fields[3];
+        retassure(parseUnsigned(fields[2], 10, record.duration) && parseInt(fields[4], record.result)
+                  && parseUnsigned(fields[5], 10, record.bytes), "bad number in call record: %s\n", line.c_str());
+        retassure(fields[6] == "-" || fromHex(fields[6], record.data), "bad data in call record: %s\n", line.c_str());
+    } else if (fields[0] == "mode") {
+        retassure(fields.size() == 3, "malformed mode record: %s\n", line.c_str());
+        record.kind = mode;
+        retassure(parseInt(fields[2], record.result) && record.result >= _MODE_UNKNOWN
+                  && record.result <= _MODE_RESTORE, "unknown mode in session record: %s\n", line.c_str());
+    } else if (fields[0] == "device") {
+        retassure(fields.size() == 5, "malformed device record: %s\n", line.c_str());
+        record.kind = device;
+        record.hardwareModel = fields[2];
+        retassure(parseUnsigned(fields[3], 16, record.ecid), "bad ecid in device record: %s\n", line.c_str());
+        if (fields[4] != "-") record.serial = fields[4];
+    } else {
+        reterror("unknown session record: %s\n", line.c_str());
+    }
+    return record;
+}
+
+std::string device_session_record::format() const {
+    std::stringstream line;
+    switch (kind) {
+        case call:
+            line << "call\t" << time << '\t' << duration << '\t' << name << '\t' << result << '\t' << bytes << '\t'
+                 << (data.empty() ? "-" : toHex(data.data(), data.size()));
+            break;
+        case mode:
+            line << "mode\t" << time << '\t' << result;
+            break;
+        case device:
+            line << "device\t" << time << '\t' << hardwareModel << '\t' << std::hex << ecid << '\t'
+                 << (serial.empty() ? "-" : serial);
+            break;
+    }
+    line << '\n';
+    return line.str();
+}
+
+#pragma mark recording_device_backend
+
+recording_device_backend::recording_device_backend(const std::string &path)
+        : _out(fopen(path.c_str(), "w")), _start(std::chrono::steady_clock::now()) {
+    retassure(_out, "can't open session capture %s for writing\n", path.c_str());
+    fputs(sessionHeader, _out);
+}
+
+recording_device_backend::~recording_device_backend() {
+    {
+        std::lock_guard<std::mutex> guard(transferRecordersLock);
+        for (auto it = transferRecorders.begin(); it != transferRecorders.end();) {
+            it = it->second == this ? transferRecorders.erase(it) : std::next(it);
+        }
+    }
+    fclose(_out);
+}
+
+uint64_t recording_device_backend::now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+
+void recording_device_backend::write(const device_session_record &record) {
+    // events arrive on libirecovery's and usbmuxd's threads, flushed so a failed restore leaves a usable capture
+    std::lock_guard<std::mutex> guard(_lock);
+    fputs(record.format().c_str(), _out);
+    fflush(_out);
+}
+
+void recording_device_backend::recordCall(struct idevicerestore_client_t *client, const char *name, uint64_t start,
+                                          int result, uint64_t bytes, const std::string &data) {
+    device_session_record record;
+    record.kind = device_session_record::call;
+    record.time = start;
+    record.duration = now() - start;
+    record.name = name;
+    record.result = result;
+    record.bytes = bytes;
+    record.data = data;
+    write(record);
+    recordDevice(client);
+}
+
+int recording_device_backend::transferProgress(irecv_client_t irecv, const irecv_event_t *event) {
+    if (event->type != IRECV_PROGRESS) return 0;
+    // all idevicerestore's own progress callbacks do
+    print_progress_bar(event->progress);
+    recording_device_backend *self = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(transferRecordersLock);
+        auto found = transferRecorders.find(irecv);
+        if (found != transferRecorders.end()) self = found->second;
+    }
+    if (!self) return 0;
+    // size is what of the current buffer was sent so far, a buffer's last event is at 100%
+    std::lock_guard<std::mutex> guard(self->_transferLock);
+    auto sent = (uint64_t) event->size;
+    if (sent < self->_bufferSent) self->_bufferSent = 0;
+    self->_transferred += sent - self->_bufferSent;
+    self->_bufferSent = event->progress >= 100 ? 0 : sent;
+    return 0;
+}
+
+void recording_device_backend::watchTransfers(struct idevicerestore_client_t *client) {
+    {
+        std::lock_guard<std::mutex> guard(_transferLock);
+        _transferred = 0;
+        _bufferSent = 0;
+    }
+    // idevicerestore's senders may open a connection of their own, so this runs before every call that sends images
+    std::lock_guard<std::mutex> guard(transferRecordersLock);
+    for (irecv_client_t irecv: {client->dfu ? client->dfu->client : nullptr,
+                                client->recovery ? client->recovery->client : nullptr}) {
+        if (!irecv) continue;
+        irecv_event_subscribe(irecv, IRECV_PROGRESS, transferProgress, nullptr);
+        transferRecorders[irecv] = this;
+    }
+}
+
+uint64_t recording_device_backend::transferred() {
+    std::lock_guard<std::mutex> guard(_transferLock);
+    return _transferred;
+}
+
+void recording_device_backend::recordDevice(struct idevicerestore_client_t *client) {
+    // the device is only known once futurerestore asked for its model, a replay needs it to skip the USB lookup
+    if (!client->device || !client->device->hardware_model) return;
+    device_session_record record;
+    record.kind = device_session_record::device;
+    record.time = now();
+    record.hardwareModel = client->device->hardware_model;
+    record.ecid = client->ecid;
+    if (client->srnm) record.serial = client->srnm;
+    std::string identity = record.hardwareModel + '\t' + std::to_string(record.ecid) + '\t' + record.serial;
+    if (identity == _lastDevice) return;
+    _lastDevice = identity;
+    write(record);
+}
+
+void recording_device_backend::recordMode(uint64_t when) {
+    device_session_record record;
+    record.kind = device_session_record::mode;
+    record.time = when;
+    mutex_lock(&_client->device_event_mutex);
+    record.result = _client->mode ? _client->mode->index : _MODE_UNKNOWN;
+    mutex_unlock(&_client->device_event_mutex);
+    write(record);
+}
+
+void recording_device_backend::irecvEvent(const irecv_device_event_t *event, void *userdata) {
+    auto *self = (recording_device_backend *) userdata;
+    uint64_t when = self->now();
+    deliverIrecvEvent(event, self->_client);
+    self->recordMode(when);
+}
+
+void recording_device_backend::ideviceEvent(const idevice_event_t *event, void *userdata) {
+    auto *self = (recording_device_backend *) userdata;
+    uint64_t when = self->now();
+    deliverIdeviceEvent(event, self->_client);
+    self->recordMode(when);
+}
+
+int recording_device_backend::checkMode(struct idevicerestore_client_t *client) {
+    uint64_t start = now();
+    int mode = usb_device_backend::checkMode(client);
+    recordCall(client, "checkMode", start, mode);
+    return mode;
+}
+
+bool recording_device_backend::isImage4Supported(struct idevicerestore_client_t *client) {
+    uint64_t start = now();
+    bool supported = usb_device_backend::isImage4Supported(client);
+    recordCall(client, "isImage4Supported", start, supported);
+    return supported;
+}
+
+int recording_device_backend::getPreflightInfo(struct idevicerestore_client_t *client, plist_t *info) {
+    uint64_t start = now();
+    int ret = usb_device_backend::getPreflightInfo(client, info);
+    std::string data;
+    if (ret == 0 && *info) {
+        char *xml = nullptr;
+        uint32_t xmlSize = 0;
+        plist_to_xml(*info, &xml, &xmlSize);
+        if (xml) data.assign(xml, xmlSize);
+        free(xml);
+    }
+    recordCall(client, "getPreflightInfo", start, ret, 0, data);
+    return ret;
+}
+
+void recording_device_backend::subscribeEvents(struct idevicerestore_client_t *client) {
+    // same subscriptions as usb_device_backend, with our callbacks in front of idevicerestore's
+    uint64_t start = now();
+    _client = client;
+    irecv_device_event_subscribe(&client->irecv_e_ctx, irecvEvent, this);
+    idevice_events_subscribe((idevice_subscription_context_t *) &client->idevice_e_ctx, ideviceEvent, this);
+    recordCall(client, "subscribeEvents", start, 0);
+}
+
+void recording_device_backend::unsubscribeEvents(struct idevicerestore_client_t *client) {
+    uint64_t start = now();
+    usb_device_backend::unsubscribeEvents(client);
+    recordCall(client, "unsubscribeEvents", start, 0);
+}
+
+int recording_device_backend::connect(struct idevicerestore_client_t *client, int mode) {
+    uint64_t start = now();
+    int ret = usb_device_backend::connect(client, mode);
+    recordCall(client, "connect", start, ret);
+    return ret;
+}
+
+void recording_device_backend::disconnect(struct idevicerestore_client_t *client) {
+    uint64_t start = now();
+    {
+        std::lock_guard<std::mutex> guard(transferRecordersLock);
+        if (client->dfu) transferRecorders.erase(client->dfu->client);
+        if (client->recovery) transferRecorders.erase(client->recovery->client);
+    }
+    usb_device_backend::disconnect(client);
+    recordCall(client, "disconnect", start, 0);
+}
+
+int recording_device_backend::setConfiguration(struct idevicerestore_client_t *client, int configuration) {
+    uint64_t start = now();
+    int ret = usb_device_backend::setConfiguration(client, configuration);
+    recordCall(client, "setConfiguration", start, ret);
+    return ret;
+}
+
+irecv_error_t recording_device_backend::sendBuffer(struct idevicerestore_client_t *client, const unsigned char *data,
+                                                   size_t size) {
+    uint64_t start = now();
+    irecv_error_t err = usb_device_backend::sendBuffer(client, data, size);
+    recordCall(client, "sendBuffer", start, err, size);
+    return err;
+}
+
+irecv_error_t recording_device_backend::bootBuffer(struct idevicerestore_client_t *client, const unsigned char *data,
+                                                   size_t size) {
+    uint64_t start = now();
+    irecv_error_t err = usb_device_backend::bootBuffer(client, data, size);
+    recordCall(client, "bootBuffer", start, err, size);
+    return err;
+}
+
+irecv_error_t recording_device_backend::sendCommand(struct idevicerestore_client_t *client, const char *command) {
+    uint64_t start = now();
+    irecv_error_t err = usb_device_backend::sendCommand(client, command);
+    recordCall(client, "sendCommand", start, err, strlen(command), command);
+    return err;
+}
+
+irecv_error_t recording_device_backend::getEnv(struct idevicerestore_client_t *client, const char *name,
+                                               char **value) {
+    uint64_t start = now();
+    irecv_error_t err = usb_device_backend::getEnv(client, name, value);
+    recordCall(client, "getEnv", start, err, 0, (err == IRECV_E_SUCCESS && *value) ? *value : "");
+    return err;
+}
+
+irecv_error_t recording_device_backend::setEnv(struct idevicerestore_client_t *client, const char *name,
+                                               const char *value) {
+    uint64_t start = now();
+    irecv_error_t err = usb_device_backend::setEnv(client, name, value);
+    recordCall(client, "setEnv", start, err, 0, std::string(name) + '=' + value);
+    return err;
+}
+
+irecv_error_t recording_device_backend::saveEnv(struct idevicerestore_client_t *client) {
+    uint64_t start = now();
+    irecv_error_t err = usb_device_backend::saveEnv(client);
+    recordCall(client, "saveEnv", start, err);
+    return err;
+}
+
+int recording_device_backend::setAutoboot(struct idevicerestore_client_t *client, bool enable) {
+    uint64_t start = now();
+    int ret = usb_device_backend::setAutoboot(client, enable);
+    recordCall(client, "setAutoboot", start, ret);
+    return ret;
+}
+
+int recording_device_backend::enterRecovery(struct idevicerestore_client_t *client) {
+    uint64_t start = now();
+    int ret = usb_device_backend::enterRecovery(client);
+    recordCall(client, "enterRecovery", start, ret);
+    return ret;
+}
+
+int recording_device_backend::reset(struct idevicerestore_client_t *client) {
+    uint64_t start = now();
+    int ret = usb_device_backend::reset(client);
+    recordCall(client, "reset", start, ret);
+    return ret;
+}
+
+int recording_device_backend::getApNonce(struct idevicerestore_client_t *client, unsigned char **nonce,
+                                         int *nonceSize) {
+    uint64_t start = now();
+    int ret = usb_device_backend::getApNonce(client, nonce, nonceSize);
+    recordCall(client, "getApNonce", start, ret, 0,
+               (ret == 0 && *nonce) ? std::string((char *) *nonce, *nonceSize) : "");
+    return ret;
+}
+
+int recording_device_backend::getSepNonce(struct idevicerestore_client_t *client, unsigned char **nonce,
+                                          int *nonceSize) {
+    uint64_t start = now();
+    int ret = usb_device_backend::getSepNonce(client, nonce, nonceSize);
+    recordCall(client, "getSepNonce", start, ret, 0,
+               (ret == 0 && *nonce) ? std::string((char *) *nonce, *nonceSize) : "");
+    return ret;
+}
+
+int recording_device_backend::sendComponent(struct idevicerestore_client_t *client, plist_t build_identity,
+                                            const char *component) {
+    uint64_t start = now();
+    watchTransfers(client);
+    int ret = usb_device_backend::sendComponent(client, build_identity, component);
+    recordCall(client, "sendComponent", start, ret, transferred(), component);
+    return ret;
+}
+
+int recording_device_backend::sendIBEC(struct idevicerestore_client_t *client, plist_t build_identity) {
+    uint64_t start = now();
+    watchTransfers(client);
+    int ret = usb_device_backend::sendIBEC(client, build_identity);
+    recordCall(client, "sendIBEC", start, ret, transferred());
+    return ret;
+}
+
+int recording_device_backend::enterRestore(struct idevicerestore_client_t *client, plist_t build_identity) {
+    uint64_t start = now();
+    // logo, device tree, ramdisk and kernel, each its own buffer
+    watchTransfers(client);
+    int ret = usb_device_backend::enterRestore(client, build_identity);
+    recordCall(client, "enterRestore", start, ret, transferred());
+    return ret;
+}
+
+int recording_device_backend::restore(struct idevicerestore_client_t *client, plist_t build_identity,
+                                      const char *filesystem) {
+    struct stat st{};
+    uint64_t bytes = (filesystem && stat(filesystem, &st) == 0) ? st.st_size : 0;
+    uint64_t start = now();
+    int ret = usb_device_backend::restore(client, build_identity, filesystem);
+    recordCall(client, "restore", start, ret, bytes);
+    return ret;
+}
+
+#pragma mark replay_device_backend
+
+replay_device_backend::replay_device_backend(const std::string &path) {
+    std::ifstream in(path);
+    retassure(in.good(), "can't open session capture %s\n", path.c_str());
+    std::string line;
+    std::getline(in, line);
+    retassure(line + '\n' == sessionHeader, "%s is not a futurerestore session capture\n", path.c_str());
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        _records.push_back(device_session_record::parse(line));
+        const device_session_record &record = _records.back();
+        _recordedDuration = std::max(_recordedDuration, record.time + record.duration);
+    }
+    retassure(!_records.empty(), "session capture %s is empty\n", path.c_str());
+    _events = std::thread([this] { deliverEvents(); });
+}
+
+replay_device_backend::~replay_device_backend() {
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _changed.notify_all();
+    if (_events.joinable()) _events.join();
+}
+
+void replay_device_backend::report() const {
+    size_t calls = 0;
+    for (const device_session_record &record: _records) {
+        if (record.kind == device_session_record::call) calls++;
+    }
+    info("Replayed %zu of %zu recorded calls moving %.1f MB, the recorded session took %.2fs\n", _replayedCalls, calls,
+         (double) _replayedBytes / 1e6, (double) _recordedDuration / 1e6);
+}
+
+void replay_device_backend::setMode(struct idevicerestore_client_t *client, int mode) {
+    mutex_lock(&client->device_event_mutex);
+    if (mode == _MODE_UNKNOWN && client->mode && client->mode->index != _MODE_UNKNOWN) {
+        client_event_source::deviceRemoved(client);
+    }
+    client->mode = &idevicerestore_modes[mode];
+    cond_signal(&client->device_event_cond);
+    mutex_unlock(&client->device_event_mutex);
+}
+
+void replay_device_backend::deliverEvents() {
+    std::unique_lock<std::mutex> guard(_lock);
+    while (true) {
+        _changed.wait(guard, [this] { return _stop || !_pending.empty(); });
+        if (_stop) return;
+        if (_changed.wait_until(guard, _pending.front().when, [this] { return _stop; })) return;
+        // close() may have dropped what we were waiting for
+        if (_pending.empty() || _pending.front().when > std::chrono::steady_clock::now()) continue;
+        int mode = _pending.front().mode;
+        _pending.pop_front();
+        struct idevicerestore_client_t *client = _client;
+        // never hold _lock while taking the event mutex, actions run with it held call into us
+        guard.unlock();
+        if (client) setMode(client, mode);
+        guard.lock();
+    }
+}
+
+void replay_device_backend::apply(struct idevicerestore_client_t *client, const device_session_record &record) {
+    retassure(irecv_devices_get_device_by_hardware_model(record.hardwareModel.c_str(), &client->device) ==
+              IRECV_E_SUCCESS, "unknown hardware model %s in session capture\n", record.hardwareModel.c_str());
+    client->ecid = record.ecid;
+    if (!record.serial.empty() && (!client->srnm || record.serial != client->srnm)) {
+        free(client->srnm);
+        client->srnm = strdup(record.serial.c_str());
+    }
+}
+
+const device_session_record &replay_device_backend::replay(struct idevicerestore_client_t *client, const char *name) {
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _client = client;
+    }
+    size_t found = _cursor;
+    while (found < _records.size() &&
+           (_records[found].kind != device_session_record::call || _records[found].name != name)) {
+        found++;
+    }
+    retassure(found < _records.size(), "session capture has no %s call left to replay\n", name);
+
+    // whatever the replaying code skipped happened anyway, the device is in the state it was in for this call.
+    // Calls run as device_state_machine actions hold the event mutex, so mode changes always go through the queue.
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        for (size_t i = _cursor; i < found; i++) {
+            if (_records[i].kind == device_session_record::device) {
+                apply(client, _records[i]);
+            } else if (_records[i].kind == device_session_record::mode) {
+                _pending.push_back({std::chrono::steady_clock::now(), _records[i].result});
+            }
+        }
+    }
+    _changed.notify_all();
+
+    const device_session_record &call = _records[found];
+    std::this_thread::sleep_for(std::chrono::microseconds(call.duration));
+    _replayedCalls++;
+    _replayedBytes += call.bytes;
+
+    // mode changes up to the next call follow from this one, they come at the recorded distance from its end
+    auto end = std::chrono::steady_clock::now();
+    uint64_t recordedEnd = call.time + call.duration;
+    _cursor = found + 1;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        for (; _cursor < _records.size() && _records[_cursor].kind != device_session_record::call; _cursor++) {
+            const device_session_record &record = _records[_cursor];
+            if (record.kind == device_session_record::device) {
+                apply(client, record);
+            } else {
+                uint64_t offset = record.time > recordedEnd ? record.time - recordedEnd : 0;
+                _pending.push_back({end + std::chrono::microseconds(offset), record.result});
+            }
+        }
+    }
+    _changed.notify_all();
+    return call;
+}
+
+int replay_device_backend::checkMode(struct idevicerestore_client_t *client) {
+    int mode = replay(client, "checkMode").result;
+    // like check_mode, which sets the mode without taking the event mutex
+    client->mode = &idevicerestore_modes[mode];
+    return mode;
+}
+
+bool replay_device_backend::isImage4Supported(struct idevicerestore_client_t *client) {
+    return replay(client, "isImage4Supported").result;
+}
+
+int replay_device_backend::getPreflightInfo(struct idevicerestore_client_t *client, plist_t *info) {
+    const device_session_record &call = replay(client, "getPreflightInfo");
+    if (call.result == 0 && !call.data.empty()) {
+        plist_from_xml(call.data.data(), (uint32_t) call.data.size(), info);
+    }
+    return call.result;
+}
+
+void replay_device_backend::subscribeEvents(struct idevicerestore_client_t *client) {
+    replay(client, "subscribeEvents");
+    // events come from the delivery thread, the context only marks the client as subscribed
+    client->idevice_e_ctx = this;
+}
+
+void replay_device_backend::unsubscribeEvents(struct idevicerestore_client_t *client) {
+    replay(client, "unsubscribeEvents");
+    client->idevice_e_ctx = nullptr;
+}
+
+int replay_device_backend::connect(struct idevicerestore_client_t *client, int mode) {
+    return replay(client, "connect").result;
+}
+
+void replay_device_backend::disconnect(struct idevicerestore_client_t *client) {
+    replay(client, "disconnect");
+}
+
+void replay_device_backend::close(struct idevicerestore_client_t *client) {
+    // events still pending would be reported to a freed client
+    std::lock_guard<std::mutex> guard(_lock);
+    _pending.clear();
+    _client = nullptr;
+}
+
+int replay_device_backend::setConfiguration(struct idevicerestore_client_t *client, int configuration) {
+    return replay(client, "setConfiguration").result;
+}
+
+irecv_error_t replay_device_backend::sendBuffer(struct idevicerestore_client_t *client, const unsigned char *data,
+                                                size_t size) {
+    return (irecv_error_t) replay(client, "sendBuffer").result;
+}
+
+irecv_error_t replay_device_backend::bootBuffer(struct idevicerestore_client_t *client, const unsigned char *data,
+                                                size_t size) {
+    return (irecv_error_t) replay(client, "bootBuffer").result;
+}
+
+irecv_error_t replay_device_backend::sendCommand(struct idevicerestore_client_t *client, const char *command) {
+    return (irecv_error_t) replay(client, "sendCommand").result;
+}
+
+irecv_error_t replay_device_backend::getEnv(struct idevicerestore_client_t *client, const char *name, char **value) {
+    const device_session_record &call = replay(client, "getEnv");
+    if (call.result == IRECV_E_SUCCESS) *value = strdup(call.data.c_str());
+    return (irecv_error_t) call.result;
+}
+
+irecv_error_t replay_device_backend::setEnv(struct idevicerestore_client_t *client, const char *name,
+                                            const char *value) {
+    return (irecv_error_t) replay(client, "setEnv").result;
+}
+
+irecv_error_t replay_device_backend::saveEnv(struct idevicerestore_client_t *client) {
+    return (irecv_error_t) replay(client, "saveEnv").result;
+}
+
+int replay_device_backend::setAutoboot(struct idevicerestore_client_t *client, bool enable) {
+    return replay(client, "setAutoboot").result;
+}
+
+int replay_device_backend::enterRecovery(struct idevicerestore_client_t *client) {
+    return replay(client, "enterRecovery").result;
+}
+
+int replay_device_backend::reset(struct idevicerestore_client_t *client) {
+    return replay(client, "reset").result;
+}
+
+int replay_device_backend::getApNonce(struct idevicerestore_client_t *client, unsigned char **nonce,
+                                      int *nonceSize) {
+    const device_session_record &call = replay(client, "getApNonce");
+    if (call.result == 0) {
+        *nonce = (unsigned char *) malloc(call.data.size());
+        memcpy(*nonce, call.data.data(), call.data.size());
+        *nonceSize = (int) call.data.size();
+    }
+    return call.result;
+}
+
+int replay_device_backend::getSepNonce(struct idevicerestore_client_t *client, unsigned char **nonce,
+                                       int *nonceSize) {
+    const device_session_record &call = replay(client, "getSepNonce");
+    if (call.result == 0) {
+        *nonce = (unsigned char *) malloc(call.data.size());
+        memcpy(*nonce, call.data.data(), call.data.size());
+        *nonceSize = (int) call.data.size();
+    }
+    return call.result;
+}
+
+int replay_device_backend::sendComponent(struct idevicerestore_client_t *client, plist_t build_identity,
+                                         const char *component) {
+    return replay(client, "sendComponent").result;
+}
+
+int replay_device_backend::sendIBEC(struct idevicerestore_client_t *client, plist_t build_identity) {
+    return replay(client, "sendIBEC").result;
+}
+
+int replay_device_backend::enterRestore(struct idevicerestore_client_t *client, plist_t build_identity) {
+    return replay(client, "enterRestore").result;
+}
+
+int replay_device_backend::restore(struct idevicerestore_client_t *client, plist_t build_identity,
+                                   const char *filesystem) {
+    return replay(client, "restore").result;
+}
@@ -0,0 +1,177 @@
+//
+//  device_session.hpp
+//  futurerestore
+//
+
+#ifndef device_session_hpp
+#define device_session_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "device_backend.hpp"
+
+/*
+ * Captures of real device sessions, one record per line, tab separated, times in µs since the session started:
+ *   call   <start> <duration> <name> <result> <bytes> <data as hex or ->
+ *   mode   <time> <_MODE_* index>
+ *   device <time> <hardware model> <ecid> <serial>
+ * bytes is the payload a call moved over USB, data is what a call returned (nonces, nvram values) or,
+ * for commands and nvram writes, what it sent.
+ */
+struct device_session_record {
+    enum kind { call, mode, device } kind = call;
+    uint64_t time = 0;
+    uint64_t duration = 0;
+    std::string name;
+    int result = 0;
+    uint64_t bytes = 0;
+    std::string data;
+    // device records
+    std::string hardwareModel;
+    uint64_t ecid = 0;
+    std::string serial;
+
+    static device_session_record parse(const std::string &line);
+    std::string format() const;
+};
+
+/*
+ * A real device over USB that writes everything it does to a capture file.
+ * Device events are recorded as they arrive, before idevicerestore's callbacks see them.
+ */
+class recording_device_backend : public usb_device_backend {
+    FILE *_out;
+    std::mutex _lock;
+    std::chrono::steady_clock::time_point _start;
+    struct idevicerestore_client_t *_client = nullptr;
+    std::string _lastDevice;
+    // bytes sent by idevicerestore's senders during the current call, from libirecovery's progress events
+    std::mutex _transferLock;
+    uint64_t _transferred = 0;
+    uint64_t _bufferSent = 0;
+
+    uint64_t now() const;
+    void write(const device_session_record &record);
+    void recordCall(struct idevicerestore_client_t *client, const char *name, uint64_t start, int result,
+                    uint64_t bytes = 0, const std::string &data = "");
+    void recordDevice(struct idevicerestore_client_t *client);
+    void recordMode(uint64_t when);
+
+    static void irecvEvent(const irecv_device_event_t *event, void *userdata);
+    static void ideviceEvent(const idevice_event_t *event, void *userdata);
+    static int transferProgress(irecv_client_t irecv, const irecv_event_t *event);
+    void watchTransfers(struct idevicerestore_client_t *client);
+    uint64_t transferred();
+
+public:
+    explicit recording_device_backend(const std::string &path);
+    recording_device_backend(const recording_device_backend &) = delete;
+    recording_device_backend &operator=(const recording_device_backend &) = delete;
+    ~recording_device_backend() override;
+
+    int checkMode(struct idevicerestore_client_t *client) override;
+    bool isImage4Supported(struct idevicerestore_client_t *client) override;
+    int getPreflightInfo(struct idevicerestore_client_t *client, plist_t *info) override;
+    void subscribeEvents(struct idevicerestore_client_t *client) override;
+    void unsubscribeEvents(struct idevicerestore_client_t *client) override;
+
+    int connect(struct idevicerestore_client_t *client, int mode) override;
+    void disconnect(struct idevicerestore_client_t *client) override;
+    int setConfiguration(struct idevicerestore_client_t *client, int configuration) override;
+
+    irecv_error_t sendBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) override;
+    irecv_error_t bootBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) override;
+    irecv_error_t sendCommand(struct idevicerestore_client_t *client, const char *command) override;
+    irecv_error_t getEnv(struct idevicerestore_client_t *client, const char *name, char **value) override;
+    irecv_error_t setEnv(struct idevicerestore_client_t *client, const char *name, const char *value) override;
+    irecv_error_t saveEnv(struct idevicerestore_client_t *client) override;
+    int setAutoboot(struct idevicerestore_client_t *client, bool enable) override;
+    int enterRecovery(struct idevicerestore_client_t *client) override;
+    int reset(struct idevicerestore_client_t *client) override;
+    int getApNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) override;
+    int getSepNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) override;
+
+    int sendComponent(struct idevicerestore_client_t *client, plist_t build_identity, const char *component) override;
+    int sendIBEC(struct idevicerestore_client_t *client, plist_t build_identity) override;
+    int enterRestore(struct idevicerestore_client_t *client, plist_t build_identity) override;
+    int restore(struct idevicerestore_client_t *client, plist_t build_identity, const char *filesystem) override;
+};
+
+/*
+ * Plays a capture back without hardware.
+ * Each call takes as long as it took on the device and returns what it returned then. The mode changes that followed
+ * a call are replayed at the same offsets from its end, so the time futurerestore spends noticing them and moving on
+ * is measured anew. Calls are matched by name in capture order; recorded calls the replaying code doesn't make
+ * are skipped, a call the capture doesn't have fails.
+ */
+class replay_device_backend : public device_backend {
+    struct pending_mode {
+        std::chrono::steady_clock::time_point when;
+        int mode;
+    };
+
+    std::vector<device_session_record> _records;
+    size_t _cursor = 0;
+    size_t _replayedCalls = 0;
+    uint64_t _replayedBytes = 0;
+    uint64_t _recordedDuration = 0;
+    std::chrono::steady_clock::time_point _start;
+    struct idevicerestore_client_t *_client = nullptr;
+
+    std::mutex _lock;
+    std::condition_variable _changed;
+    std::deque<pending_mode> _pending;
+    bool _stop = false;
+    std::thread _events;
+
+    const device_session_record &replay(struct idevicerestore_client_t *client, const char *name);
+    // a device record, with _lock held
+    void apply(struct idevicerestore_client_t *client, const device_session_record &record);
+    void setMode(struct idevicerestore_client_t *client, int mode);
+    void deliverEvents();
+
+public:
+    explicit replay_device_backend(const std::string &path);
+    replay_device_backend(const replay_device_backend &) = delete;
+    replay_device_backend &operator=(const replay_device_backend &) = delete;
+    ~replay_device_backend() override;
+
+    void report() const;
+
+    int checkMode(struct idevicerestore_client_t *client) override;
+    bool isImage4Supported(struct idevicerestore_client_t *client) override;
+    int getPreflightInfo(struct idevicerestore_client_t *client, plist_t *info) override;
+    void subscribeEvents(struct idevicerestore_client_t *client) override;
+    void unsubscribeEvents(struct idevicerestore_client_t *client) override;
+
+    int connect(struct idevicerestore_client_t *client, int mode) override;
+    void disconnect(struct idevicerestore_client_t *client) override;
+    void close(struct idevicerestore_client_t *client) override;
+    int setConfiguration(struct idevicerestore_client_t *client, int configuration) override;
+
+    irecv_error_t sendBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) override;
+    irecv_error_t bootBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) override;
+    irecv_error_t sendCommand(struct idevicerestore_client_t *client, const char *command) override;
+    irecv_error_t getEnv(struct idevicerestore_client_t *client, const char *name, char **value) override;
+    irecv_error_t setEnv(struct idevicerestore_client_t *client, const char *name, const char *value) override;
+    irecv_error_t saveEnv(struct idevicerestore_client_t *client) override;
+    int setAutoboot(struct idevicerestore_client_t *client, bool enable) override;
+    int enterRecovery(struct idevicerestore_client_t *client) override;
+    int reset(struct idevicerestore_client_t *client) override;
+    int getApNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) override;
+    int getSepNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) override;
+
+    int sendComponent(struct idevicerestore_client_t *client, plist_t build_identity, const char *component) override;
+    int sendIBEC(struct idevicerestore_client_t *client, plist_t build_identity) override;
+    int enterRestore(struct idevicerestore_client_t *client, plist_t build_identity) override;
+    int restore(struct idevicerestore_client_t *client, plist_t build_identity, const char *filesystem) override;
+};
+
+#endif /* device_session_hpp */
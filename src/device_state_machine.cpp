@@ -0,0 +1,100 @@
+//
+//  device_state_machine.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <mutex>
+#include <unordered_map>
+#include "device_state_machine.hpp"
+
+extern "C" {
+#include "common.h"
+#include "idevicerestore.h"
+}
+
+using namespace tihmstar;
+
+namespace {
+    // idevicerestore_client_t has no room for it, keyed by client instead
+    std::mutex removalsLock;
+    std::unordered_map<const struct idevicerestore_client_t *, uint64_t> removals;
+}
+
+void client_event_source::deviceRemoved(struct idevicerestore_client_t *client) {
+    std::lock_guard<std::mutex> guard(removalsLock);
+    removals[client]++;
+}
+
+void client_event_source::lock() {
+    mutex_lock(&_client->device_event_mutex);
+}
+
+void client_event_source::unlock() {
+    mutex_unlock(&_client->device_event_mutex);
+}
+
+int client_event_source::mode() {
+    return _client->mode ? _client->mode->index : _MODE_UNKNOWN;
+}
+
+const char *client_event_source::modeName() {
+    return _client->mode ? _client->mode->string : "Unknown";
+}
+
+uint64_t client_event_source::disconnects() {
+    std::lock_guard<std::mutex> guard(removalsLock);
+    auto found = removals.find(_client);
+    return (found != removals.end()) ? found->second : 0;
+}
+
+void client_event_source::waitForEvent(std::chrono::steady_clock::time_point deadline) {
+    auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) return;
+    cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, (unsigned int) left.count());
+}
+
+bool device_state_machine::reached(int mode, uint64_t consumedDisconnects) {
+    int current = _source.mode();
+    if (mode == _MODE_UNKNOWN) return current == _MODE_UNKNOWN || _source.disconnects() > consumedDisconnects;
+    return (mode == anyMode) ? current != _MODE_UNKNOWN : current == mode;
+}
+
+void device_state_machine::walk(std::initializer_list<step> steps) {
+    // disconnects before the walk belong to earlier steps
+    uint64_t consumedDisconnects = _source.disconnects();
+    for (const step &s: steps) {
+        if (s.waiting) info("%s", s.waiting);
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::milliseconds(s.timeoutMs);
+        while (!reached(s.mode, consumedDisconnects)) {
+            retassure(std::chrono::steady_clock::now() < deadline, "%s", s.failure);
+            _source.waitForEvent(deadline);
+        }
+        if (s.mode == _MODE_UNKNOWN) {
+            consumedDisconnects++;
+            debug("Device disconnected after %.2fs\n",
+                  std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            continue;
+        }
+        debug("Device in %s mode after %.2fs\n", _source.modeName(),
+              std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+}
+
+void device_state_machine::expect(std::initializer_list<step> steps) {
+    _source.lock();
+    cleanup([&] {
+        _source.unlock();
+    });
+    walk(steps);
+}
+
+void device_state_machine::run(const std::function<void()> &action, std::initializer_list<step> steps) {
+    _source.lock();
+    cleanup([&] {
+        _source.unlock();
+    });
+    action();
+    walk(steps);
+}
@@ -0,0 +1,98 @@
+//
+//  device_state_machine.hpp
+//  futurerestore
+//
+
+#ifndef device_state_machine_hpp
+#define device_state_machine_hpp
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+
+struct idevicerestore_client_t;
+
+/*
+ * Where device mode changes come from.
+ * mode() and waitForEvent() are only called with the lock held, the same lock the event producer takes before it
+ * changes the mode, so a change can't happen between checking the mode and starting to wait.
+ */
+class device_event_source {
+public:
+    virtual ~device_event_source() = default;
+
+    virtual void lock() = 0;
+    virtual void unlock() = 0;
+    // _MODE_* index of the mode the last event reported
+    virtual int mode() = 0;
+    virtual const char *modeName() = 0;
+    // how often the device dropped off the bus so far, a drop and re-enumeration can both happen between two looks
+    virtual uint64_t disconnects() = 0;
+    // returns once an event arrived or deadline passed, may also return spuriously
+    virtual void waitForEvent(std::chrono::steady_clock::time_point deadline) = 0;
+};
+
+/*
+ * Events of an idevicerestore client, as delivered by irecv_event_cb and idevice_event_cb.
+ * The callbacks have to be subscribed already. idevicerestore only keeps the current mode, so device backends
+ * report every removal of the client's device through deviceRemoved() as well.
+ */
+class client_event_source : public device_event_source {
+    struct idevicerestore_client_t *_client;
+
+public:
+    explicit client_event_source(struct idevicerestore_client_t *client) : _client(client) {}
+
+    // called by event producers with the client's device_event_mutex held
+    static void deviceRemoved(struct idevicerestore_client_t *client);
+
+    void lock() override;
+    void unlock() override;
+    int mode() override;
+    const char *modeName() override;
+    uint64_t disconnects() override;
+    void waitForEvent(std::chrono::steady_clock::time_point deadline) override;
+};
+
+/*
+ * Walks a device through a sequence of modes, e.g. DFU -> disconnected -> Recovery after sending an iBEC.
+ * Each step is reached as soon as the source reports its mode, whether that happens before or after waiting
+ * starts, and has its own deadline counted from the previous step. A disconnected step is also reached by a
+ * disconnect the source counted since the walk started, so DFU -> DFU after an iBSS isn't missed when the device
+ * is back before the waiter wakes up; every disconnected step consumes one.
+ */
+class device_state_machine {
+public:
+    static constexpr int anyMode = -1;          // any mode but _MODE_UNKNOWN
+
+    // deadlines per kind of transition
+    static constexpr unsigned int presentTimeout = 1000;        // device should be attached already
+    static constexpr unsigned int discoverTimeout = 10000;      // first event after subscribing
+    static constexpr unsigned int disconnectTimeout = 10000;    // bootloader or reset dropping off the bus
+    static constexpr unsigned int reconnectTimeout = 20000;     // next stage enumerating again
+    static constexpr unsigned int restoreTimeout = 180000;      // ramdisk booting into restore mode
+
+    struct step {
+        int mode;                   // _MODE_* index to reach, or anyMode
+        unsigned int timeoutMs;
+        const char *waiting;        // logged before waiting for the step, may be nullptr
+        const char *failure;        // exception message if the deadline passes first
+    };
+
+private:
+    device_event_source &_source;
+
+    bool reached(int mode, uint64_t consumedDisconnects);
+    void walk(std::initializer_list<step> steps);
+
+public:
+    explicit device_state_machine(device_event_source &source) : _source(source) {}
+
+    // waits for each step in turn, throws if one misses its deadline
+    void expect(std::initializer_list<step> steps);
+    // same, but runs action first with the source locked, so nothing it triggers can be missed
+    void run(const std::function<void()> &action, std::initializer_list<step> steps);
+};
+
+#endif /* device_state_machine_hpp */
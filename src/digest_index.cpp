@@ -0,0 +1,245 @@
+//
+//  digest_index.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <cinttypes>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "digest_index.hpp"
+#include "digest_stream.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+using namespace tihmstar;
+
+#define DIGEST_INDEX_MAGIC      "futurerestore-digestindex 2"
+
+namespace {
+    bool statFile(const std::string &path, uint64_t &size, int64_t &mtime, uint64_t &inode) {
+#ifdef WIN32
+        struct _stat64 st{0};
+        if (_stat64(path.c_str(), &st) < 0) return false;
+#else
+        struct stat st{0};
+        if (stat(path.c_str(), &st) < 0) return false;
+#endif
+        size = (uint64_t) st.st_size;
+        // nanoseconds, a file rewritten within the same second must not keep its old digest
+#if defined(__APPLE__)
+        mtime = (int64_t) st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(WIN32)
+        mtime = (int64_t) st.st_mtime * 1000000000;
+#else
+        mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+        inode = (uint64_t) st.st_ino;
+        return true;
+    }
+
+    std::string toHex(const std::string &bin) {
+        static const char hexChars[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(bin.size() * 2);
+        for (unsigned char c: bin) {
+            hex.push_back(hexChars[c >> 4]);
+            hex.push_back(hexChars[c & 0xf]);
+        }
+        return hex;
+    }
+
+    bool fromHex(const std::string &hex, std::string &bin) {
+        if (hex.size() % 2) return false;
+        bin.clear();
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            unsigned int byte = 0;
+            if (sscanf(hex.c_str() + i, "%2x", &byte) != 1) return false;
+            bin.push_back((char) byte);
+        }
+        return true;
+    }
+}
+
+digest_index::digest_index(std::string indexPath) : _indexPath(std::move(indexPath)) {
+    load();
+}
+
+digest_index::~digest_index() {
+    try {
+        save();
+    } catch (...) {
+        //losing the index only costs a rehash next run
+    }
+}
+
+std::string digest_index::key(const std::string &path, int type) {
+    return std::to_string(type) + ":" + path;
+}
+
+void digest_index::load() {
+    std::ifstream in(_indexPath);
+    if (!in.good()) return;
+    std::string line;
+    if (!std::getline(in, line) || line != DIGEST_INDEX_MAGIC) return;
+    while (std::getline(in, line)) {
+        entry r;
+        int type = -1;
+        char hex[129]{};
+        int pathOffset = 0;
+        if (sscanf(line.c_str(), "%d %128s %" SCNu64 " %" SCNd64 " %" SCNu64 " %" SCNd64 " %n", &type, hex, &r.size,
+                   &r.mtime, &r.inode, &r.lastUsed, &pathOffset) != 6 || !pathOffset) {
+            continue;
+        }
+        if (!fromHex(hex, r.digest) || r.digest.size() != digest_stream::digestSize(type)) continue;
+        _entries[key(line.substr(pathOffset), type)] = std::move(r);
+    }
+}
+
+void digest_index::save() {
+    std::unique_lock<std::mutex> lk(_lock);
+    if (!_dirty) return;
+    // unique, another futurerestore may be saving the same index right now
+    std::string tmpPath = _indexPath + ".XXXXXX";
+    int fd = mkstemp(&tmpPath[0]);
+    if (fd < 0) {
+        debug("%s: can't create a temporary file next to %s, not saving digest index\n", __func__, _indexPath.c_str());
+        return;
+    }
+    close(fd);
+    {
+        std::ofstream out(tmpPath, std::ios::out | std::ios::trunc);
+        if (!out.good()) {
+            remove(tmpPath.c_str());
+            debug("%s: can't write %s, not saving digest index\n", __func__, tmpPath.c_str());
+            return;
+        }
+        out << DIGEST_INDEX_MAGIC << "\n";
+        char buf[128]{};
+        for (const auto &it: _entries) {
+            size_t sep = it.first.find(':');
+            snprintf(buf, sizeof(buf), " %" PRIu64 " %" PRId64 " %" PRIu64 " %" PRId64 " ", it.second.size,
+                     it.second.mtime, it.second.inode, it.second.lastUsed);
+            out << it.first.substr(0, sep) << " " << toHex(it.second.digest) << buf << it.first.substr(sep + 1) << "\n";
+        }
+        if (!out.good()) {
+            remove(tmpPath.c_str());
+            return;
+        }
+    }
+    if (rename(tmpPath.c_str(), _indexPath.c_str())) {
+        remove(_indexPath.c_str());
+        rename(tmpPath.c_str(), _indexPath.c_str());
+    }
+    _dirty = false;
+}
+
+bool digest_index::cachedDigest(const std::string &path, int type, std::string &digest) {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t inode = 0;
+    if (!statFile(path, size, mtime, inode)) return false;
+
+    std::string k = key(path, type);
+    std::unique_lock<std::mutex> lk(_lock);
+    if (_forceVerify && !_verified.count(k)) return false;
+    auto found = _entries.find(k);
+    if (found == _entries.end()) return false;
+    entry &r = found->second;
+    if (r.size != size || r.mtime != mtime || r.inode != inode) {
+        _entries.erase(found);
+        _dirty = true;
+        return false;
+    }
+    r.lastUsed = (int64_t) time(nullptr);
+    _dirty = true;
+    digest = r.digest;
+    return true;
+}
+
+std::string digest_index::digestOf(const std::string &path, int type) {
+    return digestsOf(path, {type}).front();
+}
+
+std::vector<std::string> digest_index::digestsOf(const std::string &path, const std::vector<int> &types) {
+    std::vector<std::string> digests(types.size());
+    std::vector<int> missingTypes;
+    std::vector<size_t> missingSlots;
+    for (size_t i = 0; i < types.size(); i++) {
+        if (!cachedDigest(path, types[i], digests[i])) {
+            missingTypes.push_back(types[i]);
+            missingSlots.push_back(i);
+        }
+    }
+    if (missingTypes.empty()) return digests;
+
+    // stat before reading, so a file changed while it is hashed can't pair its new stat data with the old digest
+    entry before;
+    retassure(statFile(path, before.size, before.mtime, before.inode), "%s: failed to open %s\n", __func__, path.c_str());
+    std::ifstream stream(path, std::ios::binary | std::ios::in);
+    retassure(stream.good(), "%s: failed to open %s\n", __func__, path.c_str());
+    std::vector<std::string> computed = multi_digest_stream::digestStream(stream, missingTypes);
+    entry after;
+    bool unchanged = statFile(path, after.size, after.mtime, after.inode) && after.size == before.size &&
+                     after.mtime == before.mtime && after.inode == before.inode;
+    if (!unchanged) debug("%s: %s changed while it was hashed, not recording its digest\n", __func__, path.c_str());
+    for (size_t i = 0; i < missingTypes.size(); i++) {
+        if (unchanged) insert(path, missingTypes[i], before, computed[i]);
+        digests[missingSlots[i]] = std::move(computed[i]);
+    }
+    return digests;
+}
+
+bool digest_index::matches(const std::string &path, const std::string &expected) {
+    int type = digest_stream::typeForDigestSize(expected.size());
+    if (type < 0) return false;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t inode = 0;
+    if (!statFile(path, size, mtime, inode)) return false;
+    try {
+        return digestOf(path, type) == expected;
+    } catch (tihmstar::exception &e) {
+        return false;
+    }
+}
+
+void digest_index::record(const std::string &path, int type, const std::string &digest) {
+    entry r;
+    if (!statFile(path, r.size, r.mtime, r.inode)) return;
+    insert(path, type, std::move(r), digest);
+}
+
+void digest_index::insert(const std::string &path, int type, entry r, const std::string &digest) {
+    r.lastUsed = (int64_t) time(nullptr);
+    r.digest = digest;
+    std::string k = key(path, type);
+    std::unique_lock<std::mutex> lk(_lock);
+    _entries[k] = std::move(r);
+    _verified.insert(std::move(k));
+    _dirty = true;
+}
+
+void digest_index::forget(const std::string &path) {
+    std::unique_lock<std::mutex> lk(_lock);
+    for (int type = 0; type < 4; type++) {
+        std::string k = key(path, type);
+        _verified.erase(k);
+        if (_entries.erase(k)) _dirty = true;
+    }
+}
+
+int64_t digest_index::lastUsed(const std::string &path) {
+    std::unique_lock<std::mutex> lk(_lock);
+    int64_t lastUsed = -1;
+    for (int type = 0; type < 4; type++) {
+        auto found = _entries.find(key(path, type));
+        if (found != _entries.end() && found->second.lastUsed > lastUsed) lastUsed = found->second.lastUsed;
+    }
+    return lastUsed;
+}
@@ -0,0 +1,71 @@
+//
+//  digest_index.hpp
+//  futurerestore
+//
+
+#ifndef digest_index_hpp
+#define digest_index_hpp
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * Persistent map from (path, size, mtime in ns, inode) to file digests.
+ * As long as a file's stat data is unchanged its digest is served from the index,
+ * so checking an unchanged cached file costs one stat instead of a full read.
+ * Digest types use the getSHA numbering (0 = SHA384, 1 = SHA256, 2 = SHA512, 3 = SHA1).
+ */
+class digest_index {
+    struct entry {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        uint64_t inode = 0;
+        int64_t lastUsed = 0;
+        std::string digest;
+    };
+
+    std::string _indexPath;
+    std::unordered_map<std::string, entry> _entries;
+    // keys hashed during this run, trusted even when verification is forced
+    std::unordered_set<std::string> _verified;
+    std::mutex _lock;
+    bool _forceVerify = false;
+    bool _dirty = false;
+
+    static std::string key(const std::string &path, int type);
+    void load();
+    // records digest under the stat data in r
+    void insert(const std::string &path, int type, entry r, const std::string &digest);
+
+public:
+    explicit digest_index(std::string indexPath);
+    digest_index(const digest_index &) = delete;
+    digest_index &operator=(const digest_index &) = delete;
+    ~digest_index();
+
+    // ignore digests recorded by earlier runs and rehash every file once
+    void setForceVerify(bool force) {_forceVerify = force;}
+    bool forceVerify() const {return _forceVerify;}
+
+    // recorded digest of path if the file is unchanged since it was recorded
+    bool cachedDigest(const std::string &path, int type, std::string &digest);
+    // digest of path, hashing the file only if nothing valid is recorded, throws if it can't be read
+    std::string digestOf(const std::string &path, int type);
+    // same for several types at once, whatever is missing is computed in a single read of the file
+    std::vector<std::string> digestsOf(const std::string &path, const std::vector<int> &types);
+    // true if path exists and hashes to expected, the digest type is derived from its size
+    bool matches(const std::string &path, const std::string &expected);
+    // remember a digest computed elsewhere, e.g. while the file was downloaded
+    void record(const std::string &path, int type, const std::string &digest);
+    void forget(const std::string &path);
+    // unix time of the last lookup or record for path, -1 if unknown
+    int64_t lastUsed(const std::string &path);
+
+    void save();
+};
+
+#endif /* digest_index_hpp */
@@ -0,0 +1,195 @@
+//
+//  digest_stream.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include "digest_stream.hpp"
+
+#ifdef __APPLE__
+#   include <CommonCrypto/CommonDigest.h>
+#else
+#   include <openssl/evp.h>
+#endif // __APPLE__
+
+using namespace tihmstar;
+
+#ifdef __APPLE__
+struct digest_stream::context {
+    union {
+        CC_SHA1_CTX sha1;
+        CC_SHA256_CTX sha256;
+        CC_SHA512_CTX sha512;
+    };
+    bool finished = false;
+};
+
+digest_stream::digest_stream(int type) : _type(type), _ctx(std::make_unique<context>()) {
+    switch (_type) {
+        case 0:
+            CC_SHA384_Init(&_ctx->sha512);
+            break;
+        case 1:
+            CC_SHA256_Init(&_ctx->sha256);
+            break;
+        case 2:
+            CC_SHA512_Init(&_ctx->sha512);
+            break;
+        case 3:
+            CC_SHA1_Init(&_ctx->sha1);
+            break;
+        default:
+            reterror("%s: unknown digest type %d\n", __func__, type);
+    }
+}
+
+digest_stream::~digest_stream() = default;
+
+void digest_stream::update(const void *data, size_t size) {
+    retassure(!_ctx->finished, "%s: digest already finished\n", __func__);
+    // CommonCrypto takes 32 bit lengths
+    const auto *bytes = (const uint8_t *) data;
+    while (size) {
+        auto chunk = (CC_LONG) std::min<size_t>(size, 0x40000000);
+        switch (_type) {
+            case 0:
+                CC_SHA384_Update(&_ctx->sha512, bytes, chunk);
+                break;
+            case 1:
+                CC_SHA256_Update(&_ctx->sha256, bytes, chunk);
+                break;
+            case 2:
+                CC_SHA512_Update(&_ctx->sha512, bytes, chunk);
+                break;
+            case 3:
+                CC_SHA1_Update(&_ctx->sha1, bytes, chunk);
+                break;
+        }
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+std::string digest_stream::finish() {
+    retassure(!_ctx->finished, "%s: digest already finished\n", __func__);
+    _ctx->finished = true;
+    unsigned char md[64]{};
+    switch (_type) {
+        case 0:
+            CC_SHA384_Final(md, &_ctx->sha512);
+            break;
+        case 1:
+            CC_SHA256_Final(md, &_ctx->sha256);
+            break;
+        case 2:
+            CC_SHA512_Final(md, &_ctx->sha512);
+            break;
+        case 3:
+            CC_SHA1_Final(md, &_ctx->sha1);
+            break;
+    }
+    return {(const char *) md, digestSize(_type)};
+}
+#else
+// EVP picks the SHA-NI/ARMv8 crypto extension code paths at runtime, the SHA*_Init family is deprecated
+struct digest_stream::context {
+    EVP_MD_CTX *md = nullptr;
+    bool finished = false;
+    ~context() {
+        safeFreeCustom(md, EVP_MD_CTX_free);
+    }
+};
+
+digest_stream::digest_stream(int type) : _type(type), _ctx(std::make_unique<context>()) {
+    const EVP_MD *md = nullptr;
+    switch (_type) {
+        case 0:
+            md = EVP_sha384();
+            break;
+        case 1:
+            md = EVP_sha256();
+            break;
+        case 2:
+            md = EVP_sha512();
+            break;
+        case 3:
+            md = EVP_sha1();
+            break;
+        default:
+            reterror("%s: unknown digest type %d\n", __func__, type);
+    }
+    retassure(_ctx->md = EVP_MD_CTX_new(), "%s: failed to allocate digest context\n", __func__);
+    retassure(EVP_DigestInit_ex(_ctx->md, md, nullptr) == 1, "%s: failed to init digest type %d\n", __func__, type);
+}
+
+digest_stream::~digest_stream() = default;
+
+void digest_stream::update(const void *data, size_t size) {
+    retassure(!_ctx->finished, "%s: digest already finished\n", __func__);
+    retassure(EVP_DigestUpdate(_ctx->md, data, size) == 1, "%s: digest update failed\n", __func__);
+}
+
+std::string digest_stream::finish() {
+    retassure(!_ctx->finished, "%s: digest already finished\n", __func__);
+    _ctx->finished = true;
+    unsigned char md[EVP_MAX_MD_SIZE]{};
+    unsigned int mdSize = 0;
+    retassure(EVP_DigestFinal_ex(_ctx->md, md, &mdSize) == 1, "%s: digest final failed\n", __func__);
+    return {(const char *) md, mdSize};
+}
+#endif // __APPLE__
+
+size_t digest_stream::digestSize(int type) {
+    switch (type) {
+        case 0: return 48;
+        case 1: return 32;
+        case 2: return 64;
+        case 3: return 20;
+        default: return 0;
+    }
+}
+
+int digest_stream::typeForDigestSize(size_t digestSize) {
+    switch (digestSize) {
+        case 20: return 3;
+        case 32: return 1;
+        case 48: return 0;
+        case 64: return 2;
+        default: return -1;
+    }
+}
+
+multi_digest_stream::multi_digest_stream(const std::vector<int> &types) {
+    retassure(!types.empty(), "%s: no digest types requested\n", __func__);
+    for (int type: types) {
+        _streams.push_back(std::make_unique<digest_stream>(type));
+    }
+}
+
+void multi_digest_stream::update(const void *data, size_t size) {
+    for (auto &stream: _streams) {
+        stream->update(data, size);
+    }
+}
+
+std::vector<std::string> multi_digest_stream::finish() {
+    std::vector<std::string> digests;
+    digests.reserve(_streams.size());
+    for (auto &stream: _streams) {
+        digests.push_back(stream->finish());
+    }
+    return digests;
+}
+
+std::vector<std::string> multi_digest_stream::digestStream(std::istream &stream, const std::vector<int> &types) {
+    multi_digest_stream hasher(types);
+    std::vector<char> buffer(0x100000);
+    while (stream.good()) {
+        stream.read(buffer.data(), (std::streamsize) buffer.size());
+        std::streamsize bytesRead = stream.gcount();
+        if (bytesRead > 0) hasher.update(buffer.data(), (size_t) bytesRead);
+    }
+    retassure(stream.eof(), "%s: failed to read stream\n", __func__);
+    return hasher.finish();
+}
@@ -0,0 +1,60 @@
+//
+//  digest_stream.hpp
+//  futurerestore
+//
+
+#ifndef digest_stream_hpp
+#define digest_stream_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Incremental SHA digest.
+ * type uses the same numbering as futurerestore::getSHA: 0 = SHA384, 1 = SHA256, 2 = SHA512, 3 = SHA1.
+ */
+class digest_stream {
+    struct context;
+    int _type;
+    std::unique_ptr<context> _ctx;
+
+public:
+    explicit digest_stream(int type);
+    digest_stream(const digest_stream &) = delete;
+    digest_stream &operator=(const digest_stream &) = delete;
+    ~digest_stream();
+
+    int type() const {return _type;}
+    void update(const void *data, size_t size);
+    // returns the raw digest, the stream can't be updated afterwards
+    std::string finish();
+
+    static size_t digestSize(int type);
+    // getSHA type matching a manifest digest of the given length, -1 if unknown
+    static int typeForDigestSize(size_t digestSize);
+};
+
+/*
+ * Several digests of the same bytes in one pass.
+ * Every chunk passed to update() is fed to all contexts while it is still in cache,
+ * so asking for SHA1 and SHA384 of a file reads it once instead of twice.
+ */
+class multi_digest_stream {
+    std::vector<std::unique_ptr<digest_stream>> _streams;
+
+public:
+    explicit multi_digest_stream(const std::vector<int> &types);
+
+    void update(const void *data, size_t size);
+    // raw digests in the order the types were passed in
+    std::vector<std::string> finish();
+
+    // reads stream to its end in 1 MiB chunks, throws if reading fails before eof
+    static std::vector<std::string> digestStream(std::istream &stream, const std::vector<int> &types);
+};
+
+#endif /* digest_stream_hpp */
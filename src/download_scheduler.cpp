@@ -0,0 +1,140 @@
+//
+//  download_scheduler.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include "download_scheduler.hpp"
+#include "thread_pool.hpp"
+#include "digest_stream.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+using namespace tihmstar;
+
+download_scheduler::download_scheduler(std::shared_ptr<remote_zip> zip, size_t maxConcurrent)
+: _zip(std::move(zip)), _maxConcurrent(maxConcurrent ? maxConcurrent : 1) {
+    retassure(_zip, "%s: got empty remote zip\n", __func__);
+}
+
+void download_scheduler::addJob(std::string name, std::string remotePath, std::string dstPath, bool required,
+                                std::function<void(const std::string &)> onFetched, std::string expectedDigest) {
+    retassure(expectedDigest.empty() || digest_stream::typeForDigestSize(expectedDigest.size()) >= 0,
+              "%s: unsupported digest size %zu for %s\n", __func__, expectedDigest.size(), name.c_str());
+    _jobs.push_back({std::move(name), std::move(remotePath), std::move(dstPath), required, std::move(onFetched),
+                     std::move(expectedDigest)});
+}
+
+void download_scheduler::updateProgress(size_t jobIdx, uint64_t done) {
+    std::unique_lock<std::mutex> lk(_progressLock);
+    if (_progress[jobIdx] >= done) return;
+    _progress[jobIdx] = done;
+
+    uint64_t total = 0;
+    size_t finished = 0;
+    for (size_t i = 0; i < _progress.size(); i++) {
+        total += _progress[i];
+        if (_progress[i] == _sizes[i]) finished++;
+    }
+    auto percent = (unsigned int) (_totalSize ? (total * 100) / _totalSize : 100);
+    if (percent == _lastReported) return;
+    _lastReported = percent;
+    info("\r[%3u%%] downloaded %zu/%zu components", percent, finished, _progress.size());
+    if (percent == 100) info("\n");
+}
+
+bool download_scheduler::fetch(const std::vector<size_t> &jobIdxs) {
+    std::vector<remote_zip::extract_request> requests;
+    std::vector<std::unique_ptr<digest_stream>> hashers(jobIdxs.size());
+    requests.reserve(jobIdxs.size());
+    for (size_t i = 0; i < jobIdxs.size(); i++) {
+        const job &j = _jobs[jobIdxs[i]];
+        remote_zip::data_callback sink = nullptr;
+        if (!j.expectedDigest.empty()) {
+            hashers[i] = std::make_unique<digest_stream>(digest_stream::typeForDigestSize(j.expectedDigest.size()));
+            digest_stream *hasher = hashers[i].get();
+            sink = [hasher](const uint8_t *buf, size_t len) {
+                hasher->update(buf, len);
+            };
+        }
+        requests.push_back({j.remotePath, j.dstPath, [this, jobIdx = jobIdxs[i]](uint64_t done, uint64_t total) {
+            updateProgress(jobIdx, done);
+        }, std::move(sink)});
+    }
+    try {
+        _zip->downloadEntries(requests);
+        for (size_t i = 0; i < jobIdxs.size(); i++) {
+            const job &j = _jobs[jobIdxs[i]];
+            if (hashers[i]) {
+                retassure(hashers[i]->finish() == j.expectedDigest, "%s does not match its manifest digest\n", j.name.c_str());
+            }
+            if (j.onFetched) j.onFetched(j.dstPath);
+        }
+    } catch (tihmstar::exception &e) {
+        error("%s: failed to download %s: %s\n", __func__, _jobs[jobIdxs.front()].name.c_str(), e.what());
+        return false;
+    } catch (std::exception &e) {
+        // e.g. bad_alloc or whatever onFetched throws, nothing may escape a pool task
+        error("%s: failed to download %s: %s\n", __func__, _jobs[jobIdxs.front()].name.c_str(), e.what());
+        return false;
+    }
+    for (size_t jobIdx: jobIdxs) {
+        updateProgress(jobIdx, _sizes[jobIdx]);
+    }
+    return true;
+}
+
+void download_scheduler::run() {
+    if (_jobs.empty()) return;
+
+    _progress.assign(_jobs.size(), 0);
+    _sizes.assign(_jobs.size(), 0);
+    _totalSize = 0;
+    _lastReported = 0;
+    for (size_t i = 0; i < _jobs.size(); i++) {
+        const remote_zip::entry *e = _zip->getEntry(_jobs[i].remotePath);
+        retassure(e || !_jobs[i].required, "Could not find %s in %s\n", _jobs[i].remotePath.c_str(), _zip->url().c_str());
+        _sizes[i] = e ? e->compressedSize : 0;
+        _totalSize += _sizes[i];
+    }
+
+    // neighbouring entries share one Range request, every group is one unit of work
+    std::vector<std::string> remotePaths;
+    remotePaths.reserve(_jobs.size());
+    for (const job &j: _jobs) {
+        remotePaths.push_back(j.remotePath);
+    }
+    std::vector<std::vector<size_t>> groups = _zip->coalesce(remotePaths);
+
+    std::atomic<bool> failed{false};
+    std::mutex failedLock;
+    std::string failedName;
+    {
+        thread_pool pool(std::min(_maxConcurrent, groups.size()));
+        info("Downloading %zu components in %zu requests (%zu at a time)\n", _jobs.size(), groups.size(), pool.size());
+        for (const auto &group: groups) {
+            pool.enqueue([&] {
+                if (failed) return;
+                if (fetch(group)) return;
+                for (size_t i: group) {
+                    remove(_jobs[i].dstPath.c_str());
+                    if (!_jobs[i].required) {
+                        warning("Skipping optional component %s\n", _jobs[i].name.c_str());
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lk(failedLock);
+                    if (!failed.exchange(true)) failedName = _jobs[i].name;
+                }
+            });
+        }
+        pool.wait();
+    }
+    _jobs.clear();
+    retassure(!failed, "\nCould not download %s\n", failedName.c_str());
+}
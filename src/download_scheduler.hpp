@@ -0,0 +1,67 @@
+//
+//  download_scheduler.hpp
+//  futurerestore
+//
+
+#ifndef download_scheduler_hpp
+#define download_scheduler_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "remote_zip.hpp"
+
+/*
+ * Fetches a batch of files out of one remote_zip concurrently.
+ * Jobs are queued with addJob() and executed by run(). Entries that sit next to each other in the archive
+ * are fetched together with one Range request, at most maxConcurrent requests are in flight
+ * and one aggregated progress line is printed for the whole batch.
+ * If a required job fails, no further jobs are started, the partial file is removed and run() throws.
+ */
+class download_scheduler {
+public:
+    struct job {
+        std::string name;
+        std::string remotePath;
+        std::string dstPath;
+        bool required = true;
+        // runs on the worker once the file is on disk, may throw to fail the job
+        std::function<void(const std::string &)> onFetched;
+        // if set, the file is hashed while it downloads and the job fails on mismatch
+        std::string expectedDigest;
+    };
+
+private:
+    std::shared_ptr<remote_zip> _zip;
+    size_t _maxConcurrent;
+    std::vector<job> _jobs;
+
+    std::mutex _progressLock;
+    std::vector<uint64_t> _progress;
+    std::vector<uint64_t> _sizes;
+    uint64_t _totalSize = 0;
+    unsigned int _lastReported = 0;
+
+    void updateProgress(size_t jobIdx, uint64_t done);
+    bool fetch(const std::vector<size_t> &jobIdxs);
+
+public:
+    static constexpr size_t defaultConcurrency = 4;
+
+    download_scheduler(std::shared_ptr<remote_zip> zip, size_t maxConcurrent = defaultConcurrency);
+    download_scheduler(const download_scheduler &) = delete;
+    download_scheduler &operator=(const download_scheduler &) = delete;
+
+    void addJob(std::string name, std::string remotePath, std::string dstPath, bool required = true,
+                std::function<void(const std::string &)> onFetched = nullptr, std::string expectedDigest = "");
+    size_t jobCount() const {return _jobs.size();}
+    const std::shared_ptr<remote_zip> &zip() const {return _zip;}
+
+    void run();
+};
+
+#endif /* download_scheduler_hpp */
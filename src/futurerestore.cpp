@@ -11,7 +11,18 @@
 #include <zlib.h>
 #include <utility>
 #include <fstream>
+#include <future>
+#include <algorithm>
+#include <chrono>
+#ifndef WIN32
+#include <glob.h>
+#endif
 #include "futurerestore.hpp"
+#include "digest_stream.hpp"
+#include "thread_pool.hpp"
+#include "zip_extractor.hpp"
+#include "device_state_machine.hpp"
+#include "device_backend.hpp"
 
 #ifdef HAVE_LIBIPATCHER
 #include <libipatcher/libipatcher.hpp>
@@ -89,6 +100,9 @@ void safe_mkdir(const char *path, int mode) {
 #endif
 
 #define USEC_PER_SEC 1000000
+// SHA256 of extracted filesystems, hashed on the extraction's write thread
+#define FILESYSTEM_DIGEST_TYPE 1
+#define FILESYSTEM_CACHE_MAGIC "futurerestore-fscache 1"
 
 #ifdef WIN32
 std::string futurerestoreTempPath("download");
@@ -97,46 +111,14 @@ std::string tempPath("/tmp");
 std::string futurerestoreTempPath(tempPath + "/futurerestore");
 #endif
 
-std::string roseTempPath = futurerestoreTempPath + "/rose.bin";
-std::string seTempPath = futurerestoreTempPath + "/se.sefw";
-std::string veridianDGMTempPath = futurerestoreTempPath + "/veridianDGM.der";
-std::string veridianFWMTempPath = futurerestoreTempPath + "/veridianFWM.plist";
-std::string timerTempPath = futurerestoreTempPath + "/timer.bin";
-std::string baobabTempPath = futurerestoreTempPath + "/baobab.bin";
-std::string cryptex1SysOSTempPath = futurerestoreTempPath + "/cryptex1SysOS.dmg";
-std::string cryptex1SysVOLTempPath = futurerestoreTempPath + "/cryptex1SysVOL.dmg.root_hash";
-std::string cryptex1SysTCTempPath = futurerestoreTempPath + "/cryptex1SysTC.dmg.trustcache";
-std::string cryptex1AppOSTempPath = futurerestoreTempPath + "/cryptex1AppOS.dmg";
-std::string cryptex1AppVOLTempPath = futurerestoreTempPath + "/cryptex1AppVOL.dmg.root_hash";
-std::string cryptex1AppTCTempPath = futurerestoreTempPath + "/cryptex1AppTC.dmg.trustcache";
-std::string basebandTempPath = futurerestoreTempPath + "/baseband.bbfw";
-std::string basebandManifestTempPath = futurerestoreTempPath + "/basebandManifest.plist";
-std::string sepTempPath = futurerestoreTempPath + "/sep.im4p";
-std::string sepManifestTempPath = futurerestoreTempPath + "/sepManifest.plist";
-
 #ifdef __APPLE__
 #include <sys/sysctl.h>
 #   include <CommonCrypto/CommonDigest.h>
 
 #   define SHA1(d, n, md) CC_SHA1(d, n, md)
-#   define SHA_CTX CC_SHA1_CTX
-#   define SHA1_Init(c) CC_SHA1_Init(c)
-#   define SHA1_Final(md, c) CC_SHA1_Final(md, c)
-#   define SHA1_Update(c, d, l) CC_SHA1_Update(c, d, l)
 #   define SHA256(d, n, md) CC_SHA256(d, n, md)
-#   define SHA256_CTX CC_SHA256_CTX
-#   define SHA256_Init(c) CC_SHA256_Init(c)
-#   define SHA256_Final(md, c) CC_SHA256_Final(md, c)
-#   define SHA256_Update(c, d, l) CC_SHA256_Update(c, d, l)
 #   define SHA384(d, n, md) CC_SHA384(d, n, md)
-#   define SHA384_Init(c) CC_SHA384_Init(c)
-#   define SHA384_Final(md, c) CC_SHA384_Final(md, c)
-#   define SHA384_Update(c, d, l) CC_SHA384_Update(c, d, l)
 #   define SHA512(d, n, md) CC_SHA512(d, n, md)
-#   define SHA512_CTX CC_SHA512_CTX
-#   define SHA512_Init(c) CC_SHA512_Init(c)
-#   define SHA512_Final(md, c) CC_SHA512_Final(md, c)
-#   define SHA512_Update(c, d, l) CC_SHA512_Update(c, d, l)
 #else
 #   include <openssl/sha.h>
 extern "C" {
@@ -151,12 +133,6 @@ extern "C" {
 
 using namespace tihmstar;
 
-#pragma mark helpers
-extern "C" {
-void irecv_event_cb(const irecv_device_event_t *event, void *userdata);
-void idevice_event_cb(const idevice_event_t *event, void *userdata);
-}
-
 #pragma mark futurerestore
 
 futurerestore::futurerestore(bool isUpdateInstall, bool isPwnDfu, bool noIBSS, bool setNonce, bool serial,
@@ -178,22 +154,6 @@ futurerestore::futurerestore(bool isUpdateInstall, bool isPwnDfu, bool noIBSS, b
         if(!TMPDIR.empty() && stat(tmpdir, &st) > -1) {
 #endif
             futurerestoreTempPath = TMPDIR +"/futurerestore";
-            roseTempPath = futurerestoreTempPath + "/rose.bin";
-            seTempPath = futurerestoreTempPath + "/se.sefw";
-            veridianDGMTempPath = futurerestoreTempPath + "/veridianDGM.der";
-            veridianFWMTempPath = futurerestoreTempPath + "/veridianFWM.plist";
-            timerTempPath = futurerestoreTempPath + "/timer.bin";
-            baobabTempPath = futurerestoreTempPath + "/baobab.bin";
-            cryptex1SysOSTempPath = futurerestoreTempPath + "/cryptex1SysOS.dmg";
-            cryptex1SysVOLTempPath = futurerestoreTempPath + "/cryptex1SysVOL.dmg.root_hash";
-            cryptex1SysTCTempPath = futurerestoreTempPath + "/cryptex1SysTC.dmg.trustcache";
-            cryptex1AppOSTempPath = futurerestoreTempPath + "/cryptex1AppOS.dmg";
-            cryptex1AppVOLTempPath = futurerestoreTempPath + "/cryptex1AppVOL.dmg.root_hash";
-            cryptex1AppTCTempPath = futurerestoreTempPath + "/cryptex1AppTC.dmg.trustcache";
-            basebandTempPath = futurerestoreTempPath + "/baseband.bbfw";
-            basebandManifestTempPath = futurerestoreTempPath + "/basebandManifest.plist";
-            sepTempPath = futurerestoreTempPath + "/sep.im4p";
-            sepManifestTempPath = futurerestoreTempPath + "/sepManifest.plist";
         }
     }
 #ifdef WIN32
@@ -201,11 +161,7 @@ futurerestore::futurerestore(bool isUpdateInstall, bool isPwnDfu, bool noIBSS, b
 #else
     if (stat(futurerestoreTempPath.c_str(), &st) == -1) safe_mkdir(futurerestoreTempPath.c_str(), 0755);
 #endif
-
-// TODO: implement windows CI and enable update check
-#ifndef WIN32
-    this->checkForUpdates();
-#endif
+    _tempPath = futurerestoreTempPath;
 
     nocache = 1; //tsschecker nocache
     _foundnonce = -1;
@@ -219,18 +175,15 @@ futurerestore::futurerestore(bool isUpdateInstall, bool isPwnDfu, bool noIBSS, b
 bool futurerestore::init() {
     if (_didInit) return _didInit;
 //    If device is in an invalid state, don't check if it supports img4
-    if ((_didInit = check_mode(_client) != _MODE_UNKNOWN)) {
-        if (!(_client->image4supported = is_image4_supported(_client))) {
+    if ((_didInit = _device->checkMode(_client) != _MODE_UNKNOWN)) {
+        if (!(_client->image4supported = _device->isImage4Supported(_client))) {
             info("[INFO] 32-bit device detected\n");
         } else {
             info("[INFO] 64-bit device detected\n");
         }
     }
     if(_client) {
-        dfu_client_free(_client);
-    }
-    if(_client) {
-        recovery_client_free(_client);
+        _device->disconnect(_client);
     }
     getDeviceMode(true);
 #ifdef __APPLE__
@@ -239,6 +192,16 @@ bool futurerestore::init() {
     return _didInit;
 }
 
+void futurerestore::selectDevice(uint64_t ecid) {
+    retassure(!_didInit, "a device can only be selected before init\n");
+    // idevicerestore only opens and follows the device with this ECID
+    _client->ecid = ecid;
+    char dirName[32];
+    snprintf(dirName, sizeof(dirName), "/%016llx", (unsigned long long) ecid);
+    _tempPath = futurerestoreTempPath + dirName;
+    mkdir_with_parents(_tempPath.c_str(), 0755);
+}
+
 uint64_t futurerestore::getDeviceEcid() const {
     retassure(_didInit, "did not init\n");
     return _client->ecid;
@@ -249,9 +212,8 @@ int futurerestore::getDeviceMode(bool reRequest) const {
     if (!reRequest && _client->mode && _client->mode->index != _MODE_UNKNOWN) {
         return _client->mode->index;
     } else {
-        dfu_client_free(_client);
-        recovery_client_free(_client);
-        return check_mode(_client);
+        _device->disconnect(_client);
+        return _device->checkMode(_client);
     }
 }
 
@@ -265,14 +227,12 @@ void futurerestore::putDeviceIntoRecovery() {
     getDeviceMode(false);
     info("Found device in %s mode\n", _client->mode->string);
     if (_client->mode == MODE_NORMAL) {
-        irecv_device_event_subscribe(&_client->irecv_e_ctx, irecv_event_cb, _client);
-        idevice_event_subscribe(idevice_event_cb, _client);
-        _client->idevice_e_ctx = (void *) idevice_event_cb;
+        _device->subscribeEvents(_client);
 #ifdef HAVE_LIBIPATCHER
         retassure(!_isPwnDfu, "isPwnDfu enabled, but device was found in normal mode\n");
 #endif
         info("Entering recovery mode...\n");
-        retassure(!normal_enter_recovery(_client), "Unable to place device into recovery mode from %s mode\n",
+        retassure(!_device->enterRecovery(_client), "Unable to place device into recovery mode from %s mode\n",
                   _client->mode->string);
     } else if (_client->mode == MODE_RECOVERY) {
         info("Device already in recovery mode\n");
@@ -292,8 +252,7 @@ void futurerestore::putDeviceIntoRecovery() {
     safeFree(_client->udid); //only needs to be freed manually when function didn't throw exception
 
     //these get also freed by destructor
-    dfu_client_free(_client);
-    recovery_client_free(_client);
+    _device->disconnect(_client);
 }
 
 void futurerestore::setAutoboot(bool val) const {
@@ -301,15 +260,15 @@ void futurerestore::setAutoboot(bool val) const {
 
     retassure(getDeviceMode(false) == _MODE_RECOVERY, "can't set auto-boot, when device isn't in recovery mode\n");
     if (!_client->recovery) {
-        retassure(!recovery_client_new(_client), "Could not connect to device in recovery mode.\n");
+        retassure(!_device->connect(_client, _MODE_RECOVERY), "Could not connect to device in recovery mode.\n");
     }
-    retassure(!recovery_set_autoboot(_client, val), "Setting auto-boot failed?!\n");
+    retassure(!_device->setAutoboot(_client, val), "Setting auto-boot failed?!\n");
 }
 
 void futurerestore::exitRecovery() const {
     setAutoboot(true);
-    recovery_send_reset(_client);
-    recovery_client_free(_client);
+    _device->reset(_client);
+    _device->disconnect(_client);
 }
 
 plist_t futurerestore::nonceMatchesApTickets() {
@@ -327,7 +286,7 @@ plist_t futurerestore::nonceMatchesApTickets() {
     if (_rerestoreiOS9) {
         info("Skipping ApNonce check\n");
     } else {
-        recovery_get_ap_nonce(_client, &realnonce, &realNonceSize);
+        _device->getApNonce(_client, &realnonce, &realNonceSize);
 
         info("Got ApNonce from device: ");
         int i = 0;
@@ -339,74 +298,41 @@ plist_t futurerestore::nonceMatchesApTickets() {
 
     std::vector<const char *> nonces;
 
-    if (_client->image4supported) {
-        for (int i = 0; i < _im4ms.size(); i++) {
-            auto nonce = img4tool::getValFromIM4M({_im4ms[i].first, _im4ms[i].second}, 'BNCH');
-            if (nonce.payloadSize() == realNonceSize && memcmp(realnonce, nonce.payload(), realNonceSize) == 0)
-                return _aptickets[i];
-        }
-    } else {
-        for (int i = 0; i < _im4ms.size(); i++) {
-            size_t ticketNonceSize = 0;
-            const char *nonce = nullptr;
-            try {
-                //nonce might not exist, which we use in re-restoring iOS 9.x for 32-bit
-                auto n = getNonceFromSCAB(_im4ms[i].first, _im4ms[i].second);
-                ticketNonceSize = n.second;
-                nonce = n.first;
-            } catch (...) {}
-            if (memcmp(realnonce, nonce, ticketNonceSize) == 0 &&
-                ((ticketNonceSize == realNonceSize && realNonceSize + ticketNonceSize > 0) ||
-                 (!ticketNonceSize && *_client->version == '9' &&
-                  (getDeviceMode(false) == _MODE_DFU ||
-                   (getDeviceMode(false) == _MODE_RECOVERY &&
-                    !strncmp(getiBootBuild(), "iBoot-2817", strlen("iBoot-2817")))
-                  )
-                 )
-                )
-                    )
-                //either nonce needs to match or using re-restore bug in iOS 9.x
-                return _aptickets[i];
+    size_t ticket = _rerestoreiOS9 ? ticket_table::npos : _tickets.find(realnonce, realNonceSize);
+    if (!_client->image4supported) {
+        //either nonce needs to match or using re-restore bug in iOS 9.x, the first ticket that works wins
+        size_t noNonce = _tickets.firstWithoutNonce();
+        if (noNonce < ticket && *_client->version == '9' &&
+            (getDeviceMode(false) == _MODE_DFU ||
+             (getDeviceMode(false) == _MODE_RECOVERY &&
+              !strncmp(getiBootBuild(), "iBoot-2817", strlen("iBoot-2817"))))) {
+            ticket = noNonce;
         }
     }
 
-    return nullptr;
+    return (ticket != ticket_table::npos) ? _aptickets[ticket] : nullptr;
 }
 
 std::pair<const char *, size_t> futurerestore::nonceMatchesIM4Ms() {
+    size_t ticket = nonceMatchingTicket();
+    return (ticket != ticket_table::npos) ? _im4ms[ticket] : std::pair<const char *, size_t>{NULL, 0};
+}
+
+size_t futurerestore::nonceMatchingTicket() {
     retassure(_didInit, "did not init\n");
 
     retassure(getDeviceMode(true) == _MODE_RECOVERY, "Device is not in recovery mode, can't check ApNonce\n");
 
     unsigned char *realnonce;
     int realNonceSize = 0;
-    recovery_get_ap_nonce(_client, &realnonce, &realNonceSize);
+    _device->getApNonce(_client, &realnonce, &realNonceSize);
 
-    std::vector<const char *> nonces;
-
-    if (_client->image4supported) {
-        for (auto &_im4m: _im4ms) {
-            auto nonce = img4tool::getValFromIM4M({_im4m.first, _im4m.second}, 'BNCH');
-            if (nonce.payloadSize() == realNonceSize && memcmp(realnonce, nonce.payload(), realNonceSize) == 0)
-                return _im4m;
-        }
-    } else {
-        for (auto &_im4m: _im4ms) {
-            size_t ticketNonceSize = 0;
-            const char *nonce = nullptr;
-            try {
-                //nonce might not exist, which we use in re-restoring iOS 9.x for 32-bit
-                auto n = getNonceFromSCAB(_im4m.first, _im4m.second);
-                ticketNonceSize = n.second;
-                nonce = n.first;
-            } catch (...) {
-                //
-            }
-            if (memcmp(realnonce, nonce, ticketNonceSize) == 0) return _im4m;
-        }
+    size_t ticket = _tickets.find(realnonce, realNonceSize);
+    if (!_client->image4supported) {
+        //nonce might not exist, which we use in re-restoring iOS 9.x for 32-bit
+        ticket = std::min(ticket, _tickets.firstWithoutNonce());
     }
-
-    return {NULL, 0};
+    return ticket;
 }
 
 void futurerestore::waitForNonce(std::vector<const char *> nonces, size_t nonceSize) {
@@ -416,6 +342,11 @@ void futurerestore::waitForNonce(std::vector<const char *> nonces, size_t nonceS
     unsigned char *realnonce;
     int realNonceSize = 0;
 
+    // last index wins for duplicates, like the linear scan this replaced
+    std::unordered_map<std::string, int> nonceIndex;
+    for (int i = 0; i < nonces.size(); i++) {
+        nonceIndex[std::string(nonces[i], nonceSize)] = i;
+    }
     for (auto nonce: nonces) {
         info("waiting for ApNonce: ");
         int i = 0;
@@ -425,30 +356,67 @@ void futurerestore::waitForNonce(std::vector<const char *> nonces, size_t nonceS
         info("\n");
     }
 
+    if (!_client->idevice_e_ctx) {
+        _device->subscribeEvents(_client);
+    }
+
+    client_event_source events(_client);
+    device_state_machine device(events);
+    std::vector<double> cycleSeconds;
     do {
-        if (realNonceSize) {
-            recovery_send_reset(_client);
-            recovery_client_free(_client);
-            usleep(1 * USEC_PER_SEC);
+        // the first pass only reads the nonce the device is in already, every later one is a reboot cycle
+        auto cycleStart = std::chrono::steady_clock::now();
+        bool reset = realNonceSize != 0;
+        if (reset) {
+            try {
+                device.run([&] {
+                    _device->reset(_client);
+                    _device->disconnect(_client);
+                }, {{_MODE_UNKNOWN, device_state_machine::disconnectTimeout, nullptr, "device did not disconnect"},
+                    {_MODE_RECOVERY, 60000, nullptr, "device did not come back in recovery mode"}});
+            } catch (tihmstar::exception &e) {
+                info("No device event after reset (%s), polling for recovery mode instead\n", e.what());
+            }
         }
         while (getDeviceMode(true) != _MODE_RECOVERY) usleep(USEC_PER_SEC * 0.5);
-        retassure(!recovery_client_new(_client), "Could not connect to device in recovery mode\n");
+        retassure(!_device->connect(_client, _MODE_RECOVERY), "Could not connect to device in recovery mode\n");
 
-        recovery_get_ap_nonce(_client, &realnonce, &realNonceSize);
+        _device->getApNonce(_client, &realnonce, &realNonceSize);
         info("Got ApNonce from device: ");
         for (int i = 0; i < realNonceSize; i++) {
             info("%02x ", realnonce[i]);
         }
         info("\n");
-        for (int i = 0; i < nonces.size(); i++) {
-            if (memcmp(realnonce, (unsigned const char *) nonces[i], realNonceSize) == 0) _foundnonce = i;
+        if (realNonceSize == nonceSize) {
+            auto found = nonceIndex.find(std::string((const char *) realnonce, realNonceSize));
+            if (found != nonceIndex.end()) _foundnonce = found->second;
+        }
+        if (reset) {
+            cycleSeconds.push_back(
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - cycleStart).count());
+            if (_foundnonce == -1 && cycleSeconds.size() % 25 == 0) reportNonceCycles(cycleSeconds);
         }
     } while (_foundnonce == -1);
     info("Device has requested ApNonce now\n");
+    if (!cycleSeconds.empty()) reportNonceCycles(cycleSeconds);
 
     setAutoboot(true);
 }
 
+void futurerestore::reportNonceCycles(const std::vector<double> &cycleSeconds) {
+    // cycles run back to back, so their sum is the time spent rebooting
+    double total = 0;
+    for (double seconds: cycleSeconds) total += seconds;
+    std::vector<double> sorted = cycleSeconds;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p) {
+        return sorted[std::min(sorted.size() - 1, (size_t) (p * (double) sorted.size()))];
+    };
+    info("%zu reboot cycles in %.1fs, %.1f cycles/min, per cycle: min %.1fs, median %.1fs, p90 %.1fs, max %.1fs\n",
+         sorted.size(), total, total > 0 ? 60.0 * (double) sorted.size() / total : 0.0,
+         sorted.front(), percentile(0.5), percentile(0.9), sorted.back());
+}
+
 void futurerestore::waitForNonce() {
     retassure(!_im4ms.empty(), "No IM4M loaded\n");
 
@@ -457,95 +425,232 @@ void futurerestore::waitForNonce() {
 
     retassure(_client->image4supported, "Error: ApNonce collision function is not supported on 32-bit devices\n");
 
-    for (auto im4m: _im4ms) {
-        auto nonce = img4tool::getValFromIM4M({im4m.first, im4m.second}, 'BNCH');
+    for (size_t i = 0; i < _tickets.size(); i++) {
+        auto nonce = _tickets.nonce(i);
         if (!nonceSize) {
-            nonceSize = nonce.payloadSize();
+            nonceSize = nonce.second;
         }
-        retassure(nonceSize == nonce.payloadSize(), "Nonces have different lengths!");
-        nonces.push_back((const char *) nonce.payload());
+        retassure(nonceSize == nonce.second, "Nonces have different lengths!");
+        nonces.push_back((const char *) nonce.first);
     }
 
     waitForNonce(nonces, nonceSize);
 }
 
 void futurerestore::loadAPTickets(const std::vector<const char *> &apticketPaths) {
-    for (auto apticketPath: apticketPaths) {
-        plist_t apticket = nullptr;
-        char *im4m = nullptr;
+    std::vector<std::string> paths = expandAPTicketPaths(apticketPaths);
+    std::vector<loaded_ticket> loaded(paths.size());
+    std::vector<std::string> failures(paths.size());
+    size_t taken = 0;
+    cleanup([&] {
+        for (size_t i = taken; i < loaded.size(); i++) {
+            safeFreeCustom(loaded[i].apticket, plist_free);
+            safeFree(loaded[i].im4m);
+        }
+    });
+
+    // reading, inflating and parsing are independent per file, only the order below matters
+    auto started = std::chrono::steady_clock::now();
+    {
+        bool image4 = _client->image4supported;
+        bool updateInstall = _isUpdateInstall;
+        thread_pool pool(std::min(paths.size(), thread_pool::defaultThreadCount()));
+        for (size_t i = 0; i < paths.size(); i++) {
+            pool.enqueue([&, i] {
+                try {
+                    loaded[i] = loadAPTicket(paths[i], image4, updateInstall);
+                } catch (tihmstar::exception &e) {
+                    failures[i] = e.what();
+                }
+            });
+        }
+        pool.wait();
+    }
+    for (const auto &failure: failures) {
+        retassure(failure.empty(), "%s", failure.c_str());
+    }
+
+    // tickets keep the order they were given in, the first one is the default
+    for (; taken < loaded.size(); taken++) {
+        loaded_ticket &ticket = loaded[taken];
+        _tickets.add(ticket.nonce.data(), ticket.nonce.size(), ticket.ecid, ticket.generator);
+        _im4ms.emplace_back(ticket.im4m, ticket.im4mSize);
+        _aptickets.push_back(ticket.apticket);
+        if (paths.size() <= 16) printf("reading signing ticket %s is done\n", paths[taken].c_str());
+    }
+    if (paths.size() > 1) {
+        info("Loaded %zu signing tickets in %.2fs\n", paths.size(),
+             std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+    }
+}
+
+futurerestore::loaded_ticket futurerestore::loadAPTicket(const std::string &apticketPath, bool image4,
+                                                         bool updateInstall) {
+    loaded_ticket loaded;
+    bool ok = false;
+    cleanup([&] {
+        if (!ok) {
+            safeFreeCustom(loaded.apticket, plist_free);
+            safeFree(loaded.im4m);
+        }
+    });
 #ifdef WIN32
-        struct _stat64 fst{};
+    struct _stat64 fst{};
+    retassure(!_stat64(apticketPath.c_str(), &fst), "failed to load APTicket at %s\n", apticketPath.c_str());
 #else
-        struct stat fst{};
+    struct stat fst{};
+    retassure(!stat(apticketPath.c_str(), &fst), "failed to load APTicket at %s\n", apticketPath.c_str());
 #endif
+
+    std::string bin = readGzipFile(apticketPath);
+    retassure(!bin.empty(), "Error reading gz compressed data\n");
+    plist_t apticket = nullptr;
+    if (bin.size() >= 8 && memcmp(bin.data(), "bplist00", 8) == 0)
+        plist_from_bin(bin.data(), (uint32_t) bin.size(), &apticket);
+    else
+        plist_from_xml(bin.data(), (uint32_t) bin.size(), &apticket);
+
+    if (updateInstall) {
+        if (plist_t update = plist_dict_get_item(apticket, "updateInstall")) {
+            plist_t cpy = plist_copy(update);
+            plist_free(update);
+            plist_t gen_cpy = nullptr;
+            if (plist_t gen = plist_dict_get_item(apticket, "generator")) {
+                gen_cpy = plist_copy(gen);
+                plist_free(gen);
+                plist_dict_set_item(cpy, "generator", gen_cpy);
+            }
+            plist_free(apticket);
+            apticket = cpy;
+        }
+    }
+    loaded.apticket = apticket;
+
+    plist_t ticket = plist_dict_get_item(apticket, image4 ? "ApImg4Ticket" : "APTicket");
+    uint64_t im4msize = 0;
+    plist_get_data_val(ticket, &loaded.im4m, &im4msize);
+    loaded.im4mSize = (size_t) im4msize;
+
+    retassure(im4msize, "Error: failed to load signing ticket file %s\n", apticketPath.c_str());
+
+    // parse what nonce matching and ECID checks need once, instead of on every check
+    try {
+        if (image4) {
+            auto bnch = img4tool::getValFromIM4M({loaded.im4m, loaded.im4mSize}, 'BNCH');
+            loaded.nonce.assign((const char *) bnch.payload(), bnch.payloadSize());
+        } else {
+            //nonce might not exist, which we use in re-restoring iOS 9.x for 32-bit
+            auto n = getNonceFromSCAB(loaded.im4m, loaded.im4mSize);
+            loaded.nonce.assign(n.first, n.second);
+        }
+    } catch (...) {}
+    try {
+        loaded.ecid = image4 ? img4tool::getValFromIM4M({loaded.im4m, loaded.im4mSize}, 'ECID').getIntegerValue()
+                             : getEcidFromSCAB(loaded.im4m, loaded.im4mSize);
+    } catch (...) {}
+    try {
+        loaded.generator = std::stoull(getGeneratorFromSHSH2(apticket), nullptr, 16);
+    } catch (...) {}
+    ok = true;
+    return loaded;
+}
+
+std::vector<std::string> futurerestore::expandAPTicketPaths(const std::vector<const char *> &apticketPaths) {
+    std::vector<std::string> paths;
+    for (const char *apticketPath: apticketPaths) {
 #ifdef WIN32
-        retassure(!_stat64(apticketPath, &fst), "failed to load APTicket at %s\n", apticketPath);
+        struct _stat64 st{};
+        bool exists = !_stat64(apticketPath, &st);
 #else
-        retassure(!stat(apticketPath, &fst), "failed to load APTicket at %s\n", apticketPath);
+        struct stat st{};
+        bool exists = !stat(apticketPath, &st);
 #endif
-
-        gzFile zf = gzopen(apticketPath, "rb");
-        if (zf) {
-            int blen = 0;
-            int readsize = 16384; //0x4000
-            int bufsize = readsize;
-            std::allocator<uint8_t> alloc;
-            char *bin = (char *)alloc.allocate(bufsize);
-            char *p = bin;
-            do {
-                int bytes_read = gzread(zf, p, readsize);
-                retassure(bytes_read > 0, "Error reading gz compressed data\n");
-                blen += bytes_read;
-                if (bytes_read < readsize) {
-                    if (gzeof(zf)) {
-                        bufsize += bytes_read;
-                        break;
-                    }
-                }
-                bufsize += readsize;
-                bin = (char *) realloc(bin, bufsize);
-                p = bin + blen;
-            } while (!gzeof(zf));
-            gzclose(zf);
-            if (blen > 0) {
-                if (memcmp(bin, "bplist00", 8) == 0)
-                    plist_from_bin(bin, blen, &apticket);
-                else
-                    plist_from_xml(bin, blen, &apticket);
+        if (exists && S_ISDIR(st.st_mode)) {
+            // every .shsh/.shsh2 in the directory, sorted so the default ticket doesn't depend on readdir order
+            std::vector<std::string> found;
+            DIR *dir = opendir(apticketPath);
+            retassure(dir, "failed to open APTicket directory %s\n", apticketPath);
+            while (struct dirent *ent = readdir(dir)) {
+                std::string name = ent->d_name;
+                auto dot = name.rfind('.');
+                if (name[0] == '.' || dot == std::string::npos) continue;
+                std::string ext = name.substr(dot);
+                if (ext != ".shsh" && ext != ".shsh2") continue;
+                found.push_back(std::string(apticketPath) + "/" + name);
             }
-            free(bin);
-        }
-
-        if (_isUpdateInstall) {
-            if (plist_t update = plist_dict_get_item(apticket, "updateInstall")) {
-                plist_t cpy = plist_copy(update);
-                plist_free(update);
-                plist_t gen_cpy = nullptr;
-                if (plist_t gen = plist_dict_get_item(apticket, "generator")) {
-                    gen_cpy = plist_copy(gen);
-                    plist_free(gen);
-                    plist_dict_set_item(cpy, "generator", gen_cpy);
-                }
-                plist_free(apticket);
-                apticket = cpy;
+            closedir(dir);
+            retassure(!found.empty(), "No signing tickets (.shsh, .shsh2) found in %s\n", apticketPath);
+            std::sort(found.begin(), found.end());
+            paths.insert(paths.end(), found.begin(), found.end());
+#ifndef WIN32
+        // cmd on Windows expands wildcards itself before we see them
+        } else if (!exists && strpbrk(apticketPath, "*?[")) {
+            glob_t g{};
+            int ret = glob(apticketPath, 0, nullptr, &g);
+            cleanup([&] {
+                globfree(&g);
+            });
+            retassure(ret == 0 && g.gl_pathc, "No signing tickets match %s\n", apticketPath);
+            for (size_t i = 0; i < g.gl_pathc; i++) {
+                paths.emplace_back(g.gl_pathv[i]);
             }
+#endif
+        } else {
+            paths.emplace_back(apticketPath);
         }
+    }
+    return paths;
+}
 
-        plist_t ticket = plist_dict_get_item(apticket, (_client->image4supported) ? "ApImg4Ticket" : "APTicket");
-        uint64_t im4msize = 0;
-        plist_get_data_val(ticket, &im4m, &im4msize);
+std::string futurerestore::readGzipFile(const std::string &path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    retassure(in.good(), "failed to load APTicket at %s\n", path.c_str());
+    in.seekg(0, std::ios::end);
+    std::string raw((size_t) in.tellg(), '\0');
+    in.seekg(0, std::ios::beg);
+    in.read(&raw[0], (std::streamsize) raw.size());
+    retassure(in.good() || raw.empty(), "failed to load APTicket at %s\n", path.c_str());
+    if (raw.size() < 18 || (uint8_t) raw[0] != 0x1f || (uint8_t) raw[1] != 0x8b) {
+        // not compressed, gzopen passed these through as well
+        return raw;
+    }
 
-        retassure(im4msize, "Error: failed to load signing ticket file %s\n", apticketPath);
+    // ISIZE, the uncompressed size mod 2^32, closes the gzip stream, so the output usually fits the first try
+    auto *tail = (const uint8_t *) raw.data() + raw.size() - 4;
+    uint32_t isize = (uint32_t) tail[0] | ((uint32_t) tail[1] << 8) | ((uint32_t) tail[2] << 16)
+                     | ((uint32_t) tail[3] << 24);
+    // deflate can't do better than ~1032:1, don't trust a trailer claiming more (truncated or foreign file)
+    std::string out(std::min<size_t>(isize ? isize : raw.size() * 4, raw.size() * 1032), '\0');
 
-        _im4ms.emplace_back(im4m, im4msize);
-        _aptickets.push_back(apticket);
-        printf("reading signing ticket %s is done\n", apticketPath);
+    z_stream zs{};
+    retassure(inflateInit2(&zs, 16 + MAX_WBITS) == Z_OK, "%s: inflateInit2 failed\n", __func__);
+    cleanup([&] {
+        inflateEnd(&zs);
+    });
+    zs.next_in = (Bytef *) raw.data();
+    zs.avail_in = (uInt) raw.size();
+    size_t produced = 0;
+    while (true) {
+        if (produced == out.size()) out.resize(out.size() * 2);
+        zs.next_out = (Bytef *) out.data() + produced;
+        zs.avail_out = (uInt) (out.size() - produced);
+        int ret = inflate(&zs, Z_NO_FLUSH);
+        produced = out.size() - zs.avail_out;
+        if (ret == Z_STREAM_END) {
+            // concatenated gzip members, gzread reads through those too
+            if (zs.avail_in < 2 || zs.next_in[0] != 0x1f || zs.next_in[1] != 0x8b) break;
+            retassure(inflateReset(&zs) == Z_OK, "%s: inflateReset failed\n", __func__);
+            continue;
+        }
+        retassure(ret == Z_OK || (ret == Z_BUF_ERROR && !zs.avail_out), "Error reading gz compressed data\n");
     }
+    out.resize(produced);
+    return out;
 }
 
 uint64_t futurerestore::getBasebandGoldCertIDFromDevice() const {
     if (!_client->preflight_info) {
-        if (normal_get_preflight_info(_client, &_client->preflight_info) == -1) {
+        if (_device->getPreflightInfo(_client, &_client->preflight_info) == -1) {
             printf("[WARNING] failed to read BasebandGoldCertID from device! Is it already in recovery?\n");
             return 0;
         }
@@ -564,9 +669,9 @@ uint64_t futurerestore::getBasebandGoldCertIDFromDevice() const {
 char *futurerestore::getiBootBuild() {
     if (!_ibootBuild) {
         if (_client->recovery == nullptr) {
-            retassure(!recovery_client_new(_client), "Error: can't create new recovery client");
+            retassure(!_device->connect(_client, _MODE_RECOVERY), "Error: can't create new recovery client");
         }
-        irecv_getenv(_client->recovery->client, "build-version", &_ibootBuild);
+        _device->getEnv(_client, "build-version", &_ibootBuild);
         retassure(_ibootBuild, "Error: can't get a build-version");
     }
     return _ibootBuild;
@@ -589,6 +694,29 @@ getIPSWComponent(struct idevicerestore_client_t *client, plist_t build_identity,
     return {(char *) component_data, component_size};
 }
 
+#if __aarch64__
+#define BOOTLOADER_RETRY_HINT "If you're using a USB-C to Lightning cable, switch to USB-A to Lightning (see issue #67)"
+#else
+#define BOOTLOADER_RETRY_HINT "Reset device and try again"
+#endif
+
+#ifdef HAVE_LIBIPATCHER
+// sends a patched iBEC to a device in DFU mode and waits for it to come back in recovery mode
+static void sendAndBootIBEC(device_backend &backend, struct idevicerestore_client_t *client,
+                            device_state_machine &device, const std::pair<ptr_smart<char *>, size_t> &iBEC) {
+    info("Sending %s (%lu bytes)...\n", "iBEC", iBEC.second);
+    device.run([&] {
+        irecv_error_t err = backend.bootBuffer(client, (unsigned char *) (char *) iBEC.first, iBEC.second);
+        retassure(err == IRECV_E_SUCCESS, "ERROR: Unable to boot %s component: %s\n", "iBEC", irecv_strerror(err));
+    }, {{_MODE_UNKNOWN, device_state_machine::disconnectTimeout,
+         "Booting iBEC, waiting for device to disconnect...\n",
+         "Device did not disconnect. Possibly invalid iBEC. " BOOTLOADER_RETRY_HINT},
+        {_MODE_RECOVERY, device_state_machine::reconnectTimeout,
+         "Booting iBEC, waiting for device to reconnect...\n",
+         "Device did not reconnect. Possibly invalid iBEC. " BOOTLOADER_RETRY_HINT}});
+}
+#endif
+
 void futurerestore::enterPwnRecovery(plist_t build_identity, std::string bootargs) {
 #ifndef HAVE_LIBIPATCHER
     reterror("compiled without libipatcher");
@@ -605,21 +733,16 @@ void futurerestore::enterPwnRecovery(plist_t build_identity, std::string bootarg
     bool cache2 = false;
     std::string img3_end(".patched.img3");
     std::string img4_end(".patched.img4");
-    std::string ibss_name(futurerestoreTempPath + "/ibss.");
-    std::string ibec_name(futurerestoreTempPath + "/ibec.");
+    std::string ibss_name(_tempPath + "/ibss.");
+    std::string ibec_name(_tempPath + "/ibec.");
 
     /* Assure device is in dfu */
-    irecv_device_event_subscribe(&_client->irecv_e_ctx, irecv_event_cb, _client);
-    idevice_event_subscribe(idevice_event_cb, _client);
-    _client->idevice_e_ctx = (void *) idevice_event_cb;
+    _device->subscribeEvents(_client);
+    client_event_source events(_client);
+    device_state_machine device(events);
     getDeviceMode(true);
-    mutex_lock(&_client->device_event_mutex);
-    cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 1000);
-    retassure(((_client->mode == MODE_DFU) || (mutex_unlock(&_client->device_event_mutex), 0)),
-              "Device isn't in DFU mode!");
-    retassure(((dfu_client_new(_client) == IRECV_E_SUCCESS) || (mutex_unlock(&_client->device_event_mutex), 0)),
-              "Failed to connect to device in DFU Mode!");
-    mutex_unlock(&_client->device_event_mutex);
+    device.expect({{_MODE_DFU, device_state_machine::presentTimeout, nullptr, "Device isn't in DFU mode!"}});
+    retassure(_device->connect(_client, _MODE_DFU) == IRECV_E_SUCCESS, "Failed to connect to device in DFU Mode!");
     info("Device found in DFU Mode.\n");
 
     ibss_name.append(getDeviceBoardNoCopy());
@@ -731,75 +854,43 @@ void futurerestore::enterPwnRecovery(plist_t build_identity, std::string bootarg
     if (!_noIBSS) {
         /* send iBSS */
         info("Sending %s (%lu bytes)...\n", "iBSS", iBSS.second);
-        mutex_lock(&_client->device_event_mutex);
-        err = irecv_send_buffer(_client->dfu->client, (unsigned char *) (char *) iBSS.first,
-                                (unsigned long) iBSS.second, 1);
-        retassure(err == IRECV_E_SUCCESS, "ERROR: Unable to send %s component: %s\n", "iBSS", irecv_strerror(err));
-
-        info("Booting iBSS, waiting for device to disconnect...\n");
-        cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 10000);
-
-        retassure(((_client->mode == MODE_UNKNOWN) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                  "Device did not disconnect. Possibly invalid iBSS. Reset device and try again");
+        device.run([&] {
+            err = _device->sendBuffer(_client, (unsigned char *) (char *) iBSS.first, iBSS.second);
+            retassure(err == IRECV_E_SUCCESS, "ERROR: Unable to send %s component: %s\n", "iBSS", irecv_strerror(err));
+        }, {{_MODE_UNKNOWN, device_state_machine::disconnectTimeout,
+             "Booting iBSS, waiting for device to disconnect...\n",
+             "Device did not disconnect. Possibly invalid iBSS. Reset device and try again"}});
         info("Booting iBSS, waiting for device to reconnect...\n");
     }
-    bool dfu = false;
     if ((_client->device->chip_id >= 0x7000 && _client->device->chip_id <= 0x8004) ||
         (_client->device->chip_id >= 0x8900 && _client->device->chip_id <= 0x8965)) {
-        cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 10000);
-        retassure(((_client->mode == MODE_DFU) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                  "Device did not reconnect. Possibly invalid iBSS. Reset device and try again");
+        device.expect({{_MODE_DFU, device_state_machine::reconnectTimeout, nullptr,
+                        "Device did not reconnect. Possibly invalid iBSS. Reset device and try again"}});
         if (_client->build_major > 8) {
-            mutex_unlock(&_client->device_event_mutex);
             getDeviceMode(true);
-            retassure(((dfu_client_new(_client) == IRECV_E_SUCCESS) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Failed to connect to device in DFU Mode!");
-            retassure(irecv_usb_set_configuration(_client->dfu->client, 1) >= 0, "ERROR: set configuration failed\n");
+            retassure(_device->connect(_client, _MODE_DFU) == IRECV_E_SUCCESS, "Failed to connect to device in DFU Mode!");
+            retassure(_device->setConfiguration(_client, 1) >= 0, "ERROR: set configuration failed\n");
             /* send iBEC */
             info("Sending %s (%lu bytes)...\n", "iBEC", iBEC.second);
-            mutex_lock(&_client->device_event_mutex);
-            err = irecv_send_buffer(_client->dfu->client, (unsigned char *) (char *) iBEC.first,
-                                    (unsigned long) iBEC.second, 1);
-            retassure(err == IRECV_E_SUCCESS, "ERROR: Unable to send %s component: %s\n", "iBEC", irecv_strerror(err));
-
-            info("Booting iBEC, waiting for device to disconnect...\n");
-            cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 10000);
-
-#if __aarch64__
-            retassure(((_client->mode == MODE_UNKNOWN) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not disconnect. Possibly invalid iBEC. If you're using a USB-C to Lightning cable, switch to USB-A to Lightning (see issue #67)");
-#else
-            retassure(((_client->mode == MODE_UNKNOWN) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not disconnect. Possibly invalid iBEC. Reset device and try again");
-#endif
-            info("Booting iBEC, waiting for device to reconnect...\n");
-            cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 10000);
-#if __aarch64__
-            retassure(((_client->mode == MODE_RECOVERY) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not reconnect. Possibly invalid iBEC. If you're using a USB-C to Lightning cable, switch to USB-A to Lightning (see issue #67)");
-#else
-            retassure(((_client->mode == MODE_RECOVERY) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not reconnect. Possibly invalid iBEC. Reset device and try again");
-#endif
-            mutex_unlock(&_client->device_event_mutex);
+            device.run([&] {
+                err = _device->sendBuffer(_client, (unsigned char *) (char *) iBEC.first, iBEC.second);
+                retassure(err == IRECV_E_SUCCESS, "ERROR: Unable to send %s component: %s\n", "iBEC",
+                          irecv_strerror(err));
+            }, {{_MODE_UNKNOWN, device_state_machine::disconnectTimeout,
+                 "Booting iBEC, waiting for device to disconnect...\n",
+                 "Device did not disconnect. Possibly invalid iBEC. " BOOTLOADER_RETRY_HINT},
+                {_MODE_RECOVERY, device_state_machine::reconnectTimeout,
+                 "Booting iBEC, waiting for device to reconnect...\n",
+                 "Device did not reconnect. Possibly invalid iBEC. " BOOTLOADER_RETRY_HINT}});
             getDeviceMode(true);
-            retassure(((recovery_client_new(_client) == IRECV_E_SUCCESS) ||
-                       (mutex_unlock(&_client->device_event_mutex), 0)),
+            retassure(_device->connect(_client, _MODE_RECOVERY) == IRECV_E_SUCCESS,
                       "Failed to connect to device in Recovery Mode!");
         }
     } else if ((_client->device->chip_id >= 0x8006 && _client->device->chip_id <= 0x8030) ||
                (_client->device->chip_id >= 0x8101 && _client->device->chip_id <= 0x8301)) {
-        dfu = true;
-        cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 10000);
-#if __aarch64__
-        retassure(((_client->mode == MODE_RECOVERY) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                  "Device did not reconnect. Possibly invalid iBSS. If you're using a USB-C to Lightning cable, switch to USB-A to Lightning (see issue #67)");
-#else
-        retassure(((_client->mode == MODE_RECOVERY) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                  "Device did not reconnect. Possibly invalid iBSS. Reset device and try again");
-#endif
+        device.expect({{_MODE_RECOVERY, device_state_machine::reconnectTimeout, nullptr,
+                        "Device did not reconnect. Possibly invalid iBSS. " BOOTLOADER_RETRY_HINT}});
     } else {
-        mutex_unlock(&_client->device_event_mutex);
         reterror("Device not supported!\n");
     }
 
@@ -809,135 +900,88 @@ void futurerestore::enterPwnRecovery(plist_t build_identity, std::string bootarg
         cleanup([&] {
             safeFree(deviceGen);
         });
-        mutex_unlock(&_client->device_event_mutex);
         if (_client->device->chip_id < 0x8015) {
-            if (dfu) {
-                assure(!irecv_send_command(_client->dfu->client, "bgcolor 255 0 0"));
-            } else {
-                assure(!irecv_send_command(_client->recovery->client, "bgcolor 255 0 0"));
-            }
+            assure(!_device->sendCommand(_client, "bgcolor 255 0 0"));
             sleep(2);
         }
-        auto nonceelem = img4tool::getValFromIM4M({_im4ms[0].first, _im4ms[0].second}, 'BNCH');
+        auto nonceelem = _tickets.nonce(0);
 
         info("ApNonce pre-hax:\n");
         getDeviceMode(true);
-        retassure(((recovery_client_new(_client) == IRECV_E_SUCCESS) ||
-                   (mutex_unlock(&_client->device_event_mutex), 0)),
+        retassure(_device->connect(_client, _MODE_RECOVERY) == IRECV_E_SUCCESS,
                   "Failed to connect to device in Recovery Mode!");
-        if (get_ap_nonce(_client, &_client->nonce, &_client->nonce_size) < 0) {
+        if (_device->getApNonce(_client, &_client->nonce, &_client->nonce_size) < 0) {
             reterror("Failed to get apnonce from device!");
         }
+        for (int i = 0; i < _client->nonce_size; i++) {
+            info("%02x", _client->nonce[i]);
+        }
+        info("\n");
 
         std::string generator = (_setNonce && _custom_nonce != nullptr) ? _custom_nonce : getGeneratorFromSHSH2(
                 _client->tss);
 
         if ((_setNonce && _custom_nonce != nullptr) ||
-            memcmp(_client->nonce, nonceelem.payload(), _client->nonce_size) != 0) {
+            memcmp(_client->nonce, nonceelem.first, _client->nonce_size) != 0) {
             if (!_setNonce)
                 info("ApNonce from device doesn't match IM4M nonce, applying hax...\n");
 
             assure(_client->tss);
             info("Writing generator=%s to nvram!\n", generator.c_str());
 
-            retassure(!irecv_setenv(_client->recovery->client, "com.apple.System.boot-nonce", generator.c_str()),
+            retassure(!_device->setEnv(_client, "com.apple.System.boot-nonce", generator.c_str()),
                       "Failed to write generator to nvram!");
-            retassure(!irecv_saveenv(_client->recovery->client), "Failed to save nvram!");
+            retassure(!_device->saveEnv(_client), "Failed to save nvram!");
 
             getDeviceMode(true);
-            retassure(((dfu_client_new(_client) == IRECV_E_SUCCESS) || (mutex_unlock(&_client->device_event_mutex), 0)),
+            retassure(_device->connect(_client, _MODE_DFU) == IRECV_E_SUCCESS,
                       "Failed to connect to device in Recovery Mode!");
-            retassure(irecv_usb_set_configuration(_client->dfu->client, 1) >= 0, "ERROR: set configuration failed\n");
-
-            /* send iBEC */
-            info("Sending %s (%lu bytes)...\n", "iBEC", iBEC.second);
-            mutex_lock(&_client->device_event_mutex);
-            err = irecv_send_buffer(_client->dfu->client, (unsigned char *) (char *) iBEC.first,
-                                    (unsigned long) iBEC.second, 1);
-            retassure(err == IRECV_E_SUCCESS, "ERROR: Unable to send %s component: %s\n", "iBEC", irecv_strerror(err));
-            retassure(((irecv_send_command_breq(_client->dfu->client, "go", 1) == IRECV_E_SUCCESS) ||
-                       (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not disconnect/reconnect. Possibly invalid iBEC. Reset device and try again\n");
-            irecv_usb_control_transfer(_client->dfu->client, 0x21, 1, 0, 0, nullptr, 0, 5000);
-
-            info("Booting iBEC, waiting for device to disconnect...\n");
-            cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 10000);
-            retassure(((_client->mode == MODE_UNKNOWN) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not disconnect. Possibly invalid iBEC. Reset device and try again");
-            info("Booting iBEC, waiting for device to reconnect...\n");
-            cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 10000);
-            retassure(((_client->mode == MODE_RECOVERY) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not reconnect. Possibly invalid iBEC. Reset device and try again");
-            mutex_unlock(&_client->device_event_mutex);
+            retassure(_device->setConfiguration(_client, 1) >= 0, "ERROR: set configuration failed\n");
+            sendAndBootIBEC(*_device, _client, device, iBEC);
             getDeviceMode(true);
-            retassure(((recovery_client_new(_client) == IRECV_E_SUCCESS) ||
-                       (mutex_unlock(&_client->device_event_mutex), 0)),
+            retassure(_device->connect(_client, _MODE_RECOVERY) == IRECV_E_SUCCESS,
                       "Failed to connect to device in Recovery Mode after ApNonce hax!");
             printf("APnonce post-hax:\n");
-            if (get_ap_nonce(_client, &_client->nonce, &_client->nonce_size) < 0) {
+            if (_device->getApNonce(_client, &_client->nonce, &_client->nonce_size) < 0) {
                 reterror("Failed to get apnonce from device!");
             }
-            assure(!irecv_send_command(_client->recovery->client, "bgcolor 255 255 0"));
-            retassure(_setNonce || memcmp(_client->nonce, nonceelem.payload(), _client->nonce_size) == 0,
+            for (int i = 0; i < _client->nonce_size; i++) {
+                info("%02x", _client->nonce[i]);
+            }
+            info("\n");
+            assure(!_device->sendCommand(_client, "bgcolor 255 255 0"));
+            retassure(_setNonce || memcmp(_client->nonce, nonceelem.first, _client->nonce_size) == 0,
                       "ApNonce from device doesn't match IM4M nonce after applying ApNonce hax. Aborting!");
         } else {
             getDeviceMode(true);
-            retassure(((dfu_client_new(_client) == IRECV_E_SUCCESS) || (mutex_unlock(&_client->device_event_mutex), 0)),
+            retassure(_device->connect(_client, _MODE_DFU) == IRECV_E_SUCCESS,
                       "Failed to connect to device in Recovery Mode!");
-            retassure(irecv_usb_set_configuration(_client->dfu->client, 1) >= 0, "ERROR: set configuration failed\n");
-            /* send iBEC */
-            info("Sending %s (%lu bytes)...\n", "iBEC", iBEC.second);
-            mutex_lock(&_client->device_event_mutex);
-            err = irecv_send_buffer(_client->dfu->client, (unsigned char *) (char *) iBEC.first,
-                                    (unsigned long) iBEC.second, 1);
-            retassure(err == IRECV_E_SUCCESS, "ERROR: Unable to send %s component: %s\n", "iBEC", irecv_strerror(err));
-            retassure(((irecv_send_command_breq(_client->dfu->client, "go", 1) == IRECV_E_SUCCESS) ||
-                       (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not disconnect/reconnect. Possibly invalid iBEC. Reset device and try again\n");
-            irecv_usb_control_transfer(_client->dfu->client, 0x21, 1, 0, 0, nullptr, 0, 5000);
-
-            info("Booting iBEC, waiting for device to disconnect...\n");
-            cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 10000);
-            retassure(((MODE_UNKNOWN) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not disconnect. Possibly invalid iBEC. Reset device and try again");
-            info("Booting iBEC, waiting for device to reconnect...\n");
-            cond_wait_timeout(&_client->device_event_cond, &_client->device_event_mutex, 10000);
-            retassure(((MODE_RECOVERY) || (mutex_unlock(&_client->device_event_mutex), 0)),
-                      "Device did not reconnect. Possibly invalid iBEC. Reset device and try again");
-            mutex_unlock(&_client->device_event_mutex);
+            retassure(_device->setConfiguration(_client, 1) >= 0, "ERROR: set configuration failed\n");
+            sendAndBootIBEC(*_device, _client, device, iBEC);
             getDeviceMode(true);
-            retassure(((recovery_client_new(_client) == IRECV_E_SUCCESS) ||
-                       (mutex_unlock(&_client->device_event_mutex), 0)),
+            retassure(_device->connect(_client, _MODE_RECOVERY) == IRECV_E_SUCCESS,
                       "Failed to connect to device in Recovery Mode after ApNonce hax!");
-            assure(!irecv_send_command(_client->recovery->client, "bgcolor 255 255 0"));
+            assure(!_device->sendCommand(_client, "bgcolor 255 255 0"));
             info("APNonce from device already matches IM4M nonce, no need for extra hax...\n");
         }
-        retassure(!irecv_setenv(_client->recovery->client, "com.apple.System.boot-nonce", generator.c_str()),
+        retassure(!_device->setEnv(_client, "com.apple.System.boot-nonce", generator.c_str()),
                   "failed to write generator to nvram");
-        retassure(!irecv_saveenv(_client->recovery->client), "failed to save nvram");
+        retassure(!_device->saveEnv(_client), "failed to save nvram");
         uint64_t gen = std::stoull(generator, nullptr, 16);
-        auto *nonce = (uint8_t *)alloc.allocate(_client->nonce_size == 32 ? 48 : 20);
-        if (_client->nonce_size == 20) {
-            SHA1((unsigned char *) &gen, 8, nonce);
-        } else if (_client->nonce_size == 32) {
-            SHA384((unsigned char *) &gen, 8, nonce);
-        } else {
-            reterror("Failed to set nonce generator: %s! Unknown nonce size: %d\n", generator.c_str(),
-                     _client->nonce_size);
-        }
-        for (int i = 0; i < _client->nonce_size; i++) {
-            if (*(uint8_t *) (nonce + i) != *(uint8_t *) (_client->nonce + i)) {
-                reterror("Failed to set nonce generator: %s!\n", generator.c_str());
-            }
-        }
+        retassure(_client->nonce_size == 20 || _client->nonce_size == 32,
+                  "Failed to set nonce generator: %s! Unknown nonce size: %d\n", generator.c_str(),
+                  _client->nonce_size);
+        retassure(nonceForGenerator(gen, _client->nonce_size) ==
+                  std::string((const char *) _client->nonce, _client->nonce_size),
+                  "Failed to set nonce generator: %s!\n", generator.c_str());
         info("Successfully set nonce generator: %s\n", generator.c_str());
 
         if (_setNonce) {
             info("Done setting nonce!\n");
             info("Use futurerestore --exit-recovery to go back to normal mode if you aren't restoring.\n");
             setAutoboot(false);
-            recovery_send_reset(_client);
-            recovery_client_free(_client);
+            _device->reset(_client);
+            _device->disconnect(_client);
             exit(0);
         }
 
@@ -968,44 +1012,46 @@ void get_custom_component(struct idevicerestore_client_t *client, plist_t build_
 
 void futurerestore::doRestore(const char *ipsw) {
     plist_t buildmanifest = nullptr;
-    int delete_fs = 0;
     char *filesystem = nullptr;
+    std::string privateFilesystem;
     cleanup([&] {
         info("Cleaning up...\n");
         safeFreeCustom(buildmanifest, plist_free);
-        if (delete_fs && filesystem) unlink(filesystem);
+        safeFree(filesystem);
+        if (!privateFilesystem.empty()) unlink(privateFilesystem.c_str());
+    });
+    // declared after the cleanup above so an early return waits for the extraction before deleting its file
+    std::atomic<bool> fsCancel{false};
+    std::future<std::string> fsExtraction;
+    // runs before fsExtraction's destructor waits, an unwinding restore stops the extraction instead of finishing it
+    cleanup([&] {
+        fsCancel = true;
     });
     struct idevicerestore_client_t *client = _client;
     plist_t build_identity = nullptr;
 
     client->ipsw = strdup(ipsw);
+    attachComponents();
     if (_noRestore) client->flags |= FLAG_NO_RESTORE;
     if (_noRSEP) client->flags |= FLAG_NO_RSEP;
     if (!_isUpdateInstall) client->flags |= FLAG_ERASE;
 
     if(!client->idevice_e_ctx) {
-        irecv_device_event_subscribe(&client->irecv_e_ctx, irecv_event_cb, client);
-        idevice_event_subscribe(idevice_event_cb, client);
-        client->idevice_e_ctx = (void *) idevice_event_cb;
+        _device->subscribeEvents(client);
     }
 
-    mutex_lock(&client->device_event_mutex);
-    client->ignore_device_add_events = 0;
-    unsigned int timeout = 10000;
-    // 1337 epic speed hax
-    if(client->mode != MODE_UNKNOWN) {
-        timeout = 1;
-    }
-    cond_wait_timeout(&client->device_event_cond, &client->device_event_mutex, timeout);
-
-    retassure(client->mode != MODE_UNKNOWN, "Unable to discover device mode. Please make sure a device is attached.\n");
+    client_event_source events(client);
+    device_state_machine device(events);
+    device.run([&] {
+        client->ignore_device_add_events = 0;
+    }, {{device_state_machine::anyMode, device_state_machine::discoverTimeout, nullptr,
+         "Unable to discover device mode. Please make sure a device is attached.\n"}});
     if (client->mode != MODE_RECOVERY) {
         retassure(client->mode == MODE_DFU, "Device is in unexpected mode detected!");
         retassure(_enterPwnRecoveryRequested, "Device is in DFU mode detected, but we were expecting recovery mode!");
     } else {
         retassure(!_enterPwnRecoveryRequested, "--use-pwndfu was specified, but device found in recovery mode!");
     }
-    mutex_unlock(&client->device_event_mutex);
     info("Found device in %s mode\n", client->mode->string);
 
     info("Identified device as %s, %s\n", getDeviceBoardNoCopy(), getDeviceModelNoCopy());
@@ -1029,7 +1075,7 @@ void futurerestore::doRestore(const char *ipsw) {
     build_manifest_get_version_information(buildmanifest, client);
     info("Product version: %s\n", client->version);
     info("Product build: %s Major: %d\n", client->build, client->build_major);
-    client->image4supported = is_image4_supported(client);
+    client->image4supported = _device->isImage4Supported(client);
     info("Device supports Image4: %s\n", (client->image4supported) ? "true" : "false");
 
     if (_enterPwnRecoveryRequested) //we are in pwnDFU, so we don't need to check nonces
@@ -1067,16 +1113,12 @@ void futurerestore::doRestore(const char *ipsw) {
     plist_t manifest = plist_dict_get_item(build_identity, "Manifest"); //this is the buildidentity used for restore
 
     printf("checking if the APTicket is valid for this restore...\n"); //if we are in pwnDFU, just use first APTicket. We don't need to check nonces.
-    auto im4m = (_enterPwnRecoveryRequested || _rerestoreiOS9) ? _im4ms.at(0) : nonceMatchesIM4Ms();
+    size_t ticket = (_enterPwnRecoveryRequested || _rerestoreiOS9) ? 0 : nonceMatchingTicket();
+    retassure(ticket < _im4ms.size(), "APTicket can't be used for restoring this device, its nonce doesn't match\n");
+    auto im4m = _im4ms[ticket];
 
     uint64_t deviceEcid = getDeviceEcid();
-    uint64_t im4mEcid = 0;
-    if (_client->image4supported) {
-        auto ecid = img4tool::getValFromIM4M({im4m.first, im4m.second}, 'ECID');
-        im4mEcid = ecid.getIntegerValue();
-    } else {
-        im4mEcid = getEcidFromSCAB(im4m.first, im4m.second);
-    }
+    uint64_t im4mEcid = _tickets.ecid(ticket);
 
     retassure(im4mEcid, "Failed to read ECID from APTicket\n");
 
@@ -1210,6 +1252,7 @@ void futurerestore::doRestore(const char *ipsw) {
         retassure(digest && plist_get_node_type(digest) == PLIST_DATA, "ERROR: can't find SEP digest\n");
 
         plist_get_data_val(digest, reinterpret_cast<char **>(&sephash), &sephashlen);
+        // hash what is sent, not _sepPath: the file may have been replaced since it was mapped
         if (sephashlen == 20) {
             SHA1((unsigned char *) _client->sepfwdata, _client->sepfwdatasize, (unsigned char *)&genHash);
         }
@@ -1225,12 +1268,7 @@ void futurerestore::doRestore(const char *ipsw) {
     if (_enterPwnRecoveryRequested) {
         retassure((getDeviceMode(true) == _MODE_DFU) || (getDeviceMode(false) == _MODE_RECOVERY && _noIBSS),
                   "unexpected device mode\n");
-        if(client->irecv_e_ctx) {
-            irecv_device_event_unsubscribe(client->irecv_e_ctx);
-        }
-        if(client->idevice_e_ctx != nullptr) {
-            client->idevice_e_ctx = nullptr;
-        }
+        _device->unsubscribeEvents(client);
         std::string bootargs;
         if (_boot_args != nullptr) {
             bootargs = _boot_args;
@@ -1246,15 +1284,8 @@ void futurerestore::doRestore(const char *ipsw) {
                     "-v -restore debug=0x2014e keepsyms=0x1 amfi=0xff amfi_allow_any_signature=0x1 amfi_get_out_of_my_way=0x1 cs_enforcement_disable=0x1");
         }
         enterPwnRecovery(build_identity, bootargs);
-        if(_client->irecv_e_ctx) {
-            irecv_device_event_unsubscribe(_client->irecv_e_ctx);
-        }
-        if(_client->idevice_e_ctx != nullptr) {
-            _client->idevice_e_ctx = nullptr;
-        }
-        irecv_device_event_subscribe(&client->irecv_e_ctx, irecv_event_cb, _client);
-        idevice_event_subscribe(idevice_event_cb, client);
-        client->idevice_e_ctx = (void *) idevice_event_cb;
+        _device->unsubscribeEvents(client);
+        _device->subscribeEvents(client);
     }
 
     // Get filesystem name from build identity
@@ -1262,6 +1293,22 @@ void futurerestore::doRestore(const char *ipsw) {
     retassure(!build_identity_get_component_path(build_identity, "OS", &fsname),
               "ERROR: Unable to get path for filesystem component\n");
 
+    // an unpacked iPSW directory already has the filesystem on disk, hand it over as is
+#ifdef WIN32
+    struct _stat64 ipswSt{};
+    bool ipswIsDirectory = _stat64(client->ipsw, &ipswSt) == 0 && (ipswSt.st_mode & S_IFMT) == S_IFDIR;
+#else
+    struct stat ipswSt{};
+    bool ipswIsDirectory = stat(client->ipsw, &ipswSt) == 0 && S_ISDIR(ipswSt.st_mode);
+#endif
+    if (ipswIsDirectory) {
+        std::string unpackedFilesystem = std::string(client->ipsw) + "/" + fsname;
+        if (getFileSize(unpackedFilesystem)) {
+            info("Using filesystem from unpacked iPSW '%s'\n", unpackedFilesystem.c_str());
+            filesystem = strdup(unpackedFilesystem.c_str());
+        }
+    }
+
     // check if we already have an extracted filesystem
 #ifdef WIN32
     struct _stat64 st{};
@@ -1301,22 +1348,66 @@ void futurerestore::doRestore(const char *ipsw) {
     strcat(tmpf, "/");
     strcat(tmpf, fsname);
 
+    // the central directory tells whether a cached filesystem still matches this iPSW
+    std::shared_ptr<zip_extractor> fsZip;
+    if (!filesystem) {
+        try {
+            fsZip = std::make_shared<zip_extractor>(client->ipsw);
+        } catch (tihmstar::exception &e) {
+            debug("Can't open %s for pipelined extraction: %s\n", client->ipsw, e.what());
+        }
+        if (fsZip && !fsZip->getEntry(fsname)) fsZip.reset();
+    }
+    digest_index *digestIndex = getDigestIndex();
+    // a copy only this process uses, removed again by the cleanup above
+    auto newPrivateFilesystem = [&privateFilesystem](const std::string &finalPath) {
+        std::string tmpl = finalPath + ".XXXXXX";
+        int fd = mkstemp(&tmpl[0]);
+        retassure(fd >= 0, "ERROR: Could not create temporary file for the filesystem\n");
+        close(fd);
+        return privateFilesystem = tmpl;
+    };
+
+    filesystem_cache_info cacheInfo;
 #ifdef WIN32
     memset(&st, '\0', sizeof(struct _stat64));
-    if (_stat64(tmpf, &st) == 0) {
+    if (fsZip && _stat64(tmpf, &st) == 0 && loadFilesystemCacheInfo(tmpf, cacheInfo)) {
 #else
     memset(&st, '\0', sizeof(struct stat));
-    if (stat(tmpf, &st) == 0) {
+    if (fsZip && stat(tmpf, &st) == 0 && loadFilesystemCacheInfo(tmpf, cacheInfo)) {
 #endif
-        off_t fssize = 0;
-        ipsw_get_file_size(client->ipsw, fsname, (uint64_t *) &fssize);
-        if ((fssize > 0) && (st.st_size == fssize)) {
-            info("Using cached filesystem from '%s'\n", tmpf);
-            filesystem = strdup(tmpf);
+        const zip_extractor::entry *fsEntry = fsZip->getEntry(fsname);
+        if (cacheInfo.crc32 == fsEntry->crc32 && cacheInfo.size == fsEntry->uncompressedSize
+            && (uint64_t) st.st_size == cacheInfo.size) {
+            std::string digest;
+            if (digestIndex->cachedDigest(tmpf, FILESYSTEM_DIGEST_TYPE, digest) && digest == cacheInfo.digest) {
+                info("Using cached filesystem from '%s'\n", tmpf);
+                filesystem = strdup(tmpf);
+            } else {
+                // touched since it was extracted, or --reverify-cache: hash it while the device boots
+                info("Verifying cached filesystem '%s' in the background\n", tmpf);
+                fsExtraction = std::async(std::launch::async,
+                                          [newPrivateFilesystem, fsZip, digestIndex, ipswPath = std::string(client->ipsw),
+                                           fsName = std::string(fsname), cachePath = std::string(tmpf),
+                                           expected = cacheInfo.digest, cancel = &fsCancel]() {
+                    if (digestIndex->digestOf(cachePath, FILESYSTEM_DIGEST_TYPE) == expected) {
+                        digestIndex->save();
+                        return cachePath;
+                    }
+                    warning("Cached filesystem '%s' doesn't match its digest, extracting a private copy\n",
+                            cachePath.c_str());
+                    // processes still using it keep their open file, the next run extracts a fresh one
+                    remove((cachePath + ".meta").c_str());
+                    digestIndex->forget(cachePath);
+                    std::string extractPath = newPrivateFilesystem(cachePath);
+                    extractFilesystem(fsZip, ipswPath, fsName, extractPath, cancel);
+                    return extractPath;
+                });
+            }
         }
     }
 
-    if (!filesystem) {
+    if (!filesystem && !fsExtraction.valid()) {
         char extfn[1024];
         strcpy(extfn, tmpf);
         strcat(extfn, ".extract");
@@ -1325,88 +1416,97 @@ void futurerestore::doRestore(const char *ipsw) {
         strcat(lockfn, ".lock");
         lock_info_t li;
 
+        std::unique_lock<std::mutex> claiming;
+        if (_sharedCache) claiming = std::unique_lock<std::mutex>(_sharedCache->extractionLock());
         lock_file(lockfn, &li);
         FILE *extf = nullptr;
         if (access(extfn, F_OK) != 0) {
             extf = fopen(extfn, "w");
         }
         unlock_file(&li);
-        if (!extf) {
-            // use temp filename
-            filesystem = reinterpret_cast<char *>(mkstemp(const_cast<char *>("ipsw_")));
-            if (!filesystem) {
-                error("WARNING: Could not get temporary filename, using '%s' in current directory\n", fsname);
-                filesystem = strdup(fsname);
-            }
-            delete_fs = 1;
-        } else {
-            // use <fsname>.extract as filename
-            filesystem = strdup(extfn);
-            fclose(extf);
-        }
+        if (claiming) claiming.unlock();
+        bool ownsExtraction = extf != nullptr;
+        safeFreeCustom(extf, fclose);
         remove(lockfn);
-
-        info("Extracting filesystem from iPSW\n");
-        retassure(!ipsw_extract_to_file_with_progress(client->ipsw, fsname, filesystem, 1),
-                  "ERROR: Unable to extract filesystem from iPSW\n");
-
-        // rename <fsname>.extract to <fsname>
-        if (strstr(filesystem, ".extract")) {
-            remove(tmpf);
-            rename(filesystem, tmpf);
-            free(filesystem);
-            filesystem = strdup(tmpf);
-        }
+        if (ownsExtraction) {
+            // whatever is cached is replaced, don't let its sidecar vouch for the new file in between
+            remove((std::string(tmpf) + ".meta").c_str());
+        }
+        uint64_t fssize = 0;
+        ipsw_get_file_size(client->ipsw, fsname, &fssize);
+
+        // nothing below depends on the filesystem until restore_device, extract it while the device boots
+        info("Extracting filesystem from iPSW in the background\n");
+        fsExtraction = std::async(std::launch::async,
+                                  [newPrivateFilesystem, fsZip, digestIndex, ipswPath = std::string(client->ipsw),
+                                   fsName = std::string(fsname), extractPath = std::string(extfn),
+                                   finalPath = std::string(tmpf), ownsExtraction, fssize,
+                                   cancel = &fsCancel]() mutable {
+            if (!ownsExtraction) {
+                // another futurerestore is extracting the same iPSW, share its copy instead of writing a second one
+                if (waitForFilesystemExtraction(extractPath, finalPath, fssize, cancel)) {
+                    if (verifySharedFilesystem(fsZip, digestIndex, fsName, finalPath)) {
+                        return finalPath;
+                    }
+                    warning("Filesystem extracted by another process doesn't match its digest, extracting a private copy\n");
+                } else {
+                    info("Filesystem extraction by another process stalled, extracting a private copy\n");
+                }
+                extractPath = newPrivateFilesystem(finalPath);
+            }
+            std::string digest = extractFilesystem(fsZip, ipswPath, fsName, extractPath, cancel);
+            if (!ownsExtraction) {
+                return extractPath;
+            }
+            // rename <fsname>.extract to <fsname>
+            remove(finalPath.c_str());
+            if (rename(extractPath.c_str(), finalPath.c_str())) {
+                remove(extractPath.c_str());
+                reterror("ERROR: Could not move %s to %s\n", extractPath.c_str(), finalPath.c_str());
+            }
+            if (!digest.empty()) {
+                // later runs reuse it as long as the iPSW entry and the file's stat data are unchanged
+                const zip_extractor::entry *fsEntry = fsZip->getEntry(fsName);
+                digestIndex->record(finalPath, FILESYSTEM_DIGEST_TYPE, digest);
+                digestIndex->save();
+                saveFilesystemCacheInfo(finalPath, {fsEntry->crc32, fsEntry->uncompressedSize, digest});
+            }
+            return finalPath;
+        });
     }
 
     if (_rerestoreiOS9) {
-        mutex_lock(&_client->device_event_mutex);
-        if (dfu_send_component(client, build_identity, "iBSS") < 0) {
-            irecv_close(client->dfu->client);
-            client->dfu->client = nullptr;
-            reterror("ERROR: Unable to send iBSS to device\n");
-        }
-
-        /* reconnect */
-        dfu_client_free(client);
-
-        info("Booting iBSS, Waiting for device to disconnect...\n");
-        cond_wait_timeout(&client->device_event_cond, &client->device_event_mutex, 10000);
-        retassure((client->mode == MODE_UNKNOWN || (mutex_unlock(&client->device_event_mutex), 0)),
-                  "Device did not disconnect. Possibly invalid iBSS. Reset device and try again");
-        mutex_unlock(&client->device_event_mutex);
-
-        info("Booting iBSS, Waiting for device to reconnect...\n");
-        mutex_lock(&_client->device_event_mutex);
-        cond_wait_timeout(&client->device_event_cond, &client->device_event_mutex, 10000);
-        retassure((client->mode == MODE_DFU || (mutex_unlock(&client->device_event_mutex), 0)),
-                  "Device did not disconnect. Possibly invalid iBSS. Reset device and try again");
-        mutex_unlock(&client->device_event_mutex);
-
-        dfu_client_new(client);
-
-        /* send iBEC */
-        if (dfu_send_component(client, build_identity, "iBEC") < 0) {
-            irecv_close(client->dfu->client);
-            client->dfu->client = nullptr;
-            reterror("ERROR: Unable to send iBEC to device\n");
-        }
-
-        dfu_client_free(client);
-
-        info("Booting iBEC, Waiting for device to disconnect...\n");
-        mutex_lock(&_client->device_event_mutex);
-        cond_wait_timeout(&client->device_event_cond, &client->device_event_mutex, 10000);
-        retassure((client->mode == MODE_UNKNOWN || (mutex_unlock(&client->device_event_mutex), 0)),
-                  "Device did not disconnect. Possibly invalid iBEC. Reset device and try again");
-        mutex_unlock(&client->device_event_mutex);
-
-        info("Booting iBEC, Waiting for device to reconnect...\n");
-        mutex_lock(&_client->device_event_mutex);
-        cond_wait_timeout(&client->device_event_cond, &client->device_event_mutex, 10000);
-        retassure((client->mode == MODE_RECOVERY || (mutex_unlock(&client->device_event_mutex), 0)),
-                  "Device did not reconnect. Possibly invalid iBEC. Reset device and try again");
-        mutex_unlock(&client->device_event_mutex);
+        device.run([&] {
+            if (_device->sendComponent(client, build_identity, "iBSS") < 0) {
+                _device->disconnect(client);
+                reterror("ERROR: Unable to send iBSS to device\n");
+            }
+
+            /* reconnect */
+            _device->disconnect(client);
+        }, {{_MODE_UNKNOWN, device_state_machine::disconnectTimeout,
+             "Booting iBSS, Waiting for device to disconnect...\n",
+             "Device did not disconnect. Possibly invalid iBSS. Reset device and try again"},
+            {_MODE_DFU, device_state_machine::reconnectTimeout,
+             "Booting iBSS, Waiting for device to reconnect...\n",
+             "Device did not reconnect. Possibly invalid iBSS. Reset device and try again"}});
+
+        _device->connect(client, _MODE_DFU);
+
+        device.run([&] {
+            /* send iBEC */
+            if (_device->sendComponent(client, build_identity, "iBEC") < 0) {
+                _device->disconnect(client);
+                reterror("ERROR: Unable to send iBEC to device\n");
+            }
+
+            _device->disconnect(client);
+        }, {{_MODE_UNKNOWN, device_state_machine::disconnectTimeout,
+             "Booting iBEC, Waiting for device to disconnect...\n",
+             "Device did not disconnect. Possibly invalid iBEC. Reset device and try again"},
+            {_MODE_RECOVERY, device_state_machine::reconnectTimeout,
+             "Booting iBEC, Waiting for device to reconnect...\n",
+             "Device did not reconnect. Possibly invalid iBEC. Reset device and try again"}});
 
     } else {
         if ((client->build_major > 8)) {
@@ -1428,55 +1528,34 @@ void futurerestore::doRestore(const char *ipsw) {
     } else if (!_rerestoreiOS9) {
 
         /* now we load the iBEC */
-        retassure(!recovery_send_ibec(client, build_identity), "ERROR: Unable to send iBEC\n");
-
-        debug("waiting for device to reconnect...\n");
-        recovery_client_free(client);
-
-        debug("Waiting for device to disconnect...\n");
-        mutex_unlock(&client->device_event_mutex);
-        cond_wait_timeout(&client->device_event_cond, &client->device_event_mutex, 10000);
-#if __aarch64__
-        retassure((client->mode == MODE_UNKNOWN || (mutex_unlock(&client->device_event_mutex), 0)),
-                  "Device did not disconnect. Possibly invalid iBEC. If you're using a USB-C to Lightning cable, switch to USB-A to Lightning (see issue #67)");
-#else
-        retassure((client->mode == MODE_UNKNOWN || (mutex_unlock(&client->device_event_mutex), 0)),
-                  "Device did not disconnect. Possibly invalid iBEC. Reset device and try again");  
-#endif  
-        mutex_unlock(&client->device_event_mutex);
-
-        debug("Waiting for device to reconnect...\n");
-        mutex_unlock(&client->device_event_mutex);
-        cond_wait_timeout(&client->device_event_cond, &client->device_event_mutex, 10000);
-#if __aarch64__
-        retassure((client->mode == MODE_RECOVERY || (mutex_unlock(&client->device_event_mutex), 0)),
-                  "Device did not disconnect. Possibly invalid iBEC. If you're using a USB-C to Lightning cable, switch to USB-A to Lightning (see issue #67)");
-#else
-        retassure((client->mode == MODE_RECOVERY || (mutex_unlock(&client->device_event_mutex), 0)),
-                  "Device did not disconnect. Possibly invalid iBEC. Reset device and try again");    
-#endif    
-        mutex_unlock(&client->device_event_mutex);
+        device.run([&] {
+            retassure(!_device->sendIBEC(client, build_identity), "ERROR: Unable to send iBEC\n");
+            _device->disconnect(client);
+        }, {{_MODE_UNKNOWN, device_state_machine::disconnectTimeout, nullptr,
+             "Device did not disconnect. Possibly invalid iBEC. " BOOTLOADER_RETRY_HINT},
+            {_MODE_RECOVERY, device_state_machine::reconnectTimeout, nullptr,
+             "Device did not reconnect. Possibly invalid iBEC. " BOOTLOADER_RETRY_HINT}});
     }
 
     retassure(client->mode == MODE_RECOVERY, "failed to reconnect to device in recovery (iBEC) mode\n");
 
     //do magic
-    if (_client->image4supported) get_sep_nonce(client, &client->sepnonce, &client->sepnonce_size);
-    get_ap_nonce(client, &client->nonce, &client->nonce_size);
+    if (_client->image4supported) _device->getSepNonce(client, &client->sepnonce, &client->sepnonce_size);
+    _device->getApNonce(client, &client->nonce, &client->nonce_size);
 
     if (client->mode == MODE_RECOVERY) {
         retassure(client->srnm, "ERROR: Could not retrieve device serial number. Can't continue.\n");
 
         if (client->device->chip_id < 0x8015) {
-            retassure(!irecv_send_command(client->recovery->client, "bgcolor 0 255 0"),
+            retassure(!_device->sendCommand(client, "bgcolor 0 255 0"),
                       "ERROR: Unable to set bgcolor\n");
             info("[WARNING] Setting bgcolor to green! If you don't see a green screen, then your device didn't boot iBEC correctly\n");
             sleep(2); //show the user a green screen!
         }
 
-        retassure(!recovery_enter_restore(client, build_identity), "ERROR: Unable to place device into restore mode\n");
+        retassure(!_device->enterRestore(client, build_identity), "ERROR: Unable to place device into restore mode\n");
 
-        recovery_client_free(client);
+        _device->disconnect(client);
     }
 
     if (_client->image4supported && !_setNonce) {
@@ -1486,15 +1565,18 @@ void futurerestore::doRestore(const char *ipsw) {
         retassure(_client->sepfwdatasize && _client->sepfwdata, "SEP is not loaded, refusing to continue");
     }
 
-    mutex_lock(&client->device_event_mutex);
     debug("Waiting for device to enter restore mode...\n");
-    cond_wait_timeout(&client->device_event_cond, &client->device_event_mutex, 180000);
-    retassure((client->mode == MODE_RESTORE || (mutex_unlock(&client->device_event_mutex), 0)),
-              "Unable to place device into restore mode");
-    mutex_unlock(&client->device_event_mutex);
+    device.expect({{_MODE_RESTORE, device_state_machine::restoreTimeout, nullptr,
+                    "Unable to place device into restore mode"}});
+
+    if (fsExtraction.valid()) {
+        info("Waiting for filesystem extraction to finish...\n");
+        filesystem = strdup(fsExtraction.get().c_str());
+        info("Filesystem ready\n");
+    }
 
     info("About to restore device... \n");
-    int result = restore_device(client, build_identity, filesystem);
+    int result = _device->restore(client, build_identity, filesystem);
     if (result == 2) return;
     else retassure(!(result), "ERROR: Unable to restore device\n");
 }
@@ -1624,7 +1706,10 @@ void futurerestore::daemonManager(bool load) {
 #endif
 
 futurerestore::~futurerestore() {
-    recovery_client_free(_client);
+    for (auto &provider: _componentProviders) {
+        if (provider.file) provider.detach();
+    }
+    _device->close(_client);
     idevicerestore_client_free(_client);
     for (auto im4m: _im4ms) {
         safeFree(im4m.first);
@@ -1650,7 +1735,9 @@ futurerestore::~futurerestore() {
 
 void futurerestore::loadFirmwareTokens() {
     if (!_firmwareTokens) {
-        if (!_firmwareJson) _firmwareJson = getFirmwareJson();
+        if (!_firmwareJson) {
+            _firmwareJson = _sharedCache ? _sharedCache->firmwareJson("firmware", getFirmwareJson) : getFirmwareJson();
+        }
         retassure(_firmwareJson, "[TSSC] Could not get firmware.json\n");
         long cnt = parseTokens(_firmwareJson, &_firmwareTokens);
         retassure(cnt > 0, "[TSSC] parsing %s.json failed\n", (0) ? "ota" : "firmware");
@@ -1671,7 +1758,9 @@ void futurerestore::loadFirmwareTokens() {
         retassure(cnt > 0, "[TSSC] parsing %s.json failed\n", (0) ? "beta ota" : "beta firmware");
     }
     if(!_otaFirmwareTokens && _useCustomLatestOTA) {
-        if (!_otaFirmwareJson) _otaFirmwareJson = getOtaJson();
+        if (!_otaFirmwareJson) {
+            _otaFirmwareJson = _sharedCache ? _sharedCache->firmwareJson("ota", getOtaJson) : getOtaJson();
+        }
         retassure(_otaFirmwareJson, "[TSSC] Could not get otas json\n");
         long cnt = parseTokens(_otaFirmwareJson, &_otaFirmwareTokens);
         retassure(cnt > 0, "[TSSC] parsing %s.json failed\n", (0) ? "beta ota" : "beta firmware");
@@ -1736,82 +1825,132 @@ const char *futurerestore::getDeviceBoardNoCopy() {
 }
 
 char *futurerestore::getLatestManifest() {
+    if (!_latestManifest && _sharedCache) {
+        // sessions of the same model and selection look the latest firmware up once
+        std::string key = std::string(getDeviceBoardNoCopy()) + "|" + _customLatest + "|" + _customLatestBuildID + "|"
+                          + (_useCustomLatestBeta ? "beta" : "") + "|" + (_useCustomLatestOTA ? "ota" : "");
+        auto latest = _sharedCache->latestFirmware(key);
+        std::lock_guard<std::mutex> guard(latest->lock);
+        if (latest->manifest.empty()) {
+            loadLatestManifest();
+            latest->manifest = _latestManifest;
+            latest->url = _latestFirmwareUrl;
+        } else {
+            _latestManifest = strdup(latest->manifest.c_str());
+            _latestFirmwareUrl = strdup(latest->url.c_str());
+        }
+    }
     if (!_latestManifest) {
-        loadFirmwareTokens();
+        loadLatestManifest();
+    }
+    return _latestManifest;
+}
 
-        const char *device = getDeviceModelNoCopy();
-        t_iosVersion versVals;
-        memset(&versVals, 0, sizeof(versVals));
+void futurerestore::loadLatestManifest() {
+    loadFirmwareTokens();
 
-        int versionCnt = 0;
-        int i = 0;
-        char **versions = nullptr;
-        if(_useCustomLatestBuildID) {
-            if(_useCustomLatestOTA) {
-                versions = getListOfiOSForDevice2(_otaFirmwareTokens, device, 1, &versionCnt, 1,
-                                                  _useCustomLatestBeta);
+    const char *device = getDeviceModelNoCopy();
+    t_iosVersion versVals;
+    memset(&versVals, 0, sizeof(versVals));
+
+    int versionCnt = 0;
+    int i = 0;
+    char **versions = nullptr;
+    if(_useCustomLatestBuildID) {
+        if(_useCustomLatestOTA) {
+            versions = getListOfiOSForDevice2(_otaFirmwareTokens, device, 1, &versionCnt, 1,
+                                              _useCustomLatestBeta);
+        } else {
+            versions = getListOfiOSForDevice2(_firmwareTokens, device, 0, &versionCnt, 1,
+                                              _useCustomLatestBeta);
+        }
+    } else {
+        versions = getListOfiOSForDevice(_firmwareTokens, device, 0, &versionCnt, _useCustomLatestBeta);
+    }
+    retassure(versionCnt, "[TSSC] failed finding latest firmware version\n");
+    char *bpos = nullptr;
+    while ((bpos = strstr((char *) (versVals.version = strdup(versions[i++])), "[B]")) != nullptr) {
+        free((char *) versVals.version);
+        if (--versionCnt == 0)
+            reterror("[TSSC] automatic selection of firmware Couldn't find for non-beta versions\n");
+    }
+    if(_useCustomLatest) {
+        i = 0;
+        while(i < versionCnt) {
+            versVals.version = strdup(versions[i++]);
+            std::string version(versVals.version);
+            if(!std::equal(_customLatest.begin(), _customLatest.end(), version.begin())) {
+                free((char *) versVals.version);
             } else {
-                versions = getListOfiOSForDevice2(_firmwareTokens, device, 0, &versionCnt, 1,
-                                                  _useCustomLatestBeta);
+                i = -1;
+                break;
             }
+        }
+        if(i != -1) {
+            reterror("[TSSC] failed to find custom version for device!\n");
+        }
+    } else if(!_useCustomLatestBeta && _useCustomLatestBuildID) {
+        i = 0;
+        while (i < versionCnt) {
+            versVals.buildID = strdup(versions[i++]);
+            std::string version(versVals.buildID);
+            if (!std::equal(_customLatestBuildID.begin(), _customLatestBuildID.end(), version.begin())) {
+                free((char *) versVals.buildID);
+            } else {
+                i = -1;
+                break;
+            }
+        }
+        if(i != -1) {
+            reterror("[TSSC] failed to find custom buildid for device!\n");
+        }
+    }
+    if(!_useCustomLatestBeta) {
+        if(_useCustomLatestBuildID) {
+            debug("[TSSC] selecting latest firmware version: %s\n", versVals.buildID);
         } else {
-            versions = getListOfiOSForDevice(_firmwareTokens, device, 0, &versionCnt, _useCustomLatestBeta);
-        }
-        retassure(versionCnt, "[TSSC] failed finding latest firmware version\n");
-        char *bpos = nullptr;
-        while ((bpos = strstr((char *) (versVals.version = strdup(versions[i++])), "[B]")) != nullptr) {
-            free((char *) versVals.version);
-            if (--versionCnt == 0)
-                reterror("[TSSC] automatic selection of firmware Couldn't find for non-beta versions\n");
-        }
-        if(_useCustomLatest) {
-            i = 0;
-            while(i < versionCnt) {
-                versVals.version = strdup(versions[i++]);
-                std::string version(versVals.version);
-                if(!std::equal(_customLatest.begin(), _customLatest.end(), version.begin())) {
-                    free((char *) versVals.version);
-                } else {
-                    i = -1;
-                    break;
+            debug("[TSSC] selecting latest firmware version: %s\n", versVals.version);
+        }
+    }
+    if (bpos) *bpos = '\0';
+    if (versions) free(versions[versionCnt - 1]), free(versions);
+
+    ptr_smart<const char *> autofree(
+            versVals.version); //make sure it gets freed after function finishes execution by either reaching end or throwing exception
+    ptr_smart<const char *> autofree2(
+            versVals.buildID); //make sure it gets freed after function finishes execution by either reaching end or throwing exception
+
+    if(_useCustomLatestBeta) {
+        debug("[TSSC] selecting latest firmware version: %s\n", _customLatestBuildID.c_str());
+        if(_useCustomLatestOTA) {
+            t_versionURL *urls = getFirmwareUrls(device, &versVals, _otaFirmwareTokens, _useCustomLatestBeta, _useCustomLatestOTA);
+            while(urls && urls++->url) {
+                char *manifeststr = getBuildManifest(urls->url, device, nullptr, _customLatestBuildID.c_str(), _useCustomLatestOTA);
+                if(!manifeststr) {
+                    continue;
                 }
-            }
-            if(i != -1) {
-                reterror("[TSSC] failed to find custom version for device!\n");
-            }
-        } else if(!_useCustomLatestBeta && _useCustomLatestBuildID) {
-            i = 0;
-            while (i < versionCnt) {
-                versVals.buildID = strdup(versions[i++]);
-                std::string version(versVals.buildID);
-                if (!std::equal(_customLatestBuildID.begin(), _customLatestBuildID.end(), version.begin())) {
-                    free((char *) versVals.buildID);
-                } else {
-                    i = -1;
+                plist_t manifest = nullptr;
+                plist_from_xml(manifeststr, (uint32_t) strlen(manifeststr), &manifest);
+                plist_t ident = getBuildidentityWithBoardconfig(manifest, getDeviceBoardNoCopy(), _useCustomLatestOTA);
+                if(ident) {
+                    _latestFirmwareUrl = urls->url;
+                    safeFree(urls->buildID);
+                    safeFree(urls->version);
                     break;
                 }
+                safeFree(urls->buildID);
+                safeFree(urls->version);
             }
-            if(i != -1) {
-                reterror("[TSSC] failed to find custom buildid for device!\n");
-            }
-        }
-        if(!_useCustomLatestBeta) {
-            if(_useCustomLatestBuildID) {
-                debug("[TSSC] selecting latest firmware version: %s\n", versVals.buildID);
+        } else {
+            if(_useAppleDB) {
+                _latestFirmwareUrl = getBetaURLForDevice2(_betaFirmwareTokens, getDeviceModelNoCopy());
             } else {
-                debug("[TSSC] selecting latest firmware version: %s\n", versVals.version);
+                _latestFirmwareUrl = getBetaURLForDevice(_betaFirmwareTokens, _customLatestBuildID.c_str());
             }
         }
-        if (bpos) *bpos = '\0';
-        if (versions) free(versions[versionCnt - 1]), free(versions);
-
-        ptr_smart<const char *> autofree(
-                versVals.version); //make sure it gets freed after function finishes execution by either reaching end or throwing exception
-        ptr_smart<const char *> autofree2(
-                versVals.buildID); //make sure it gets freed after function finishes execution by either reaching end or throwing exception
-
-        if(_useCustomLatestBeta) {
-            debug("[TSSC] selecting latest firmware version: %s\n", _customLatestBuildID.c_str());
+        _latestManifest = getBuildManifest(_latestFirmwareUrl, device, nullptr, _customLatestBuildID.c_str(), _useCustomLatestOTA);
+    } else {
+        if(_useCustomLatestBuildID) {
             if(_useCustomLatestOTA) {
                 t_versionURL *urls = getFirmwareUrls(device, &versVals, _otaFirmwareTokens, _useCustomLatestBeta, _useCustomLatestOTA);
                 while(urls && urls++->url) {
@@ -1832,761 +1971,289 @@ char *futurerestore::getLatestManifest() {
                     safeFree(urls->version);
                 }
             } else {
-                if(_useAppleDB) {
-                    _latestFirmwareUrl = getBetaURLForDevice2(_betaFirmwareTokens, getDeviceModelNoCopy());
-                } else {
-                    _latestFirmwareUrl = getBetaURLForDevice(_betaFirmwareTokens, _customLatestBuildID.c_str());
-                }
+                _latestFirmwareUrl = getFirmwareUrl(device, &versVals, _firmwareTokens, _useCustomLatestBeta,
+                                                    _useCustomLatestOTA);
             }
-            _latestManifest = getBuildManifest(_latestFirmwareUrl, device, nullptr, _customLatestBuildID.c_str(), _useCustomLatestOTA);
         } else {
-            if(_useCustomLatestBuildID) {
-                if(_useCustomLatestOTA) {
-                    t_versionURL *urls = getFirmwareUrls(device, &versVals, _otaFirmwareTokens, _useCustomLatestBeta, _useCustomLatestOTA);
-                    while(urls && urls++->url) {
-                        char *manifeststr = getBuildManifest(urls->url, device, nullptr, _customLatestBuildID.c_str(), _useCustomLatestOTA);
-                        if(!manifeststr) {
-                            continue;
-                        }
-                        plist_t manifest = nullptr;
-                        plist_from_xml(manifeststr, (uint32_t) strlen(manifeststr), &manifest);
-                        plist_t ident = getBuildidentityWithBoardconfig(manifest, getDeviceBoardNoCopy(), _useCustomLatestOTA);
-                        if(ident) {
-                            _latestFirmwareUrl = urls->url;
-                            safeFree(urls->buildID);
-                            safeFree(urls->version);
-                            break;
-                        }
-                        safeFree(urls->buildID);
-                        safeFree(urls->version);
-                    }
-                } else {
-                    _latestFirmwareUrl = getFirmwareUrl(device, &versVals, _firmwareTokens, _useCustomLatestBeta,
-                                                        _useCustomLatestOTA);
-                }
-            } else {
-                _latestFirmwareUrl = getFirmwareUrl(device, &versVals, _firmwareTokens, _useCustomLatestBeta, _useCustomLatestOTA);
-            }
-            _latestManifest = getBuildManifest(_latestFirmwareUrl, device, nullptr, versVals.buildID,
-                                               _useCustomLatestOTA);
+            _latestFirmwareUrl = getFirmwareUrl(device, &versVals, _firmwareTokens, _useCustomLatestBeta, _useCustomLatestOTA);
         }
-        retassure(_latestFirmwareUrl, "Could not find url of latest firmware version\n");
-        retassure(_latestManifest, "Could not get buildmanifest of latest firmware version\n");
+        _latestManifest = getBuildManifest(_latestFirmwareUrl, device, nullptr, versVals.buildID,
+                                           _useCustomLatestOTA);
     }
+    retassure(_latestFirmwareUrl, "Could not find url of latest firmware version\n");
+    retassure(_latestManifest, "Could not get buildmanifest of latest firmware version\n");
+}
 
-    return _latestManifest;
+manifest_index *futurerestore::getLatestManifestIndex() {
+    if (!_latestManifestIndex) {
+        _latestManifestIndex = std::make_unique<manifest_index>(getLatestManifest());
+    }
+    return _latestManifestIndex.get();
 }
 
 char *futurerestore::getLatestFirmwareUrl() {
     return getLatestManifest(), _latestFirmwareUrl;
 }
 
-void inline futurerestore::test() const {
-    info("DEBUG: 1337: device: %p\n", _client->device);
-    assert(_client->device);
-}
-
-void futurerestore::downloadLatestRose() {
-    char *manifeststr = getLatestManifest();
-    char *roseStr = (elemExists("Rap,RTKitOS", manifeststr, getDeviceBoardNoCopy(), 0) ? getPathOfElementInManifest(
-            "Rap,RTKitOS", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    char otaString[1024]{};
-    if (roseStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", roseStr);
-            roseStr = reinterpret_cast<char *>(&otaString);
-        }
-        auto *digestString = getDigestOfElementInManifest("Rap,RTKitOS", manifeststr, getDeviceBoardNoCopy(), 0);
-        unsigned char *hash = getSHA(roseTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
-        if(hash && digestString && !memcmp(digestString, hash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-            info("Using cached Rose\n");
-            safeFree(digestString);
-            safeFree(hash);
-        } else {
-            info("Downloading Rose firmware\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), roseStr, roseTempPath.c_str()),
-                      "Could not download Rose\n");
-        }
-        loadRose(roseTempPath);
+std::shared_ptr<remote_zip> futurerestore::getLatestFirmwareZip() {
+    if (!_latestFirmwareZip) {
+        _latestFirmwareZip = remote_zip::open(getLatestFirmwareUrl(), futurerestoreTempPath);
     }
+    return _latestFirmwareZip;
 }
 
-void futurerestore::downloadLatestSE() {
-    char *manifeststr = getLatestManifest();
-    char *seStr = (elemExists("SE,UpdatePayload", manifeststr, getDeviceBoardNoCopy(), 0) ? getPathOfElementInManifest(
-            "SE,UpdatePayload", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    char otaString[1024]{};
-    if (seStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", seStr);
-            seStr = reinterpret_cast<char *>(&otaString);
-        }
-        // TODO: SE caching how does ProductionUpdatePayloadHash work?
-        info("Downloading SE firmware\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), seStr, seTempPath.c_str()),
-                  "Could not download SE\n");
-        loadSE(seTempPath);
-    }
-}
-
-void futurerestore::downloadLatestSavage() {
-    char *manifeststr = getLatestManifest();
-    char *savageB0ProdStr = (elemExists("Savage,B0-Prod-Patch", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                             ? getPathOfElementInManifest("Savage,B0-Prod-Patch", manifeststr, getDeviceBoardNoCopy(),
-                                                          0) : nullptr);
-    char *savageB0DevStr = (elemExists("Savage,B0-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), 0)
-                            ? getPathOfElementInManifest("Savage,B0-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                            : nullptr);
-    char *savageB2ProdStr = (elemExists("Savage,B2-Prod-Patch", manifeststr, getDeviceBoardNoCopy(), 0)
-                             ? getPathOfElementInManifest("Savage,B2-Prod-Patch", manifeststr, getDeviceBoardNoCopy(),
-                                                          _useCustomLatestOTA) : nullptr);
-    char *savageB2DevStr = (elemExists("Savage,B2-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), 0)
-                            ? getPathOfElementInManifest("Savage,B2-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                            : nullptr);
-    char *savageBAProdStr = (elemExists("Savage,BA-Prod-Patch", manifeststr, getDeviceBoardNoCopy(), 0)
-                             ? getPathOfElementInManifest("Savage,BA-Prod-Patch", manifeststr, getDeviceBoardNoCopy(),
-                                                          _useCustomLatestOTA) : nullptr);
-    char *savageBADevStr = (elemExists("Savage,BA-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), 0)
-                            ? getPathOfElementInManifest("Savage,BA-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                            : nullptr);
-    std::array<std::string, 6> savagePaths{};
-
-
-    char otaString[1024]{};
-    if (savageB0ProdStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", savageB0ProdStr);
-            savageB0ProdStr = reinterpret_cast<char *>(&otaString);
-        }
-        savagePaths[0] = futurerestoreTempPath + "/savageB0PP.fw";
-        auto *digestString = getDigestOfElementInManifest("Savage,B0-Prod-Patch", manifeststr, getDeviceBoardNoCopy(), 0);
-        unsigned char *hash = getSHA(savagePaths[0], 1);
-        if(hash && digestString && !memcmp(digestString, hash, 32)) {
-            info("Using cached Savage,B0-Prod-Patch.\n");
-            safeFree(digestString);
-            safeFree(hash);
-        } else {
-            info("Downloading Savage,B0-Prod-Patch\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), savageB0ProdStr, savagePaths[0].c_str()),
-                      "Could not download Savage,B0-Prod-Patch\n");
-        }
-    }
-    memset(otaString, 0, 1024);
-    if (savageB0DevStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", savageB0DevStr);
-            savageB0DevStr = reinterpret_cast<char *>(&otaString);
-        }
-        savagePaths[1] = futurerestoreTempPath + "//savageB0DP.fw";
-        auto *digestString = getDigestOfElementInManifest("Savage,B0-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), 0);
-        unsigned char *hash = getSHA(savagePaths[1], 1);
-        if(hash && digestString && !memcmp(digestString, hash, 32)) {
-            info("Using cached Savage,B0-Dev-Patch.\n");
-            safeFree(digestString);
-            safeFree(hash);
-        } else {
-            info("Downloading Savage,B0-Dev-Patch\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), savageB0DevStr, savagePaths[1].c_str()),
-                      "Could not download Savage,B0-Dev-Patch\n");
-        }
-    }
-    memset(otaString, 0, 1024);
-    if (savageB2ProdStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", savageB2ProdStr);
-            savageB2ProdStr = reinterpret_cast<char *>(&otaString);
-        }
-        savagePaths[2] = futurerestoreTempPath + "//savageB2PP.fw";
-        auto *digestString = getDigestOfElementInManifest("Savage,B2-Prod-Patch", manifeststr, getDeviceBoardNoCopy(), 0);
-        unsigned char *hash = getSHA(savagePaths[2], 1);
-        if(hash && digestString && !memcmp(digestString, hash, 32)) {
-            info("Using cached Savage,B2-Prod-Patch.\n");
-            safeFree(digestString);
-            safeFree(hash);
-        } else {
-            info("Downloading Savage,B2-Prod-Patch\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), savageB2ProdStr, savagePaths[2].c_str()),
-                      "Could not download Savage,B2-Prod-Patch\n");
-        }
+digest_index *futurerestore::getDigestIndex() {
+    if (_sharedCache) {
+        return _sharedCache->digestIndex(futurerestoreTempPath + "/digests.index", _forceCacheVerification);
     }
-    memset(otaString, 0, 1024);
-    if (savageB2DevStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", savageB2DevStr);
-            savageB2DevStr = reinterpret_cast<char *>(&otaString);
-        }
-        savagePaths[3] = futurerestoreTempPath + "//savageB2DP.fw";
-        auto *digestString = getDigestOfElementInManifest("Savage,B2-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), 0);
-        unsigned char *hash = getSHA(savagePaths[3], 1);
-        if(hash && digestString && !memcmp(digestString, hash, 32)) {
-            info("Using cached Savage,B2-Dev-Patch.\n");
-            safeFree(digestString);
-            safeFree(hash);
-        } else {
-            info("Downloading Savage,B2-Dev-Patch\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), savageB2DevStr, savagePaths[3].c_str()),
-                      "Could not download Savage,B2-Dev-Patch\n");
-        }
-    }
-    memset(otaString, 0, 1024);
-    if (savageBAProdStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", savageBAProdStr);
-            savageBAProdStr = reinterpret_cast<char *>(&otaString);
-        }
-        savagePaths[4] = futurerestoreTempPath + "//savageBAPP.fw";
-        auto *digestString = getDigestOfElementInManifest("Savage,BA-Prod-Patch", manifeststr, getDeviceBoardNoCopy(), 0);
-        unsigned char *hash = getSHA(savagePaths[4], 1);
-        if(hash && digestString && !memcmp(digestString, hash, 32)) {
-            info("Using cached Savage,BA-Prod-Patch.\n");
-            safeFree(digestString);
-            safeFree(hash);
-        } else {
-            info("Downloading Savage,BA-Prod-Patch\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), savageBAProdStr, savagePaths[4].c_str()),
-                      "Could not download Savage,BA-Prod-Patch\n");
-        }
+    if (!_digestIndex) {
+        _digestIndex = std::make_unique<digest_index>(futurerestoreTempPath + "/digests.index");
+        _digestIndex->setForceVerify(_forceCacheVerification);
     }
-    memset(otaString, 0, 1024);
-    if (savageBADevStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", savageBADevStr);
-            savageBADevStr = reinterpret_cast<char *>(&otaString);
-        }
-        savagePaths[5] = futurerestoreTempPath + "//savageBADP.fw";
-        auto *digestString = getDigestOfElementInManifest("Savage,BA-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), 0);
-        unsigned char *hash = getSHA(savagePaths[5], 1);
-        if(hash && digestString && !memcmp(digestString, hash, 32)) {
-            info("Using cached Savage,BA-Dev-Patch.\n");
-            safeFree(digestString);
-            safeFree(hash);
-        } else {
-            info("Downloading Savage,BA-Dev-Patch\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), savageBADevStr, savagePaths[5].c_str()),
-                      "Could not download Savage,BA-Dev-Patch\n");
-        }
+    return _digestIndex.get();
+}
+
+component_store *futurerestore::getComponentStore() {
+    if (_sharedCache) {
+        return _sharedCache->componentStore(futurerestoreTempPath + "/store", getDigestIndex(), _componentStoreBudget);
     }
-    if (savageB0ProdStr &&
-        savageB0DevStr &&
-        savageB2ProdStr &&
-        savageB2DevStr &&
-        savageBAProdStr &&
-        savageBADevStr) {
-        loadSavage(savagePaths);
+    if (!_componentStore) {
+        _componentStore = std::make_unique<component_store>(futurerestoreTempPath + "/store", getDigestIndex(),
+                                                            _componentStoreBudget);
     }
+    return _componentStore.get();
 }
 
-void futurerestore::downloadLatestVeridian() {
-    char *manifeststr = getLatestManifest();
-    char *veridianDGMStr = (elemExists("BMU,DigestMap", manifeststr, getDeviceBoardNoCopy(), 0)
-                            ? getPathOfElementInManifest("BMU,DigestMap", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                            : nullptr);
-    char *veridianFWMStr = (elemExists("BMU,FirmwareMap", manifeststr, getDeviceBoardNoCopy(), 0)
-                            ? getPathOfElementInManifest("BMU,FirmwareMap", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                            : nullptr);
-    char otaString[1024]{};
-    if (veridianDGMStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", veridianDGMStr);
-            veridianDGMStr = reinterpret_cast<char *>(&otaString);
-        }
-        auto *digestString = getDigestOfElementInManifest("BMU,DigestMap", manifeststr, getDeviceBoardNoCopy(), 0);
-        unsigned char *hash = getSHA(veridianDGMTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
-        if(hash && digestString && !memcmp(digestString, hash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-            info("Using cached BMU,DigestMap(Veridian).\n");
-            safeFree(digestString);
-            safeFree(hash);
-        } else {
-            info("Downloading Veridian DigestMap\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), veridianDGMStr, veridianDGMTempPath.c_str()),
-                      "Could not download Veridian DigestMap\n");
-        }
+void futurerestore::downloadComponent(const char *name, const char *remotePath, const std::string &dstPath,
+                                      std::function<void(const std::string &)> onFetched, std::string expectedDigest) {
+    std::string fetchPath = dstPath;
+    if (!onFetched) {
+        // dstPath may be mapped by another futurerestore, truncating it in place would SIGBUS that process.
+        // Replacing the name leaves existing mappings on the old file.
+        std::string tmpl = dstPath + ".XXXXXX";
+        int fd = mkstemp(&tmpl[0]);
+        retassure(fd >= 0, "ERROR: Could not create temporary file for %s\n", name);
+        close(fd);
+        fetchPath = tmpl;
+        onFetched = [dstPath](const std::string &partPath) {
+            if (rename(partPath.c_str(), dstPath.c_str())) {
+                // windows won't rename over an existing file
+                remove(dstPath.c_str());
+                retassure(!rename(partPath.c_str(), dstPath.c_str()), "ERROR: Could not move %s to %s\n",
+                          partPath.c_str(), dstPath.c_str());
+            }
+        };
     }
-    memset(otaString, 0, 1024);
-    if (veridianFWMStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", veridianFWMStr);
-            veridianFWMStr = reinterpret_cast<char *>(&otaString);
-        }
-        auto digestString = getDigestOfElementInManifest("BMU,FirmwareMap", manifeststr, getDeviceBoardNoCopy(), 0);
-        auto hash = getSHA(veridianFWMTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
-        if(hash && digestString && !memcmp(digestString, hash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-            info("Using cached BMU,FirmwareMap(Veridian).\n");
-            safeFree(digestString);
-            safeFree(hash);
-        } else {
-            info("Downloading Veridian FirmwareMap\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), veridianFWMStr, veridianFWMTempPath.c_str()),
-                      "Could not download Veridian FirmwareMap\n");
+    if (_downloadScheduler) {
+        _downloadScheduler->addJob(name, remotePath, fetchPath, true, std::move(onFetched), std::move(expectedDigest));
+        return;
+    }
+    info("Downloading %s\n\n", name);
+    download_scheduler single(getLatestFirmwareZip(), 1);
+    single.addJob(name, remotePath, fetchPath, true, std::move(onFetched), std::move(expectedDigest));
+    single.run();
+}
+
+std::string futurerestore::fetchComponent(const char *name, const char *remotePath, const unsigned char *digest,
+                                          size_t digestSize, const std::string &fallbackPath) {
+    if (!digest || !digestSize) {
+        // nothing to address it by, always fetch a fresh copy
+        downloadComponent(name, remotePath, fallbackPath);
+        return fallbackPath;
+    }
+    component_store *store = getComponentStore();
+    std::string expected((const char *) digest, digestSize);
+    if (_downloadScheduler) {
+        // checked against the cache together with everything else in queuePendingFetches()
+        if (_queuedDigests.insert(expected).second) {
+            _pendingFetches.push_back({name, remotePath, expected});
+        }
+        return store->pathFor(digest, digestSize);
+    }
+    if (store->lookup(digest, digestSize)) {
+        info("Using cached %s.\n", name);
+        return store->pathFor(digest, digestSize);
+    }
+    // hashed while it downloads, so committing it is just a rename
+    downloadComponent(name, remotePath, store->newStagingFile(digest, digestSize),
+                      [store, expected](const std::string &stagingPath) {
+        store->commit((const unsigned char *) expected.data(), expected.size(), stagingPath);
+    }, expected);
+    return store->pathFor(digest, digestSize);
+}
+
+std::vector<std::unique_lock<std::mutex>> futurerestore::queuePendingFetches() {
+    component_store *store = getComponentStore();
+    std::vector<std::string> digests;
+    digests.reserve(_pendingFetches.size());
+    for (const auto &fetch : _pendingFetches) {
+        digests.push_back(fetch.digest);
+    }
+    // a session waits for one fetching the same component and finds it cached afterwards,
+    // taking the locks in digest order keeps two sessions from each holding what the other needs
+    std::vector<std::unique_lock<std::mutex>> fetching;
+    if (_sharedCache) {
+        std::vector<std::string> sorted = digests;
+        std::sort(sorted.begin(), sorted.end());
+        for (const auto &digest : sorted) {
+            fetching.emplace_back(_sharedCache->fetchLock(digest));
+        }
+    }
+    // files the digest index doesn't vouch for get rehashed, do all of them at once
+    std::vector<uint8_t> cached = store->lookupAll(digests, thread_pool::defaultThreadCount());
+    for (size_t i = 0; i < _pendingFetches.size(); i++) {
+        const pending_fetch &fetch = _pendingFetches[i];
+        if (cached[i]) {
+            info("Using cached %s.\n", fetch.name.c_str());
+            continue;
         }
+        std::string expected = fetch.digest;
+        downloadComponent(fetch.name.c_str(), fetch.remotePath.c_str(),
+                          store->newStagingFile((const unsigned char *) expected.data(), expected.size()),
+                          [store, expected](const std::string &stagingPath) {
+            store->commit((const unsigned char *) expected.data(), expected.size(), stagingPath);
+        }, expected);
     }
-    if (veridianDGMStr && veridianFWMStr)
-        loadVeridian(veridianDGMTempPath, veridianFWMTempPath);
+    _pendingFetches.clear();
+    return fetching;
 }
 
-void futurerestore::downloadLatestTimer() {
-    char *manifeststr = getLatestManifest();
-    char *timerStr = (elemExists("Timer,RestoreRTKitOS", manifeststr, getDeviceBoardNoCopy(), 0) ? getPathOfElementInManifest(
-            "Timer,RestoreRTKitOS", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    char otaString[1024]{};
-    if (timerStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", timerStr);
-            timerStr = reinterpret_cast<char *>(&otaString);
-        }
-        info("Downloading Timer firmware\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), timerStr, timerTempPath.c_str()),
-                  "Could not download Timer\n");
-        loadTimer(timerTempPath);
+void futurerestore::deferLoad(std::function<void()> load) {
+    if (_downloadScheduler) {
+        _pendingLoads.push_back(std::move(load));
+        return;
     }
+    load();
 }
 
-void futurerestore::downloadLatestBaobab() {
-    char *manifeststr = getLatestManifest();
-    char *baobabStr = (elemExists("Baobab,TCON", manifeststr, getDeviceBoardNoCopy(), 0) ? getPathOfElementInManifest(
-            "Baobab,TCON", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    char otaString[1024]{};
-    if (baobabStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", baobabStr);
-            baobabStr = reinterpret_cast<char *>(&otaString);
-        }
-        info("Downloading Baobab firmware\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), baobabStr, baobabTempPath.c_str()),
-                  "Could not download Baobab\n");
-        loadBaobab(baobabTempPath);
-    }
-}
-
-void futurerestore::downloadLatestYonkers() {
-    char *manifeststr = getLatestManifest();
-    char *yonkers0Str = (elemExists("Yonkers,SysTopPatch0", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                             ? getPathOfElementInManifest("Yonkers,SysTopPatch0", manifeststr, getDeviceBoardNoCopy(),
-                                                          0) : nullptr);
-    char *yonkers1Str = (elemExists("Yonkers,SysTopPatch1", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatch1", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkers2Str = (elemExists("Yonkers,SysTopPatch2", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatch2", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkers3Str = (elemExists("Yonkers,SysTopPatch3", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatch3", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkers4Str = (elemExists("Yonkers,SysTopPatch4", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatch4", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkers5Str = (elemExists("Yonkers,SysTopPatch5", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatch5", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkers6Str = (elemExists("Yonkers,SysTopPatch6", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatch6", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkers7Str = (elemExists("Yonkers,SysTopPatch7", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatch7", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkers8Str = (elemExists("Yonkers,SysTopPatch8", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatch8", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkers9Str = (elemExists("Yonkers,SysTopPatch9", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatch9", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkersAStr = (elemExists("Yonkers,SysTopPatchA", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatchA", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkersBStr = (elemExists("Yonkers,SysTopPatchB", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatchB", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkersCStr = (elemExists("Yonkers,SysTopPatchC", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatchC", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkersDStr = (elemExists("Yonkers,SysTopPatchD", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatchD", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkersEStr = (elemExists("Yonkers,SysTopPatchE", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatchE", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    char *yonkersFStr = (elemExists("Yonkers,SysTopPatchF", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA)
-                         ? getPathOfElementInManifest("Yonkers,SysTopPatchF", manifeststr, getDeviceBoardNoCopy(),
-                                                      0) : nullptr);
-    std::array<std::string, 16> yonkersPaths{};
-
+void inline futurerestore::test() const {
+    info("DEBUG: 1337: device: %p\n", _client->device);
+    assert(_client->device);
+}
 
-    char otaString[1024]{};
-    if (yonkers0Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers0Str);
-            yonkers0Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[0] = futurerestoreTempPath + "/yonkers0.fw";
-            info("Downloading Yonkers,SysTopPatch0\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers0Str, yonkersPaths[0].c_str()),
-                      "Could not download Yonkers,SysTopPatch0\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkers1Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers1Str);
-            yonkers1Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[1] = futurerestoreTempPath + "/yonkers1.fw";
-        info("Downloading Yonkers,SysTopPatch1\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers1Str, yonkersPaths[1].c_str()),
-                  "Could not download Yonkers,SysTopPatch1\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkers2Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers2Str);
-            yonkers2Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[2] = futurerestoreTempPath + "/yonkers2.fw";
-        info("Downloading Yonkers,SysTopPatch2\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers2Str, yonkersPaths[2].c_str()),
-                  "Could not download Yonkers,SysTopPatch2\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkers3Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers3Str);
-            yonkers3Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[3] = futurerestoreTempPath + "/yonkers3.fw";
-        info("Downloading Yonkers,SysTopPatch3\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers3Str, yonkersPaths[3].c_str()),
-                  "Could not download Yonkers,SysTopPatch3\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkers4Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers4Str);
-            yonkers4Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[4] = futurerestoreTempPath + "/yonkers4.fw";
-        info("Downloading Yonkers,SysTopPatch4\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers4Str, yonkersPaths[4].c_str()),
-                  "Could not download Yonkers,SysTopPatch4\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkers5Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers5Str);
-            yonkers5Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[5] = futurerestoreTempPath + "/yonkers5.fw";
-        info("Downloading Yonkers,SysTopPatch5\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers5Str, yonkersPaths[5].c_str()),
-                  "Could not download Yonkers,SysTopPatch5\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkers6Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers6Str);
-            yonkers6Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[6] = futurerestoreTempPath + "/yonkers6.fw";
-        info("Downloading Yonkers,SysTopPatch6\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers6Str, yonkersPaths[6].c_str()),
-                  "Could not download Yonkers,SysTopPatch6\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkers7Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers7Str);
-            yonkers7Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[7] = futurerestoreTempPath + "/yonkers7.fw";
-        info("Downloading Yonkers,SysTopPatch7\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers7Str, yonkersPaths[7].c_str()),
-                  "Could not download Yonkers,SysTopPatch7\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkers8Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers8Str);
-            yonkers8Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[8] = futurerestoreTempPath + "/yonkers8.fw";
-        info("Downloading Yonkers,SysTopPatch8\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers8Str, yonkersPaths[8].c_str()),
-                  "Could not download Yonkers,SysTopPatch8\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkers9Str) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkers9Str);
-            yonkers9Str = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[9] = futurerestoreTempPath + "/yonkers9.fw";
-        info("Downloading Yonkers,SysTopPatch9\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkers9Str, yonkersPaths[9].c_str()),
-                  "Could not download Yonkers,SysTopPatch9\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkersAStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkersAStr);
-            yonkersAStr = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[10] = futurerestoreTempPath + "/yonkersA.fw";
-        info("Downloading Yonkers,SysTopPatchA\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkersAStr, yonkersPaths[10].c_str()),
-                  "Could not download Yonkers,SysTopPatchA\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkersBStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkersBStr);
-            yonkersBStr = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[11] = futurerestoreTempPath + "/yonkersB.fw";
-        info("Downloading Yonkers,SysTopPatchB\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkersBStr, yonkersPaths[11].c_str()),
-                  "Could not download Yonkers,SysTopPatchB\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkersCStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkersCStr);
-            yonkersCStr = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[12] = futurerestoreTempPath + "/yonkersC.fw";
-        info("Downloading Yonkers,SysTopPatchC\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkersCStr, yonkersPaths[12].c_str()),
-                  "Could not download Yonkers,SysTopPatchC\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkersDStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkersDStr);
-            yonkersDStr = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[13] = futurerestoreTempPath + "/yonkersD.fw";
-        info("Downloading Yonkers,SysTopPatchD\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkersDStr, yonkersPaths[13].c_str()),
-                  "Could not download Yonkers,SysTopPatchD\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkersEStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkersEStr);
-            yonkersEStr = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[14] = futurerestoreTempPath + "/yonkersE.fw";
-        info("Downloading Yonkers,SysTopPatchE\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkersEStr, yonkersPaths[14].c_str()),
-                  "Could not download Yonkers,SysTopPatchE\n");
-    }
-    memset(otaString, 0, 1024);
-    if (yonkersFStr) {
-        if(_useCustomLatestOTA) {
-            snprintf(otaString, 1024, "%s%s", "AssetData/boot/", yonkersFStr);
-            yonkersFStr = reinterpret_cast<char *>(&otaString);
-        }
-        yonkersPaths[15] = futurerestoreTempPath + "/yonkersF.fw";
-        info("Downloading Yonkers,SysTopPatchF\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), yonkersFStr, yonkersPaths[15].c_str()),
-                  "Could not download Yonkers,SysTopPatchF\n");
-    }
-    if (yonkers0Str &&
-            yonkers0Str &&
-            yonkers1Str &&
-            yonkers2Str &&
-            yonkers3Str &&
-            yonkers4Str &&
-            yonkers5Str &&
-            yonkers6Str &&
-            yonkers7Str &&
-            yonkers8Str &&
-            yonkers9Str &&
-            yonkersAStr &&
-            yonkersBStr &&
-            yonkersCStr &&
-            yonkersDStr &&
-            yonkersEStr &&
-            yonkersFStr) {
-        loadYonkers(yonkersPaths);
-    }
-}
-
-void futurerestore::downloadLatestCryptex1() {
-    char *manifeststr = getLatestManifest();
-    char *cryptex1SysOSStr = (elemExists("Cryptex1,SystemOS", manifeststr, getDeviceBoardNoCopy(), 0)
-                              ? getPathOfElementInManifest(
-                    "Cryptex1,SystemOS", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    auto *cryptex1SysOSDGSTStr = getDigestOfElementInManifest("Cryptex1,SystemOS", manifeststr, getDeviceBoardNoCopy(),
-                                                              _useCustomLatestOTA);
-    info("Checking for cached Cryptex1...\n");
-    auto *cryptex1SysOSHash = getSHA(cryptex1SysOSTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
-
-    char *cryptex1SysVOLStr = (elemExists("Cryptex1,SystemVolume", manifeststr, getDeviceBoardNoCopy(), 0)
-                               ? getPathOfElementInManifest(
-                    "Cryptex1,SystemVolume", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    auto *cryptex1SysVOLDGSTStr = getDigestOfElementInManifest("Cryptex1,SystemVolume", manifeststr,
-                                                               getDeviceBoardNoCopy(), _useCustomLatestOTA);
-    auto *cryptex1SysVOLHash = getSHA(cryptex1SysVOLTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
-
-    char *cryptex1SysTCStr = (elemExists("Cryptex1,SystemTrustCache", manifeststr, getDeviceBoardNoCopy(), 0)
-                              ? getPathOfElementInManifest(
-                    "Cryptex1,SystemTrustCache", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    auto *cryptex1SysTCDGSTStr = getDigestOfElementInManifest("Cryptex1,SystemTrustCache", manifeststr,
-                                                              getDeviceBoardNoCopy(), _useCustomLatestOTA);
-    auto *cryptex1SysTCHash = getSHA(cryptex1SysTCTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
-
-    char *cryptex1AppOSStr = (elemExists("Cryptex1,AppOS", manifeststr, getDeviceBoardNoCopy(), 0)
-                              ? getPathOfElementInManifest(
-                    "Cryptex1,AppOS", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    auto *cryptex1AppOSDGSTStr = getDigestOfElementInManifest("Cryptex1,AppOS", manifeststr, getDeviceBoardNoCopy(),
-                                                              _useCustomLatestOTA);
-    auto *cryptex1AppOSHash = getSHA(cryptex1AppOSTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
-
-    char *cryptex1AppVOLStr = (elemExists("Cryptex1,AppVolume", manifeststr, getDeviceBoardNoCopy(), 0)
-                               ? getPathOfElementInManifest(
-                    "Cryptex1,AppVolume", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    auto *cryptex1AppVOLDGSTStr = getDigestOfElementInManifest("Cryptex1,AppVolume", manifeststr,
-                                                               getDeviceBoardNoCopy(), _useCustomLatestOTA);
-    auto *cryptex1AppVOLHash = getSHA(cryptex1AppVOLTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
-
-
-    char *cryptex1AppTCStr = (elemExists("Cryptex1,AppTrustCache", manifeststr, getDeviceBoardNoCopy(), 0)
-                              ? getPathOfElementInManifest(
-                    "Cryptex1,AppTrustCache", manifeststr, getDeviceBoardNoCopy(), _useCustomLatestOTA) : nullptr);
-    auto *cryptex1AppTCDGSTStr = getDigestOfElementInManifest("Cryptex1,AppTrustCache", manifeststr,
-                                                              getDeviceBoardNoCopy(), _useCustomLatestOTA);
-    auto *cryptex1AppTCHash = getSHA(cryptex1AppTCTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
+#define COMPONENT_FIELD(data, size) \
+    [](const futurerestore *self, const char *name, const std::string &path) { \
+        self->mapComponent(path, name, self->_client->data, self->_client->size); \
+    }
+
+const futurerestore::component_descriptor futurerestore::_firmwareComponents[] = {
+    {"Rap,RTKitOS", "Rose", "/rose.bin", true, false, COMPONENT_FIELD(rosefwdata, rosefwdatasize)},
+    // TODO: SE caching how does ProductionUpdatePayloadHash work?
+    {"SE,UpdatePayload", "SE", "/se.sefw", false, false, COMPONENT_FIELD(sefwdata, sefwdatasize)},
+    {"Savage,B0-Prod-Patch", "Savage", "/savageB0PP.fw", true, false, COMPONENT_FIELD(savagefwdata[0], savagefwdatasize[0])},
+    {"Savage,B0-Dev-Patch", "Savage", "/savageB0DP.fw", true, false, COMPONENT_FIELD(savagefwdata[1], savagefwdatasize[1])},
+    {"Savage,B2-Prod-Patch", "Savage", "/savageB2PP.fw", true, false, COMPONENT_FIELD(savagefwdata[2], savagefwdatasize[2])},
+    {"Savage,B2-Dev-Patch", "Savage", "/savageB2DP.fw", true, false, COMPONENT_FIELD(savagefwdata[3], savagefwdatasize[3])},
+    {"Savage,BA-Prod-Patch", "Savage", "/savageBAPP.fw", true, false, COMPONENT_FIELD(savagefwdata[4], savagefwdatasize[4])},
+    {"Savage,BA-Dev-Patch", "Savage", "/savageBADP.fw", true, false, COMPONENT_FIELD(savagefwdata[5], savagefwdatasize[5])},
+    {"BMU,DigestMap", "Veridian", "/veridianDGM.der", true, false, COMPONENT_FIELD(veridiandgmfwdata, veridiandgmfwdatasize)},
+    {"BMU,FirmwareMap", "Veridian", "/veridianFWM.plist", true, false, COMPONENT_FIELD(veridianfwmfwdata, veridianfwmfwdatasize)},
+    {"Timer,RestoreRTKitOS", "Timer", "/timer.bin", false, false,
+     [](const futurerestore *self, const char *name, const std::string &path) {
+        // the same firmware serves both Timer requests
+        self->mapComponent(path, name, self->_client->timerfwdata, self->_client->timerfwdatasize);
+        self->mapComponent(path, name, self->_client->rtimerfwdata, self->_client->rtimerfwdatasize);
+     }},
+    {"Baobab,TCON", "Baobab", "/baobab.bin", false, false, COMPONENT_FIELD(baobabfwdata, baobabfwdatasize)},
+    {"Yonkers,SysTopPatch0", "Yonkers", "/yonkers0.fw", false, false, COMPONENT_FIELD(yonkersfwdata[0], yonkersfwdatasize[0])},
+    {"Yonkers,SysTopPatch1", "Yonkers", "/yonkers1.fw", false, false, COMPONENT_FIELD(yonkersfwdata[1], yonkersfwdatasize[1])},
+    {"Yonkers,SysTopPatch2", "Yonkers", "/yonkers2.fw", false, false, COMPONENT_FIELD(yonkersfwdata[2], yonkersfwdatasize[2])},
+    {"Yonkers,SysTopPatch3", "Yonkers", "/yonkers3.fw", false, false, COMPONENT_FIELD(yonkersfwdata[3], yonkersfwdatasize[3])},
+    {"Yonkers,SysTopPatch4", "Yonkers", "/yonkers4.fw", false, false, COMPONENT_FIELD(yonkersfwdata[4], yonkersfwdatasize[4])},
+    {"Yonkers,SysTopPatch5", "Yonkers", "/yonkers5.fw", false, false, COMPONENT_FIELD(yonkersfwdata[5], yonkersfwdatasize[5])},
+    {"Yonkers,SysTopPatch6", "Yonkers", "/yonkers6.fw", false, false, COMPONENT_FIELD(yonkersfwdata[6], yonkersfwdatasize[6])},
+    {"Yonkers,SysTopPatch7", "Yonkers", "/yonkers7.fw", false, false, COMPONENT_FIELD(yonkersfwdata[7], yonkersfwdatasize[7])},
+    {"Yonkers,SysTopPatch8", "Yonkers", "/yonkers8.fw", false, false, COMPONENT_FIELD(yonkersfwdata[8], yonkersfwdatasize[8])},
+    {"Yonkers,SysTopPatch9", "Yonkers", "/yonkers9.fw", false, false, COMPONENT_FIELD(yonkersfwdata[9], yonkersfwdatasize[9])},
+    {"Yonkers,SysTopPatchA", "Yonkers", "/yonkersA.fw", false, false, COMPONENT_FIELD(yonkersfwdata[10], yonkersfwdatasize[10])},
+    {"Yonkers,SysTopPatchB", "Yonkers", "/yonkersB.fw", false, false, COMPONENT_FIELD(yonkersfwdata[11], yonkersfwdatasize[11])},
+    {"Yonkers,SysTopPatchC", "Yonkers", "/yonkersC.fw", false, false, COMPONENT_FIELD(yonkersfwdata[12], yonkersfwdatasize[12])},
+    {"Yonkers,SysTopPatchD", "Yonkers", "/yonkersD.fw", false, false, COMPONENT_FIELD(yonkersfwdata[13], yonkersfwdatasize[13])},
+    {"Yonkers,SysTopPatchE", "Yonkers", "/yonkersE.fw", false, false, COMPONENT_FIELD(yonkersfwdata[14], yonkersfwdatasize[14])},
+    {"Yonkers,SysTopPatchF", "Yonkers", "/yonkersF.fw", false, false, COMPONENT_FIELD(yonkersfwdata[15], yonkersfwdatasize[15])},
+    {"Cryptex1,SystemOS", "Cryptex1", "/cryptex1SysOS.dmg", true, true,
+     COMPONENT_FIELD(cryptex1sysosdata, cryptex1sysosdatasize)},
+    {"Cryptex1,SystemVolume", "Cryptex1", "/cryptex1SysVOL.dmg.root_hash", true, true,
+     COMPONENT_FIELD(cryptex1sysvoldata, cryptex1sysvoldatasize)},
+    {"Cryptex1,SystemTrustCache", "Cryptex1", "/cryptex1SysTC.dmg.trustcache", true, true,
+     COMPONENT_FIELD(cryptex1systcdata, cryptex1systcdatasize)},
+    {"Cryptex1,AppOS", "Cryptex1", "/cryptex1AppOS.dmg", true, true,
+     COMPONENT_FIELD(cryptex1apposdata, cryptex1apposdatasize)},
+    {"Cryptex1,AppVolume", "Cryptex1", "/cryptex1AppVOL.dmg.root_hash", true, true,
+     COMPONENT_FIELD(cryptex1appvoldata, cryptex1appvoldatasize)},
+    {"Cryptex1,AppTrustCache", "Cryptex1", "/cryptex1AppTC.dmg.trustcache", true, true,
+     COMPONENT_FIELD(cryptex1apptcdata, cryptex1apptcdatasize)},
+};
 
-    char otaString[1024]{};
-    if (cryptex1SysOSHash && cryptex1SysOSDGSTStr &&
-        !memcmp(cryptex1SysOSDGSTStr, cryptex1SysOSHash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-        info("Using cached Cryptex1,SystemOS.\n");
-        safeFree(cryptex1SysOSDGSTStr);
-        safeFree(cryptex1SysOSHash);
+#undef COMPONENT_FIELD
+
+void futurerestore::fetchFirmwareComponent(const component_descriptor &component) {
+    manifest_index *manifest = getLatestManifestIndex();
+    const char *board = getDeviceBoardNoCopy();
+    const char *remotePath = manifest->getPathOfElement(component.element, board, _useCustomLatestOTA);
+    std::string otaPath;
+    if (_useCustomLatestOTA) {
+        otaPath = std::string("AssetData/boot/") + remotePath;
+        remotePath = otaPath.c_str();
+    }
+    std::string tempPath = _tempPath + component.tempName;
+    std::string path = tempPath;
+    if (component.cacheable) {
+        size_t digestSize = 0;
+        auto *digest = manifest->getDigestOfElement(component.element, board,
+                                                    component.otaDigest ? _useCustomLatestOTA : 0, &digestSize);
+        path = fetchComponent(component.element, remotePath, digest, digestSize, tempPath);
     } else {
-        if (cryptex1SysOSStr) {
-            if (_useCustomLatestOTA) {
-                snprintf(otaString, 1024, "%s%s", "AssetData/boot/", cryptex1SysOSStr);
-                cryptex1SysOSStr = reinterpret_cast<char *>(&otaString);
-            }
-            info("Downloading Cryptex1,SystemOS dmg(this may take a while)\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), cryptex1SysOSStr, cryptex1SysOSTempPath.c_str()),
-                      "Could not download Cryptex1,SystemOS\n");
-        }
+        downloadComponent(component.element, remotePath, tempPath);
     }
-    if (cryptex1SysVOLHash && cryptex1SysVOLDGSTStr &&
-        !memcmp(cryptex1SysVOLDGSTStr, cryptex1SysVOLHash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-        info("Using cached Cryptex1,SystemVolume.\n");
-        safeFree(cryptex1SysVOLDGSTStr);
-        safeFree(cryptex1SysVOLHash);
-    } else {
-        if (cryptex1SysVOLStr) {
-            if (_useCustomLatestOTA) {
-                snprintf(otaString, 1024, "%s%s", "AssetData/boot/", cryptex1SysVOLStr);
-                cryptex1SysVOLStr = reinterpret_cast<char *>(&otaString);
-            }
-            info("Downloading Cryptex1,SystemVolume root_hash\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), cryptex1SysVOLStr, cryptex1SysVOLTempPath.c_str()),
-                      "Could not download Cryptex1,SystemVolume\n");
-        }
-    }
-    if (cryptex1SysTCHash && cryptex1SysTCDGSTStr &&
-        !memcmp(cryptex1SysTCDGSTStr, cryptex1SysTCHash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-        info("Using cached Cryptex1,SystemTrustCache.\n");
-        safeFree(cryptex1SysTCDGSTStr);
-        safeFree(cryptex1SysTCHash);
-    } else {
-        if (cryptex1SysTCStr) {
-            if (_useCustomLatestOTA) {
-                snprintf(otaString, 1024, "%s%s", "AssetData/boot/", cryptex1SysTCStr);
-                cryptex1SysTCStr = reinterpret_cast<char *>(&otaString);
-            }
-            info("Downloading Cryptex1,SystemTrustCache\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), cryptex1SysTCStr, cryptex1SysTCTempPath.c_str()),
-                      "Could not download Cryptex1,SystemTrustCache\n");
+    deferLoad([this, &component, path] { component.load(this, component.element, path); });
+}
+
+void futurerestore::downloadLatestFirmwareComponents() {
+    info("Downloading the latest firmware components...\n");
+    manifest_index *manifest = getLatestManifestIndex();
+    download_scheduler scheduler(getLatestFirmwareZip(), _downloadConcurrency);
+    _downloadScheduler = &scheduler;
+    cleanup([&] {
+        _downloadScheduler = nullptr;
+        _pendingLoads.clear();
+        _queuedDigests.clear();
+        _pendingFetches.clear();
+    });
+    // a group is only worth fetching if every part of it is in the manifest, it is loaded as a whole
+    std::unordered_set<std::string> incompleteGroups;
+    for (const auto &component : _firmwareComponents) {
+        if (!manifest->elemExists(component.element, getDeviceBoardNoCopy(), 0)) {
+            incompleteGroups.insert(component.group);
         }
     }
-    if (cryptex1AppOSHash && cryptex1AppOSDGSTStr &&
-        !memcmp(cryptex1AppOSDGSTStr, cryptex1AppOSHash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-        info("Using cached Cryptex1,AppOS.\n");
-        safeFree(cryptex1AppOSDGSTStr);
-        safeFree(cryptex1AppOSHash);
-    } else {
-        if (cryptex1AppOSStr) {
-            if (_useCustomLatestOTA) {
-                snprintf(otaString, 1024, "%s%s", "AssetData/boot/", cryptex1AppOSStr);
-                cryptex1AppOSStr = reinterpret_cast<char *>(&otaString);
-            }
-            info("Downloading Cryptex1,AppOS dmg\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), cryptex1AppOSStr, cryptex1AppOSTempPath.c_str()),
-                      "Could not download Cryptex1,AppOS\n");
+    for (const auto &component : _firmwareComponents) {
+        if (!incompleteGroups.count(component.group)) {
+            fetchFirmwareComponent(component);
         }
     }
-    if (cryptex1AppVOLHash && cryptex1AppVOLDGSTStr &&
-        !memcmp(cryptex1AppVOLDGSTStr, cryptex1AppVOLHash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-        info("Using cached Cryptex1,AppVolume.\n");
-        safeFree(cryptex1AppVOLDGSTStr);
-        safeFree(cryptex1AppVOLHash);
-    } else {
-        if (cryptex1AppVOLStr) {
-            if (_useCustomLatestOTA) {
-                snprintf(otaString, 1024, "%s%s", "AssetData/boot/", cryptex1AppVOLStr);
-                cryptex1AppVOLStr = reinterpret_cast<char *>(&otaString);
-            }
-            info("Downloading Cryptex1,AppVolume root_hash\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), cryptex1AppVOLStr, cryptex1AppVOLTempPath.c_str()),
-                      "Could not download Cryptex1,AppVolume\n");
-        }
+    // the first session fetches a component, others needing it find it in the component store
+    std::vector<std::unique_lock<std::mutex>> fetching = queuePendingFetches();
+    // everything is queued now, fetch it in one go and only then hand the files to idevicerestore
+    _downloadScheduler = nullptr;
+    scheduler.run();
+    fetching.clear();
+    for (auto &load : _pendingLoads) {
+        load();
     }
-    if(cryptex1AppTCHash && cryptex1AppTCDGSTStr && !memcmp(cryptex1AppTCDGSTStr, cryptex1AppTCHash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-        info("Using cached Cryptex1,AppTrustCache.\n");
-        safeFree(cryptex1AppTCDGSTStr);
-        safeFree(cryptex1AppTCHash);
-    } else {
-        if (cryptex1AppTCStr) {
-            if (_useCustomLatestOTA) {
-                snprintf(otaString, 1024, "%s%s", "AssetData/boot/", cryptex1AppTCStr);
-                cryptex1AppTCStr = reinterpret_cast<char *>(&otaString);
-            }
-            info("Downloading Cryptex1,AppTrustCache\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), cryptex1AppTCStr, cryptex1AppTCTempPath.c_str()),
-                      "Could not download Cryptex1,AppTrustCache\n");
-        }
-    }
-    loadCryptex1(cryptex1SysOSTempPath, cryptex1SysVOLTempPath, cryptex1SysTCTempPath, cryptex1AppOSTempPath, cryptex1AppVOLTempPath, cryptex1AppTCTempPath);
-}
-
-void futurerestore::downloadLatestFirmwareComponents() {
-    info("Downloading the latest firmware components...\n");
-    char *manifeststr = getLatestManifest();
-    if (elemExists("Rap,RTKitOS", manifeststr, getDeviceBoardNoCopy(), 0))
-        downloadLatestRose();
-    if (elemExists("SE,UpdatePayload", manifeststr, getDeviceBoardNoCopy(), 0))
-        downloadLatestSE();
-    if (elemExists("Savage,B0-Prod-Patch", manifeststr, getDeviceBoardNoCopy(), 0) &&
-        elemExists("Savage,B0-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), 0) &&
-        elemExists("Savage,B2-Prod-Patch", manifeststr, getDeviceBoardNoCopy(), 0) &&
-        elemExists("Savage,B2-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), 0) &&
-        elemExists("Savage,BA-Prod-Patch", manifeststr, getDeviceBoardNoCopy(), 0) &&
-        elemExists("Savage,BA-Dev-Patch", manifeststr, getDeviceBoardNoCopy(), 0)) {
-        downloadLatestSavage();
-    }
-    if (elemExists("BMU,DigestMap", manifeststr, getDeviceBoardNoCopy(), 0) ||
-        elemExists("BMU,FirmwareMap", manifeststr, getDeviceBoardNoCopy(), 0))
-        downloadLatestVeridian();
-    if (elemExists("Timer,RestoreRTKitOS", manifeststr, getDeviceBoardNoCopy(), 0))
-        downloadLatestTimer();
-    if (elemExists("Baobab,TCON", manifeststr, getDeviceBoardNoCopy(), 0))
-        downloadLatestBaobab();
-    if (elemExists("Yonkers,PatchEpoch", manifeststr, getDeviceBoardNoCopy(), 0))
-        downloadLatestYonkers();
-    if (elemExists("Cryptex1,SystemOS", manifeststr, getDeviceBoardNoCopy(), 0))
-        downloadLatestCryptex1();
+    getComponentStore()->evict();
+    getDigestIndex()->save();
     info("Finished downloading the latest firmware components!\n");
 }
 
 void futurerestore::downloadLatestBaseband() {
+    manifest_index *manifest = getLatestManifestIndex();
     auto manifeststr = std::string(getLatestManifest());
+    std::string basebandTempPath = _tempPath + "/baseband.bbfw";
+    std::string basebandManifestTempPath = _tempPath + "/basebandManifest.plist";
     saveStringToFile(manifeststr, basebandManifestTempPath);
-    auto pathStr = getPathOfElementInManifest("BasebandFirmware", manifeststr.c_str(), getDeviceBoardNoCopy(), _useCustomLatestOTA);
-    auto *bbcfgDigestString = getBBCFGDigestInManifest(manifeststr.c_str(), getDeviceBoardNoCopy(), 0);
+    auto pathStr = manifest->getPathOfElement("BasebandFirmware", getDeviceBoardNoCopy(), _useCustomLatestOTA);
+    auto *bbcfgDigestString = manifest->getBBCFGDigest(getDeviceBoardNoCopy(), 0);
     size_t basebandSize = 0;
     char *basebandData = nullptr;
     basebandData = readBaseband(basebandTempPath, basebandData, &basebandSize);
@@ -2597,7 +2264,6 @@ void futurerestore::downloadLatestBaseband() {
             auto *hash = getSHABuffer((char *) bbcfgData, basebandSize, 1);
             if(hash && bbcfgDigestString && !memcmp(bbcfgDigestString, hash, 32)) {
                 info("Using cached Baseband.\n");
-                safeFree(bbcfgDigestString);
                 safeFree(hash);
                 cached = true;
             }
@@ -2609,9 +2275,7 @@ void futurerestore::downloadLatestBaseband() {
             snprintf(otaString, 1024, "%s%s", "AssetData/boot/", pathStr);
             pathStr = reinterpret_cast<char *>(&otaString);
         }
-        info("Downloading Baseband\n\n");
-        retassure(!downloadPartialzip(getLatestFirmwareUrl(), pathStr, basebandTempPath.c_str()),
-                  "Could not download baseband\n");
+        downloadComponent("baseband", pathStr, basebandTempPath);
     }
     setBasebandPath(basebandTempPath);
     setBasebandManifestPath(basebandManifestTempPath);
@@ -2620,27 +2284,28 @@ void futurerestore::downloadLatestBaseband() {
 }
 
 void futurerestore::downloadLatestSep() {
+    manifest_index *manifest = getLatestManifestIndex();
     auto manifestString = std::string(getLatestManifest());
+    std::string sepTempPath = _tempPath + "/sep.im4p";
+    std::string sepManifestTempPath = _tempPath + "/sepManifest.plist";
     saveStringToFile(manifestString, sepManifestTempPath);
-    auto pathString = getPathOfElementInManifest("SEP", manifestString.c_str(), getDeviceBoardNoCopy(), _useCustomLatestOTA);
-    auto *digestString = getDigestOfElementInManifest("SEP",manifestString.c_str(), getDeviceBoardNoCopy(), _useCustomLatestOTA);
-    auto *hash = getSHA(sepTempPath, ((_client->device->chip_id < 0x8010) ? 3 : 0));
-    if(hash && digestString && !memcmp(digestString, hash, ((_client->device->chip_id < 0x8010) ? 20 : 48))) {
-        info("Using cached SEP.\n");
-        safeFree(digestString);
-        safeFree(hash);
-    } else {
-        char otaString[1024]{};
-        if(pathString) {
-            if(_useCustomLatestOTA) {
-                snprintf(otaString, 1024, "%s%s", "AssetData/boot/", pathString);
-                pathString = reinterpret_cast<char *>(&otaString);
-            }
-            info("Downloading SEP\n\n");
-            retassure(!downloadPartialzip(getLatestFirmwareUrl(), pathString, sepTempPath.c_str()), "Could not download SEP\n");
-        }
-    }
-    setSepPath(sepTempPath);
+    auto pathString = manifest->getPathOfElement("SEP", getDeviceBoardNoCopy(), _useCustomLatestOTA);
+    size_t digestSize = 0;
+    auto *digest = manifest->getDigestOfElement("SEP", getDeviceBoardNoCopy(), _useCustomLatestOTA, &digestSize);
+    char otaString[1024]{};
+    if(_useCustomLatestOTA) {
+        snprintf(otaString, 1024, "%s%s", "AssetData/boot/", pathString);
+        pathString = reinterpret_cast<char *>(&otaString);
+    }
+    std::unique_lock<std::mutex> fetching;
+    if (_sharedCache && digest && digestSize) {
+        fetching = std::unique_lock<std::mutex>(_sharedCache->fetchLock(std::string((const char *) digest, digestSize)));
+    }
+    std::string sepPath = fetchComponent("SEP", pathString, digest, digestSize, sepTempPath);
+    if (fetching) fetching.unlock();
+    getComponentStore()->evict();
+    getDigestIndex()->save();
+    setSepPath(sepPath);
     setSepManifestPath(sepManifestTempPath);
     loadSep(this->_sepPath);
     loadSepManifest(this->_sepManifestPath);
@@ -2658,260 +2323,48 @@ void futurerestore::loadBasebandManifest(const std::string& basebandManifestPath
               "Failed to load Baseband Manifest");
 };
 
-void futurerestore::loadRose(const std::string& rosePath) const {
-    std::ifstream roseFileStream(rosePath, std::ios::in | std::ios::binary);
-    retassure(roseFileStream.good(), "%s: failed init file stream for %s!\n", __func__, rosePath.c_str());
-    _client->rosefwdatasize = futurerestore::getFileSize(rosePath);
-    std::allocator<uint8_t> alloc;
-    retassure(_client->rosefwdata = (char *)alloc.allocate(_client->rosefwdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, rosePath.c_str());
-    roseFileStream.read((char *) _client->rosefwdata,
-                          (std::streamsize) _client->rosefwdatasize);
-    retassure(roseFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, rosePath.c_str());
-    retassure(*(uint64_t *) (_client->rosefwdata) != 0,
-              "%s: failed to load Rose for %s with the size %zu!\n",
-              __func__, rosePath.c_str(), _client->rosefwdatasize);
-}
-
-void futurerestore::loadSE(const std::string& sePath) const {
-    std::ifstream seFileStream(sePath, std::ios::in | std::ios::binary);
-    retassure(seFileStream.good(), "%s: failed init file stream for %s!\n", __func__, sePath.c_str());
-    _client->sefwdatasize = futurerestore::getFileSize(sePath);
-    std::allocator<uint8_t> alloc;
-    retassure(_client->sefwdata = (char *)alloc.allocate(_client->sefwdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, sePath.c_str());
-    seFileStream.read((char *) _client->sefwdata,
-                        (std::streamsize) _client->sefwdatasize);
-    retassure(seFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, sePath.c_str());
-    retassure(*(uint64_t *) (_client->sefwdata) != 0,
-              "%s: failed to load SE for %s with the size %zu!\n",
-              __func__, sePath.c_str(), _client->sefwdatasize);
-}
-
-void futurerestore::loadSavage(const std::array<std::string, 6>& savagePaths) const {
-    int index = 0;
-    for (const auto &savagePath: savagePaths) {
-        std::ifstream savageFileStream(savagePath, std::ios::in | std::ios::binary);
-        retassure(savageFileStream.good(), "%s: failed init file stream for %s!\n", __func__, savagePath.c_str());
-        _client->savagefwdatasize[index] = futurerestore::getFileSize(savagePath);
-        std::allocator<uint8_t> alloc;
-        retassure(_client->savagefwdata[index] = (char *)alloc.allocate(_client->savagefwdatasize[index]),
-                  "%s: failed to allocate memory for %s\n", __func__, savagePath.c_str());
-        savageFileStream.read((char *) _client->savagefwdata[index],
-                              (std::streamsize) _client->savagefwdatasize[index]);
-        retassure(savageFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, savagePath.c_str());
-        retassure(*(uint64_t *) (_client->savagefwdata[index]) != 0,
-                  "%s: failed to load Savage for %s with the size %zu!\n",
-                  __func__, savagePath.c_str(), _client->savagefwdatasize[index]);
-        index++;
-    }
-}
-
-void futurerestore::loadVeridian(const std::string& veridianDGMPath, const std::string& veridianFWMPath) const {
-    std::ifstream veridianDGMFileStream(veridianDGMPath, std::ios::in | std::ios::binary);
-    std::ifstream veridianFWMFileStream(veridianFWMPath, std::ios::in | std::ios::binary);
-    retassure(veridianDGMFileStream.good(), "%s: failed init file stream for %s!\n", __func__, veridianDGMPath.c_str());
-    retassure(veridianFWMFileStream.good(), "%s: failed init file stream for %s!\n", __func__,
-              veridianFWMPath.c_str());
-    _client->veridiandgmfwdatasize = futurerestore::getFileSize(veridianDGMPath);
-    std::allocator<uint8_t> alloc;
-    retassure(_client->veridiandgmfwdata = (char *)alloc.allocate(_client->veridiandgmfwdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, veridianDGMPath.c_str());
-    veridianDGMFileStream.read((char *) _client->veridiandgmfwdata,
-                               (std::streamsize) _client->veridiandgmfwdatasize);
-    retassure(veridianDGMFileStream.good(), "%s: failed init read stream for %s!\n", __func__, veridianDGMPath.c_str());
-    retassure(*(uint64_t *) (_client->veridiandgmfwdata) != 0,
-              "%s: failed to load Veridian for %s with the size %zu!\n",
-              __func__, veridianDGMPath.c_str(), _client->veridiandgmfwdatasize);
-    _client->veridianfwmfwdatasize = futurerestore::getFileSize(veridianFWMPath);
-    retassure(_client->veridianfwmfwdata = (char *)alloc.allocate(_client->veridianfwmfwdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, veridianFWMPath.c_str());
-    veridianFWMFileStream.read((char *) _client->veridianfwmfwdata,
-                               (std::streamsize) _client->veridianfwmfwdatasize);
-    retassure(veridianFWMFileStream.good(), "%s: failed to read file stream for %s!\n", __func__,
-              veridianFWMPath.c_str());
-    retassure(*(uint64_t *) (_client->veridianfwmfwdata) != 0,
-              "%s: failed to load Veridian for %s with the size %zu!\n",
-              __func__, veridianFWMPath.c_str(), _client->veridianfwmfwdatasize);
-}
-
-void futurerestore::loadTimer(const std::string& timerPath) const {
-    std::ifstream timerFileStream(timerPath, std::ios::in | std::ios::binary);
-    retassure(timerFileStream.good(), "%s: failed init file stream for %s!\n", __func__, timerPath.c_str());
-    _client->timerfwdatasize = futurerestore::getFileSize(timerPath);
-    _client->rtimerfwdatasize = futurerestore::getFileSize(timerPath);
-    std::allocator<uint8_t> alloc;
-    retassure(_client->timerfwdata = (char *)alloc.allocate(_client->timerfwdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, timerPath.c_str());
-    retassure(_client->rtimerfwdata = (char *)alloc.allocate(_client->rtimerfwdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, timerPath.c_str());
-    timerFileStream.read((char *) _client->timerfwdata,
-                      (std::streamsize) _client->timerfwdatasize);
-    retassure(timerFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, timerPath.c_str());
-    retassure(*(uint64_t *) (_client->timerfwdata) != 0,
-              "%s: failed to load Timer for %s with the size %zu!\n",
-              __func__, timerPath.c_str(), _client->timerfwdatasize);
-    timerFileStream.read((char *) _client->rtimerfwdata,
-                      (std::streamsize) _client->rtimerfwdatasize);
-    retassure(timerFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, timerPath.c_str());
-    retassure(*(uint64_t *) (_client->rtimerfwdata) != 0,
-              "%s: failed to load Timer for %s with the size %zu!\n",
-              __func__, timerPath.c_str(), _client->rtimerfwdatasize);
-}
-
-void futurerestore::loadBaobab(const std::string& baobabPath) const {
-    std::ifstream baobobFileStream(baobabPath, std::ios::in | std::ios::binary);
-    retassure(baobobFileStream.good(), "%s: failed init file stream for %s!\n", __func__, baobabPath.c_str());
-    _client->baobabfwdatasize = futurerestore::getFileSize(baobabPath);
-    std::allocator<uint8_t> alloc;
-    retassure(_client->baobabfwdata = (char *)alloc.allocate(_client->baobabfwdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, baobabPath.c_str());
-    baobobFileStream.read((char *) _client->baobabfwdata,
-                      (std::streamsize) _client->baobabfwdatasize);
-    retassure(baobobFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, baobabPath.c_str());
-    retassure(*(uint64_t *) (_client->baobabfwdata) != 0,
-              "%s: failed to load Baobab for %s with the size %zu!\n",
-              __func__, baobabPath.c_str(), _client->baobabfwdatasize);
-}
-
-void futurerestore::loadCryptex1(const std::string& cryptex1SysOSPath, const std::string& cryptex1SysVOLPath, const std::string& cryptex1SysTCPath, const std::string& cryptex1AppOSPath, const std::string& cryptex1AppVOLPath, const std::string& cryptex1AppTCPath) const {
-    std::ifstream cryptex1SysOSFileStream(cryptex1SysOSPath, std::ios::in | std::ios::binary);
-    retassure(cryptex1SysOSFileStream.good(), "%s: failed init file stream for %s!\n", __func__, cryptex1SysOSPath.c_str());
-    _client->cryptex1sysosdatasize = futurerestore::getFileSize(cryptex1SysOSPath);
-    std::allocator<uint8_t> alloc;
+template <typename T, typename S>
+void futurerestore::mapComponent(const std::string &path, const char *name, T *&data, S &size) const {
+    retassure(getFileSize(path) >= sizeof(uint64_t), "%s: failed to load %s for %s!\n", __func__, name, path.c_str());
+    // loading the same field again replaces the earlier file
+    for (auto it = _componentProviders.begin(); it != _componentProviders.end(); ++it) {
+        if (it->field == &data) {
+            if (it->file) it->detach();
+            _componentProviders.erase(it);
+            break;
+        }
+    }
+    std::string componentName = name;
+    _componentProviders.push_back({&data, [path, componentName, &data, &size] {
+        auto file = std::make_shared<mapped_file>(path);
+        retassure(*(uint64_t *) file->data() != 0, "attachComponents: failed to load %s for %s with the size %zu!\n",
+                  componentName.c_str(), path.c_str(), file->size());
+        data = (T *) file->data();
+        size = (S) file->size();
+        return file;
+    }, [&data, &size] {
+        // idevicerestore must not free a mapping, the field is cleared again before the client goes away
+        data = nullptr;
+        size = 0;
+    }, nullptr});
+}
 
-    retassure(_client->cryptex1sysosdata = (char *)alloc.allocate(_client->cryptex1sysosdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, cryptex1SysOSPath.c_str());
-    cryptex1SysOSFileStream.read((char *) _client->cryptex1sysosdata,
-                      (std::streamsize) _client->cryptex1sysosdatasize);
-    retassure(cryptex1SysOSFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, cryptex1SysOSPath.c_str());
-    retassure(*(uint64_t *) (_client->cryptex1sysosdata) != 0,
-              "%s: failed to load Cryptex1,SystemOS for %s with the size %zu!\n",
-              __func__, cryptex1SysOSPath.c_str(), _client->cryptex1sysosdatasize);
-
-    std::ifstream cryptex1SysVOLFileStream(cryptex1SysVOLPath, std::ios::in | std::ios::binary);
-    retassure(cryptex1SysVOLFileStream.good(), "%s: failed init file stream for %s!\n", __func__, cryptex1SysVOLPath.c_str());
-    _client->cryptex1sysvoldatasize = futurerestore::getFileSize(cryptex1SysVOLPath);
-    retassure(_client->cryptex1sysvoldata = (char *)alloc.allocate(_client->cryptex1sysvoldatasize),
-              "%s: failed to allocate memory for %s\n", __func__, cryptex1SysVOLPath.c_str());
-    cryptex1SysVOLFileStream.read((char *) _client->cryptex1sysvoldata,
-                      (std::streamsize) _client->cryptex1sysvoldatasize);
-    retassure(cryptex1SysVOLFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, cryptex1SysVOLPath.c_str());
-    retassure(*(uint64_t *) (_client->cryptex1sysvoldata) != 0,
-              "%s: failed to load Cryptex1,SystemVolume for %s with the size %zu!\n",
-              __func__, cryptex1SysVOLPath.c_str(), _client->cryptex1sysvoldatasize);
-
-    std::ifstream cryptex1SysTCFileStream(cryptex1SysTCPath, std::ios::in | std::ios::binary);
-    retassure(cryptex1SysTCFileStream.good(), "%s: failed init file stream for %s!\n", __func__, cryptex1SysTCPath.c_str());
-    _client->cryptex1systcdatasize = futurerestore::getFileSize(cryptex1SysTCPath);
-    retassure(_client->cryptex1systcdata = (char *)alloc.allocate(_client->cryptex1systcdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, cryptex1SysTCPath.c_str());
-    cryptex1SysTCFileStream.read((char *) _client->cryptex1systcdata,
-                                 (std::streamsize) _client->cryptex1systcdatasize);
-    retassure(cryptex1SysTCFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, cryptex1SysTCPath.c_str());
-    retassure(*(uint64_t *) (_client->cryptex1systcdata) != 0,
-              "%s: failed to load Cryptex1,SystemTrustCache for %s with the size %zu!\n",
-              __func__, cryptex1SysTCPath.c_str(), _client->cryptex1systcdatasize);
-
-    std::ifstream cryptex1AppOSFileStream(cryptex1AppOSPath, std::ios::in | std::ios::binary);
-    retassure(cryptex1AppOSFileStream.good(), "%s: failed init file stream for %s!\n", __func__, cryptex1AppOSPath.c_str());
-    _client->cryptex1apposdatasize = futurerestore::getFileSize(cryptex1AppOSPath);
-    retassure(_client->cryptex1apposdata = (char *)alloc.allocate(_client->cryptex1apposdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, cryptex1AppOSPath.c_str());
-    cryptex1AppOSFileStream.read((char *) _client->cryptex1apposdata,
-                                 (std::streamsize) _client->cryptex1apposdatasize);
-    retassure(cryptex1AppOSFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, cryptex1AppOSPath.c_str());
-    retassure(*(uint64_t *) (_client->cryptex1apposdata) != 0,
-              "%s: failed to load Cryptex1,AppOS for %s with the size %zu!\n",
-              __func__, cryptex1AppOSPath.c_str(), _client->cryptex1apposdatasize);
-
-    std::ifstream cryptex1AppVOLFileStream(cryptex1AppVOLPath, std::ios::in | std::ios::binary);
-    retassure(cryptex1AppVOLFileStream.good(), "%s: failed init file stream for %s!\n", __func__, cryptex1AppVOLPath.c_str());
-    _client->cryptex1appvoldatasize = futurerestore::getFileSize(cryptex1AppVOLPath);
-    retassure(_client->cryptex1appvoldata = (char *)alloc.allocate(_client->cryptex1appvoldatasize),
-              "%s: failed to allocate memory for %s\n", __func__, cryptex1AppVOLPath.c_str());
-    cryptex1AppVOLFileStream.read((char *) _client->cryptex1appvoldata,
-                                  (std::streamsize) _client->cryptex1appvoldatasize);
-    retassure(cryptex1AppVOLFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, cryptex1AppVOLPath.c_str());
-    retassure(*(uint64_t *) (_client->cryptex1appvoldata) != 0,
-              "%s: failed to load Cryptex1,AppVolume for %s with the size %zu!\n",
-              __func__, cryptex1AppVOLPath.c_str(), _client->cryptex1appvoldatasize);
-
-    std::ifstream cryptex1AppTCFileStream(cryptex1AppTCPath, std::ios::in | std::ios::binary);
-    retassure(cryptex1AppTCFileStream.good(), "%s: failed init file stream for %s!\n", __func__, cryptex1AppTCPath.c_str());
-    _client->cryptex1apptcdatasize = futurerestore::getFileSize(cryptex1AppTCPath);
-    retassure(_client->cryptex1apptcdata = (char *)alloc.allocate(_client->cryptex1apptcdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, cryptex1AppTCPath.c_str());
-    cryptex1AppTCFileStream.read((char *) _client->cryptex1apptcdata,
-                                 (std::streamsize) _client->cryptex1apptcdatasize);
-    retassure(cryptex1AppTCFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, cryptex1AppTCPath.c_str());
-    retassure(*(uint64_t *) (_client->cryptex1apptcdata) != 0,
-              "%s: failed to load Cryptex1,AppTrustCache for %s with the size %zu!\n",
-              __func__, cryptex1AppTCPath.c_str(), _client->cryptex1apptcdatasize);
-}
-
-void futurerestore::loadYonkers(const std::array<std::string, 16>& yonkersPaths) const {
-    int index = 0;
-    for (const auto &yonkersPath: yonkersPaths) {
-        std::ifstream yonkersFileStream(yonkersPath, std::ios::in | std::ios::binary);
-        retassure(yonkersFileStream.good(), "%s: failed init file stream for %s!\n", __func__, yonkersPath.c_str());
-        _client->yonkersfwdatasize[index] = futurerestore::getFileSize(yonkersPath);
-        std::allocator<uint8_t> alloc;
-        retassure(_client->yonkersfwdata[index] = (char *)alloc.allocate(_client->yonkersfwdatasize[index]),
-                  "%s: failed to allocate memory for %s\n", __func__, yonkersPath.c_str());
-        yonkersFileStream.read((char *) _client->yonkersfwdata[index],
-        (std::streamsize) _client->yonkersfwdatasize[index]);
-        retassure(yonkersFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, yonkersPath.c_str());
-        retassure(*(uint64_t *) (_client->yonkersfwdata[index]) != 0,
-                  "%s: failed to load Yonkers for %s with the size %zu!\n",
-                  __func__, yonkersPath.c_str(), _client->yonkersfwdatasize[index]);
-        index++;
+void futurerestore::attachComponents() {
+    for (auto &provider: _componentProviders) {
+        if (!provider.file) provider.file = provider.attach();
     }
 }
 
 void futurerestore::loadRamdisk(const std::string& ramdiskPath) const {
-    std::ifstream ramdiskFileStream(ramdiskPath, std::ios::in | std::ios::binary);
-    retassure(ramdiskFileStream.good(), "%s: failed init file stream for %s!\n", __func__, ramdiskPath.c_str());
-    _client->ramdiskdatasize = futurerestore::getFileSize(ramdiskPath);
-    std::allocator<uint8_t> alloc;
-    retassure(_client->ramdiskdata = (char *)alloc.allocate(_client->ramdiskdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, ramdiskPath.c_str());
-    ramdiskFileStream.read((char *) _client->ramdiskdata,
-                           (std::streamsize) _client->ramdiskdatasize);
-    retassure(ramdiskFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, ramdiskPath.c_str());
-    retassure(*(uint64_t *) (_client->ramdiskdata) != 0,
-              "%s: failed to load Ramdisk for %s with the size %zu!\n",
-              __func__, ramdiskPath.c_str(), _client->ramdiskdatasize);
+    mapComponent(ramdiskPath, "Ramdisk", _client->ramdiskdata, _client->ramdiskdatasize);
 }
 
 void futurerestore::loadKernel(const std::string& kernelPath) const {
-    std::ifstream kernelFileStream(kernelPath, std::ios::in | std::ios::binary);
-    retassure(kernelFileStream.good(), "%s: failed init file stream for %s!\n", __func__, kernelPath.c_str());
-    _client->kerneldatasize = futurerestore::getFileSize(kernelPath);
-    std::allocator<uint8_t> alloc;
-    retassure(_client->kerneldata = (char *)alloc.allocate(_client->kerneldatasize),
-              "%s: failed to allocate memory for %s\n", __func__, kernelPath.c_str());
-    kernelFileStream.read((char *) _client->kerneldata,
-                          (std::streamsize) _client->kerneldatasize);
-    retassure(kernelFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, kernelPath.c_str());
-    retassure(*(uint64_t *) (_client->kerneldata) != 0,
-              "%s: failed to load Kernel for %s with the size %zu!\n",
-              __func__, kernelPath.c_str(), _client->kerneldatasize);
+    mapComponent(kernelPath, "Kernel", _client->kerneldata, _client->kerneldatasize);
 }
 
 void futurerestore::loadSep(const std::string& sepPath) const {
-    std::ifstream sepFileStream(sepPath, std::ios::binary | std::ios::in);
-    retassure(sepFileStream.good(), "%s: failed init file stream for %s!\n", __func__, sepPath.c_str());
-    _client->sepfwdatasize = futurerestore::getFileSize(sepPath);
-    std::allocator<uint8_t> alloc;
-    retassure(_client->sepfwdata = (char *)alloc.allocate(_client->sepfwdatasize),
-              "%s: failed to allocate memory for %s\n", __func__, sepPath.c_str());
-    sepFileStream.read(reinterpret_cast<char*>(_client->sepfwdata),
-                          static_cast<std::streamsize>(_client->sepfwdatasize));
-    retassure(sepFileStream.good(), "%s: failed to read file stream for %s!\n", __func__, sepPath.c_str());
-    retassure(*(uint64_t *) (_client->sepfwdata) != 0,
-              "%s: failed to load SEP for %s with the size %zu!\n",
-              __func__, sepPath.c_str(), _client->sepfwdatasize);
+    mapComponent(sepPath, "SEP", _client->sepfwdata, _client->sepfwdatasize);
 }
 
 void futurerestore::loadBaseband(const std::string& basebandPath) {
@@ -2981,75 +2434,14 @@ unsigned char *futurerestore::getSHABuffer(char *data, size_t dataSize, int type
 }
 
 unsigned char *futurerestore::getSHABufferStream(std::ifstream &stream, int type) {
-  std::allocator<uint8_t> alloc;
-  auto *fileHash = (unsigned char *)nullptr;
-  const size_t bufferSize = 0x100000;
-  char *buffer = (char *)alloc.allocate(bufferSize);
-  switch(type) {
-  case 1:
-    fileHash = (unsigned char *) alloc.allocate(32);
-    memset(fileHash, 0, 32);
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-
-    while(stream.good()) {
-      stream.read(buffer, bufferSize);
-      std::streamsize bytesRead = stream.gcount();
-      if (bytesRead > 0) {
-        SHA256_Update(&sha256, buffer, bytesRead);
-      }
-    }
-    SHA256_Final(fileHash, &sha256);
-    break;
-  case 2:
-    fileHash = (unsigned char *) alloc.allocate(64);
-    memset(fileHash, 0, 64);
-    SHA512_CTX sha512;
-    SHA512_Init(&sha512);
-
-    while(stream.good()) {
-      stream.read(buffer, bufferSize);
-      std::streamsize bytesRead = stream.gcount();
-      if (bytesRead > 0) {
-        SHA512_Update(&sha512, buffer, bytesRead);
-      }
-    }
-    SHA512_Final(fileHash, &sha512);
-    break;
-  case 3:
-    fileHash = (unsigned char *) alloc.allocate(20);
-    memset(fileHash, 0, 20);
-    SHA_CTX sha1;
-    SHA1_Init(&sha1);
-
-    while(stream.good()) {
-      stream.read(buffer, bufferSize);
-      std::streamsize bytesRead = stream.gcount();
-      if (bytesRead > 0) {
-        SHA1_Update(&sha1, buffer, bytesRead);
-      }
-    }
-    SHA1_Final(fileHash, &sha1);
-    break;
-  default:
-    fileHash = (unsigned char *) alloc.allocate(48);
-    memset(fileHash, 0, 48);
-    SHA512_CTX sha384;
-    SHA384_Init(&sha384);
-
-    while(stream.good()) {
-      stream.read(buffer, bufferSize);
-      std::streamsize bytesRead = stream.gcount();
-      if (bytesRead > 0) {
-        SHA384_Update(&sha384, buffer, bytesRead);
-      }
-    }
-    SHA384_Final(fileHash, &sha384);
-    break;
-  }
-  free(buffer);
-  stream.seekg(0, std::ios::beg);
-  return fileHash;
+    if (type < 0 || type > 3) type = 0;
+    std::string digest = multi_digest_stream::digestStream(stream, {type}).front();
+    std::allocator<uint8_t> alloc;
+    auto *fileHash = (unsigned char *) alloc.allocate(digest.size());
+    memcpy(fileHash, digest.data(), digest.size());
+    stream.clear();
+    stream.seekg(0, std::ios::beg);
+    return fileHash;
 }
 
 size_t futurerestore::getFileSize(const std::string &name) {
@@ -3066,6 +2458,123 @@ size_t futurerestore::getFileSize(const std::string &name) {
     return st.st_size;
 }
 
+bool futurerestore::waitForFilesystemExtraction(const std::string &extractPath, const std::string &finalPath,
+                                                uint64_t size, const std::atomic<bool> *cancel) {
+    size_t lastSize = 0;
+    int idleSeconds = 0;
+    info("Waiting for another process to finish extracting the filesystem...\n");
+    while (true) {
+        retassure(!cancel || !cancel->load(), "%s: cancelled\n", __func__);
+#ifdef WIN32
+        struct _stat64 st{0};
+        bool extracting = _stat64(extractPath.c_str(), &st) == 0;
+#else
+        struct stat st{0};
+        bool extracting = stat(extractPath.c_str(), &st) == 0;
+#endif
+        if (!extracting) {
+            // renamed into place when done, gone without a result if it failed
+            size_t finalSize = access(finalPath.c_str(), F_OK) == 0 ? getFileSize(finalPath) : 0;
+            return finalSize && (!size || finalSize == size);
+        }
+        if ((size_t) st.st_size != lastSize) {
+            lastSize = (size_t) st.st_size;
+            idleSeconds = 0;
+        } else if (++idleSeconds > 60) {
+            // left behind by a process that died
+            return false;
+        }
+        sleep(1);
+    }
+}
+
+std::string futurerestore::extractFilesystem(const std::shared_ptr<zip_extractor> &zip, const std::string &ipswPath,
+                                             const std::string &fsName, const std::string &dstPath,
+                                             const std::atomic<bool> *cancel) {
+    if (!zip) {
+        // no progress bar, it would run into the device logs
+        // libzip can't be interrupted, a cancelled restore waits for this fallback to finish
+        retassure(!ipsw_extract_to_file_with_progress(ipswPath.c_str(), fsName.c_str(), dstPath.c_str(), 0),
+                  "ERROR: Unable to extract filesystem from iPSW\n");
+        return "";
+    }
+    digest_stream digest(FILESYSTEM_DIGEST_TYPE);
+    zip_extractor::report(fsName, zip->extract(fsName, dstPath, [&digest](const uint8_t *buf, size_t len) {
+        digest.update(buf, len);
+    }, cancel));
+    return digest.finish();
+}
+
+bool futurerestore::verifySharedFilesystem(const std::shared_ptr<zip_extractor> &zip, digest_index *digestIndex,
+                                           const std::string &fsName, const std::string &filesystemPath) {
+    const zip_extractor::entry *fsEntry = zip ? zip->getEntry(fsName) : nullptr;
+    if (!fsEntry) {
+        // extracted without the central directory, there is no sidecar to check against and the size had to match
+        return true;
+    }
+    filesystem_cache_info cacheInfo;
+    if (!loadFilesystemCacheInfo(filesystemPath, cacheInfo) || cacheInfo.crc32 != fsEntry->crc32
+        || cacheInfo.size != fsEntry->uncompressedSize || getFileSize(filesystemPath) != cacheInfo.size) {
+        return false;
+    }
+    // the extracting process recorded the digest in its own index, ours usually has to hash the file
+    std::string digest;
+    if (!digestIndex->cachedDigest(filesystemPath, FILESYSTEM_DIGEST_TYPE, digest)) {
+        digest = digestIndex->digestOf(filesystemPath, FILESYSTEM_DIGEST_TYPE);
+        digestIndex->save();
+    }
+    return digest == cacheInfo.digest;
+}
+
+bool futurerestore::loadFilesystemCacheInfo(const std::string &filesystemPath, filesystem_cache_info &cacheInfo) {
+    std::ifstream in(filesystemPath + ".meta");
+    std::string line;
+    if (!in.good() || !std::getline(in, line) || line != FILESYSTEM_CACHE_MAGIC || !std::getline(in, line)) {
+        return false;
+    }
+    unsigned int crc = 0;
+    unsigned long long size = 0;
+    char hex[129]{};
+    if (sscanf(line.c_str(), "%x %llu %128s", &crc, &size, hex) != 3
+        || strlen(hex) != digest_stream::digestSize(FILESYSTEM_DIGEST_TYPE) * 2) {
+        return false;
+    }
+    cacheInfo.crc32 = crc;
+    cacheInfo.size = size;
+    cacheInfo.digest.clear();
+    for (size_t i = 0; hex[i]; i += 2) {
+        unsigned int byte = 0;
+        if (sscanf(hex + i, "%2x", &byte) != 1) return false;
+        cacheInfo.digest.push_back((char) byte);
+    }
+    return true;
+}
+
+void futurerestore::saveFilesystemCacheInfo(const std::string &filesystemPath, const filesystem_cache_info &cacheInfo) {
+    std::string metaPath = filesystemPath + ".meta";
+    std::string tmpPath = metaPath + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::out | std::ios::trunc);
+        char buf[64]{};
+        snprintf(buf, sizeof(buf), "%08x %llu ", (unsigned int) cacheInfo.crc32, (unsigned long long) cacheInfo.size);
+        out << FILESYSTEM_CACHE_MAGIC << "\n" << buf;
+        for (unsigned char c: cacheInfo.digest) {
+            snprintf(buf, sizeof(buf), "%02x", c);
+            out << buf;
+        }
+        out << "\n";
+        if (!out.good()) {
+            debug("%s: can't write %s, filesystem won't be reused\n", __func__, tmpPath.c_str());
+            remove(tmpPath.c_str());
+            return;
+        }
+    }
+    if (rename(tmpPath.c_str(), metaPath.c_str())) {
+        remove(metaPath.c_str());
+        rename(tmpPath.c_str(), metaPath.c_str());
+    }
+}
+
 unsigned char *futurerestore::getSHA(const std::string& filePath, int type) {
     std::ifstream fileStream(filePath, std::ios::binary | std::ios::in);
     if(!fileStream.good()) {
@@ -3337,6 +2846,24 @@ std::string futurerestore::getGeneratorFromSHSH2(plist_t shsh2) {
     return {genstr};
 }
 
+std::string futurerestore::nonceForGenerator(uint64_t generator, size_t nonceSize) {
+    int type = -1;
+    if (nonceSize == 20) {
+        type = 3;
+    } else if (nonceSize == 32) {
+        type = 0;
+    }
+    retassure(type != -1, "unknown nonce size %zu\n", nonceSize);
+    // the device hashes the generator as it sits in its memory, little endian
+    uint8_t gen[8];
+    for (int i = 0; i < 8; i++) {
+        gen[i] = (uint8_t) (generator >> (8 * i));
+    }
+    digest_stream digest(type);
+    digest.update(gen, sizeof(gen));
+    return digest.finish().substr(0, nonceSize);
+}
+
 // TODO: implement windows CI and enable update check
 #ifndef WIN32
 
@@ -3448,12 +2975,9 @@ const char *futurerestore::extractZipFileToString(char *zip_buffer, const char *
 }
 
 bool futurerestore::is32bit() const {
-    bool ret = !is_image4_supported(_client);
-    if(_client) {
-        dfu_client_free(_client);
-    }
+    bool ret = !_device->isImage4Supported(_client);
     if(_client) {
-        recovery_client_free(_client);
+        _device->disconnect(_client);
     }
     getDeviceMode(true);
     return ret;
@@ -21,7 +21,10 @@
 #include <utility>
 #include <vector>
 #include <array>
+#include <atomic>
+#include <memory>
 #include <string>
+#include <unordered_set>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <cerrno>
@@ -30,6 +33,14 @@
 #include "idevicerestore.h"
 #include <jssy.h>
 #include <plist/plist.h>
+#include "manifest_index.hpp"
+#include "download_scheduler.hpp"
+#include "component_store.hpp"
+#include "mapped_file.hpp"
+#include "ticket_table.hpp"
+#include "zip_extractor.hpp"
+#include "device_backend.hpp"
+#include "session_cache.hpp"
 
 template <typename T>
 class ptr_smart {
@@ -55,6 +66,7 @@ class futurerestore {
     bool _didInit = false;
     std::vector<plist_t> _aptickets;
     std::vector<std::pair<char *, size_t>>_im4ms;
+    ticket_table _tickets;
     int _foundnonce = -1;
     bool _isUpdateInstall = false;
     bool _isPwnDfu = false;
@@ -71,7 +83,17 @@ class futurerestore {
     jssytok_t *_betaFirmwareTokens = nullptr;
     jssytok_t *_otaFirmwareTokens = nullptr;
     char *_latestManifest = nullptr;
+    std::unique_ptr<manifest_index> _latestManifestIndex;
     char *_latestFirmwareUrl = nullptr;
+    std::shared_ptr<remote_zip> _latestFirmwareZip;
+    std::unique_ptr<digest_index> _digestIndex;
+    bool _forceCacheVerification = false;
+    std::unique_ptr<component_store> _componentStore;
+    uint64_t _componentStoreBudget = component_store::defaultBudget;
+    // set for the sessions of a multi-device run, the caches above stay unused then
+    std::shared_ptr<session_cache> _sharedCache;
+    // futurerestoreTempPath, or a directory of its own once a device is selected
+    std::string _tempPath;
     bool _useCustomLatest = false;
     bool _useCustomLatestBuildID = false;
     bool _useCustomLatestBeta = false;
@@ -108,15 +130,103 @@ class futurerestore {
     bool _noCache = false;
     bool _skipBlob = false;
 
+    size_t _downloadConcurrency = download_scheduler::defaultConcurrency;
+    download_scheduler *_downloadScheduler = nullptr;
+    std::vector<std::function<void()>> _pendingLoads;
+    std::unordered_set<std::string> _queuedDigests;
+    struct pending_fetch {
+        std::string name;
+        std::string remotePath;
+        std::string digest;
+    };
+    std::vector<pending_fetch> _pendingFetches;
+
+    /*
+     * Component files are only attached to _client when doRestore starts, so runs that never get there
+     * don't touch them. Attached files are mapped, restore code faults in only the pages it sends.
+     */
+    struct component_provider {
+        const void *field;
+        std::function<std::shared_ptr<mapped_file>()> attach;
+        std::function<void()> detach;
+        std::shared_ptr<mapped_file> file;
+    };
+    mutable std::vector<component_provider> _componentProviders;
+
+    /*
+     * FirmwareUpdater payloads fetched from the latest firmware by downloadLatestFirmwareComponents.
+     * The digest type follows from the manifest Digest's length, see digest_stream::typeForDigestSize.
+     */
+    struct component_descriptor {
+        const char *element;    // key in the build identity's Manifest
+        const char *group;      // elements of a group are only fetched and loaded if all of them exist
+        const char *tempName;   // file in _tempPath when it doesn't go to the component store
+        bool cacheable;         // the manifest Digest covers the file, verify it and keep it in the component store
+        bool otaDigest;         // take the Digest from the OTA build identity with --custom-latest-ota
+        void (*load)(const futurerestore *self, const char *name, const std::string &path);
+    };
+    static const component_descriptor _firmwareComponents[];
+
+    // device calls of the restore flow, a simulated_device_backend stands in for hardware
+    std::shared_ptr<device_backend> _device = std::make_shared<usb_device_backend>();
+
     bool _enterPwnRecoveryRequested = false;
     bool _rerestoreiOS9 = false;
     //methods
     void enterPwnRecovery(plist_t build_identity, std::string bootargs);
+    void loadLatestManifest();
+    // without onFetched the file is downloaded under a unique name and renamed to dstPath once complete
+    void downloadComponent(const char *name, const char *remotePath, const std::string &dstPath,
+                           std::function<void(const std::string &)> onFetched = nullptr, std::string expectedDigest = "");
+    std::string fetchComponent(const char *name, const char *remotePath, const unsigned char *digest, size_t digestSize,
+                               const std::string &fallbackPath);
+    // returns the shared cache's fetch locks of the queued components, held until the scheduler has run
+    std::vector<std::unique_lock<std::mutex>> queuePendingFetches();
+    void fetchFirmwareComponent(const component_descriptor &component);
+    void deferLoad(std::function<void()> load);
+    template <typename T, typename S>
+    void mapComponent(const std::string &path, const char *name, T *&data, S &size) const;
+    size_t nonceMatchingTicket();
+    static void reportNonceCycles(const std::vector<double> &cycleSeconds);
+    static std::string extractFilesystem(const std::shared_ptr<zip_extractor> &zip, const std::string &ipswPath,
+                                         const std::string &fsName, const std::string &dstPath,
+                                         const std::atomic<bool> *cancel = nullptr);
 
 public:
+    // one parsed signing ticket file, the caller owns apticket and im4m
+    struct loaded_ticket {
+        plist_t apticket = nullptr;
+        char *im4m = nullptr;
+        size_t im4mSize = 0;
+        std::string nonce;
+        uint64_t ecid = 0;
+        uint64_t generator = 0;
+    };
+    static loaded_ticket loadAPTicket(const std::string &apticketPath, bool image4, bool updateInstall);
+    static std::vector<std::string> expandAPTicketPaths(const std::vector<const char *> &apticketPaths);
+    // contents of a gzip compressed file, other files are returned as they are
+    static std::string readGzipFile(const std::string &path);
+
+    /*
+     * Sidecar of an extracted filesystem in the cache dir.
+     * crc32 and size tie it to the iPSW entry, the digest to the extracted bytes.
+     */
+    struct filesystem_cache_info {
+        uint32_t crc32 = 0;
+        uint64_t size = 0;
+        std::string digest;     // raw FILESYSTEM_DIGEST_TYPE digest, stored as hex
+    };
+
+    static bool verifySharedFilesystem(const std::shared_ptr<zip_extractor> &zip, digest_index *digestIndex,
+                                       const std::string &fsName, const std::string &filesystemPath);
+    static bool loadFilesystemCacheInfo(const std::string &filesystemPath, filesystem_cache_info &cacheInfo);
+    static void saveFilesystemCacheInfo(const std::string &filesystemPath, const filesystem_cache_info &cacheInfo);
+
     void test() const;
     struct idevicerestore_client_t* _client;
     explicit futurerestore(bool isUpdateInstall = false, bool isPwnDfu = false, bool noIBSS = false, bool setNonce = false, bool serial = false, bool noRestore = false, bool noRSEP = false);
+    // before init(), restricts the session to the device with ecid
+    void selectDevice(uint64_t ecid);
     bool init();
     int getDeviceMode(bool reRequest) const;
     uint64_t getDeviceEcid() const;
@@ -135,7 +245,11 @@ public:
     const char *getDeviceModelNoCopy();
     const char *getDeviceBoardNoCopy();
     char *getLatestManifest();
+    manifest_index *getLatestManifestIndex();
     char *getLatestFirmwareUrl();
+    std::shared_ptr<remote_zip> getLatestFirmwareZip();
+    digest_index *getDigestIndex();
+    component_store *getComponentStore();
     std::string getSepManifestPath(){return _sepManifestPath;}
     std::string getBasebandManifestPath(){return _basebandManifestPath;}
 
@@ -143,28 +257,12 @@ public:
 #ifndef WIN32
     void checkForUpdates();
 #endif
-    void downloadLatestRose();
-    void downloadLatestSE();
-    void downloadLatestSavage();
-    void downloadLatestVeridian();
-    void downloadLatestTimer();
-    void downloadLatestBaobab();
-    void downloadLatestCryptex1();
-    void downloadLatestYonkers();
     void downloadLatestFirmwareComponents();
     void downloadLatestBaseband();
     void downloadLatestSep();
     
     void loadSepManifest(const std::string& sepManifestPath);
     void loadBasebandManifest(const std::string& basebandManifestPath);
-    void loadRose(const std::string& rosePath) const;
-    void loadSE(const std::string& sePath) const;
-    void loadSavage(const std::array<std::string, 6>& savagePaths) const;
-    void loadVeridian(const std::string& veridianDGMPath, const std::string& veridianFWMPath) const;
-    void loadTimer(const std::string& timerPath) const;
-    void loadBaobab(const std::string& baobabPath) const;
-    void loadCryptex1(const std::string& cryptex1SysOSPath, const std::string& cryptex1SysVOLPath, const std::string& cryptex1SysTCPath, const std::string& cryptex1AppOSPath, const std::string& cryptex1AppVOLPath, const std::string& cryptex1AppTCPath) const;
-    void loadYonkers(const std::array<std::string, 16>& yonkersPaths) const;
     void loadRamdisk(const std::string& ramdiskPath) const;
     void loadKernel(const std::string& kernelPath) const;
     void loadSep(const std::string& sepPath) const;
@@ -173,6 +271,8 @@ public:
     static unsigned char *getSHABuffer(char *data, size_t dataSize, int type = 0);
     static unsigned char *getSHABufferStream(std::ifstream &stream, int type = 0);
     static size_t getFileSize(const std::string &name) ;
+    static bool waitForFilesystemExtraction(const std::string &extractPath, const std::string &finalPath, uint64_t size,
+                                            const std::atomic<bool> *cancel = nullptr);
     static unsigned char *getSHA(const std::string& filePath, int type = 0) ;
 
     void setCustomLatest(std::string version){_customLatest = std::move(version); _useCustomLatest = true;}
@@ -187,11 +287,19 @@ public:
     void setBootArgs(const char *boot_args){_boot_args = boot_args;};
     void disableCache(){_noCache = true;};
     void skipBlobValidation(){_skipBlob = true;};
+    void setDownloadConcurrency(size_t jobs){_downloadConcurrency = jobs ? jobs : 1;};
+    void setComponentStoreBudget(uint64_t bytes){_componentStoreBudget = bytes; if (_componentStore) _componentStore->setBudget(bytes);};
+    // before init(), the device is found through the backend
+    void setDeviceBackend(std::shared_ptr<device_backend> backend){_device = std::move(backend);};
+    void setSharedCache(std::shared_ptr<session_cache> cache){_sharedCache = std::move(cache);};
+    void forceCacheVerification(){_forceCacheVerification = true; if (_digestIndex) _digestIndex->setForceVerify(true);};
 
     bool is32bit() const;
 
     uint64_t getBasebandGoldCertIDFromDevice() const;
     
+    // maps the component files loaded so far into _client, doRestore does this before it talks to the device
+    void attachComponents();
     void doRestore(const char *ipsw);
 
 #ifdef __APPLE__
@@ -211,6 +319,8 @@ public:
     static unsigned char *getBBCFGDigestInManifest(const char *manifeststr, const char *boardConfig, int isUpdateInstall);
     static bool elemExists(const char *element, const char *manifeststr, const char *boardConfig, int isUpdateInstall);
     static std::string getGeneratorFromSHSH2(plist_t shsh2);
+    // ApNonce the device derives from generator: SHA1 for 20 byte nonces, SHA384 cut to 32 bytes for 32 byte ones
+    static std::string nonceForGenerator(uint64_t generator, size_t nonceSize);
     static const char *extractZipFileToString(char *zip_buffer, const char *file, uint32_t *sz);
 
 };
@@ -8,6 +8,15 @@
 
 #include <getopt.h>
 #include "futurerestore.hpp"
+#include "blob_checker.hpp"
+#include "simulated_device.hpp"
+#include "device_session.hpp"
+#include "session_cache.hpp"
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <curl/curl.h>
 
 extern "C"{
 #include "tsschecker.h"
@@ -42,6 +51,15 @@ static struct option longopts[] = {
         { "help",                       no_argument,            nullptr, 'h' },
         { "custom-latest-beta",         no_argument,            nullptr, 'i' },
         { "custom-latest-ota",          no_argument,            nullptr, 'k' },
+        { "download-jobs",              required_argument,      nullptr, 'J' },
+        { "cache-budget",               required_argument,      nullptr, 'B' },
+        { "reverify-cache",             no_argument,            nullptr, 'V' },
+        { "check-blobs",                required_argument,      nullptr, 'C' },
+        { "audit-generators",           required_argument,      nullptr, 'A' },
+        { "simulate-device",            required_argument,      nullptr, 'S' },
+        { "record-session",             required_argument,      nullptr, 'R' },
+        { "replay-session",             required_argument,      nullptr, 'Y' },
+        { "devices",                    required_argument,      nullptr, 'D' },
         { "latest-sep",                 no_argument,            nullptr, '0' },
         { "no-restore",                 no_argument,            nullptr, 'z' },
         { "latest-baseband",            no_argument,            nullptr, '1' },
@@ -82,6 +100,7 @@ static struct option longopts[] = {
 #define FLAG_CUSTOM_LATEST_OTA      1 << 18
 #define FLAG_NO_RSEP_FR             1 << 19
 #define FLAG_IGNORE_BB_FAIL         1 << 20
+#define FLAG_REVERIFY_CACHE         1 << 21
 
 bool manual = false;
 
@@ -91,6 +110,7 @@ void cmd_help(){
     printf("\nGeneral options:\n");
     printf("  -h, --help\t\t\t\tShows this usage message\n");
     printf("  -t, --apticket PATH\t\t\tSigning tickets used for restoring\n");
+    printf("                     \t\t\tPATH may also be a directory of .shsh/.shsh2 files or a glob\n");
     printf("  -u, --update\t\t\t\tUpdate instead of erase install (requires appropriate APTicket)\n");
     printf("              \t\t\t\tDO NOT use this parameter, if you update from jailbroken firmware!\n");
     printf("  -w, --wait\t\t\t\tKeep rebooting until ApNonce matches APTicket (ApNonce collision, unreliable)\n");
@@ -100,7 +120,22 @@ void cmd_help(){
     printf("  -c, --custom-latest VERSION\t\tSpecify custom latest version to use for SEP, Baseband and other FirmwareUpdater components\n");
     printf("  -g, --custom-latest-buildid BUILDID\tSpecify custom latest buildid to use for SEP, Baseband and other FirmwareUpdater components\n");
     printf("  -i, --custom-latest-beta\t\tGet custom url from list of beta firmwares\n");
-    printf("  -k, --custom-latest-ota\t\tGet custom url from list of ota firmwares");
+    printf("  -k, --custom-latest-ota\t\tGet custom url from list of ota firmwares\n");
+    printf("  -J, --download-jobs NUM\t\tDownload up to NUM latest firmware components in parallel (default: %zu)\n", download_scheduler::defaultConcurrency);
+    printf("  -B, --cache-budget MIB\t\tKeep at most MIB MiB of downloaded firmware components cached (default: %llu)\n", (unsigned long long) (component_store::defaultBudget >> 20));
+    printf("  -V, --reverify-cache\t\t\tRehash every cached file instead of trusting the digest index\n");
+    printf("  -C, --check-blobs FILE\t\tCheck every -t ticket against every iPSW/BuildManifest argument without a device\n");
+    printf("                        \t\tand write the compatibility matrix as CSV to FILE (- for stdout), exits with 1 if no pair is compatible\n");
+    printf("  -A, --audit-generators FILE\t\tCheck that the generator of every -t ticket produces its nonce without a device\n");
+    printf("                             \t\tand write the results as CSV to FILE (- for stdout), exits with 1 if any is flagged\n");
+    printf("  -S, --simulate-device SPEC\t\tRun against a simulated device instead of USB, to time a restore without hardware\n");
+    printf("                            \t\tSPEC is key=value,... with board, ecid, mode (dfu/recovery), link (MB/s),\n");
+    printf("                            \t\tdisconnect, reboot, restore-boot, restore (ms), nonce-size, nonces (hex:hex...)\n");
+    printf("  -R, --record-session FILE\t\tRecord every device call, transfer and mode change with its timing to FILE\n");
+    printf("  -Y, --replay-session FILE\t\tReplay a session recorded with -R instead of using USB, with the recorded device timing\n");
+    printf("  -D, --devices ECID,...\t\tRestore every listed device (in recovery or DFU mode) at once, each on a thread of\n");
+    printf("                        \t\tits own, with firmware looked up and downloaded once for all of them\n");
+    printf("                        \t\tEvery other option applies to all devices, there are no per device SEP or baseband overrides\n");
 
 #ifdef HAVE_LIBIPATCHER
     printf("\nOptions for downgrading with Odysseus:\n");
@@ -170,12 +205,17 @@ int main_r(int argc, const char * argv[]) {
     const char *ramdiskPath = nullptr;
     const char *kernelPath = nullptr;
     const char *custom_nonce = nullptr;
+    const char *checkBlobsPath = nullptr;
+    const char *auditGeneratorsPath = nullptr;
+    const char *simulateSpec = nullptr;
+    std::vector<uint64_t> devices;
+    std::shared_ptr<recording_device_backend> recordedSession;
+    std::shared_ptr<replay_device_backend> replayedSession;
+    size_t downloadJobs = download_scheduler::defaultConcurrency;
+    uint64_t cacheBudget = component_store::defaultBudget;
 
     vector<const char*> apticketPaths;
 
-    t_devicevals devVals = {nullptr};
-    t_iosVersion versVals = {nullptr};
-
     char *legacy = std::getenv("FUTURERESTORE_I_SOLEMNLY_SWEAR_THAT_I_AM_UP_TO_NO_GOOD");
     manual = legacy != nullptr;
     if(manual) {
@@ -187,7 +227,7 @@ int main_r(int argc, const char * argv[]) {
         return -1;
     }
 
-    while ((opt = getopt_long(argc, (char* const *)argv, "ht:b:p:s:m:c:g:ikwude0z123456789afj", longopts, &optindex)) > 0) {
+    while ((opt = getopt_long(argc, (char* const *)argv, "ht:b:p:s:m:c:g:ikJ:B:VC:A:S:R:Y:D:wude0z123456789afj", longopts, &optindex)) > 0) {
         switch (opt) {
             case 'h': // long option: "help"; can be called as short option
                 cmd_help();
@@ -232,6 +272,57 @@ int main_r(int argc, const char * argv[]) {
             case 'k': // long option: "custom-latest-ota"; can be called as short option
                 flags |= FLAG_CUSTOM_LATEST_OTA;
                 break;
+            case 'J': // long option: "download-jobs"; can be called as short option
+                downloadJobs = strtoul(optarg, nullptr, 10);
+                retassure(downloadJobs > 0, "--download-jobs requires a positive number\n");
+                break;
+            case 'B': // long option: "cache-budget"; can be called as short option
+            {
+                // a typo must not turn into a budget of 0 and empty the store
+                char *end = nullptr;
+                errno = 0;
+                unsigned long long mib = strtoull(optarg, &end, 10);
+                if (errno || !mib || *end || optarg[0] == '-' || mib > (UINT64_MAX >> 20)) {
+                    reterror("--cache-budget requires a positive number of MiB up to %llu\n",
+                             (unsigned long long) (UINT64_MAX >> 20));
+                }
+                cacheBudget = (uint64_t) mib << 20;
+                break;
+            }
+            case 'V': // long option: "reverify-cache"; can be called as short option
+                flags |= FLAG_REVERIFY_CACHE;
+                break;
+            case 'C': // long option: "check-blobs"; can be called as short option
+                checkBlobsPath = optarg;
+                break;
+            case 'A': // long option: "audit-generators"; can be called as short option
+                auditGeneratorsPath = optarg;
+                break;
+            case 'S': // long option: "simulate-device"; can be called as short option
+                simulateSpec = optarg;
+                break;
+            case 'D': // long option: "devices"; can be called as short option
+            {
+                std::stringstream ecids(optarg);
+                std::string ecid;
+                while (std::getline(ecids, ecid, ',')) {
+                    if (ecid.empty()) continue;
+                    char *end = nullptr;
+                    errno = 0;
+                    unsigned long long value = strtoull(ecid.c_str(), &end, 0);
+                    if (errno || !value || *end || ecid[0] == '-') {
+                        reterror("--devices: \"%s\" is not an ECID\n", ecid.c_str());
+                    }
+                    devices.push_back(value);
+                }
+                break;
+            }
+            case 'R': // long option: "record-session"; can be called as short option
+                recordedSession = std::make_shared<recording_device_backend>(optarg);
+                break;
+            case 'Y': // long option: "replay-session"; can be called as short option
+                replayedSession = std::make_shared<replay_device_backend>(optarg);
+                break;
             case '0': // long option: "latest-sep";
                 flags |= FLAG_LATEST_SEP;
                 break;
@@ -298,6 +389,32 @@ int main_r(int argc, const char * argv[]) {
         }
     }
 
+    if (checkBlobsPath) {
+        // offline, nothing below needs a device
+        retassure(!apticketPaths.empty() && argc > optind,
+                  "--check-blobs requires -t and at least one iPSW or BuildManifest\n");
+        blob_checker checker(flags & FLAG_UPDATE);
+        checker.addTickets(apticketPaths);
+        checker.addFirmwares({argv + optind, argv + argc});
+        FILE *out = strcmp(checkBlobsPath, "-") ? fopen(checkBlobsPath, "w") : stdout;
+        retassure(out, "failed to create %s\n", checkBlobsPath);
+        size_t compatible = checker.run(out);
+        if (out != stdout) fclose(out);
+        return compatible ? 0 : 1;
+    }
+
+    if (auditGeneratorsPath) {
+        // offline as well, only the tickets themselves are needed
+        retassure(!apticketPaths.empty(), "--audit-generators requires -t\n");
+        blob_checker checker(flags & FLAG_UPDATE);
+        checker.addTickets(apticketPaths);
+        FILE *out = strcmp(auditGeneratorsPath, "-") ? fopen(auditGeneratorsPath, "w") : stdout;
+        retassure(out, "failed to create %s\n", auditGeneratorsPath);
+        size_t flagged = checker.auditGenerators(out);
+        if (out != stdout) fclose(out);
+        return flagged ? 1 : 0;
+    }
+
     if (argc-optind == 1) {
         argv += optind;
 
@@ -316,189 +433,304 @@ int main_r(int argc, const char * argv[]) {
         return -5;
     }
 
-    futurerestore client(flags & FLAG_UPDATE, flags & FLAG_IS_PWN_DFU, flags & FLAG_NO_IBSS, flags & FLAG_SET_NONCE, flags & FLAG_SERIAL, flags & FLAG_NO_RESTORE_FR, flags & FLAG_NO_RSEP_FR);
-    retassure(client.init(),"can't init, no device found\n");
-
-    printf("futurerestore init done\n");
-    if(flags & FLAG_NO_IBSS)
-        retassure((flags & FLAG_IS_PWN_DFU),"--no-ibss requires --use-pwndfu\n");
-    if(flags & FLAG_RESTORE_RAMDISK)
-        retassure((flags & FLAG_IS_PWN_DFU),"--rdsk requires --use-pwndfu\n");
-    if(flags & FLAG_RESTORE_KERNEL)
-        retassure((flags & FLAG_IS_PWN_DFU),"--rkrn requires --use-pwndfu\n");
-    if(flags & FLAG_SET_NONCE)
-        retassure((flags & FLAG_IS_PWN_DFU),"--set-nonce requires --use-pwndfu\n");
-    if(flags & FLAG_SET_NONCE && client.is32bit())
-        error("--set-nonce not supported on 32bit devices.\n");
-    if(flags & FLAG_RESTORE_RAMDISK)
-        retassure((flags & FLAG_RESTORE_KERNEL),"--rdsk requires --rkrn\n");
-    if(flags & FLAG_SERIAL) {
-        retassure((flags & FLAG_IS_PWN_DFU),"--serial requires --use-pwndfu\n");
-        retassure(!(flags & FLAG_BOOT_ARGS),"--serial conflicts with --boot-args\n");
-    }
-    if(flags & FLAG_BOOT_ARGS)
-        retassure((flags & FLAG_IS_PWN_DFU),"--boot-args requires --use-pwndfu\n");
-    if(flags & FLAG_NO_CACHE)
-        retassure((flags & FLAG_IS_PWN_DFU),"--no-cache requires --use-pwndfu\n");
-    if(flags & FLAG_SKIP_BLOB)
-        retassure((flags & FLAG_IS_PWN_DFU),"--skip-blob requires --use-pwndfu\n");
-    if(flags & FLAG_CUSTOM_LATEST_BETA)
-        retassure((flags & FLAG_CUSTOM_LATEST_BUILDID),"-i, --custom-latest-beta requires -g, --custom-latest-buildid\n");
-    if(flags & FLAG_CUSTOM_LATEST_OTA)
-        retassure((flags & FLAG_CUSTOM_LATEST_BUILDID),"-k, --custom-latest-ota requires -g, --custom-latest-buildid\n");
-    if(flags & FLAG_CUSTOM_LATEST_BUILDID)
-        retassure((flags & FLAG_CUSTOM_LATEST) == 0,"-g, --custom-latest-buildid is not compatible with -c, --custom-latest\n");
-
-    if (exitRecovery) {
-        client.exitRecovery();
-        info("Done\n");
-        return 0;
-    }
+    retassure((simulateSpec != nullptr) + (recordedSession != nullptr) + (replayedSession != nullptr) <= 1,
+              "--simulate-device, --record-session and --replay-session can't be combined\n");
 
-    try {
-        if (!apticketPaths.empty()) {
-            client.loadAPTickets(apticketPaths);
-        }
+    retassure(devices.empty() || (!recordedSession && !replayedSession),
+              "--devices can't be combined with --record-session or --replay-session\n");
+    // these end with exit() or without restoring, neither of which works for one device among several
+    retassure(devices.empty() || (!(flags & FLAG_SET_NONCE) && !(flags & FLAG_WAIT) && !exitRecovery),
+              "--devices can't be combined with --set-nonce, --wait or --exit-recovery\n");
 
-        if(!customLatest.empty()) {
-            client.setCustomLatest(customLatest);
+    // idevicerestore keeps this in a global, set it before any session starts instead of from every worker
+    if(flags & FLAG_IGNORE_BB_FAIL) {
+        restore_set_ignore_bb_fail(1);
+    }
+    // tsschecker's signing checks aren't thread safe, the sessions of a multi-device run take turns
+    std::mutex signingCheckLock;
+
+    // init to doRestore for one device, the sessions of a multi-device run each go through it on a thread of their own
+    auto restoreSession = [&](futurerestore &client, bool &restored) -> int {
+        int err = 0;
+        t_devicevals devVals = {nullptr};
+        t_iosVersion versVals = {nullptr};
+        retassure(client.init(),"can't init, no device found\n");
+
+        printf("futurerestore init done\n");
+        if(flags & FLAG_NO_IBSS)
+            retassure((flags & FLAG_IS_PWN_DFU),"--no-ibss requires --use-pwndfu\n");
+        if(flags & FLAG_RESTORE_RAMDISK)
+            retassure((flags & FLAG_IS_PWN_DFU),"--rdsk requires --use-pwndfu\n");
+        if(flags & FLAG_RESTORE_KERNEL)
+            retassure((flags & FLAG_IS_PWN_DFU),"--rkrn requires --use-pwndfu\n");
+        if(flags & FLAG_SET_NONCE)
+            retassure((flags & FLAG_IS_PWN_DFU),"--set-nonce requires --use-pwndfu\n");
+        if(flags & FLAG_SET_NONCE && client.is32bit())
+            error("--set-nonce not supported on 32bit devices.\n");
+        if(flags & FLAG_RESTORE_RAMDISK)
+            retassure((flags & FLAG_RESTORE_KERNEL),"--rdsk requires --rkrn\n");
+        if(flags & FLAG_SERIAL) {
+            retassure((flags & FLAG_IS_PWN_DFU),"--serial requires --use-pwndfu\n");
+            retassure(!(flags & FLAG_BOOT_ARGS),"--serial conflicts with --boot-args\n");
         }
-        if(!customLatestBuildID.empty()) {
-            client.setCustomLatestBuildID(customLatestBuildID, (flags & FLAG_CUSTOM_LATEST_BETA) != 0, (flags & FLAG_CUSTOM_LATEST_OTA) != 0);
+        if(flags & FLAG_BOOT_ARGS)
+            retassure((flags & FLAG_IS_PWN_DFU),"--boot-args requires --use-pwndfu\n");
+        if(flags & FLAG_NO_CACHE)
+            retassure((flags & FLAG_IS_PWN_DFU),"--no-cache requires --use-pwndfu\n");
+        if(flags & FLAG_SKIP_BLOB)
+            retassure((flags & FLAG_IS_PWN_DFU),"--skip-blob requires --use-pwndfu\n");
+        if(flags & FLAG_CUSTOM_LATEST_BETA)
+            retassure((flags & FLAG_CUSTOM_LATEST_BUILDID),"-i, --custom-latest-beta requires -g, --custom-latest-buildid\n");
+        if(flags & FLAG_CUSTOM_LATEST_OTA)
+            retassure((flags & FLAG_CUSTOM_LATEST_BUILDID),"-k, --custom-latest-ota requires -g, --custom-latest-buildid\n");
+        if(flags & FLAG_CUSTOM_LATEST_BUILDID)
+            retassure((flags & FLAG_CUSTOM_LATEST) == 0,"-g, --custom-latest-buildid is not compatible with -c, --custom-latest\n");
+
+        if (exitRecovery) {
+            client.exitRecovery();
+            info("Done\n");
+            return 0;
         }
-        if (!(
-                ((!apticketPaths.empty() && ipsw)
-                 && ((basebandPath && basebandManifestPath) || ((flags & FLAG_LATEST_BASEBAND) || (flags & FLAG_NO_BASEBAND)))
-                 && ((sepPath && sepManifestPath) || (flags & FLAG_LATEST_SEP) || client.is32bit())
-                ) || (ipsw && (flags & FLAG_IS_PWN_DFU))
-        )) {
-
-            if (!(flags & FLAG_WAIT) || ipsw){
-                error("missing argument\n");
-                cmd_help();
-                err = -2;
-            }else{
-                client.putDeviceIntoRecovery();
-                client.waitForNonce();
-                info("Done\n");
+
+        try {
+            if (!apticketPaths.empty()) {
+                client.loadAPTickets(apticketPaths);
             }
-            goto error;
-        }
 
-        devVals.deviceModel = (char*)client.getDeviceModelNoCopy();
-        devVals.deviceBoard = (char*)client.getDeviceBoardNoCopy();
+            client.setDownloadConcurrency(downloadJobs);
+            client.setComponentStoreBudget(cacheBudget);
+            if (flags & FLAG_REVERIFY_CACHE) {
+                client.forceCacheVerification();
+            }
 
-        if(flags & FLAG_RESTORE_RAMDISK) {
-            client.setRamdiskPath(ramdiskPath);
-            client.loadRamdisk(ramdiskPath);
-        }
+            if(!customLatest.empty()) {
+                client.setCustomLatest(customLatest);
+            }
+            if(!customLatestBuildID.empty()) {
+                client.setCustomLatestBuildID(customLatestBuildID, (flags & FLAG_CUSTOM_LATEST_BETA) != 0, (flags & FLAG_CUSTOM_LATEST_OTA) != 0);
+            }
+            if (!(
+                    ((!apticketPaths.empty() && ipsw)
+                     && ((basebandPath && basebandManifestPath) || ((flags & FLAG_LATEST_BASEBAND) || (flags & FLAG_NO_BASEBAND)))
+                     && ((sepPath && sepManifestPath) || (flags & FLAG_LATEST_SEP) || client.is32bit())
+                    ) || (ipsw && (flags & FLAG_IS_PWN_DFU))
+            )) {
+
+                if (!(flags & FLAG_WAIT) || ipsw){
+                    error("missing argument\n");
+                    cmd_help();
+                    err = -2;
+                }else{
+                    client.putDeviceIntoRecovery();
+                    client.waitForNonce();
+                    info("Done\n");
+                }
+                return err;
+            }
 
-        if(flags & FLAG_RESTORE_KERNEL) {
-            client.setKernelPath(kernelPath);
-            client.loadKernel(kernelPath);
-        }
+            devVals.deviceModel = (char*)client.getDeviceModelNoCopy();
+            devVals.deviceBoard = (char*)client.getDeviceBoardNoCopy();
 
-        if(flags & FLAG_SET_NONCE) {
-            client.setNonce(custom_nonce);
-        }
+            if(flags & FLAG_RESTORE_RAMDISK) {
+                client.setRamdiskPath(ramdiskPath);
+                client.loadRamdisk(ramdiskPath);
+            }
 
-        if(flags & FLAG_BOOT_ARGS) {
-            client.setBootArgs(bootargs);
-        }
+            if(flags & FLAG_RESTORE_KERNEL) {
+                client.setKernelPath(kernelPath);
+                client.loadKernel(kernelPath);
+            }
 
-        if(flags & FLAG_NO_CACHE) {
-            client.disableCache();
-        }
+            if(flags & FLAG_SET_NONCE) {
+                client.setNonce(custom_nonce);
+            }
 
-        if(flags & FLAG_SKIP_BLOB) {
-            client.skipBlobValidation();
-        }
-        if(!(flags & FLAG_SET_NONCE)) {
-            if (flags & FLAG_LATEST_SEP) {
-                info("User specified to use latest signed SEP\n");
-                client.downloadLatestSep();
-            } else if (!client.is32bit()) {
-                client.setSepPath(sepPath);
-                client.setSepManifestPath(sepManifestPath);
-                client.loadSep(sepPath);
-                client.loadSepManifest(sepManifestPath);
+            if(flags & FLAG_BOOT_ARGS) {
+                client.setBootArgs(bootargs);
             }
-        }
-        if(flags & FLAG_IGNORE_BB_FAIL) {
-            restore_set_ignore_bb_fail(1);
-        }
 
-        versVals.basebandMode = kBasebandModeWithoutBaseband;
-        if(!(flags & FLAG_SET_NONCE)) {
-            info("Checking if SEP is being signed...\n");
-            if (!client.is32bit() &&
-                !(isManifestSignedForDevice(client.getSepManifestPath().c_str(), &devVals, &versVals, nullptr))) {
-                reterror("SEP firmware is NOT being signed!\n");
-            } else {
-                info("SEP is being signed!\n");
+            if(flags & FLAG_NO_CACHE) {
+                client.disableCache();
             }
-        }
-        if (flags & FLAG_NO_BASEBAND){
-            info("\nWARNING: user specified is not to flash a baseband. This can make the restore fail if the device needs a baseband!\n");
-            info("\nIf you added this flag by mistake, you can press CTRL-C now to cancel\n");
-            int c = 10;
-            info("Continuing restore in ");
-            while (c) {
-                info("%d ",c--);
-                fflush(stdout);
-                sleep(1);
+
+            if(flags & FLAG_SKIP_BLOB) {
+                client.skipBlobValidation();
             }
-            info("");
-        }else{
             if(!(flags & FLAG_SET_NONCE)) {
-                if (flags & FLAG_LATEST_BASEBAND) {
-                    info("User specified to use latest signed baseband\n");
-                    client.downloadLatestBaseband();
-                } else {
-                    client.setBasebandPath(basebandPath);
-                    client.setBasebandManifestPath(basebandManifestPath);
-                    client.loadBaseband(basebandPath);
-                    client.loadBasebandManifest(basebandManifestPath);
-                    info("Did set SEP and baseband path and firmware\n");
+                if (flags & FLAG_LATEST_SEP) {
+                    info("User specified to use latest signed SEP\n");
+                    client.downloadLatestSep();
+                } else if (!client.is32bit()) {
+                    client.setSepPath(sepPath);
+                    client.setSepManifestPath(sepManifestPath);
+                    client.loadSep(sepPath);
+                    client.loadSepManifest(sepManifestPath);
                 }
             }
 
-            versVals.basebandMode = kBasebandModeOnlyBaseband;
-            if (!(devVals.bbgcid = client.getBasebandGoldCertIDFromDevice())){
-                debug("[WARNING] using tsschecker's fallback to get BasebandGoldCertID. This might result in invalid baseband signing status information\n");
-            }
+            versVals.basebandMode = kBasebandModeWithoutBaseband;
             if(!(flags & FLAG_SET_NONCE)) {
-                info("Checking if Baseband is being signed...\n");
-                if (!(isManifestSignedForDevice(client.getBasebandManifestPath().c_str(), &devVals, &versVals,
-                                                nullptr))) {
-                    reterror("Baseband firmware is NOT being signed!\n");
+                info("Checking if SEP is being signed...\n");
+                std::unique_lock<std::mutex> signingCheck(signingCheckLock);
+                if (!client.is32bit() &&
+                    !(isManifestSignedForDevice(client.getSepManifestPath().c_str(), &devVals, &versVals, nullptr))) {
+                    reterror("SEP firmware is NOT being signed!\n");
                 } else {
-                    info("Baseband is being signed!\n");
+                    info("SEP is being signed!\n");
                 }
             }
+            if (flags & FLAG_NO_BASEBAND){
+                info("\nWARNING: user specified is not to flash a baseband. This can make the restore fail if the device needs a baseband!\n");
+                info("\nIf you added this flag by mistake, you can press CTRL-C now to cancel\n");
+                int c = 10;
+                info("Continuing restore in ");
+                while (c) {
+                    info("%d ",c--);
+                    fflush(stdout);
+                    sleep(1);
+                }
+                info("");
+            }else{
+                if(!(flags & FLAG_SET_NONCE)) {
+                    if (flags & FLAG_LATEST_BASEBAND) {
+                        info("User specified to use latest signed baseband\n");
+                        client.downloadLatestBaseband();
+                    } else {
+                        client.setBasebandPath(basebandPath);
+                        client.setBasebandManifestPath(basebandManifestPath);
+                        client.loadBaseband(basebandPath);
+                        client.loadBasebandManifest(basebandManifestPath);
+                        info("Did set SEP and baseband path and firmware\n");
+                    }
+                }
+
+                versVals.basebandMode = kBasebandModeOnlyBaseband;
+                if (!(devVals.bbgcid = client.getBasebandGoldCertIDFromDevice())){
+                    debug("[WARNING] using tsschecker's fallback to get BasebandGoldCertID. This might result in invalid baseband signing status information\n");
+                }
+                if(!(flags & FLAG_SET_NONCE)) {
+                    info("Checking if Baseband is being signed...\n");
+                    std::unique_lock<std::mutex> signingCheck(signingCheckLock);
+                    if (!(isManifestSignedForDevice(client.getBasebandManifestPath().c_str(), &devVals, &versVals,
+                                                    nullptr))) {
+                        reterror("Baseband firmware is NOT being signed!\n");
+                    } else {
+                        info("Baseband is being signed!\n");
+                    }
+                }
+            }
+            if(!client.is32bit() && !(flags & FLAG_SET_NONCE)) {
+                client.downloadLatestFirmwareComponents();
+            }
+            client.putDeviceIntoRecovery();
+            if (flags & FLAG_WAIT){
+                client.waitForNonce();
+            }
+        } catch (int error) {
+            err = error;
+            printf("[Error] Fail code=%d\n",err);
+            return err;
         }
-        if(!client.is32bit() && !(flags & FLAG_SET_NONCE)) {
-            client.downloadLatestFirmwareComponents();
+
+        try {
+            client.doRestore(ipsw);
+            printf("Done: restoring succeeded!\n");
+            restored = true;
+        } catch (tihmstar::exception &e) {
+            e.dump();
+            printf("Done: restoring failed!\n");
         }
-        client.putDeviceIntoRecovery();
-        if (flags & FLAG_WAIT){
-            client.waitForNonce();
+        return err;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    if (devices.empty()) {
+        futurerestore client(flags & FLAG_UPDATE, flags & FLAG_IS_PWN_DFU, flags & FLAG_NO_IBSS, flags & FLAG_SET_NONCE, flags & FLAG_SERIAL, flags & FLAG_NO_RESTORE_FR, flags & FLAG_NO_RSEP_FR);
+// TODO: implement windows CI and enable update check
+#ifndef WIN32
+        client.checkForUpdates();
+#endif
+        std::shared_ptr<simulated_device_backend> simulatedDevice;
+        if (simulateSpec) {
+            info("Using a simulated device\n");
+            simulatedDevice = std::make_shared<simulated_device_backend>(simulated_device_backend::parseConfig(simulateSpec));
+            client.setDeviceBackend(simulatedDevice);
+        } else if (recordedSession) {
+            client.setDeviceBackend(recordedSession);
+        } else if (replayedSession) {
+            info("Replaying a recorded device session\n");
+            client.setDeviceBackend(replayedSession);
         }
-    } catch (int error) {
-        err = error;
-        printf("[Error] Fail code=%d\n",err);
-        goto error;
-    }
-
-    try {
-        client.doRestore(ipsw);
-        printf("Done: restoring succeeded!\n");
-    } catch (tihmstar::exception &e) {
-        e.dump();
-        printf("Done: restoring failed!\n");
+        bool restored = false;
+        if ((err = restoreSession(client, restored)) == 0) {
+            if (simulatedDevice) {
+                simulatedDevice->report();
+                info("Simulated run took %.2fs\n",
+                     std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            } else if (replayedSession) {
+                replayedSession->report();
+                info("Replay took %.2fs\n",
+                     std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+    } else {
+        // firmware lookups and downloads happen once, after that every device only waits on its own USB port
+        auto cache = std::make_shared<session_cache>();
+        std::vector<std::unique_ptr<futurerestore>> sessions;
+        std::vector<std::shared_ptr<simulated_device_backend>> simulatedDevices;
+        for (uint64_t ecid : devices) {
+            auto session = std::make_unique<futurerestore>(flags & FLAG_UPDATE, flags & FLAG_IS_PWN_DFU, flags & FLAG_NO_IBSS, flags & FLAG_SET_NONCE, flags & FLAG_SERIAL, flags & FLAG_NO_RESTORE_FR, flags & FLAG_NO_RSEP_FR);
+            if (simulateSpec) {
+                simulated_device_backend::config config = simulated_device_backend::parseConfig(simulateSpec);
+                config.ecid = ecid;
+                simulatedDevices.push_back(std::make_shared<simulated_device_backend>(config));
+                session->setDeviceBackend(simulatedDevices.back());
+            }
+            session->selectDevice(ecid);
+            session->setSharedCache(cache);
+            sessions.push_back(std::move(session));
+        }
+#ifndef WIN32
+        // once per run, not once per device
+        sessions.front()->checkForUpdates();
+#endif
+        info("Restoring %zu devices\n", sessions.size());
+        std::vector<int> results(sessions.size(), 0);
+        std::vector<char> restored(sessions.size(), false);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < sessions.size(); i++) {
+            workers.emplace_back([&, i] {
+                bool sessionRestored = false;
+                try {
+                    results[i] = restoreSession(*sessions[i], sessionRestored);
+                } catch (tihmstar::exception &e) {
+                    e.dump();
+                    results[i] = e.code() ? e.code() : -1;
+                } catch (std::exception &e) {
+                    // anything escaping a worker would terminate every other restore with it
+                    error("ECID 0x%016llx: %s\n", (unsigned long long) devices[i], e.what());
+                    results[i] = -1;
+                } catch (...) {
+                    error("ECID 0x%016llx: unknown exception\n", (unsigned long long) devices[i]);
+                    results[i] = -1;
+                }
+                restored[i] = sessionRestored;
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        for (size_t i = 0; i < sessions.size(); i++) {
+            info("ECID 0x%016llx: %s\n", (unsigned long long) devices[i], restored[i] ? "restored" : "failed");
+            if (!restored[i] && !err) err = results[i] ? results[i] : -1;
+        }
+        for (auto &simulatedDevice : simulatedDevices) {
+            simulatedDevice->report();
+        }
+        info("Restoring %zu devices took %.2fs\n", sessions.size(),
+             std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
     }
 
-    error:
     if (err){
         printf("Failed with error code=%d\n",err);
     }
@@ -507,6 +739,8 @@ int main_r(int argc, const char * argv[]) {
 }
 
 int main(int argc, const char * argv[]) {
+    // curl_global_init is not thread safe, do it once before any download or device worker starts
+    curl_global_init(CURL_GLOBAL_ALL);
 #ifdef DEBUG
     return main_r(argc, argv);
 #else
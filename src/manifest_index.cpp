@@ -0,0 +1,143 @@
+//
+//  manifest_index.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <cstring>
+#include "manifest_index.hpp"
+
+extern "C" {
+#include "tsschecker.h"
+}
+
+using namespace tihmstar;
+
+manifest_index::manifest_index(const char *manifeststr) {
+    retassure(manifeststr, "%s: got empty manifest\n", __func__);
+    plist_from_xml(manifeststr, (uint32_t) strlen(manifeststr), &_buildmanifest);
+    retassure(_buildmanifest, "%s: failed to parse manifest\n", __func__);
+}
+
+manifest_index::manifest_index(plist_t buildmanifest) {
+    retassure(buildmanifest, "%s: got empty manifest\n", __func__);
+    _buildmanifest = plist_copy(buildmanifest);
+}
+
+manifest_index::~manifest_index() {
+    safeFreeCustom(_buildmanifest, plist_free);
+}
+
+manifest_index::identity *manifest_index::getIdentity(const char *boardConfig, int isUpdateInstall) {
+    std::string key(boardConfig ? boardConfig : "");
+    key.push_back(isUpdateInstall ? '1' : '0');
+
+    auto found = _identities.find(key);
+    if (found != _identities.end()) {
+        return found->second.buildIdentity ? &found->second : nullptr;
+    }
+
+    identity &ident = _identities[key];
+    if (!(ident.buildIdentity = getBuildidentityWithBoardconfig(_buildmanifest, boardConfig, isUpdateInstall))) {
+        // remember misses too, so repeated queries for a missing identity stay cheap
+        return nullptr;
+    }
+
+    plist_t manifest = plist_dict_get_item(ident.buildIdentity, "Manifest");
+    if (!manifest || plist_get_node_type(manifest) != PLIST_DICT) {
+        return &ident;
+    }
+
+    plist_dict_iter iter = nullptr;
+    plist_dict_new_iter(manifest, &iter);
+    if (!iter) {
+        return &ident;
+    }
+    while (true) {
+        char *name = nullptr;
+        plist_t elem = nullptr;
+        plist_dict_next_item(manifest, iter, &name, &elem);
+        if (!name) {
+            break;
+        }
+        component &comp = ident.components[name];
+        if (plist_t info = plist_dict_get_item(elem, "Info")) {
+            if (plist_t path = plist_dict_get_item(info, "Path")) {
+                char *pathStr = nullptr;
+                if (plist_get_node_type(path) == PLIST_STRING && (plist_get_string_val(path, &pathStr), pathStr)) {
+                    comp.path = pathStr;
+                    comp.hasPath = true;
+                    free(pathStr);
+                }
+            }
+        }
+        if (plist_t digest = plist_dict_get_item(elem, "Digest")) {
+            char *digestData = nullptr;
+            uint64_t digestSize = 0;
+            if (plist_get_node_type(digest) == PLIST_DATA && (plist_get_data_val(digest, &digestData, &digestSize), digestData)) {
+                comp.digest.assign(digestData, digestSize);
+                comp.hasDigest = true;
+                free(digestData);
+            }
+        }
+        if (!strcmp(name, "BasebandFirmware")) {
+            if (plist_t bbcfg = plist_dict_get_item(elem, "BBCFG-DownloadDigest")) {
+                char *digestData = nullptr;
+                uint64_t digestSize = 0;
+                if (plist_get_node_type(bbcfg) == PLIST_DATA && (plist_get_data_val(bbcfg, &digestData, &digestSize), digestData)) {
+                    ident.bbcfgDigest.assign(digestData, digestSize);
+                    ident.hasBBCFGDigest = true;
+                    free(digestData);
+                }
+            }
+        }
+        free(name);
+    }
+    free(iter);
+
+    return &ident;
+}
+
+plist_t manifest_index::getBuildIdentity(const char *boardConfig, int isUpdateInstall) {
+    identity *ident = getIdentity(boardConfig, isUpdateInstall);
+    return ident ? ident->buildIdentity : nullptr;
+}
+
+const manifest_index::component *manifest_index::getComponent(const char *element, const char *boardConfig, int isUpdateInstall) {
+    identity *ident = getIdentity(boardConfig, isUpdateInstall);
+    if (!ident) {
+        return nullptr;
+    }
+    auto found = ident->components.find(element);
+    return (found != ident->components.end()) ? &found->second : nullptr;
+}
+
+const char *manifest_index::getPathOfElement(const char *element, const char *boardConfig, int isUpdateInstall) {
+    const component *comp = getComponent(element, boardConfig, isUpdateInstall);
+    retassure(comp && comp->hasPath, "Could not get %s path\n", element);
+    return comp->path.c_str();
+}
+
+const unsigned char *manifest_index::getDigestOfElement(const char *element, const char *boardConfig, int isUpdateInstall,
+                                                        size_t *digestSize) {
+    const component *comp = getComponent(element, boardConfig, isUpdateInstall);
+    if (!comp || !comp->hasDigest) {
+        return nullptr;
+    }
+    if (digestSize) *digestSize = comp->digest.size();
+    return (const unsigned char *) comp->digest.data();
+}
+
+const unsigned char *manifest_index::getBBCFGDigest(const char *boardConfig, int isUpdateInstall, size_t *digestSize) {
+    identity *ident = getIdentity(boardConfig, isUpdateInstall);
+    if (!ident || !ident->hasBBCFGDigest) {
+        return nullptr;
+    }
+    if (digestSize) *digestSize = ident->bbcfgDigest.size();
+    return (const unsigned char *) ident->bbcfgDigest.data();
+}
+
+bool manifest_index::elemExists(const char *element, const char *boardConfig, int isUpdateInstall) {
+    const component *comp = getComponent(element, boardConfig, isUpdateInstall);
+    return comp && comp->hasPath;
+}
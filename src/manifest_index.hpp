@@ -0,0 +1,58 @@
+//
+//  manifest_index.hpp
+//  futurerestore
+//
+
+#ifndef manifest_index_hpp
+#define manifest_index_hpp
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <plist/plist.h>
+
+/*
+ * Parses a BuildManifest once and answers component queries from a hash index.
+ * Identities are indexed lazily per (boardConfig, isUpdateInstall) the first time they are asked for,
+ * after that every path/digest/exists lookup is a single hash probe.
+ */
+class manifest_index {
+public:
+    struct component {
+        std::string path;
+        std::string digest;
+        bool hasPath = false;
+        bool hasDigest = false;
+    };
+
+private:
+    struct identity {
+        plist_t buildIdentity = nullptr;
+        std::unordered_map<std::string, component> components;
+        std::string bbcfgDigest;
+        bool hasBBCFGDigest = false;
+    };
+
+    plist_t _buildmanifest = nullptr;
+    std::unordered_map<std::string, identity> _identities;
+
+    identity *getIdentity(const char *boardConfig, int isUpdateInstall);
+
+public:
+    explicit manifest_index(const char *manifeststr);
+    explicit manifest_index(plist_t buildmanifest);
+    manifest_index(const manifest_index &) = delete;
+    manifest_index &operator=(const manifest_index &) = delete;
+    ~manifest_index();
+
+    plist_t buildManifest() const {return _buildmanifest;}
+    plist_t getBuildIdentity(const char *boardConfig, int isUpdateInstall);
+    const component *getComponent(const char *element, const char *boardConfig, int isUpdateInstall);
+
+    const char *getPathOfElement(const char *element, const char *boardConfig, int isUpdateInstall);
+    const unsigned char *getDigestOfElement(const char *element, const char *boardConfig, int isUpdateInstall, size_t *digestSize = nullptr);
+    const unsigned char *getBBCFGDigest(const char *boardConfig, int isUpdateInstall, size_t *digestSize = nullptr);
+    bool elemExists(const char *element, const char *boardConfig, int isUpdateInstall);
+};
+
+#endif /* manifest_index_hpp */
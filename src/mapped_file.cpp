@@ -0,0 +1,63 @@
+//
+//  mapped_file.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include "mapped_file.hpp"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace tihmstar;
+
+#ifdef WIN32
+mapped_file::mapped_file(std::string path) : _path(std::move(path)) {
+    HANDLE file = CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    retassure(file != INVALID_HANDLE_VALUE, "%s: failed to open %s\n", __func__, _path.c_str());
+    cleanup([&] {
+        CloseHandle(file);
+    });
+    LARGE_INTEGER size{};
+    retassure(GetFileSizeEx(file, &size), "%s: failed to get file size for %s\n", __func__, _path.c_str());
+    retassure(size.QuadPart > 0, "%s: %s is empty\n", __func__, _path.c_str());
+    _size = (size_t) size.QuadPart;
+    retassure(_mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr),
+              "%s: failed to create mapping for %s\n", __func__, _path.c_str());
+    if (!(_data = (char *) MapViewOfFile(_mapping, FILE_MAP_COPY, 0, 0, _size))) {
+        CloseHandle(_mapping);
+        reterror("%s: failed to map %s\n", __func__, _path.c_str());
+    }
+}
+
+mapped_file::~mapped_file() {
+    if (_data) UnmapViewOfFile(_data);
+    if (_mapping) CloseHandle(_mapping);
+}
+#else
+mapped_file::mapped_file(std::string path) : _path(std::move(path)) {
+    int fd = open(_path.c_str(), O_RDONLY);
+    retassure(fd >= 0, "%s: failed to open %s\n", __func__, _path.c_str());
+    cleanup([&] {
+        close(fd);
+    });
+    struct stat st{0};
+    retassure(!fstat(fd, &st), "%s: failed to get file size for %s\n", __func__, _path.c_str());
+    retassure(st.st_size > 0, "%s: %s is empty\n", __func__, _path.c_str());
+    _size = (size_t) st.st_size;
+    void *data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    retassure(data != MAP_FAILED, "%s: failed to map %s\n", __func__, _path.c_str());
+    _data = (char *) data;
+}
+
+mapped_file::~mapped_file() {
+    if (_data) munmap(_data, _size);
+}
+#endif // WIN32
@@ -0,0 +1,43 @@
+//
+//  mapped_file.hpp
+//  futurerestore
+//
+
+#ifndef mapped_file_hpp
+#define mapped_file_hpp
+
+//make sure WIN32 is defined if compiling for windows
+#if defined _WIN32 || defined __CYGWIN__
+#ifndef WIN32
+#define WIN32
+#endif
+#endif
+
+#include <cstddef>
+#include <string>
+
+/*
+ * Copy-on-write view of a whole file.
+ * Pages are read from disk when they are first touched, so handing a multi-gigabyte
+ * component to idevicerestore doesn't make it resident. Writes stay private to the process.
+ */
+class mapped_file {
+    std::string _path;
+    char *_data = nullptr;
+    size_t _size = 0;
+#ifdef WIN32
+    void *_mapping = nullptr;
+#endif
+
+public:
+    explicit mapped_file(std::string path);
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+    ~mapped_file();
+
+    const std::string &path() const {return _path;}
+    char *data() const {return _data;}
+    size_t size() const {return _size;}
+};
+
+#endif /* mapped_file_hpp */
@@ -0,0 +1,677 @@
+//
+//  remote_zip.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <curl/curl.h>
+#include <zlib.h>
+#include "remote_zip.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+using namespace tihmstar;
+
+#define ZIP_EOCD_SIG            0x06054b50
+#define ZIP_EOCD_SIZE           22
+#define ZIP64_LOCATOR_SIG       0x07064b50
+#define ZIP64_LOCATOR_SIZE      20
+#define ZIP64_EOCD_SIG          0x06064b50
+#define ZIP64_EOCD_SIZE         56
+#define ZIP_CDENTRY_SIG         0x02014b50
+#define ZIP_CDENTRY_SIZE        46
+#define ZIP_LOCAL_SIG           0x04034b50
+#define ZIP_LOCAL_SIZE          30
+#define ZIP64_EXTRA_ID          0x0001
+
+#define ZIP_INDEX_MAGIC         "futurerestore-zipindex 2"
+
+std::mutex remote_zip::_handlesLock;
+std::unordered_map<std::string, std::shared_ptr<remote_zip::shared_handle>> remote_zip::_handles;
+
+namespace {
+    uint16_t readLE16(const uint8_t *p) {
+        return (uint16_t) (p[0] | (p[1] << 8));
+    }
+
+    uint32_t readLE32(const uint8_t *p) {
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    uint64_t readLE64(const uint8_t *p) {
+        return (uint64_t) readLE32(p) | ((uint64_t) readLE32(p + 4) << 32);
+    }
+
+    CURL *newCurlHandle(const std::string &url) {
+        CURL *curl = curl_easy_init();
+        retassure(curl, "%s: curl_easy_init failed\n", __func__);
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "futurerestore");
+        return curl;
+    }
+
+    struct range_transfer {
+        CURL *curl;
+        const remote_zip::write_callback *writer;
+        bool checkedStatus = false;
+        bool badStatus = false;
+        bool stopped = false;
+    };
+
+    size_t rangeWriteCallback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+        auto *transfer = (range_transfer *) userdata;
+        size_t len = size * nmemb;
+        if (!transfer->checkedStatus) {
+            long status = 0;
+            curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &status);
+            transfer->checkedStatus = true;
+            // anything but 206 means the server ignored the Range header and sends the whole archive
+            if (status != 206) {
+                transfer->badStatus = true;
+                return 0;
+            }
+        }
+        if (!(*transfer->writer)((const uint8_t *) ptr, len)) {
+            transfer->stopped = true;
+            return 0;
+        }
+        return len;
+    }
+
+    struct head_validators {
+        std::string etag;
+        std::string lastModified;
+    };
+
+    size_t headerCallback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+        auto *validators = (head_validators *) userdata;
+        size_t len = size * nmemb;
+        std::string line(ptr, len);
+        // a redirect's headers don't describe the archive
+        if (line.compare(0, 5, "HTTP/") == 0) {
+            *validators = head_validators();
+            return len;
+        }
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) return len;
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) {return (char) tolower(c);});
+        size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+        size_t valueEnd = line.find_last_not_of(" \t\r\n");
+        std::string value = (valueStart == std::string::npos || valueEnd < valueStart)
+                            ? "" : line.substr(valueStart, valueEnd - valueStart + 1);
+        if (name == "etag") {
+            validators->etag = value;
+        } else if (name == "last-modified") {
+            validators->lastModified = value;
+        }
+        return len;
+    }
+
+    std::string indexPathForUrl(const std::string &indexDir, const std::string &url) {
+        // FNV-1a, only used to derive a stable file name
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (unsigned char c: url) {
+            hash ^= c;
+            hash *= 0x100000001b3ULL;
+        }
+        char name[32]{};
+        snprintf(name, sizeof(name), "%016" PRIx64 ".zipindex", hash);
+        return indexDir + "/" + name;
+    }
+
+    /*
+     * Consumes the raw archive bytes of one entry, starting at its local file header,
+     * and writes the decompressed payload to a file.
+     * Errors are recorded instead of thrown since feed() runs inside curl's write callback.
+     */
+    class entry_extractor {
+        const remote_zip::entry &_entry;
+        FILE *_out = nullptr;
+        const remote_zip::data_callback &_sink;
+        std::vector<uint8_t> _header;
+        size_t _headerSize = 0;
+        uint64_t _consumed = 0;
+        uint64_t _written = 0;
+        uint32_t _crc = 0;
+        z_stream _zs{};
+        bool _zInit = false;
+        bool _zEnd = false;
+        std::string _error;
+
+        bool writeOut(const uint8_t *buf, size_t len) {
+            if (!len) return true;
+            if (fwrite(buf, 1, len, _out) != len) {
+                _error = "failed to write output file";
+                return false;
+            }
+            _crc = (uint32_t) crc32(_crc, buf, (uInt) len);
+            if (_sink) _sink(buf, len);
+            _written += len;
+            return true;
+        }
+
+        bool feedData(const uint8_t *buf, size_t len) {
+            if (_entry.method == 0) {
+                return writeOut(buf, len);
+            }
+            uint8_t outBuf[0x10000];
+            _zs.next_in = (Bytef *) buf;
+            _zs.avail_in = (uInt) len;
+            while (_zs.avail_in && !_zEnd) {
+                _zs.next_out = outBuf;
+                _zs.avail_out = sizeof(outBuf);
+                int ret = inflate(&_zs, Z_NO_FLUSH);
+                if (ret == Z_STREAM_END) {
+                    _zEnd = true;
+                } else if (ret != Z_OK) {
+                    _error = "inflate failed";
+                    return false;
+                }
+                if (!writeOut(outBuf, sizeof(outBuf) - _zs.avail_out)) return false;
+            }
+            return true;
+        }
+
+    public:
+        entry_extractor(const remote_zip::entry &entry, FILE *out, const remote_zip::data_callback &sink)
+        : _entry(entry), _out(out), _sink(sink) {
+            _crc = (uint32_t) crc32(0L, Z_NULL, 0);
+        }
+
+        ~entry_extractor() {
+            if (_zInit) inflateEnd(&_zs);
+        }
+
+        const std::string &errorString() const {return _error;}
+        uint64_t consumed() const {return _consumed;}
+
+        bool headerDone() const {return _headerSize && _header.size() == _headerSize;}
+        bool done() const {return headerDone() && _consumed == _entry.compressedSize;}
+
+        // absolute archive offset of the next byte this extractor needs
+        uint64_t nextOffset() const {
+            return _entry.localHeaderOffset + (headerDone() ? _headerSize + _consumed : _header.size());
+        }
+
+        // returns false once the entry is complete or on error
+        bool feed(const uint8_t *buf, size_t len) {
+            while (len && !headerDone()) {
+                size_t want = (_headerSize ? _headerSize : ZIP_LOCAL_SIZE) - _header.size();
+                size_t take = std::min(want, len);
+                _header.insert(_header.end(), buf, buf + take);
+                buf += take;
+                len -= take;
+                if (!_headerSize && _header.size() == ZIP_LOCAL_SIZE) {
+                    if (readLE32(_header.data()) != ZIP_LOCAL_SIG) {
+                        _error = "bad local file header";
+                        return false;
+                    }
+                    _headerSize = ZIP_LOCAL_SIZE + readLE16(&_header[26]) + readLE16(&_header[28]);
+                }
+            }
+            if (!headerDone()) return true;
+            if (_entry.method == 8 && !_zInit) {
+                if (inflateInit2(&_zs, -MAX_WBITS) != Z_OK) {
+                    _error = "inflateInit2 failed";
+                    return false;
+                }
+                _zInit = true;
+            }
+            size_t take = (size_t) std::min<uint64_t>(len, _entry.compressedSize - _consumed);
+            if (take && !feedData(buf, take)) return false;
+            _consumed += take;
+            return !done();
+        }
+
+        bool verify() {
+            if (!done()) {
+                _error = "transfer ended early";
+            } else if (_written != _entry.uncompressedSize) {
+                _error = "size mismatch";
+            } else if (_crc != _entry.crc32) {
+                _error = "crc32 mismatch";
+            }
+            return _error.empty();
+        }
+    };
+}
+
+remote_zip::remote_zip(std::string url) : _url(std::move(url)) {
+    retassure(!_url.empty(), "%s: got empty url\n", __func__);
+}
+
+std::shared_ptr<remote_zip> remote_zip::open(const std::string &url, const std::string &indexDir) {
+    std::shared_ptr<shared_handle> handle;
+    {
+        std::unique_lock<std::mutex> lk(_handlesLock);
+        std::shared_ptr<shared_handle> &slot = _handles[url];
+        if (!slot) slot = std::make_shared<shared_handle>();
+        handle = slot;
+    }
+    // only callers for the same URL wait for the HEAD and central directory requests
+    std::unique_lock<std::mutex> lk(handle->lock);
+    if (auto existing = handle->zip.lock()) {
+        return existing;
+    }
+
+    std::shared_ptr<remote_zip> zip(new remote_zip(url));
+    zip->fetchArchiveInfo();
+    std::string indexPath = indexDir.empty() ? "" : indexPathForUrl(indexDir, url);
+    if (!indexPath.empty() && zip->loadIndexFile(indexPath)) {
+        debug("Using cached zip index %s for %s\n", indexPath.c_str(), url.c_str());
+    } else {
+        zip->fetchCentralDirectory();
+        if (!indexPath.empty()) zip->saveIndexFile(indexPath);
+    }
+    zip->buildEntryIndex();
+    handle->zip = zip;
+    return zip;
+}
+
+void remote_zip::fetchArchiveInfo() {
+    CURL *curl = newCurlHandle(_url);
+    cleanup([&] {
+        safeFreeCustom(curl, curl_easy_cleanup);
+    });
+    head_validators validators;
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &validators);
+    CURLcode res = curl_easy_perform(curl);
+    retassure(res == CURLE_OK, "%s: HEAD %s failed: %s\n", __func__, _url.c_str(), curl_easy_strerror(res));
+    curl_off_t size = -1;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size);
+    retassure(size > 0, "%s: server did not report a size for %s\n", __func__, _url.c_str());
+    _archiveSize = (uint64_t) size;
+    _etag = std::move(validators.etag);
+    _lastModified = std::move(validators.lastModified);
+}
+
+void remote_zip::fetchRange(uint64_t offset, uint64_t length, const write_callback &writer) const {
+    if (!length) return;
+    retassure(offset + length <= _archiveSize, "%s: range %" PRIu64 "+%" PRIu64 " is out of bounds\n", __func__, offset, length);
+
+    CURL *curl = newCurlHandle(_url);
+    cleanup([&] {
+        safeFreeCustom(curl, curl_easy_cleanup);
+    });
+    char range[64]{};
+    snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64, offset, offset + length - 1);
+    range_transfer transfer{curl, &writer};
+    curl_easy_setopt(curl, CURLOPT_RANGE, range);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, rangeWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+    CURLcode res = curl_easy_perform(curl);
+    retassure(!transfer.badStatus, "%s: server does not support Range requests for %s\n", __func__, _url.c_str());
+    if (transfer.stopped) return;
+    retassure(res == CURLE_OK, "%s: fetching range %s failed: %s\n", __func__, range, curl_easy_strerror(res));
+}
+
+void remote_zip::fetchCentralDirectory() {
+    _entries = readCentralDirectory(_archiveSize, [this](uint64_t offset, uint64_t length) {
+        std::vector<uint8_t> buf;
+        buf.reserve(length);
+        fetchRange(offset, length, [&](const uint8_t *data, size_t len) {
+            buf.insert(buf.end(), data, data + len);
+            return true;
+        });
+        return buf;
+    }, _url);
+}
+
+std::vector<remote_zip::entry> remote_zip::readCentralDirectory(uint64_t archiveSize, const range_reader &read,
+                                                               const std::string &archiveName) {
+    uint64_t tailSize = std::min<uint64_t>(archiveSize, 0xffff + ZIP_EOCD_SIZE + ZIP64_LOCATOR_SIZE);
+    retassure(tailSize >= ZIP_EOCD_SIZE, "%s: %s is too small to be a zip archive\n", __func__, archiveName.c_str());
+    uint64_t tailOffset = archiveSize - tailSize;
+    std::vector<uint8_t> tail = read(tailOffset, tailSize);
+    retassure(tail.size() == tailSize, "%s: short read on archive tail\n", __func__);
+
+    size_t eocdPos = 0;
+    bool foundEOCD = false;
+    for (size_t i = tail.size() - ZIP_EOCD_SIZE + 1; i-- > 0;) {
+        if (readLE32(&tail[i]) == ZIP_EOCD_SIG && i + ZIP_EOCD_SIZE + readLE16(&tail[i + 20]) <= tail.size()) {
+            eocdPos = i;
+            foundEOCD = true;
+            break;
+        }
+    }
+    retassure(foundEOCD, "%s: no end of central directory in %s\n", __func__, archiveName.c_str());
+
+    const uint8_t *eocd = &tail[eocdPos];
+    uint64_t entryCount = readLE16(eocd + 10);
+    uint64_t cdSize = readLE32(eocd + 12);
+    uint64_t cdOffset = readLE32(eocd + 16);
+
+    if (eocdPos >= ZIP64_LOCATOR_SIZE && readLE32(&tail[eocdPos - ZIP64_LOCATOR_SIZE]) == ZIP64_LOCATOR_SIG) {
+        uint64_t eocd64Offset = readLE64(&tail[eocdPos - ZIP64_LOCATOR_SIZE + 8]);
+        std::vector<uint8_t> eocd64;
+        if (eocd64Offset >= tailOffset && eocd64Offset - tailOffset + ZIP64_EOCD_SIZE <= tail.size()) {
+            eocd64.assign(tail.begin() + (long) (eocd64Offset - tailOffset),
+                          tail.begin() + (long) (eocd64Offset - tailOffset + ZIP64_EOCD_SIZE));
+        } else {
+            eocd64 = read(eocd64Offset, ZIP64_EOCD_SIZE);
+        }
+        retassure(eocd64.size() == ZIP64_EOCD_SIZE && readLE32(eocd64.data()) == ZIP64_EOCD_SIG,
+                  "%s: bad zip64 end of central directory in %s\n", __func__, archiveName.c_str());
+        entryCount = readLE64(&eocd64[32]);
+        cdSize = readLE64(&eocd64[40]);
+        cdOffset = readLE64(&eocd64[48]);
+    }
+    retassure(cdOffset <= archiveSize && cdSize <= archiveSize - cdOffset, "%s: central directory is out of bounds\n",
+              __func__);
+    // every entry takes at least a fixed size record, don't trust a count that can't fit before reserving for it
+    retassure(entryCount <= cdSize / ZIP_CDENTRY_SIZE, "%s: central directory of %" PRIu64 " bytes can't hold %" PRIu64
+              " entries\n", __func__, cdSize, entryCount);
+
+    std::vector<uint8_t> cd = read(cdOffset, cdSize);
+    retassure(cd.size() == cdSize, "%s: short read on central directory\n", __func__);
+
+    std::vector<entry> entries;
+    entries.reserve(entryCount);
+    size_t pos = 0;
+    for (uint64_t i = 0; i < entryCount; i++) {
+        retassure(pos + ZIP_CDENTRY_SIZE <= cd.size() && readLE32(&cd[pos]) == ZIP_CDENTRY_SIG,
+                  "%s: bad central directory entry %" PRIu64 "\n", __func__, i);
+        const uint8_t *cde = &cd[pos];
+        uint16_t nameLen = readLE16(cde + 28);
+        uint16_t extraLen = readLE16(cde + 30);
+        uint16_t commentLen = readLE16(cde + 32);
+        retassure(pos + ZIP_CDENTRY_SIZE + nameLen + extraLen + commentLen <= cd.size(),
+                  "%s: truncated central directory entry %" PRIu64 "\n", __func__, i);
+
+        entry e;
+        e.method = readLE16(cde + 10);
+        e.crc32 = readLE32(cde + 16);
+        e.compressedSize = readLE32(cde + 20);
+        e.uncompressedSize = readLE32(cde + 24);
+        e.localHeaderOffset = readLE32(cde + 42);
+        e.name.assign((const char *) cde + ZIP_CDENTRY_SIZE, nameLen);
+
+        // zip64 extended information, fields are only present if the 32bit one is saturated
+        const uint8_t *extra = cde + ZIP_CDENTRY_SIZE + nameLen;
+        for (size_t x = 0; x + 4 <= extraLen;) {
+            uint16_t id = readLE16(extra + x);
+            uint16_t len = readLE16(extra + x + 2);
+            if (x + 4 + len > extraLen) break;
+            if (id == ZIP64_EXTRA_ID) {
+                const uint8_t *field = extra + x + 4;
+                const uint8_t *fieldEnd = field + len;
+                if (e.uncompressedSize == 0xffffffff && field + 8 <= fieldEnd) {
+                    e.uncompressedSize = readLE64(field);
+                    field += 8;
+                }
+                if (e.compressedSize == 0xffffffff && field + 8 <= fieldEnd) {
+                    e.compressedSize = readLE64(field);
+                    field += 8;
+                }
+                if (e.localHeaderOffset == 0xffffffff && field + 8 <= fieldEnd) {
+                    e.localHeaderOffset = readLE64(field);
+                }
+            }
+            x += 4 + len;
+        }
+        entries.push_back(std::move(e));
+        pos += ZIP_CDENTRY_SIZE + nameLen + extraLen + commentLen;
+    }
+    return entries;
+}
+
+void remote_zip::buildEntryIndex() {
+    _entryIndex.clear();
+    _entryIndex.reserve(_entries.size());
+    for (size_t i = 0; i < _entries.size(); i++) {
+        _entryIndex[_entries[i].name] = i;
+    }
+}
+
+bool remote_zip::loadIndexFile(const std::string &indexPath) {
+    std::ifstream in(indexPath);
+    if (!in.good()) return false;
+
+    // an archive replaced by one of the same size is only told apart by its validators
+    if (_etag.empty() && _lastModified.empty()) return false;
+
+    std::string line;
+    if (!std::getline(in, line) || line != ZIP_INDEX_MAGIC) return false;
+    if (!std::getline(in, line) || line != _url) return false;
+    if (!std::getline(in, line) || strtoull(line.c_str(), nullptr, 10) != _archiveSize) return false;
+    if (!std::getline(in, line) || line != _etag) return false;
+    if (!std::getline(in, line) || line != _lastModified) return false;
+    if (!std::getline(in, line)) return false;
+    uint64_t entryCount = strtoull(line.c_str(), nullptr, 10);
+    // a damaged index, the archive doesn't have room for that many central directory records
+    if (entryCount > _archiveSize / ZIP_CDENTRY_SIZE) return false;
+
+    std::vector<entry> entries;
+    entries.reserve(entryCount);
+    for (uint64_t i = 0; i < entryCount; i++) {
+        if (!std::getline(in, line)) return false;
+        entry e;
+        int nameOffset = 0;
+        unsigned int method = 0;
+        if (sscanf(line.c_str(), "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNx32 " %u %n",
+                   &e.localHeaderOffset, &e.compressedSize, &e.uncompressedSize, &e.crc32, &method, &nameOffset) != 5
+            || !nameOffset) {
+            return false;
+        }
+        e.method = (uint16_t) method;
+        e.name = line.substr(nameOffset);
+        entries.push_back(std::move(e));
+    }
+    _entries = std::move(entries);
+    return true;
+}
+
+void remote_zip::saveIndexFile(const std::string &indexPath) const {
+    // loadIndexFile() would never trust it
+    if (_etag.empty() && _lastModified.empty()) return;
+    std::string tmpPath = indexPath + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::out | std::ios::trunc);
+        if (!out.good()) {
+            debug("%s: can't write %s, not caching zip index\n", __func__, tmpPath.c_str());
+            return;
+        }
+        out << ZIP_INDEX_MAGIC << "\n" << _url << "\n" << _archiveSize << "\n" << _etag << "\n" << _lastModified << "\n"
+            << _entries.size() << "\n";
+        char buf[128]{};
+        for (const entry &e: _entries) {
+            snprintf(buf, sizeof(buf), "%" PRIu64 " %" PRIu64 " %" PRIu64 " %08" PRIx32 " %u ",
+                     e.localHeaderOffset, e.compressedSize, e.uncompressedSize, e.crc32, (unsigned int) e.method);
+            out << buf << e.name << "\n";
+        }
+        if (!out.good()) {
+            remove(tmpPath.c_str());
+            return;
+        }
+    }
+    // rename so a concurrent reader never sees a half written index
+    if (rename(tmpPath.c_str(), indexPath.c_str())) {
+        remove(indexPath.c_str());
+        rename(tmpPath.c_str(), indexPath.c_str());
+    }
+}
+
+const remote_zip::entry *remote_zip::getEntry(const std::string &name) const {
+    auto found = _entryIndex.find(name);
+    return (found != _entryIndex.end()) ? &_entries[found->second] : nullptr;
+}
+
+void remote_zip::openEntryTarget(const std::string &name, const std::string &dstPath, const entry **e, FILE **out) const {
+    *e = getEntry(name);
+    retassure(*e, "%s: %s not found in %s\n", __func__, name.c_str(), _url.c_str());
+    retassure((*e)->method == 0 || (*e)->method == 8, "%s: %s uses unsupported compression method %u\n", __func__,
+              name.c_str(), (unsigned int) (*e)->method);
+    *out = fopen(dstPath.c_str(), "wb");
+    retassure(*out, "%s: failed to create %s\n", __func__, dstPath.c_str());
+}
+
+uint64_t remote_zip::estimatedEntryEnd(const entry &e) {
+    // the local extra field may differ from the central one, leave some slack so one request usually suffices
+    return e.localHeaderOffset + ZIP_LOCAL_SIZE + e.name.size() + 0x100 + e.compressedSize;
+}
+
+namespace {
+    // fetches whatever part of the entry the extractor still misses
+    void fetchRemaining(const remote_zip &zip, const remote_zip::entry &e, entry_extractor &extractor,
+                        const remote_zip::progress_callback &progress) {
+        while (!extractor.done()) {
+            uint64_t offset = extractor.nextOffset();
+            uint64_t length = extractor.headerDone() ? e.compressedSize - extractor.consumed()
+                                                     : remote_zip::estimatedEntryEnd(e) - offset;
+            length = std::min(length, zip.archiveSize() - offset);
+            zip.fetchRange(offset, length, [&](const uint8_t *buf, size_t len) {
+                bool more = extractor.feed(buf, len);
+                if (progress && extractor.headerDone()) progress(extractor.consumed(), e.compressedSize);
+                return more;
+            });
+            retassure(extractor.errorString().empty(), "%s: %s: %s\n", __func__, e.name.c_str(),
+                      extractor.errorString().c_str());
+            retassure(extractor.nextOffset() != offset, "%s: %s: no progress at offset %" PRIu64 "\n", __func__,
+                      e.name.c_str(), offset);
+        }
+    }
+}
+
+void remote_zip::downloadEntry(const std::string &name, const std::string &dstPath, const progress_callback &progress,
+                               const data_callback &sink) const {
+    const entry *e = nullptr;
+    FILE *out = nullptr;
+    bool ok = false;
+    cleanup([&] {
+        safeFreeCustom(out, fclose);
+        if (!ok) remove(dstPath.c_str());
+    });
+    openEntryTarget(name, dstPath, &e, &out);
+
+    entry_extractor extractor(*e, out, sink);
+    fetchRemaining(*this, *e, extractor, progress);
+    retassure(extractor.verify(), "%s: %s: %s\n", __func__, name.c_str(), extractor.errorString().c_str());
+    ok = true;
+}
+
+std::vector<std::vector<size_t>> remote_zip::coalesce(const std::vector<std::string> &names, uint64_t maxGap,
+                                                      uint64_t maxSpan) const {
+    std::vector<std::vector<size_t>> groups;
+    std::vector<std::pair<const entry *, size_t>> known;
+    for (size_t i = 0; i < names.size(); i++) {
+        if (const entry *e = getEntry(names[i])) {
+            known.emplace_back(e, i);
+        } else {
+            // let the download itself report the missing entry
+            groups.push_back({i});
+        }
+    }
+    std::sort(known.begin(), known.end(), [](const auto &a, const auto &b) {
+        return a.first->localHeaderOffset < b.first->localHeaderOffset;
+    });
+
+    uint64_t groupStart = 0;
+    uint64_t groupEnd = 0;
+    for (const auto &k: known) {
+        const entry *e = k.first;
+        uint64_t end = estimatedEntryEnd(*e);
+        bool fits = groupEnd && e->localHeaderOffset <= groupEnd + maxGap && end - groupStart <= maxSpan;
+        if (!fits) {
+            groups.push_back({});
+            groupStart = e->localHeaderOffset;
+            groupEnd = 0;
+        }
+        groups.back().push_back(k.second);
+        groupEnd = std::max(groupEnd, end);
+    }
+    return groups;
+}
+
+void remote_zip::downloadEntries(const std::vector<extract_request> &requests) const {
+    if (requests.empty()) return;
+    if (requests.size() == 1) {
+        downloadEntry(requests[0].name, requests[0].dstPath, requests[0].progress, requests[0].sink);
+        return;
+    }
+
+    struct target {
+        const extract_request *req = nullptr;
+        const entry *e = nullptr;
+        FILE *out = nullptr;
+        std::unique_ptr<entry_extractor> extractor;
+    };
+    std::vector<target> targets(requests.size());
+    bool ok = false;
+    cleanup([&] {
+        for (auto &t: targets) {
+            t.extractor.reset();
+            safeFreeCustom(t.out, fclose);
+            if (!ok && t.req) remove(t.req->dstPath.c_str());
+        }
+    });
+    for (size_t i = 0; i < requests.size(); i++) {
+        targets[i].req = &requests[i];
+        openEntryTarget(requests[i].name, requests[i].dstPath, &targets[i].e, &targets[i].out);
+        targets[i].extractor = std::make_unique<entry_extractor>(*targets[i].e, targets[i].out, requests[i].sink);
+    }
+    std::sort(targets.begin(), targets.end(), [](const target &a, const target &b) {
+        return a.e->localHeaderOffset < b.e->localHeaderOffset;
+    });
+
+    /*
+     * One Range request spanning all entries, split locally.
+     * Bytes between entries are skipped, anything the span misses (e.g. a local extra field
+     * larger than estimated) is fetched per entry afterwards.
+     */
+    uint64_t start = targets.front().e->localHeaderOffset;
+    uint64_t end = start;
+    for (const auto &t: targets) {
+        end = std::max(end, estimatedEntryEnd(*t.e));
+    }
+    end = std::min(end, _archiveSize);
+    uint64_t pos = start;
+    size_t cur = 0;
+    fetchRange(start, end - start, [&](const uint8_t *buf, size_t len) {
+        while (len && cur < targets.size()) {
+            target &t = targets[cur];
+            uint64_t need = t.extractor->nextOffset();
+            if (pos > need) {
+                // entries overlap the previous one, leave the rest to fetchRemaining
+                return false;
+            }
+            if (pos < need) {
+                auto skip = (size_t) std::min<uint64_t>(len, need - pos);
+                buf += skip;
+                len -= skip;
+                pos += skip;
+                continue;
+            }
+            bool more = t.extractor->feed(buf, len);
+            auto used = (size_t) (t.extractor->nextOffset() - need);
+            if (t.req->progress && t.extractor->headerDone()) t.req->progress(t.extractor->consumed(), t.e->compressedSize);
+            if (!more && !t.extractor->done()) return false;
+            buf += used;
+            len -= used;
+            pos += used;
+            if (t.extractor->done()) cur++;
+        }
+        return cur < targets.size();
+    });
+
+    for (auto &t: targets) {
+        retassure(t.extractor->errorString().empty(), "%s: %s: %s\n", __func__, t.e->name.c_str(),
+                  t.extractor->errorString().c_str());
+        fetchRemaining(*this, *t.e, *t.extractor, t.req->progress);
+        retassure(t.extractor->verify(), "%s: %s: %s\n", __func__, t.e->name.c_str(), t.extractor->errorString().c_str());
+    }
+    ok = true;
+}
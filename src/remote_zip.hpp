@@ -0,0 +1,124 @@
+//
+//  remote_zip.hpp
+//  futurerestore
+//
+
+#ifndef remote_zip_hpp
+#define remote_zip_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Random access to a zip archive served over HTTP(S) with Range requests.
+ * The central directory is fetched once per URL and kept as an index of entry offsets and sizes,
+ * both in memory (shared by every handle for that URL) and on disk next to the downloaded components,
+ * so later runs only need a HEAD request to validate it against the archive's size, ETag and Last-Modified.
+ * All members are safe to call from several threads at once, every transfer uses its own curl handle.
+ */
+class remote_zip {
+public:
+    struct entry {
+        std::string name;
+        uint64_t localHeaderOffset = 0;
+        uint64_t compressedSize = 0;
+        uint64_t uncompressedSize = 0;
+        uint32_t crc32 = 0;
+        uint16_t method = 0;
+    };
+
+    // (bytes done, bytes total) of the compressed stream
+    typedef std::function<void(uint64_t, uint64_t)> progress_callback;
+    // return false to stop the transfer early
+    typedef std::function<bool(const uint8_t *, size_t)> write_callback;
+    // sees every decompressed byte in order, e.g. to hash an entry while it downloads
+    typedef std::function<void(const uint8_t *, size_t)> data_callback;
+    // returns the raw bytes [offset, offset+length) of an archive
+    typedef std::function<std::vector<uint8_t>(uint64_t, uint64_t)> range_reader;
+
+    struct extract_request {
+        std::string name;
+        std::string dstPath;
+        progress_callback progress;
+        data_callback sink;
+    };
+
+    // entries closer than this are fetched with one request, the bytes in between are thrown away
+    static constexpr uint64_t defaultCoalesceGap = 0x10000;
+    // but never let one request grow past this, so big entries still download in parallel
+    static constexpr uint64_t defaultCoalesceSpan = 0x1000000;
+
+private:
+    // the handle of one URL, opened by the first caller with lock held while the others wait for it
+    struct shared_handle {
+        std::mutex lock;
+        std::weak_ptr<remote_zip> zip;
+    };
+
+    std::string _url;
+    uint64_t _archiveSize = 0;
+    // validators from the HEAD response, empty if the server sent none
+    std::string _etag;
+    std::string _lastModified;
+    std::vector<entry> _entries;
+    std::unordered_map<std::string, size_t> _entryIndex;
+
+    static std::mutex _handlesLock;
+    static std::unordered_map<std::string, std::shared_ptr<shared_handle>> _handles;
+
+    explicit remote_zip(std::string url);
+
+    // HEAD request filling _archiveSize, _etag and _lastModified
+    void fetchArchiveInfo();
+    void fetchCentralDirectory();
+    void buildEntryIndex();
+    bool loadIndexFile(const std::string &indexPath);
+    void saveIndexFile(const std::string &indexPath) const;
+    void openEntryTarget(const std::string &name, const std::string &dstPath, const entry **e, FILE **out) const;
+
+public:
+    remote_zip(const remote_zip &) = delete;
+    remote_zip &operator=(const remote_zip &) = delete;
+
+    /*
+     * Returns the shared handle for url, creating it on first use.
+     * If indexDir is not empty the parsed central directory is cached there between runs.
+     */
+    static std::shared_ptr<remote_zip> open(const std::string &url, const std::string &indexDir = "");
+
+    const std::string &url() const {return _url;}
+    uint64_t archiveSize() const {return _archiveSize;}
+    const std::vector<entry> &entries() const {return _entries;}
+    const entry *getEntry(const std::string &name) const;
+    // upper bound for the end of an entry's local header + data, used to size requests
+    static uint64_t estimatedEntryEnd(const entry &e);
+    // parses the (zip64) end of central directory and the central directory, also used for local archives
+    static std::vector<entry> readCentralDirectory(uint64_t archiveSize, const range_reader &read,
+                                                   const std::string &archiveName);
+
+    // fetches the raw bytes [offset, offset+length) of the archive
+    void fetchRange(uint64_t offset, uint64_t length, const write_callback &writer) const;
+
+    // extracts one entry to dstPath, inflating and crc checking it on the fly
+    void downloadEntry(const std::string &name, const std::string &dstPath, const progress_callback &progress = nullptr,
+                       const data_callback &sink = nullptr) const;
+
+    /*
+     * Groups entries that sit close to each other in the archive.
+     * Returns indices into names, every group is meant to be passed to downloadEntries() as a whole.
+     */
+    std::vector<std::vector<size_t>> coalesce(const std::vector<std::string> &names,
+                                              uint64_t maxGap = defaultCoalesceGap,
+                                              uint64_t maxSpan = defaultCoalesceSpan) const;
+
+    // extracts several entries with a single Range request spanning all of them
+    void downloadEntries(const std::vector<extract_request> &requests) const;
+};
+
+#endif /* remote_zip_hpp */
@@ -0,0 +1,54 @@
+//
+//  session_cache.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <cstring>
+#include "session_cache.hpp"
+
+using namespace tihmstar;
+
+char *session_cache::firmwareJson(const std::string &name, const std::function<char *()> &fetch) {
+    std::lock_guard<std::mutex> guard(_jsonLock);
+    auto found = _jsons.find(name);
+    if (found == _jsons.end()) {
+        char *json = fetch();
+        // not cached, the next session tries again
+        if (!json) return nullptr;
+        found = _jsons.emplace(name, json).first;
+        free(json);
+    }
+    return strdup(found->second.c_str());
+}
+
+std::shared_ptr<session_cache::latest_firmware> session_cache::latestFirmware(const std::string &key) {
+    std::lock_guard<std::mutex> guard(_lock);
+    std::shared_ptr<latest_firmware> &latest = _latestFirmwares[key];
+    if (!latest) latest = std::make_shared<latest_firmware>();
+    return latest;
+}
+
+digest_index *session_cache::digestIndex(const std::string &indexPath, bool forceVerify) {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (!_digestIndex) {
+        _digestIndex = std::make_unique<digest_index>(indexPath);
+        _digestIndex->setForceVerify(forceVerify);
+    }
+    return _digestIndex.get();
+}
+
+std::mutex &session_cache::fetchLock(const std::string &digest) {
+    std::lock_guard<std::mutex> guard(_lock);
+    std::unique_ptr<std::mutex> &lock = _fetchLocks[digest];
+    if (!lock) lock = std::make_unique<std::mutex>();
+    return *lock;
+}
+
+component_store *session_cache::componentStore(const std::string &root, digest_index *index, uint64_t budget) {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (!_componentStore) {
+        _componentStore = std::make_unique<component_store>(root, index, budget);
+    }
+    return _componentStore.get();
+}
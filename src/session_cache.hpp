@@ -0,0 +1,61 @@
+//
+//  session_cache.hpp
+//  futurerestore
+//
+
+#ifndef session_cache_hpp
+#define session_cache_hpp
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "component_store.hpp"
+#include "digest_index.hpp"
+
+/*
+ * Firmware lookups and caches shared by the futurerestore sessions of a multi-device run.
+ * Firmware lists are fetched once, the latest manifest once per device model and custom-latest selection,
+ * and all sessions go through one digest index and component store. remote_zip already shares its handles
+ * per URL. Everything is created by the first session that asks for it, the others wait for it.
+ */
+class session_cache {
+public:
+    // latest firmware of one model, filled by the first session that looks it up with lock held
+    struct latest_firmware {
+        std::mutex lock;
+        std::string manifest;
+        std::string url;
+    };
+
+private:
+    std::mutex _lock;
+    std::mutex _jsonLock;
+    std::map<std::string, std::string> _jsons;
+    std::map<std::string, std::shared_ptr<latest_firmware>> _latestFirmwares;
+    std::unique_ptr<digest_index> _digestIndex;
+    std::unique_ptr<component_store> _componentStore;
+    std::map<std::string, std::unique_ptr<std::mutex>> _fetchLocks;
+    std::mutex _extractionLock;
+
+public:
+    session_cache() = default;
+    session_cache(const session_cache &) = delete;
+    session_cache &operator=(const session_cache &) = delete;
+
+    // a copy for the caller to free, fetch() runs once per name and returns a malloc'd string or nullptr
+    char *firmwareJson(const std::string &name, const std::function<char *()> &fetch);
+    std::shared_ptr<latest_firmware> latestFirmware(const std::string &key);
+    digest_index *digestIndex(const std::string &indexPath, bool forceVerify);
+    component_store *componentStore(const std::string &root, digest_index *index, uint64_t budget);
+
+    // held while a session looks up and downloads the component with this raw digest, so it is only fetched once
+    // while sessions fetching different components don't wait for each other
+    std::mutex &fetchLock(const std::string &digest);
+    // lock_file() only excludes other processes, sessions extracting a filesystem take this as well
+    std::mutex &extractionLock() {return _extractionLock;}
+};
+
+#endif /* session_cache_hpp */
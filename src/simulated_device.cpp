@@ -0,0 +1,374 @@
+//
+//  simulated_device.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <sys/stat.h>
+#include "simulated_device.hpp"
+#include "device_state_machine.hpp"
+#include "futurerestore.hpp"
+
+extern "C" {
+#include "common.h"
+#include "idevicerestore.h"
+}
+
+using namespace tihmstar;
+
+static const char *bootNonceKey = "com.apple.System.boot-nonce";
+
+simulated_device_backend::simulated_device_backend(config config)
+        : _config(std::move(config)), _random(_config.ecid) {
+    retassure(_config.linkBytesPerSecond > 0, "simulated link needs a positive bandwidth\n");
+    retassure(_config.nonceSize == 20 || _config.nonceSize == 32, "simulated nonce size must be 20 or 32\n");
+    for (const std::string &nonce: _config.nonces) {
+        retassure(nonce.size() == _config.nonceSize, "simulated nonce doesn't have nonce-size bytes\n");
+    }
+    for (int i = 0; i < 20; i++) _sepNonce.push_back((char) _random());
+    nextNonce();
+}
+
+simulated_device_backend::~simulated_device_backend() {
+    if (_transition.joinable()) _transition.join();
+}
+
+static bool parseUnsigned(const std::string &value, int base, uint64_t &parsed) {
+    if (value.empty() || !isxdigit((unsigned char) value[0])) return false;
+    char *end = nullptr;
+    errno = 0;
+    parsed = strtoull(value.c_str(), &end, base);
+    return !errno && !*end;
+}
+
+simulated_device_backend::config simulated_device_backend::parseConfig(const std::string &spec) {
+    config config;
+    std::stringstream fields(spec);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        if (field.empty()) continue;
+        size_t eq = field.find('=');
+        retassure(eq != std::string::npos, "simulated device option %s has no value\n", field.c_str());
+        std::string key = field.substr(0, eq);
+        std::string value = field.substr(eq + 1);
+        auto milliseconds = [&key, &value]() {
+            uint64_t parsed = 0;
+            retassure(parseUnsigned(value, 10, parsed) && parsed <= UINT_MAX,
+                      "simulated device option %s needs milliseconds, got \"%s\"\n", key.c_str(), value.c_str());
+            return (unsigned int) parsed;
+        };
+        if (key == "board") {
+            config.board = value;
+        } else if (key == "ecid") {
+            retassure(parseUnsigned(value, 0, config.ecid) && config.ecid,
+                      "simulated device option %s needs a non-zero ECID, got \"%s\"\n", key.c_str(), value.c_str());
+        } else if (key == "mode") {
+            retassure(value == "dfu" || value == "recovery", "simulated device mode must be dfu or recovery\n");
+            config.startInDfu = value == "dfu";
+        } else if (key == "link") {
+            char *end = nullptr;
+            double megabytes = strtod(value.c_str(), &end);
+            retassure(!value.empty() && !*end && std::isfinite(megabytes) && megabytes > 0,
+                      "simulated device option %s needs a positive MB/s value, got \"%s\"\n", key.c_str(),
+                      value.c_str());
+            config.linkBytesPerSecond = megabytes * 1e6;
+        } else if (key == "disconnect") {
+            config.disconnectMs = milliseconds();
+        } else if (key == "reboot") {
+            config.rebootMs = milliseconds();
+        } else if (key == "restore-boot") {
+            config.restoreBootMs = milliseconds();
+        } else if (key == "restore") {
+            config.restoreMs = milliseconds();
+        } else if (key == "nonce-size") {
+            uint64_t size = 0;
+            retassure(parseUnsigned(value, 10, size) && (size == 20 || size == 32),
+                      "simulated device option %s must be 20 or 32, got \"%s\"\n", key.c_str(), value.c_str());
+            config.nonceSize = (size_t) size;
+        } else if (key == "nonces") {
+            std::stringstream hexNonces(value);
+            std::string hex;
+            while (std::getline(hexNonces, hex, ':')) {
+                retassure(!hex.empty() && hex.size() % 2 == 0 && hex.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos,
+                          "simulated device option %s: \"%s\" is not a hex nonce\n", key.c_str(), hex.c_str());
+                std::string nonce;
+                for (size_t i = 0; i < hex.size(); i += 2) {
+                    nonce.push_back((char) strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+                }
+                config.nonces.push_back(std::move(nonce));
+            }
+        } else {
+            reterror("unknown simulated device option %s\n", key.c_str());
+        }
+    }
+    return config;
+}
+
+void simulated_device_backend::report() const {
+    info("Simulated device: %u reboots, %.1f MB sent\n", _reboots, (double) _bytesSent / 1e6);
+}
+
+void simulated_device_backend::setMode(struct idevicerestore_client_t *client, int mode) {
+    // same lock order as callers that run a device_state_machine action: event mutex first
+    mutex_lock(&client->device_event_mutex);
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _mode = mode;
+        if (mode != _MODE_UNKNOWN) _inTransition = false;
+    }
+    if (mode == _MODE_UNKNOWN && client->mode && client->mode->index != _MODE_UNKNOWN) {
+        client_event_source::deviceRemoved(client);
+    }
+    client->mode = &idevicerestore_modes[mode];
+    cond_signal(&client->device_event_cond);
+    mutex_unlock(&client->device_event_mutex);
+}
+
+bool simulated_device_backend::answers(int mode) {
+    std::lock_guard<std::mutex> guard(_lock);
+    return !_inTransition && _mode == mode;
+}
+
+void simulated_device_backend::transfer(uint64_t size) {
+    std::this_thread::sleep_for(std::chrono::duration<double>((double) size / _config.linkBytesPerSecond));
+    std::lock_guard<std::mutex> guard(_lock);
+    _bytesSent += size;
+}
+
+void simulated_device_backend::nextNonce() {
+    auto generator = _savedEnv.find(bootNonceKey);
+    uint64_t generatorValue = 0;
+    // runs on the boot thread, a generator iBoot couldn't parse is ignored like on a real device
+    if (generator != _savedEnv.end() && parseUnsigned(generator->second, 16, generatorValue)) {
+        _nonce = futurerestore::nonceForGenerator(generatorValue, _config.nonceSize);
+    } else if (!_config.nonces.empty()) {
+        _nonce = _config.nonces[_boots % _config.nonces.size()];
+    } else {
+        _nonce.clear();
+        for (size_t i = 0; i < _config.nonceSize; i++) _nonce.push_back((char) _random());
+    }
+}
+
+void simulated_device_backend::reboot(struct idevicerestore_client_t *client, int mode, unsigned int bootMs) {
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _inTransition = true;
+        _reboots++;
+    }
+    // the previous boot is done once the device answered, its thread has nothing left to do
+    if (_transition.joinable()) _transition.join();
+    _transition = std::thread([this, client, mode, bootMs] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(_config.disconnectMs));
+        setMode(client, _MODE_UNKNOWN);
+        std::this_thread::sleep_for(std::chrono::milliseconds(bootMs));
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _boots++;
+            nextNonce();
+        }
+        setMode(client, mode);
+    });
+}
+
+void simulated_device_backend::bootedDfuImage(struct idevicerestore_client_t *client) {
+    // iBSS comes back in DFU mode on the chips enterPwnRecovery sends iBEC over DFU for
+    bool toDfu = ++_dfuImages == 1 && _bootsIBSSToDfu;
+    reboot(client, toDfu ? _MODE_DFU : _MODE_RECOVERY, _config.rebootMs);
+}
+
+int simulated_device_backend::checkMode(struct idevicerestore_client_t *client) {
+    if (!_started) {
+        retassure(irecv_devices_get_device_by_hardware_model(_config.board.c_str(), &client->device) ==
+                  IRECV_E_SUCCESS, "unknown simulated board %s\n", _config.board.c_str());
+        uint32_t chip = client->device->chip_id;
+        _bootsIBSSToDfu = (chip >= 0x7000 && chip <= 0x8004) || (chip >= 0x8900 && chip <= 0x8965);
+        client->ecid = _config.ecid;
+        if (!client->srnm) client->srnm = strdup(_config.serial.c_str());
+        _started = true;
+        setMode(client, _config.startInDfu ? _MODE_DFU : _MODE_RECOVERY);
+    }
+    std::lock_guard<std::mutex> guard(_lock);
+    return _inTransition ? _MODE_UNKNOWN : _mode;
+}
+
+bool simulated_device_backend::isImage4Supported(struct idevicerestore_client_t *client) {
+    return true;
+}
+
+int simulated_device_backend::getPreflightInfo(struct idevicerestore_client_t *client, plist_t *info) {
+    // like a device that is in recovery already
+    return -1;
+}
+
+void simulated_device_backend::subscribeEvents(struct idevicerestore_client_t *client) {
+    // events come from the boot threads, the context only marks the client as subscribed
+    client->idevice_e_ctx = this;
+}
+
+void simulated_device_backend::unsubscribeEvents(struct idevicerestore_client_t *client) {
+    client->idevice_e_ctx = nullptr;
+}
+
+int simulated_device_backend::connect(struct idevicerestore_client_t *client, int mode) {
+    return (answers(_MODE_DFU) || answers(_MODE_RECOVERY)) ? 0 : -1;
+}
+
+void simulated_device_backend::disconnect(struct idevicerestore_client_t *client) {
+}
+
+void simulated_device_backend::close(struct idevicerestore_client_t *client) {
+    // a boot still under way would report its mode to a freed client
+    if (_transition.joinable()) _transition.join();
+}
+
+int simulated_device_backend::setConfiguration(struct idevicerestore_client_t *client, int configuration) {
+    return answers(_MODE_UNKNOWN) ? -1 : 0;
+}
+
+irecv_error_t simulated_device_backend::sendBuffer(struct idevicerestore_client_t *client, const unsigned char *data,
+                                                   size_t size) {
+    if (answers(_MODE_DFU)) {
+        transfer(size);
+        bootedDfuImage(client);
+    } else if (answers(_MODE_RECOVERY)) {
+        transfer(size);
+        std::lock_guard<std::mutex> guard(_lock);
+        _pendingImage = true;
+    } else {
+        return IRECV_E_NO_DEVICE;
+    }
+    return IRECV_E_SUCCESS;
+}
+
+irecv_error_t simulated_device_backend::bootBuffer(struct idevicerestore_client_t *client, const unsigned char *data,
+                                                   size_t size) {
+    if (!answers(_MODE_DFU) && !answers(_MODE_RECOVERY)) return IRECV_E_NO_DEVICE;
+    transfer(size);
+    reboot(client, _MODE_RECOVERY, _config.rebootMs);
+    return IRECV_E_SUCCESS;
+}
+
+irecv_error_t simulated_device_backend::sendCommand(struct idevicerestore_client_t *client, const char *command) {
+    if (!answers(_MODE_DFU) && !answers(_MODE_RECOVERY)) return IRECV_E_NO_DEVICE;
+    if (!strcmp(command, "go")) {
+        bool pending;
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            pending = _pendingImage;
+            _pendingImage = false;
+        }
+        if (pending) reboot(client, _MODE_RECOVERY, _config.rebootMs);
+    }
+    return IRECV_E_SUCCESS;
+}
+
+irecv_error_t simulated_device_backend::getEnv(struct idevicerestore_client_t *client, const char *name,
+                                               char **value) {
+    if (!answers(_MODE_RECOVERY)) return IRECV_E_NO_DEVICE;
+    std::lock_guard<std::mutex> guard(_lock);
+    if (!strcmp(name, "build-version")) {
+        *value = strdup(_config.ibootBuild.c_str());
+        return IRECV_E_SUCCESS;
+    }
+    auto found = _env.find(name);
+    if (found == _env.end()) return IRECV_E_UNKNOWN_ERROR;
+    *value = strdup(found->second.c_str());
+    return IRECV_E_SUCCESS;
+}
+
+irecv_error_t simulated_device_backend::setEnv(struct idevicerestore_client_t *client, const char *name,
+                                               const char *value) {
+    if (!answers(_MODE_RECOVERY)) return IRECV_E_NO_DEVICE;
+    std::lock_guard<std::mutex> guard(_lock);
+    _env[name] = value;
+    return IRECV_E_SUCCESS;
+}
+
+irecv_error_t simulated_device_backend::saveEnv(struct idevicerestore_client_t *client) {
+    if (!answers(_MODE_RECOVERY)) return IRECV_E_NO_DEVICE;
+    std::lock_guard<std::mutex> guard(_lock);
+    _savedEnv = _env;
+    return IRECV_E_SUCCESS;
+}
+
+int simulated_device_backend::setAutoboot(struct idevicerestore_client_t *client, bool enable) {
+    if (!answers(_MODE_RECOVERY)) return -1;
+    std::lock_guard<std::mutex> guard(_lock);
+    _autoboot = enable;
+    return 0;
+}
+
+int simulated_device_backend::enterRecovery(struct idevicerestore_client_t *client) {
+    if (!answers(_MODE_NORMAL)) return -1;
+    reboot(client, _MODE_RECOVERY, _config.rebootMs);
+    return 0;
+}
+
+int simulated_device_backend::reset(struct idevicerestore_client_t *client) {
+    if (!answers(_MODE_RECOVERY)) return -1;
+    bool autoboot;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        autoboot = _autoboot;
+    }
+    reboot(client, autoboot ? _MODE_NORMAL : _MODE_RECOVERY, _config.rebootMs);
+    return 0;
+}
+
+int simulated_device_backend::getApNonce(struct idevicerestore_client_t *client, unsigned char **nonce,
+                                         int *nonceSize) {
+    if (!answers(_MODE_DFU) && !answers(_MODE_RECOVERY)) return -1;
+    std::lock_guard<std::mutex> guard(_lock);
+    *nonce = (unsigned char *) malloc(_nonce.size());
+    memcpy(*nonce, _nonce.data(), _nonce.size());
+    *nonceSize = (int) _nonce.size();
+    return 0;
+}
+
+int simulated_device_backend::getSepNonce(struct idevicerestore_client_t *client, unsigned char **nonce,
+                                          int *nonceSize) {
+    if (!answers(_MODE_DFU) && !answers(_MODE_RECOVERY)) return -1;
+    *nonce = (unsigned char *) malloc(_sepNonce.size());
+    memcpy(*nonce, _sepNonce.data(), _sepNonce.size());
+    *nonceSize = (int) _sepNonce.size();
+    return 0;
+}
+
+int simulated_device_backend::sendComponent(struct idevicerestore_client_t *client, plist_t build_identity,
+                                            const char *component) {
+    if (!answers(_MODE_DFU)) return -1;
+    transfer(_config.componentBytes);
+    bootedDfuImage(client);
+    return 0;
+}
+
+int simulated_device_backend::sendIBEC(struct idevicerestore_client_t *client, plist_t build_identity) {
+    if (!answers(_MODE_RECOVERY)) return -1;
+    transfer(_config.componentBytes);
+    reboot(client, _MODE_RECOVERY, _config.rebootMs);
+    return 0;
+}
+
+int simulated_device_backend::enterRestore(struct idevicerestore_client_t *client, plist_t build_identity) {
+    if (!answers(_MODE_RECOVERY)) return -1;
+    transfer(_config.restoreImageBytes);
+    reboot(client, _MODE_RESTORE, _config.restoreBootMs);
+    return 0;
+}
+
+int simulated_device_backend::restore(struct idevicerestore_client_t *client, plist_t build_identity,
+                                      const char *filesystem) {
+    if (!answers(_MODE_RESTORE)) return -1;
+    struct stat st{};
+    if (filesystem && stat(filesystem, &st) == 0) transfer(st.st_size);
+    std::this_thread::sleep_for(std::chrono::milliseconds(_config.restoreMs));
+    return 0;
+}
@@ -0,0 +1,112 @@
+//
+//  simulated_device.hpp
+//  futurerestore
+//
+
+#ifndef simulated_device_hpp
+#define simulated_device_hpp
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "device_backend.hpp"
+
+/*
+ * A device that only exists in this process, for timing restore orchestration without hardware.
+ * Transfers take size / linkBytesPerSecond, every boot drops the device off the bus for disconnectMs and brings it
+ * back after rebootMs, both reported as device events from a worker thread. Images sent in DFU mode boot by
+ * themselves, iBoot stages wait for "go", and a generator saved to nvram decides the ApNonce after the next boot
+ * just like on a pwned device. Without one, each boot reports the next entry of nonces, or a random nonce.
+ * Only image4 devices are modelled.
+ */
+class simulated_device_backend : public device_backend {
+public:
+    struct config {
+        std::string board = "d22ap";
+        uint64_t ecid = 0x1a2b3c4d5e6f;
+        std::string serial = "SIMULATED0000";
+        std::string ibootBuild = "iBoot-7459.101.2";
+        bool startInDfu = false;                    // otherwise the device starts in recovery mode
+        double linkBytesPerSecond = 30e6;           // bulk throughput of a USB 2.0 port
+        unsigned int disconnectMs = 300;            // boot or reset until the device drops off the bus
+        unsigned int rebootMs = 1500;               // off the bus until the next stage enumerates
+        unsigned int restoreBootMs = 15000;         // restore ramdisk booting
+        unsigned int restoreMs = 60000;             // restore itself, on top of sending the filesystem
+        uint64_t componentBytes = 1 << 20;          // size of an image sent by idevicerestore's senders
+        uint64_t restoreImageBytes = 120 << 20;     // ramdisk, devicetree, kernel etc. for entering restore mode
+        size_t nonceSize = 32;
+        std::vector<std::string> nonces;            // raw nonces reported one per boot, in turn
+    };
+
+private:
+    config _config;
+    std::mutex _lock;
+    std::thread _transition;
+    std::mt19937_64 _random;
+    int _mode = 0;                  // _MODE_*, only changed by setMode
+    bool _started = false;
+    bool _inTransition = false;     // a boot is under way, the device doesn't answer
+    bool _bootsIBSSToDfu = false;
+    unsigned int _dfuImages = 0;
+    bool _pendingImage = false;
+    bool _autoboot = false;
+    size_t _boots = 0;
+    std::string _nonce;
+    std::string _sepNonce;
+    std::map<std::string, std::string> _env;
+    std::map<std::string, std::string> _savedEnv;
+    uint64_t _bytesSent = 0;
+    unsigned int _reboots = 0;
+
+    void setMode(struct idevicerestore_client_t *client, int mode);
+    void transfer(uint64_t size);
+    void reboot(struct idevicerestore_client_t *client, int mode, unsigned int bootMs);
+    void bootedDfuImage(struct idevicerestore_client_t *client);
+    bool answers(int mode);
+    void nextNonce();
+
+public:
+    explicit simulated_device_backend(config config);
+    simulated_device_backend(const simulated_device_backend &) = delete;
+    simulated_device_backend &operator=(const simulated_device_backend &) = delete;
+    ~simulated_device_backend() override;
+
+    // "key=value,..." with keys board, ecid, mode (dfu/recovery), link (MB/s), disconnect, reboot, restore-boot,
+    // restore (ms), nonce-size and nonces (hex, separated by ':')
+    static config parseConfig(const std::string &spec);
+    void report() const;
+
+    int checkMode(struct idevicerestore_client_t *client) override;
+    bool isImage4Supported(struct idevicerestore_client_t *client) override;
+    int getPreflightInfo(struct idevicerestore_client_t *client, plist_t *info) override;
+    void subscribeEvents(struct idevicerestore_client_t *client) override;
+    void unsubscribeEvents(struct idevicerestore_client_t *client) override;
+
+    int connect(struct idevicerestore_client_t *client, int mode) override;
+    void disconnect(struct idevicerestore_client_t *client) override;
+    void close(struct idevicerestore_client_t *client) override;
+    int setConfiguration(struct idevicerestore_client_t *client, int configuration) override;
+
+    irecv_error_t sendBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) override;
+    irecv_error_t bootBuffer(struct idevicerestore_client_t *client, const unsigned char *data, size_t size) override;
+    irecv_error_t sendCommand(struct idevicerestore_client_t *client, const char *command) override;
+    irecv_error_t getEnv(struct idevicerestore_client_t *client, const char *name, char **value) override;
+    irecv_error_t setEnv(struct idevicerestore_client_t *client, const char *name, const char *value) override;
+    irecv_error_t saveEnv(struct idevicerestore_client_t *client) override;
+    int setAutoboot(struct idevicerestore_client_t *client, bool enable) override;
+    int enterRecovery(struct idevicerestore_client_t *client) override;
+    int reset(struct idevicerestore_client_t *client) override;
+    int getApNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) override;
+    int getSepNonce(struct idevicerestore_client_t *client, unsigned char **nonce, int *nonceSize) override;
+
+    int sendComponent(struct idevicerestore_client_t *client, plist_t build_identity, const char *component) override;
+    int sendIBEC(struct idevicerestore_client_t *client, plist_t build_identity) override;
+    int enterRestore(struct idevicerestore_client_t *client, plist_t build_identity) override;
+    int restore(struct idevicerestore_client_t *client, plist_t build_identity, const char *filesystem) override;
+};
+
+#endif /* simulated_device_hpp */
@@ -0,0 +1,167 @@
+//
+//  blob_checker_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include "test.hpp"
+#include "manifest_builder.hpp"
+#include "ticket_builder.hpp"
+#include "../blob_checker.hpp"
+
+namespace {
+    // CSV records, a quoted field may span lines
+    std::vector<std::string> records(const std::string &csv) {
+        std::vector<std::string> rows;
+        std::string row;
+        bool quoted = false;
+        for (char c: csv) {
+            if (c == '"') quoted = !quoted;
+            if (c == '\n' && !quoted) {
+                rows.push_back(row);
+                row.clear();
+            } else {
+                row.push_back(c);
+            }
+        }
+        return rows;
+    }
+
+    bool hasRow(const std::vector<std::string> &rows, const std::string &prefix) {
+        return std::any_of(rows.begin(), rows.end(), [&](const std::string &row) {
+            return row.compare(0, prefix.size(), prefix) == 0;
+        });
+    }
+
+    template <typename F>
+    std::vector<std::string> writeCsv(const std::string &path, F write) {
+        FILE *out = fopen(path.c_str(), "w");
+        retassure(out, "failed to create %s\n", path.c_str());
+        write(out);
+        fclose(out);
+        return records(tests::readFile(path));
+    }
+
+    std::string fromHex(const char *hex) {
+        std::string bytes;
+        for (; hex[0] && hex[1]; hex += 2) {
+            bytes.push_back((char) std::stoi(std::string(hex, 2), nullptr, 16));
+        }
+        return bytes;
+    }
+
+    ticket_builder d22Ticket() {
+        ticket_builder ticket;
+        ticket.ecid = 0x1234;
+        ticket.boardId = 0x0e;
+        ticket.chipId = 0x8015;
+        ticket.nonce = std::string(32, '\x11');
+        return ticket;
+    }
+}
+
+TEST_CASE("blob_checker", "writes a row for every ticket and firmware") {
+    tests::temp_dir dir;
+    std::string good = dir.file("good.shsh2");
+    std::string noEcid = dir.file("noecid.shsh2");
+    std::string old = dir.file("old.shsh");
+    d22Ticket().write(good);
+    ticket_builder withoutEcid = d22Ticket();
+    withoutEcid.ecid = 0;
+    withoutEcid.write(noEcid);
+    // a 32-bit device's ticket has no IM4M
+    d22Ticket().write(old, "APTicket");
+
+    std::string d22 = dir.file("d22.plist");
+    std::string d21 = dir.file("d21.plist");
+    std::string missing = dir.file("missing.plist");
+    manifest_builder d22Manifest;
+    d22Manifest.version("16.5", "20F66").identity("d22ap", false).ids(0x0e, 0x8015);
+    tests::writeFile(d22, d22Manifest.xml());
+    manifest_builder d21Manifest;
+    d21Manifest.version("16.5", "20F66").identity("d21ap", false).ids(0x0c, 0x8015);
+    tests::writeFile(d21, d21Manifest.xml());
+
+    blob_checker checker;
+    checker.addTickets({dir.path().c_str()}, 2);
+    checker.addFirmwares({d22, d21, missing}, 2);
+    size_t compatible = 0;
+    auto rows = writeCsv(dir.file("matrix.csv"), [&](FILE *out) {
+        compatible = checker.run(out, 2);
+    });
+
+    // main exits with 1 when this is 0
+    CHECK(compatible == 1);
+    CHECK(rows.size() == 1 + 3 * 3);
+    CHECK(rows[0] == "ticket,ecid,signature,firmware,version,build,result,device_class,variant,error");
+    CHECK(hasRow(rows, good + ",4660,invalid," + d22 + ",16.5,20F66,match,d22ap,Customer Erase Install (IPSW),"));
+    CHECK(hasRow(rows, good + ",4660,invalid," + d21 + ",16.5,20F66,no-match,,,"));
+    CHECK(hasRow(rows, noEcid + ",0,invalid," + d22 + ",16.5,20F66,no-ecid,,,"));
+    CHECK(hasRow(rows, old + ",,," + d22 + ",16.5,20F66,error,,,"));
+    CHECK(hasRow(rows, good + ",4660,invalid," + missing + ",,,error,,,"));
+    // errors say what went wrong
+    CHECK(std::none_of(rows.begin(), rows.end(), [](const std::string &row) {
+        return row.size() > 9 && row.compare(row.size() - 9, 9, ",error,,,") == 0;
+    }));
+}
+
+TEST_CASE("blob_checker", "flags tickets it can't audit") {
+    tests::temp_dir dir;
+    std::string old = dir.file("old.shsh");
+    std::string noNonce = dir.file("nononce.shsh2");
+    ticket_builder ticket = d22Ticket();
+    ticket.generator = "0x1111111111111111";
+    ticket.write(old, "APTicket");
+    ticket.nonce.clear();
+    ticket.write(noNonce);
+
+    blob_checker checker;
+    checker.addTickets({old.c_str(), noNonce.c_str()}, 2);
+    size_t flagged = 0;
+    auto rows = writeCsv(dir.file("audit.csv"), [&](FILE *out) {
+        flagged = checker.auditGenerators(out, 2);
+    });
+
+    // main exits with 1 for these
+    CHECK(flagged == 2);
+    CHECK(rows.size() == 3);
+    CHECK(rows[0] == "ticket,ecid,generator,nonce,expected_nonce,result,error");
+    CHECK(hasRow(rows, old + ",,,,,error,"));
+    CHECK(hasRow(rows, noNonce + ",4660,0x1111111111111111,,,no-nonce,"));
+}
+
+TEST_CASE("blob_checker", "audits generators against the nonces tickets were signed for") {
+    tests::temp_dir dir;
+    std::string good = dir.file("good.shsh2");
+    std::string bad = dir.file("bad.shsh2");
+    std::string sha1 = dir.file("sha1.shsh2");
+    ticket_builder ticket = d22Ticket();
+    ticket.generator = "0x1111111111111111";
+    // what a device reports after setting 0x1111111111111111
+    ticket.nonce = fromHex("27325c8258be46e69d9ee57fa9a8fbc28b873df434e5e702a8b27999551138ae");
+    ticket.write(good);
+    // the nonce of 0xbd34a880be0b53f3 with the wrong generator saved next to it
+    ticket.nonce = fromHex("15400076bc4c35a7c8caefdcae5bda69c140a11bce870548f0862aac28c194cc");
+    ticket.write(bad);
+    ticket.nonce = fromHex("3a88b7c3802f2f0510abc432104a15ebd8bd7154");
+    ticket.write(sha1);
+
+    blob_checker checker;
+    checker.addTickets({good.c_str(), bad.c_str(), sha1.c_str()}, 2);
+    size_t flagged = 0;
+    auto rows = writeCsv(dir.file("audit.csv"), [&](FILE *out) {
+        flagged = checker.auditGenerators(out, 2);
+    });
+
+    CHECK(flagged == 1);
+    CHECK(rows.size() == 4);
+    CHECK(hasRow(rows, good + ",4660,0x1111111111111111,"
+                              "27325c8258be46e69d9ee57fa9a8fbc28b873df434e5e702a8b27999551138ae,"
+                              "27325c8258be46e69d9ee57fa9a8fbc28b873df434e5e702a8b27999551138ae,ok,"));
+    CHECK(hasRow(rows, bad + ",4660,0x1111111111111111,"
+                             "15400076bc4c35a7c8caefdcae5bda69c140a11bce870548f0862aac28c194cc,"
+                             "27325c8258be46e69d9ee57fa9a8fbc28b873df434e5e702a8b27999551138ae,mismatch,"));
+    CHECK(hasRow(rows, sha1 + ",4660,0x1111111111111111,3a88b7c3802f2f0510abc432104a15ebd8bd7154,"
+                              "3a88b7c3802f2f0510abc432104a15ebd8bd7154,ok,"));
+}
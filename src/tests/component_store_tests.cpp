@@ -0,0 +1,179 @@
+//
+//  component_store_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "test.hpp"
+#include "../component_store.hpp"
+#include "../digest_stream.hpp"
+
+namespace {
+    std::string sha384(const std::string &data) {
+        digest_stream digest(0);
+        digest.update(data.data(), data.size());
+        return digest.finish();
+    }
+
+    size_t filesIn(const std::string &path) {
+        size_t count = 0;
+        if (DIR *dir = opendir(path.c_str())) {
+            while (struct dirent *file = readdir(dir)) {
+                if (file->d_name[0] != '.') count++;
+            }
+            closedir(dir);
+        }
+        return count;
+    }
+
+    // a file an earlier run left in the store, last touched at mtime
+    std::string cachedFile(component_store &store, const std::string &content, time_t mtime) {
+        std::string digest = sha384(content);
+        std::string path = store.pathFor((const unsigned char *) digest.data(), digest.size());
+        mkdir(path.substr(0, path.find_last_of('/')).c_str(), 0755);
+        tests::writeFile(path, content);
+        struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+        utimensat(AT_FDCWD, path.c_str(), times, 0);
+        return path;
+    }
+}
+
+TEST_CASE("component_store", "stages concurrent downloads of one component separately") {
+    tests::temp_dir dir;
+    std::string root = dir.file("store");
+    std::string content = "iBSS";
+    std::string digest = sha384(content);
+    auto *raw = (const unsigned char *) digest.data();
+    {
+        digest_index index(dir.file("digests"));
+        component_store store(root, &index);
+        std::string first = store.newStagingFile(raw, digest.size());
+        std::string second = store.newStagingFile(raw, digest.size());
+        CHECK(first != second);
+        CHECK(tests::fileExists(first) && tests::fileExists(second));
+        CHECK(!store.lookup(raw, digest.size()));
+
+        tests::writeFile(first, content);
+        tests::writeFile(second, content);
+        store.commit(raw, digest.size(), first);
+        store.commit(raw, digest.size(), second);
+        CHECK(tests::readFile(store.pathFor(raw, digest.size())) == content);
+        CHECK(filesIn(root + "/staging") == 0);
+        CHECK(store.lookup(raw, digest.size()));
+    }
+}
+
+TEST_CASE("component_store", "sweeps abandoned staging files") {
+    tests::temp_dir dir;
+    std::string digest = sha384("iBSS");
+    auto *raw = (const unsigned char *) digest.data();
+    digest_index index(dir.file("digests"));
+    component_store store(dir.file("store"), &index);
+    std::string abandoned = store.newStagingFile(raw, digest.size());
+    std::string active = store.newStagingFile(raw, digest.size());
+    struct timespec twoDaysAgo[2] = {{time(nullptr) - 2 * 24 * 60 * 60, 0}, {time(nullptr) - 2 * 24 * 60 * 60, 0}};
+    utimensat(AT_FDCWD, abandoned.c_str(), twoDaysAgo, 0);
+
+    store.evict();
+    CHECK(!tests::fileExists(abandoned));
+    CHECK(tests::fileExists(active));
+}
+
+TEST_CASE("component_store", "evicts the least recently used files down to the budget") {
+    tests::temp_dir dir;
+    digest_index index(dir.file("digests"));
+    std::string block(0x1000, 'x');
+    component_store store(dir.file("store"), &index, 0x1000 * 5 / 2);
+    std::string oldest = cachedFile(store, block + "1", 1600000000);
+    std::string older = cachedFile(store, block + "2", 1600000100);
+    std::string newest = cachedFile(store, block + "3", 1600000200);
+
+    store.evict();
+    CHECK(!tests::fileExists(oldest));
+    CHECK(tests::fileExists(older) && tests::fileExists(newest));
+    // within budget, nothing else goes
+    store.evict();
+    CHECK(tests::fileExists(older));
+
+    store.setBudget(0x1000 + 1);
+    store.evict();
+    CHECK(!tests::fileExists(older));
+    CHECK(tests::fileExists(newest));
+}
+
+TEST_CASE("component_store", "orders eviction by last use before mtime") {
+    tests::temp_dir dir;
+    digest_index index(dir.file("digests"));
+    std::string block(0x1000, 'x');
+    component_store store(dir.file("store"), &index, 0x1000 * 5 / 2);
+    std::string used = cachedFile(store, block + "1", 1600000000);
+    std::string older = cachedFile(store, block + "2", 1600000100);
+    std::string newer = cachedFile(store, block + "3", 1600000200);
+    // an earlier run used the file with the oldest mtime, the index remembers that
+    index.record(used, 0, sha384(block + "1"));
+
+    store.evict();
+    CHECK(tests::fileExists(used));
+    CHECK(!tests::fileExists(older));
+    CHECK(tests::fileExists(newer));
+}
+
+TEST_CASE("component_store", "never evicts files looked up or committed in this run") {
+    tests::temp_dir dir;
+    digest_index index(dir.file("digests"));
+    std::string block(0x1000, 'x');
+    component_store store(dir.file("store"), &index, 0);
+    std::string lookedUp = cachedFile(store, block + "1", 1600000000);
+    std::string unused = cachedFile(store, block + "2", 1600000100);
+    std::string digest = sha384(block + "1");
+    CHECK(store.lookup((const unsigned char *) digest.data(), digest.size()));
+
+    std::string content = block + "3";
+    std::string committedDigest = sha384(content);
+    auto *raw = (const unsigned char *) committedDigest.data();
+    std::string staging = store.newStagingFile(raw, committedDigest.size());
+    tests::writeFile(staging, content);
+    store.commit(raw, committedDigest.size(), staging);
+
+    store.evict();
+    CHECK(tests::fileExists(lookedUp));
+    CHECK(tests::fileExists(store.pathFor(raw, committedDigest.size())));
+    CHECK(!tests::fileExists(unused));
+}
+
+TEST_CASE("component_store", "looks up many components at once") {
+    tests::temp_dir dir;
+    digest_index index(dir.file("digests"));
+    component_store store(dir.file("store"), &index);
+    std::vector<std::string> digests;
+    for (int i = 0; i < 8; i++) {
+        std::string content = "component " + std::to_string(i);
+        digests.push_back(sha384(content));
+        if (i % 2 == 0) cachedFile(store, content, 1600000000);
+    }
+    // verified once, then removed behind the index's back
+    std::string removed = cachedFile(store, "removed", 1600000000);
+    digests.push_back(sha384("removed"));
+    CHECK(store.lookup((const unsigned char *) digests.back().data(), digests.back().size()));
+    remove(removed.c_str());
+    // a file whose contents don't hash to its name
+    std::string corrupt = cachedFile(store, "corrupt", 1600000000);
+    tests::writeFile(corrupt, "corrupted");
+    digests.push_back(sha384("corrupt"));
+    // no digest type has this size
+    digests.emplace_back("short");
+
+    std::vector<uint8_t> found = store.lookupAll(digests, 4);
+    CHECK(found.size() == digests.size());
+    for (int i = 0; i < 8; i++) {
+        CHECK(found[i] == (i % 2 == 0));
+        CHECK(found[i] == store.lookup((const unsigned char *) digests[i].data(), digests[i].size()));
+    }
+    CHECK(!found[8]);
+    CHECK(!found[9]);
+    CHECK(!found[10]);
+    CHECK(store.lookupAll({}, 4).empty());
+}
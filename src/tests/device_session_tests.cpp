@@ -0,0 +1,49 @@
+//
+//  device_session_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include "test.hpp"
+#include "../device_session.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+TEST_CASE("device_session", "parses what format writes") {
+    device_session_record call;
+    call.time = 1500;
+    call.duration = 250000;
+    call.name = "getApNonce";
+    call.result = -3;
+    call.bytes = 32;
+    call.data = std::string("\x00\x01\xfe\xff", 4);
+    std::string line = call.format();
+    device_session_record parsed = device_session_record::parse(line.substr(0, line.size() - 1));
+    CHECK(parsed.kind == device_session_record::call);
+    CHECK(parsed.time == 1500 && parsed.duration == 250000);
+    CHECK(parsed.name == "getApNonce" && parsed.result == -3 && parsed.bytes == 32);
+    CHECK(parsed.data == call.data);
+
+    device_session_record mode = device_session_record::parse("mode\t42\t2");
+    CHECK(mode.kind == device_session_record::mode && mode.time == 42 && mode.result == _MODE_RECOVERY);
+
+    device_session_record device = device_session_record::parse("device\t7\tn71ap\t1a2b3c4d5e6f\t-");
+    CHECK(device.kind == device_session_record::device && device.hardwareModel == "n71ap");
+    CHECK(device.ecid == 0x1a2b3c4d5e6fULL && device.serial.empty());
+}
+
+TEST_CASE("device_session", "rejects malformed records") {
+    CHECK_THROWS(device_session_record::parse(""));
+    CHECK_THROWS(device_session_record::parse("mode\tsoon\t2"));
+    CHECK_THROWS(device_session_record::parse("mode\t42\t9"));
+    CHECK_THROWS(device_session_record::parse("mode\t42\t2x"));
+    CHECK_THROWS(device_session_record::parse("call\t1\t2\tsendCommand\tok\t0\t-"));
+    CHECK_THROWS(device_session_record::parse("call\t1\t2\tsendCommand\t0\t0\tzz"));
+    CHECK_THROWS(device_session_record::parse("call\t1\t2\tsendCommand\t0\t0\tabc"));
+    CHECK_THROWS(device_session_record::parse("call\t-1\t2\tsendCommand\t0\t0\t-"));
+    CHECK_THROWS(device_session_record::parse("call\t1\t99999999999999999999999\tsendCommand\t0\t0\t-"));
+    CHECK_THROWS(device_session_record::parse("device\t7\tn71ap\tnope\t-"));
+    CHECK_THROWS(device_session_record::parse("nonce\t7\t00"));
+}
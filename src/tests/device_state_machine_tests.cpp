@@ -0,0 +1,133 @@
+//
+//  device_state_machine_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "test.hpp"
+#include "../device_state_machine.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+namespace {
+    // what the device backends do to an idevicerestore client, without one
+    class fake_event_source : public device_event_source {
+        std::mutex _lock;
+        std::condition_variable_any _changed;
+        int _mode = _MODE_UNKNOWN;
+        uint64_t _disconnects = 0;
+
+    public:
+        explicit fake_event_source(int mode) : _mode(mode) {}
+
+        // an event producer's side, takes the lock itself
+        void setMode(int mode) {
+            std::lock_guard<std::mutex> guard(_lock);
+            if (mode == _MODE_UNKNOWN && _mode != _MODE_UNKNOWN) _disconnects++;
+            _mode = mode;
+            _changed.notify_all();
+        }
+
+        // the device drops off and comes back in mode before anyone waiting gets to look
+        void reenumerate(int mode) {
+            std::lock_guard<std::mutex> guard(_lock);
+            if (_mode != _MODE_UNKNOWN) _disconnects++;
+            _mode = mode;
+            _changed.notify_all();
+        }
+
+        void lock() override {_lock.lock();}
+        void unlock() override {_lock.unlock();}
+        int mode() override {return _mode;}
+        const char *modeName() override {return "fake";}
+        uint64_t disconnects() override {return _disconnects;}
+        void waitForEvent(std::chrono::steady_clock::time_point deadline) override {
+            _changed.wait_until(_lock, deadline);
+        }
+    };
+
+    double secondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+TEST_CASE("device_state_machine", "sees a re-enumeration into the same mode") {
+    fake_event_source source(_MODE_DFU);
+    device_state_machine machine(source);
+    std::thread device;
+    auto start = std::chrono::steady_clock::now();
+    machine.run([&] {
+        // can't deliver anything before the action returns, the source is locked until walk() waits
+        device = std::thread([&] {source.reenumerate(_MODE_DFU);});
+    }, {
+        {_MODE_UNKNOWN, 2000, nullptr, "device didn't disconnect"},
+        {_MODE_DFU, 2000, nullptr, "device didn't come back in DFU mode"},
+    });
+    device.join();
+    CHECK(secondsSince(start) < 1);
+}
+
+TEST_CASE("device_state_machine", "consumes one disconnect per step") {
+    fake_event_source source(_MODE_RECOVERY);
+    device_state_machine machine(source);
+    std::thread device;
+    // one drop for two disconnected steps, the second has to time out
+    CHECK_THROWS(machine.run([&] {
+        device = std::thread([&] {source.reenumerate(_MODE_RECOVERY);});
+    }, {
+        {_MODE_UNKNOWN, 2000, nullptr, "device didn't disconnect"},
+        {_MODE_RECOVERY, 2000, nullptr, "device didn't come back in Recovery mode"},
+        {_MODE_UNKNOWN, 50, nullptr, "device didn't disconnect again"},
+    }));
+    device.join();
+
+    // and drops before the walk started don't count for it
+    source.reenumerate(_MODE_RECOVERY);
+    CHECK_THROWS(machine.expect({{_MODE_UNKNOWN, 50, nullptr, "device didn't disconnect"}}));
+}
+
+TEST_CASE("device_state_machine", "follows mode changes step by step") {
+    fake_event_source source(_MODE_DFU);
+    device_state_machine machine(source);
+    std::thread device;
+    machine.run([&] {
+        device = std::thread([&] {
+            source.setMode(_MODE_UNKNOWN);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            source.setMode(_MODE_RECOVERY);
+        });
+    }, {
+        {_MODE_UNKNOWN, 2000, nullptr, "device didn't disconnect"},
+        {device_state_machine::anyMode, 2000, nullptr, "device didn't come back"},
+        {_MODE_RECOVERY, 0, nullptr, "device isn't in Recovery mode"},
+    });
+    device.join();
+    CHECK(source.mode() == _MODE_RECOVERY);
+}
+
+TEST_CASE("device_state_machine", "throws once a step misses its deadline") {
+    fake_event_source source(_MODE_DFU);
+    device_state_machine machine(source);
+    // a step that is reached already doesn't wait, even with no time left
+    machine.expect({{_MODE_DFU, 0, nullptr, "device isn't in DFU mode"}});
+
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS(machine.expect({{_MODE_RECOVERY, 100, nullptr, "device didn't enter Recovery mode"}}));
+    double waited = secondsSince(start);
+    CHECK(waited >= 0.1 && waited < 1);
+
+    // a change to another mode wakes the waiter but doesn't reach the step
+    std::thread device;
+    start = std::chrono::steady_clock::now();
+    CHECK_THROWS(machine.run([&] {
+        device = std::thread([&] {source.setMode(_MODE_NORMAL);});
+    }, {{_MODE_RECOVERY, 100, nullptr, "device didn't enter Recovery mode"}}));
+    device.join();
+    waited = secondsSince(start);
+    CHECK(waited >= 0.1 && waited < 1);
+}
@@ -0,0 +1,138 @@
+//
+//  digest_index_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <thread>
+#include "test.hpp"
+#include "../digest_index.hpp"
+
+namespace {
+    std::string fromHex(const char *hex) {
+        std::string bytes;
+        for (; hex[0] && hex[1]; hex += 2) {
+            bytes.push_back((char) std::stoi(std::string(hex, 2), nullptr, 16));
+        }
+        return bytes;
+    }
+
+    const std::string sha256abc = fromHex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    const std::string sha1abc = fromHex("a9993e364706816aba3e25717850c26c9cd0d89d");
+
+    void setMtime(const std::string &path, time_t seconds, long nanoseconds) {
+        struct timespec times[2] = {{seconds, nanoseconds}, {seconds, nanoseconds}};
+        utimensat(AT_FDCWD, path.c_str(), times, 0);
+    }
+}
+
+TEST_CASE("digest_index", "hashes once and keeps digests across runs") {
+    tests::temp_dir dir;
+    std::string indexPath = dir.file("digests");
+    std::string path = dir.file("component");
+    tests::writeFile(path, "abc");
+    {
+        digest_index index(indexPath);
+        std::string digest;
+        CHECK(!index.cachedDigest(path, 1, digest));
+        CHECK(index.digestsOf(path, {1, 3}) == std::vector<std::string>({sha256abc, sha1abc}));
+        CHECK(index.cachedDigest(path, 1, digest) && digest == sha256abc);
+        CHECK(index.lastUsed(path) > 0);
+    }
+    digest_index reloaded(indexPath);
+    std::string digest;
+    CHECK(reloaded.cachedDigest(path, 3, digest) && digest == sha1abc);
+    CHECK(reloaded.matches(path, sha256abc));
+    CHECK(!reloaded.matches(path, sha1abc.substr(1)));
+    CHECK(!reloaded.matches(dir.path() + "/missing", sha256abc));
+}
+
+TEST_CASE("digest_index", "drops digests of files changed within the same second") {
+    tests::temp_dir dir;
+    std::string path = dir.file("component");
+    tests::writeFile(path, "abc");
+    setMtime(path, 1700000000, 100);
+    digest_index index(dir.file("digests"));
+    CHECK(index.digestOf(path, 1) == sha256abc);
+
+    // same size, same inode, same second
+    tests::writeFile(path, "abd");
+    setMtime(path, 1700000000, 200);
+    std::string digest;
+    CHECK(!index.cachedDigest(path, 1, digest));
+    CHECK(index.digestOf(path, 1) != sha256abc);
+}
+
+TEST_CASE("digest_index", "rehashes earlier runs' digests when verification is forced") {
+    tests::temp_dir dir;
+    std::string indexPath = dir.file("digests");
+    std::string path = dir.file("component");
+    tests::writeFile(path, "abc");
+    {
+        digest_index index(indexPath);
+        index.record(path, 1, std::string(32, 'x'));
+    }
+    digest_index index(indexPath);
+    std::string digest;
+    CHECK(index.cachedDigest(path, 1, digest) && digest == std::string(32, 'x'));
+    index.setForceVerify(true);
+    CHECK(!index.cachedDigest(path, 1, digest));
+    CHECK(index.digestOf(path, 1) == sha256abc);
+    // hashed in this run, trusted from now on
+    CHECK(index.cachedDigest(path, 1, digest) && digest == sha256abc);
+
+    index.forget(path);
+    CHECK(!index.cachedDigest(path, 1, digest));
+    CHECK(index.lastUsed(path) == -1);
+}
+
+TEST_CASE("digest_index", "ignores index files of other versions") {
+    tests::temp_dir dir;
+    std::string indexPath = dir.file("digests");
+    std::string path = dir.file("component");
+    tests::writeFile(path, "abc");
+    {
+        digest_index index(indexPath);
+        index.record(path, 1, std::string(32, 'x'));
+    }
+    std::string saved = tests::readFile(indexPath);
+    tests::writeFile(indexPath, "futurerestore-digestindex 1" + saved.substr(saved.find('\n')));
+    digest_index index(indexPath);
+    std::string digest;
+    CHECK(!index.cachedDigest(path, 1, digest));
+}
+
+TEST_CASE("digest_index", "saves concurrently through separate temporary files") {
+    tests::temp_dir dir;
+    std::string indexPath = dir.file("digests");
+    std::string path = dir.file("component");
+    tests::writeFile(path, "abc");
+    // two processes sharing one index file
+    std::vector<std::thread> savers;
+    for (int t = 0; t < 2; t++) {
+        savers.emplace_back([&] {
+            for (int i = 0; i < 50; i++) {
+                digest_index index(indexPath);
+                index.record(path, 1, sha256abc);
+                index.save();
+            }
+        });
+    }
+    for (auto &saver: savers) saver.join();
+
+    size_t files = 0;
+    if (DIR *d = opendir(dir.path().c_str())) {
+        while (struct dirent *file = readdir(d)) {
+            if (file->d_name[0] != '.') files++;
+        }
+        closedir(d);
+    }
+    // the component and the index, no temporary file left behind
+    CHECK(files == 2);
+    digest_index index(indexPath);
+    std::string digest;
+    CHECK(index.cachedDigest(path, 1, digest) && digest == sha256abc);
+}
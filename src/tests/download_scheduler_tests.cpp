@@ -0,0 +1,114 @@
+//
+//  download_scheduler_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <stdexcept>
+#include "test.hpp"
+#include "http_server.hpp"
+#include "zip_builder.hpp"
+#include "../download_scheduler.hpp"
+#include "../digest_stream.hpp"
+
+namespace {
+    std::string pattern(size_t size, unsigned int seed) {
+        std::string data(size, '\0');
+        for (size_t i = 0; i < size; i++) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = (char) (seed >> 16);
+        }
+        return data;
+    }
+
+    std::string sha384(const std::string &data) {
+        digest_stream digest(0);
+        digest.update(data.data(), data.size());
+        return digest.finish();
+    }
+
+    struct firmware {
+        std::string rose = pattern(0x3000, 1);
+        std::string timer = std::string(0x20000, 'T') + pattern(0x100, 2);
+        std::string sep = pattern(0x250000, 3);
+        std::string archive;
+
+        firmware() {
+            zip_builder zip;
+            zip.add("Firmware/rose.bin", rose);
+            zip.add("Firmware/timer.bin", timer, true);
+            zip.add("Firmware/all_flash/sep.im4p", sep, true, 24);
+            archive = zip.finish();
+        }
+    };
+}
+
+TEST_CASE("download_scheduler", "downloads every job with coalesced Range requests") {
+    firmware fw;
+    http_server server(fw.archive);
+    tests::temp_dir dir;
+    auto zip = remote_zip::open(server.url());
+    CHECK(zip->entries().size() == 3);
+
+    download_scheduler scheduler(zip, 3);
+    scheduler.addJob("Rose", "Firmware/rose.bin", dir.file("rose.bin"));
+    scheduler.addJob("Timer", "Firmware/timer.bin", dir.file("timer.bin"));
+    scheduler.addJob("SEP", "Firmware/all_flash/sep.im4p", dir.file("sep.im4p"), true, nullptr, sha384(fw.sep));
+    size_t rangesBefore = server.rangeRequests();
+    scheduler.run();
+
+    CHECK(tests::readFile(dir.path() + "/rose.bin") == fw.rose);
+    CHECK(tests::readFile(dir.path() + "/timer.bin") == fw.timer);
+    CHECK(tests::readFile(dir.path() + "/sep.im4p") == fw.sep);
+    // rose and timer sit next to each other and share a request
+    CHECK(server.rangeRequests() - rangesBefore < 3);
+    CHECK(scheduler.jobCount() == 0);
+}
+
+TEST_CASE("download_scheduler", "fails on a digest mismatch and removes the file") {
+    firmware fw;
+    http_server server(fw.archive);
+    tests::temp_dir dir;
+    download_scheduler scheduler(remote_zip::open(server.url()), 2);
+    std::string sepPath = dir.file("sep.im4p");
+    scheduler.addJob("SEP", "Firmware/all_flash/sep.im4p", sepPath, true, nullptr, sha384(fw.rose));
+    CHECK_THROWS(scheduler.run());
+    CHECK(!tests::fileExists(sepPath));
+}
+
+TEST_CASE("download_scheduler", "skips optional entries missing from the archive") {
+    firmware fw;
+    http_server server(fw.archive);
+    tests::temp_dir dir;
+    download_scheduler scheduler(remote_zip::open(server.url()));
+    bool fetched = false;
+    scheduler.addJob("Rose", "Firmware/rose.bin", dir.file("rose.bin"), true, [&](const std::string &path) {
+        fetched = tests::readFile(path) == fw.rose;
+    });
+    scheduler.addJob("Baobab", "Firmware/baobab.bin", dir.file("baobab.bin"), false);
+    scheduler.run();
+    CHECK(fetched);
+
+    download_scheduler required(remote_zip::open(server.url()));
+    required.addJob("Baobab", "Firmware/baobab.bin", dir.file("baobab.bin"));
+    CHECK_THROWS(required.run());
+}
+
+TEST_CASE("download_scheduler", "turns exceptions thrown by onFetched into a failed job") {
+    firmware fw;
+    http_server server(fw.archive);
+    tests::temp_dir dir;
+    download_scheduler scheduler(remote_zip::open(server.url()));
+    std::string rosePath = dir.file("rose.bin");
+    scheduler.addJob("Rose", "Firmware/rose.bin", rosePath, true, [](const std::string &) {
+        throw std::runtime_error("commit failed");
+    });
+    CHECK_THROWS(scheduler.run());
+    CHECK(!tests::fileExists(rosePath));
+}
+
+TEST_CASE("download_scheduler", "refuses servers without Range support") {
+    firmware fw;
+    http_server server(fw.archive, false);
+    CHECK_THROWS(remote_zip::open(server.url()));
+}
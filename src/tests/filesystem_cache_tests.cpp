@@ -0,0 +1,125 @@
+//
+//  filesystem_cache_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "test.hpp"
+#include "zip_builder.hpp"
+#include "../futurerestore.hpp"
+
+namespace {
+    // the digest type futurerestore keeps for extracted filesystems, SHA256
+    const int filesystemDigestType = 1;
+
+    std::string pattern(size_t size, uint32_t seed) {
+        std::string out(size, '\0');
+        uint32_t x = seed * 2654435761u + 1;
+        for (size_t i = 0; i < size; i++) {
+            x = x * 1103515245 + 12345;
+            out[i] = (char) (x >> 16);
+        }
+        return out;
+    }
+
+    void setMtime(const std::string &path, time_t seconds, long nanoseconds) {
+        struct timespec times[2] = {{seconds, nanoseconds}, {seconds, nanoseconds}};
+        utimensat(AT_FDCWD, path.c_str(), times, 0);
+    }
+
+    std::shared_ptr<zip_extractor> ipswWith(const std::string &path, const std::string &filesystem) {
+        zip_builder zip;
+        zip.add("fs.dmg", filesystem, true);
+        tests::writeFile(path, zip.finish());
+        return std::make_shared<zip_extractor>(path);
+    }
+
+    // what an extracting futurerestore leaves behind: the filesystem, its digest and the sidecar
+    void extractWithSidecar(const std::shared_ptr<zip_extractor> &zip, digest_index &index, const std::string &path) {
+        zip->extract("fs.dmg", path);
+        const zip_extractor::entry *e = zip->getEntry("fs.dmg");
+        futurerestore::saveFilesystemCacheInfo(path, {e->crc32, e->uncompressedSize,
+                                                      index.digestOf(path, filesystemDigestType)});
+    }
+}
+
+TEST_CASE("filesystem_cache", "reads back the sidecar it wrote") {
+    tests::temp_dir dir;
+    std::string path = dir.file("fs.dmg");
+    futurerestore::filesystem_cache_info saved{0x89abcdef, 6000000000ULL, std::string(31, '\x5a') + '\0'};
+    futurerestore::saveFilesystemCacheInfo(path, saved);
+    futurerestore::filesystem_cache_info loaded;
+    CHECK(futurerestore::loadFilesystemCacheInfo(path, loaded));
+    CHECK(loaded.crc32 == saved.crc32 && loaded.size == saved.size && loaded.digest == saved.digest);
+    CHECK(!tests::fileExists(path + ".meta.tmp"));
+
+    CHECK(!futurerestore::loadFilesystemCacheInfo(dir.file("missing.dmg"), loaded));
+    std::string meta = tests::readFile(path + ".meta");
+    tests::writeFile(path + ".meta", "futurerestore-fscache 0" + meta.substr(meta.find('\n')));
+    CHECK(!futurerestore::loadFilesystemCacheInfo(path, loaded));
+    // a digest cut short, as left by a crash while writing it
+    tests::writeFile(path + ".meta", meta.substr(0, meta.size() - 3));
+    CHECK(!futurerestore::loadFilesystemCacheInfo(path, loaded));
+    tests::writeFile(path + ".meta", meta.substr(0, meta.find('\n') + 1) + "zz 1 00\n");
+    CHECK(!futurerestore::loadFilesystemCacheInfo(path, loaded));
+}
+
+TEST_CASE("filesystem_cache", "rehashes a filesystem touched since it was extracted") {
+    tests::temp_dir dir;
+    std::string filesystem = pattern(0x40000, 1);
+    auto zip = ipswWith(dir.file("fw.ipsw"), filesystem);
+    digest_index index(dir.file("digests"));
+    std::string path = dir.file("fs.dmg");
+    extractWithSidecar(zip, index, path);
+    std::string digest;
+    CHECK(index.cachedDigest(path, filesystemDigestType, digest));
+    CHECK(futurerestore::verifySharedFilesystem(zip, &index, "fs.dmg", path));
+
+    // same bytes, new mtime: no longer vouched for by the index, hashing it again still matches
+    setMtime(path, 1700000000, 0);
+    CHECK(!index.cachedDigest(path, filesystemDigestType, digest));
+    CHECK(futurerestore::verifySharedFilesystem(zip, &index, "fs.dmg", path));
+
+    // same size, different bytes
+    std::string changed = filesystem;
+    changed[0x1000] ^= 1;
+    tests::writeFile(path, changed);
+    setMtime(path, 1700000001, 0);
+    CHECK(!futurerestore::verifySharedFilesystem(zip, &index, "fs.dmg", path));
+}
+
+TEST_CASE("filesystem_cache", "rejects a filesystem of a different size") {
+    tests::temp_dir dir;
+    auto zip = ipswWith(dir.file("fw.ipsw"), pattern(0x40000, 2));
+    digest_index index(dir.file("digests"));
+    std::string path = dir.file("fs.dmg");
+    extractWithSidecar(zip, index, path);
+    CHECK(futurerestore::verifySharedFilesystem(zip, &index, "fs.dmg", path));
+
+    tests::writeFile(path, tests::readFile(path) + "x");
+    CHECK(!futurerestore::verifySharedFilesystem(zip, &index, "fs.dmg", path));
+}
+
+TEST_CASE("filesystem_cache", "rejects a sidecar of another iPSW entry or digest") {
+    tests::temp_dir dir;
+    std::string filesystem = pattern(0x40000, 3);
+    auto zip = ipswWith(dir.file("fw.ipsw"), filesystem);
+    digest_index index(dir.file("digests"));
+    std::string path = dir.file("fs.dmg");
+    extractWithSidecar(zip, index, path);
+
+    // an iPSW whose filesystem has the same size but other contents
+    std::string other = filesystem;
+    other[0] ^= 1;
+    auto otherZip = ipswWith(dir.file("other.ipsw"), other);
+    CHECK(otherZip->getEntry("fs.dmg")->crc32 != zip->getEntry("fs.dmg")->crc32);
+    CHECK(!futurerestore::verifySharedFilesystem(otherZip, &index, "fs.dmg", path));
+
+    futurerestore::filesystem_cache_info cacheInfo;
+    CHECK(futurerestore::loadFilesystemCacheInfo(path, cacheInfo));
+    cacheInfo.digest[0] ^= 1;
+    futurerestore::saveFilesystemCacheInfo(path, cacheInfo);
+    CHECK(!futurerestore::verifySharedFilesystem(zip, &index, "fs.dmg", path));
+}
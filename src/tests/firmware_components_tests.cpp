@@ -0,0 +1,139 @@
+//
+//  firmware_components_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <cstdlib>
+#include "test.hpp"
+#include "http_server.hpp"
+#include "manifest_builder.hpp"
+#include "zip_builder.hpp"
+#include "../digest_stream.hpp"
+#include "../futurerestore.hpp"
+#include "../simulated_device.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+namespace {
+    std::string sha384(const std::string &data) {
+        digest_stream digest(0);
+        digest.update(data.data(), data.size());
+        return digest.finish();
+    }
+
+    std::string pattern(size_t size, uint8_t seed) {
+        std::string out;
+        for (size_t i = 0; i < size; i++) {
+            out.push_back((char) (i * 7 + seed));
+        }
+        return out;
+    }
+
+    // a session of its own run: the latest firmware is already looked up, everything else comes from the server
+    std::unique_ptr<futurerestore> newSession(const std::string &manifest, const std::string &url) {
+        auto cache = std::make_shared<session_cache>();
+        auto latest = cache->latestFirmware("d22ap||||");
+        latest->manifest = manifest;
+        latest->url = url;
+        simulated_device_backend::config config;
+        auto session = std::make_unique<futurerestore>();
+        session->setDeviceBackend(std::make_shared<simulated_device_backend>(config));
+        session->setSharedCache(cache);
+        retassure(session->init(), "failed to init the simulated session\n");
+        return session;
+    }
+}
+
+TEST_CASE("firmware_components", "fetches the components of complete groups") {
+    tests::temp_dir dir;
+    // futurerestore keeps its store and index under $TMPDIR/futurerestore
+    setenv("TMPDIR", dir.path().c_str(), 1);
+    std::string rose = pattern(0x3000, 1);
+    std::string baobab = pattern(0x800, 2);
+    std::string veridian = pattern(0x400, 3);
+    zip_builder zip;
+    zip.add("Firmware/rose.bin", rose);
+    zip.add("Firmware/baobab.bin", baobab, true);
+    zip.add("Firmware/veridian.der", veridian);
+    http_server server(zip.finish());
+    manifest_builder manifest;
+    // the Veridian group lacks its FirmwareMap, so none of it is fetched
+    manifest.identity("d22ap", false)
+            .component("Rap,RTKitOS", "Firmware/rose.bin", sha384(rose))
+            .component("Baobab,TCON", "Firmware/baobab.bin")
+            .component("BMU,DigestMap", "Firmware/veridian.der", sha384(veridian));
+    auto firmwareZip = remote_zip::open(server.url());
+
+    auto session = newSession(manifest.xml(), server.url());
+    session->downloadLatestFirmwareComponents();
+    session->attachComponents();
+    CHECK(session->_client->rosefwdatasize == rose.size());
+    CHECK(session->_client->rosefwdata && !memcmp(session->_client->rosefwdata, rose.data(), rose.size()));
+    CHECK(session->_client->baobabfwdatasize == baobab.size());
+    CHECK(session->_client->baobabfwdata && !memcmp(session->_client->baobabfwdata, baobab.data(), baobab.size()));
+    CHECK(!session->_client->veridiandgmfwdata && !session->_client->veridianfwmfwdata);
+    unsetenv("TMPDIR");
+}
+
+TEST_CASE("firmware_components", "takes cacheable components from the store on the next run") {
+    tests::temp_dir dir;
+    setenv("TMPDIR", dir.path().c_str(), 1);
+    std::string rose = pattern(0x3000, 4);
+    std::string baobab = pattern(0x800, 5);
+    zip_builder zip;
+    zip.add("Firmware/rose.bin", rose);
+    zip.add("Firmware/baobab.bin", baobab);
+    http_server server(zip.finish());
+    manifest_builder manifest;
+    manifest.identity("d22ap", false)
+            .component("Rap,RTKitOS", "Firmware/rose.bin", sha384(rose))
+            .component("Baobab,TCON", "Firmware/baobab.bin");
+    auto firmwareZip = remote_zip::open(server.url());
+
+    newSession(manifest.xml(), server.url())->downloadLatestFirmwareComponents();
+    size_t ranges = server.rangeRequests();
+
+    // Baobab has no digest to check a cached copy against and is fetched again, Rose is not
+    auto session = newSession(manifest.xml(), server.url());
+    session->downloadLatestFirmwareComponents();
+    CHECK(server.rangeRequests() - ranges == 1);
+    session->attachComponents();
+    CHECK(session->_client->rosefwdatasize == rose.size());
+    CHECK(session->_client->rosefwdata && !memcmp(session->_client->rosefwdata, rose.data(), rose.size()));
+    CHECK(session->_client->baobabfwdata && !memcmp(session->_client->baobabfwdata, baobab.data(), baobab.size()));
+    unsetenv("TMPDIR");
+}
+
+TEST_CASE("firmware_components", "leaves components unmapped until they are attached") {
+    tests::temp_dir dir;
+    setenv("TMPDIR", dir.path().c_str(), 1);
+    std::string rose = pattern(0x3000, 6);
+    zip_builder zip;
+    zip.add("Firmware/rose.bin", rose);
+    http_server server(zip.finish());
+    manifest_builder manifest;
+    manifest.identity("d22ap", false).component("Rap,RTKitOS", "Firmware/rose.bin", sha384(rose));
+    auto firmwareZip = remote_zip::open(server.url());
+
+    auto session = newSession(manifest.xml(), server.url());
+    session->downloadLatestFirmwareComponents();
+    std::string firstSep = dir.file("first.im4p");
+    std::string secondSep = dir.file("second.im4p");
+    tests::writeFile(firstSep, pattern(0x100, 7));
+    tests::writeFile(secondSep, pattern(0x200, 8));
+    session->loadSep(firstSep);
+    CHECK(!session->_client->rosefwdata && !session->_client->sepfwdata);
+
+    session->attachComponents();
+    CHECK(session->_client->rosefwdata && session->_client->sepfwdatasize == 0x100);
+    // loading a field again drops the mapping of the earlier file until the next attach
+    session->loadSep(secondSep);
+    CHECK(!session->_client->sepfwdata && !session->_client->sepfwdatasize);
+    session->attachComponents();
+    CHECK(session->_client->sepfwdatasize == 0x200);
+    CHECK(!memcmp(session->_client->sepfwdata, pattern(0x200, 8).data(), 0x200));
+    unsetenv("TMPDIR");
+}
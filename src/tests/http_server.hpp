@@ -0,0 +1,146 @@
+//
+//  http_server.hpp
+//  futurerestore tests
+//
+
+#ifndef http_server_hpp
+#define http_server_hpp
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Serves one file over HTTP/1.1 on 127.0.0.1, one connection at a time.
+ * Answers HEAD and GET, honours single "Range: bytes=a-b" requests with 206 unless ranges are disabled.
+ * Responses carry an ETag and Last-Modified header unless they are set to empty strings.
+ */
+class http_server {
+    std::mutex _lock;
+    std::string _body;
+    std::string _etag = "\"1\"";
+    std::string _lastModified = "Wed, 21 Oct 2015 07:28:00 GMT";
+    bool _ranges;
+    int _listenFd = -1;
+    uint16_t _port = 0;
+    std::atomic<bool> _stop{false};
+    std::atomic<size_t> _headRequests{0};
+    std::atomic<size_t> _rangeRequests{0};
+    std::thread _thread;
+
+    static bool sendAll(int fd, const char *data, size_t len) {
+        while (len) {
+            ssize_t sent = send(fd, data, len, 0);
+            if (sent <= 0) return false;
+            data += sent;
+            len -= (size_t) sent;
+        }
+        return true;
+    }
+
+    void serve(int fd) {
+        std::string body;
+        std::string validators;
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            body = _body;
+            if (!_etag.empty()) validators += "ETag: " + _etag + "\r\n";
+            if (!_lastModified.empty()) validators += "Last-Modified: " + _lastModified + "\r\n";
+        }
+        std::string request;
+        char buf[4096];
+        while (request.find("\r\n\r\n") == std::string::npos) {
+            ssize_t got = recv(fd, buf, sizeof(buf), 0);
+            if (got <= 0) return;
+            request.append(buf, (size_t) got);
+        }
+        bool head = request.compare(0, 5, "HEAD ") == 0;
+        uint64_t first = 0;
+        uint64_t last = body.empty() ? 0 : body.size() - 1;
+        bool range = false;
+        size_t rangePos = request.find("\r\nRange: bytes=");
+        if (_ranges && !head && rangePos != std::string::npos) {
+            range = sscanf(request.c_str() + rangePos, "\r\nRange: bytes=%" SCNu64 "-%" SCNu64, &first, &last) == 2
+                    && first <= last && first < body.size();
+            last = std::min<uint64_t>(last, body.size() - 1);
+        }
+        char header[256]{};
+        if (head) {
+            _headRequests++;
+            snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nAccept-Ranges: bytes\r\n"
+                     "Connection: close\r\n", body.size());
+        } else if (range) {
+            _rangeRequests++;
+            snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\nContent-Length: %" PRIu64 "\r\n"
+                     "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%zu\r\nConnection: close\r\n",
+                     last - first + 1, first, last, body.size());
+        } else {
+            first = 0;
+            last = body.size() - 1;
+            snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nConnection: close\r\n",
+                     body.size());
+        }
+        std::string response = header + validators + "\r\n";
+        if (!sendAll(fd, response.data(), response.size()) || head) return;
+        sendAll(fd, body.data() + first, (size_t) (last - first + 1));
+    }
+
+    void run() {
+        while (!_stop) {
+            pollfd pfd{_listenFd, POLLIN, 0};
+            if (poll(&pfd, 1, 50) <= 0) continue;
+            int fd = accept(_listenFd, nullptr, nullptr);
+            if (fd < 0) continue;
+            serve(fd);
+            close(fd);
+        }
+    }
+
+public:
+    explicit http_server(std::string body, bool ranges = true) : _body(std::move(body)), _ranges(ranges) {
+        _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        retassure(_listenFd >= 0, "%s: socket failed\n", __func__);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addrLen = sizeof(addr);
+        retassure(!bind(_listenFd, (sockaddr *) &addr, sizeof(addr)) && !listen(_listenFd, 16)
+                  && !getsockname(_listenFd, (sockaddr *) &addr, &addrLen), "%s: can't listen on loopback\n", __func__);
+        _port = ntohs(addr.sin_port);
+        _thread = std::thread([this] { run(); });
+    }
+    http_server(const http_server &) = delete;
+    http_server &operator=(const http_server &) = delete;
+    ~http_server() {
+        _stop = true;
+        _thread.join();
+        close(_listenFd);
+    }
+
+    // what later requests get, e.g. a firmware replaced on the server
+    void setBody(std::string body, std::string etag, std::string lastModified) {
+        std::lock_guard<std::mutex> guard(_lock);
+        _body = std::move(body);
+        _etag = std::move(etag);
+        _lastModified = std::move(lastModified);
+    }
+
+    std::string url(const std::string &path = "/firmware.zip") const {
+        return "http://127.0.0.1:" + std::to_string(_port) + path;
+    }
+    size_t headRequests() const {return _headRequests;}
+    size_t rangeRequests() const {return _rangeRequests;}
+};
+
+#endif /* http_server_hpp */
@@ -0,0 +1,41 @@
+//
+//  main.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <curl/curl.h>
+#include "test.hpp"
+
+int main(int argc, const char *argv[]) {
+    // the local test server writes to connections curl may already have dropped
+#ifdef SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    curl_global_init(CURL_GLOBAL_ALL);
+    const char *suite = argc > 1 ? argv[1] : nullptr;
+    size_t ran = 0;
+    size_t failed = 0;
+    for (const auto &test: tests::registry()) {
+        if (suite && strcmp(suite, test.suite) != 0) continue;
+        int before = tests::failedChecks();
+        try {
+            test.run();
+        } catch (tihmstar::exception &e) {
+            printf("%s/%s: threw: %s\n", test.suite, test.name, e.what());
+            tests::failedChecks()++;
+        } catch (std::exception &e) {
+            printf("%s/%s: threw: %s\n", test.suite, test.name, e.what());
+            tests::failedChecks()++;
+        }
+        bool ok = tests::failedChecks() == before;
+        printf("[%s] %s/%s\n", ok ? "  OK  " : "FAILED", test.suite, test.name);
+        ran++;
+        if (!ok) failed++;
+    }
+    printf("%zu of %zu tests failed\n", failed, ran);
+    return (failed || !ran) ? 1 : 0;
+}
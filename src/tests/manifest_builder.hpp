@@ -0,0 +1,88 @@
+//
+//  manifest_builder.hpp
+//  futurerestore tests
+//
+
+#ifndef manifest_builder_hpp
+#define manifest_builder_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <plist/plist.h>
+
+/*
+ * Builds BuildManifest XML with the identity and component fields futurerestore looks at.
+ */
+class manifest_builder {
+    plist_t _manifest;
+    plist_t _identities;
+    plist_t _identity = nullptr;
+    plist_t _components = nullptr;
+
+public:
+    manifest_builder() : _manifest(plist_new_dict()), _identities(plist_new_array()) {
+        plist_dict_set_item(_manifest, "BuildIdentities", _identities);
+    }
+    manifest_builder(const manifest_builder &) = delete;
+    manifest_builder &operator=(const manifest_builder &) = delete;
+    ~manifest_builder() {
+        plist_free(_manifest);
+    }
+
+    manifest_builder &version(const std::string &productVersion, const std::string &build) {
+        plist_dict_set_item(_manifest, "ProductVersion", plist_new_string(productVersion.c_str()));
+        plist_dict_set_item(_manifest, "ProductBuildVersion", plist_new_string(build.c_str()));
+        return *this;
+    }
+
+    // components added after this go into the new identity
+    manifest_builder &identity(const std::string &board, bool update) {
+        _identity = plist_new_dict();
+        plist_t info = plist_new_dict();
+        plist_dict_set_item(info, "DeviceClass", plist_new_string(board.c_str()));
+        plist_dict_set_item(info, "RestoreBehavior", plist_new_string(update ? "Update" : "Erase"));
+        plist_dict_set_item(info, "Variant", plist_new_string(update ? "Customer Upgrade Install (IPSW)"
+                                                                     : "Customer Erase Install (IPSW)"));
+        plist_dict_set_item(_identity, "Info", info);
+        _components = plist_new_dict();
+        plist_dict_set_item(_identity, "Manifest", _components);
+        plist_array_append_item(_identities, _identity);
+        return *this;
+    }
+
+    // what a ticket's BORD and CHIP are checked against
+    manifest_builder &ids(uint64_t boardId, uint64_t chipId) {
+        char hex[32];
+        snprintf(hex, sizeof(hex), "0x%02llX", (unsigned long long) boardId);
+        plist_dict_set_item(_identity, "ApBoardID", plist_new_string(hex));
+        snprintf(hex, sizeof(hex), "0x%04llX", (unsigned long long) chipId);
+        plist_dict_set_item(_identity, "ApChipID", plist_new_string(hex));
+        return *this;
+    }
+
+    // an empty digest leaves the Digest out
+    manifest_builder &component(const std::string &name, const std::string &path, const std::string &digest = "") {
+        plist_t elem = plist_new_dict();
+        if (!digest.empty()) {
+            plist_dict_set_item(elem, "Digest", plist_new_data(digest.data(), digest.size()));
+        }
+        plist_t info = plist_new_dict();
+        plist_dict_set_item(info, "Path", plist_new_string(path.c_str()));
+        plist_dict_set_item(elem, "Info", info);
+        plist_dict_set_item(_components, name.c_str(), elem);
+        return *this;
+    }
+
+    std::string xml() const {
+        char *xml = nullptr;
+        uint32_t xmlSize = 0;
+        plist_to_xml(_manifest, &xml, &xmlSize);
+        std::string result(xml, xmlSize);
+        free(xml);
+        return result;
+    }
+};
+
+#endif /* manifest_builder_hpp */
@@ -0,0 +1,79 @@
+//
+//  manifest_index_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <cstring>
+#include "test.hpp"
+#include "manifest_builder.hpp"
+#include "../futurerestore.hpp"
+#include "../manifest_index.hpp"
+
+namespace {
+    std::string manifest() {
+        manifest_builder builder;
+        builder.identity("d22ap", false)
+                .component("iBSS", "Firmware/dfu/iBSS.d22.RELEASE.im4p", std::string(48, '\x01'))
+                .component("SEP", "Firmware/all_flash/sep-firmware.d22.RELEASE.im4p", std::string(48, '\x02'))
+                .component("KernelCache", "kernelcache.release.iphone10");
+        // same model, other variant: every path and digest differs
+        builder.identity("d22ap", true)
+                .component("iBSS", "Firmware/dfu/iBSS.d22.UPDATE.im4p", std::string(48, '\x11'))
+                .component("SEP", "Firmware/all_flash/sep-firmware.d22.UPDATE.im4p", std::string(48, '\x12'));
+        builder.identity("d21ap", false)
+                .component("iBSS", "Firmware/dfu/iBSS.d21.RELEASE.im4p", std::string(48, '\x21'));
+        return builder.xml();
+    }
+}
+
+TEST_CASE("manifest_index", "answers like the per-call manifest walks") {
+    std::string xml = manifest();
+    manifest_index index(xml.c_str());
+    // present and missing components, identities of both variants and a board that isn't in the manifest
+    const char *boards[] = {"d22ap", "d21ap", "n71ap"};
+    const char *elements[] = {"iBSS", "SEP", "KernelCache", "Missing"};
+    size_t compared = 0;
+    for (const char *board: boards) {
+        for (int update = 0; update < 2; update++) {
+            for (const char *element: elements) {
+                bool exists = futurerestore::elemExists(element, xml.c_str(), board, update);
+                CHECK(index.elemExists(element, board, update) == exists);
+                if (exists) {
+                    char *path = futurerestore::getPathOfElementInManifest(element, xml.c_str(), board, update);
+                    CHECK(!strcmp(index.getPathOfElement(element, board, update), path));
+                    free(path);
+                } else {
+                    CHECK_THROWS(futurerestore::getPathOfElementInManifest(element, xml.c_str(), board, update));
+                    CHECK_THROWS(index.getPathOfElement(element, board, update));
+                }
+
+                unsigned char *digest = futurerestore::getDigestOfElementInManifest(element, xml.c_str(), board, update);
+                size_t digestSize = 0;
+                const unsigned char *indexed = index.getDigestOfElement(element, board, update, &digestSize);
+                CHECK(!digest == !indexed);
+                if (digest && indexed) {
+                    CHECK(digestSize == 48 && !memcmp(digest, indexed, digestSize));
+                }
+                free(digest);
+                compared++;
+            }
+        }
+    }
+    CHECK(compared == 3 * 2 * 4);
+}
+
+TEST_CASE("manifest_index", "picks the identity of the requested variant") {
+    std::string xml = manifest();
+    manifest_index index(xml.c_str());
+    CHECK(std::string(index.getPathOfElement("iBSS", "d22ap", 0)) == "Firmware/dfu/iBSS.d22.RELEASE.im4p");
+    CHECK(std::string(index.getPathOfElement("iBSS", "d22ap", 1)) == "Firmware/dfu/iBSS.d22.UPDATE.im4p");
+    size_t digestSize = 0;
+    const unsigned char *digest = index.getDigestOfElement("SEP", "d22ap", 1, &digestSize);
+    CHECK(digest && digestSize == 48 && digest[0] == 0x12);
+    // the update identity doesn't list a kernel, the erase identity's must not leak into it
+    CHECK(index.elemExists("KernelCache", "d22ap", 0));
+    CHECK(!index.elemExists("KernelCache", "d22ap", 1));
+    CHECK(!index.getBuildIdentity("d21ap", 1));
+    CHECK(!index.getBuildIdentity("n71ap", 0));
+}
@@ -0,0 +1,52 @@
+//
+//  mapped_file_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <cstring>
+#include "test.hpp"
+#include "../mapped_file.hpp"
+
+TEST_CASE("mapped_file", "maps a whole file") {
+    tests::temp_dir dir;
+    std::string path = dir.file("component.im4p");
+    // spans several pages and ends mid-page
+    std::string content;
+    for (int i = 0; content.size() < 3 * 4096 + 100; i++) {
+        content += std::to_string(i) + ",";
+    }
+    tests::writeFile(path, content);
+
+    mapped_file file(path);
+    CHECK(file.path() == path);
+    CHECK(file.size() == content.size());
+    CHECK(!memcmp(file.data(), content.data(), content.size()));
+}
+
+TEST_CASE("mapped_file", "keeps writes out of the file") {
+    tests::temp_dir dir;
+    std::string path = dir.file("component.im4p");
+    std::string content(8192, 'a');
+    tests::writeFile(path, content);
+    {
+        mapped_file file(path);
+        // idevicerestore patches some components in place before sending them
+        memset(file.data(), 'b', 16);
+        file.data()[file.size() - 1] = 'c';
+        CHECK(file.data()[0] == 'b' && file.data()[file.size() - 1] == 'c');
+
+        // a second mapping of the same file doesn't see them either
+        mapped_file other(path);
+        CHECK(!memcmp(other.data(), content.data(), content.size()));
+    }
+    CHECK(tests::readFile(path) == content);
+}
+
+TEST_CASE("mapped_file", "rejects missing and empty files") {
+    tests::temp_dir dir;
+    CHECK_THROWS(mapped_file(dir.file("missing.im4p")));
+    std::string empty = dir.file("empty.im4p");
+    tests::writeFile(empty, "");
+    CHECK_THROWS(mapped_file(empty));
+}
@@ -0,0 +1,110 @@
+//
+//  nonce_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <chrono>
+#include <cstdlib>
+#include "test.hpp"
+#include "../futurerestore.hpp"
+#include "../device_state_machine.hpp"
+#include "../simulated_device.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+namespace {
+    std::string hexString(const std::string &bytes) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        for (unsigned char byte: bytes) {
+            hex += digits[byte >> 4];
+            hex += digits[byte & 0xf];
+        }
+        return hex;
+    }
+
+    // the nonce the waiting session looks for comes with the device's third boot
+    simulated_device_backend::config cyclingDevice() {
+        simulated_device_backend::config config;
+        config.disconnectMs = 10;
+        config.rebootMs = 40;
+        config.nonces = {std::string(32, '\x01'), std::string(32, '\x02'), std::string(32, '\x03')};
+        return config;
+    }
+
+    /*
+     * Reboots without telling the session's client, like a device whose USB events got lost.
+     * Mode changes go to a client of its own, the session only learns about them by asking checkMode.
+     */
+    class unannounced_device_backend : public simulated_device_backend {
+        struct idevicerestore_client_t *_shadow;
+
+    public:
+        explicit unannounced_device_backend(config config)
+                : simulated_device_backend(std::move(config)), _shadow(idevicerestore_client_new()) {}
+        ~unannounced_device_backend() override {
+            simulated_device_backend::close(_shadow);
+            idevicerestore_client_free(_shadow);
+        }
+
+        int reset(struct idevicerestore_client_t *client) override {
+            return simulated_device_backend::reset(_shadow);
+        }
+    };
+
+    double secondsToWaitForNonce(const std::shared_ptr<device_backend> &backend, const std::string &nonce) {
+        tests::temp_dir dir;
+        setenv("TMPDIR", dir.path().c_str(), 1);
+        double seconds;
+        {
+            futurerestore client;
+            client.setDeviceBackend(backend);
+            CHECK(client.init());
+            auto start = std::chrono::steady_clock::now();
+            client.waitForNonce({nonce.data()}, nonce.size());
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        unsetenv("TMPDIR");
+        return seconds;
+    }
+}
+
+// ApNonces devices report for well known generators
+TEST_CASE("nonce", "derives SHA1 nonces of 20 byte devices") {
+    CHECK(hexString(futurerestore::nonceForGenerator(0x1111111111111111, 20)) ==
+          "3a88b7c3802f2f0510abc432104a15ebd8bd7154");
+    CHECK(hexString(futurerestore::nonceForGenerator(0xbd34a880be0b53f3, 20)) ==
+          "603be133ff0bdfa0f83f21e74191cf6770ea43bb");
+}
+
+TEST_CASE("nonce", "derives truncated SHA384 nonces of 32 byte devices") {
+    CHECK(hexString(futurerestore::nonceForGenerator(0x1111111111111111, 32)) ==
+          "27325c8258be46e69d9ee57fa9a8fbc28b873df434e5e702a8b27999551138ae");
+    // not a palindrome, so the byte order the generator is hashed in matters
+    CHECK(hexString(futurerestore::nonceForGenerator(0xbd34a880be0b53f3, 32)) ==
+          "15400076bc4c35a7c8caefdcae5bda69c140a11bce870548f0862aac28c194cc");
+}
+
+TEST_CASE("nonce", "rejects unknown nonce sizes") {
+    CHECK_THROWS(futurerestore::nonceForGenerator(0x1111111111111111, 0));
+    CHECK_THROWS(futurerestore::nonceForGenerator(0x1111111111111111, 48));
+}
+
+TEST_CASE("nonce", "reboots for a nonce as fast as the device reports its modes") {
+    auto config = cyclingDevice();
+    double seconds = secondsToWaitForNonce(std::make_shared<simulated_device_backend>(config), config.nonces[2]);
+    // two reboots, a single 0.5 s poll would already take longer
+    CHECK(seconds < 0.5);
+}
+
+TEST_CASE("nonce", "polls for recovery mode when no device event arrives") {
+    auto config = cyclingDevice();
+    config.nonces.erase(config.nonces.begin() + 1);
+    double seconds = secondsToWaitForNonce(std::make_shared<unannounced_device_backend>(config), config.nonces[1]);
+    // one reboot, noticed once waiting for the disconnect gave up
+    CHECK(seconds >= device_state_machine::disconnectTimeout / 1000.0);
+    CHECK(seconds < device_state_machine::disconnectTimeout / 1000.0 + 2);
+}
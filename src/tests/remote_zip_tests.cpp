@@ -0,0 +1,279 @@
+//
+//  remote_zip_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <thread>
+#include "test.hpp"
+#include "http_server.hpp"
+#include "zip_builder.hpp"
+#include "../remote_zip.hpp"
+
+namespace {
+    void putLE(std::string &out, uint64_t v, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back((char) (v >> (8 * i)));
+        }
+    }
+
+    // serves an in memory archive, counting reads like the Range requests they stand for
+    remote_zip::range_reader reader(const std::string &archive, size_t *reads = nullptr) {
+        return [&archive, reads](uint64_t offset, uint64_t length) {
+            if (reads) (*reads)++;
+            if (offset > archive.size()) return std::vector<uint8_t>();
+            length = std::min<uint64_t>(length, archive.size() - offset);
+            return std::vector<uint8_t>(archive.begin() + (long) offset, archive.begin() + (long) (offset + length));
+        };
+    }
+
+    /*
+     * One stored entry whose sizes and offset only live in a zip64 extra field, a zip64 end of central directory
+     * and an EOCD with every field saturated, the way archivers write IPSWs larger than 4 GiB.
+     */
+    std::string zip64Archive(const std::string &name, const std::string &content, size_t prefix,
+                             size_t extensibleData = 0) {
+        std::string archive(prefix, 'p');
+        uint64_t localOffset = archive.size();
+        putLE(archive, 0x04034b50, 4);
+        putLE(archive, 45, 2);
+        putLE(archive, 0, 2);
+        putLE(archive, 0, 2);
+        putLE(archive, 0, 4);
+        putLE(archive, crc32(0, (const Bytef *) content.data(), (uInt) content.size()), 4);
+        putLE(archive, content.size(), 4);
+        putLE(archive, content.size(), 4);
+        putLE(archive, name.size(), 2);
+        putLE(archive, 0, 2);
+        archive += name + content;
+
+        uint64_t cdOffset = archive.size();
+        putLE(archive, 0x02014b50, 4);
+        putLE(archive, 45, 2);
+        putLE(archive, 45, 2);
+        putLE(archive, 0, 2);
+        putLE(archive, 0, 2);
+        putLE(archive, 0, 4);
+        putLE(archive, crc32(0, (const Bytef *) content.data(), (uInt) content.size()), 4);
+        putLE(archive, 0xffffffff, 4);
+        putLE(archive, 0xffffffff, 4);
+        putLE(archive, name.size(), 2);
+        putLE(archive, 28, 2);
+        putLE(archive, 0, 2);
+        putLE(archive, 0, 2);
+        putLE(archive, 0, 2);
+        putLE(archive, 0, 4);
+        putLE(archive, 0xffffffff, 4);
+        archive += name;
+        putLE(archive, 0x0001, 2);
+        putLE(archive, 24, 2);
+        putLE(archive, content.size(), 8);
+        putLE(archive, content.size(), 8);
+        putLE(archive, localOffset, 8);
+        uint64_t cdSize = archive.size() - cdOffset;
+
+        uint64_t eocd64Offset = archive.size();
+        putLE(archive, 0x06064b50, 4);
+        putLE(archive, 44 + extensibleData, 8);
+        putLE(archive, 45, 2);
+        putLE(archive, 45, 2);
+        putLE(archive, 0, 4);
+        putLE(archive, 0, 4);
+        putLE(archive, 1, 8);
+        putLE(archive, 1, 8);
+        putLE(archive, cdSize, 8);
+        putLE(archive, cdOffset, 8);
+        archive.append(extensibleData, 'x');
+
+        putLE(archive, 0x07064b50, 4);
+        putLE(archive, 0, 4);
+        putLE(archive, eocd64Offset, 8);
+        putLE(archive, 1, 4);
+
+        putLE(archive, 0x06054b50, 4);
+        putLE(archive, 0, 2);
+        putLE(archive, 0, 2);
+        putLE(archive, 0xffff, 2);
+        putLE(archive, 0xffff, 2);
+        putLE(archive, 0xffffffff, 4);
+        putLE(archive, 0xffffffff, 4);
+        putLE(archive, 0, 2);
+        return archive;
+    }
+}
+
+TEST_CASE("remote_zip", "reads the central directory") {
+    zip_builder zip;
+    zip.add("BuildManifest.plist", std::string(1000, 'm'));
+    zip.add("Firmware/dfu/iBSS.im4p", std::string(5000, 'i'), true, 12);
+    std::string archive = zip.finish();
+    // an archive comment, the EOCD isn't the last thing in the file then
+    archive[archive.size() - 2] = 5;
+    archive += "hello";
+
+    size_t reads = 0;
+    auto entries = remote_zip::readCentralDirectory(archive.size(), reader(archive, &reads), "test.zip");
+    // the tail, then the central directory, nothing else
+    CHECK(reads == 2);
+    CHECK(entries.size() == 2);
+    CHECK(entries[0].name == "BuildManifest.plist" && entries[0].method == 0);
+    CHECK(entries[0].localHeaderOffset == 0 && entries[0].compressedSize == 1000 && entries[0].uncompressedSize == 1000);
+    CHECK(entries[1].name == "Firmware/dfu/iBSS.im4p" && entries[1].method == 8);
+    CHECK(entries[1].uncompressedSize == 5000 && entries[1].compressedSize < 5000);
+    CHECK(entries[1].localHeaderOffset == 30 + 19 + 1000);
+    CHECK(entries[1].crc32 == crc32(0, (const Bytef *) std::string(5000, 'i').data(), 5000));
+}
+
+TEST_CASE("remote_zip", "reads zip64 records") {
+    std::string archive = zip64Archive("Restore.dmg", "filesystem", 0x1234);
+    auto entries = remote_zip::readCentralDirectory(archive.size(), reader(archive), "test.zip");
+    CHECK(entries.size() == 1);
+    CHECK(entries[0].name == "Restore.dmg");
+    CHECK(entries[0].localHeaderOffset == 0x1234);
+    CHECK(entries[0].compressedSize == 10 && entries[0].uncompressedSize == 10);
+
+    // zip64 end of central directory further back than the tail that was read, it takes a read of its own
+    std::string far = zip64Archive("Restore.dmg", std::string(0x20000, 'f'), 0, 0x10000);
+    size_t reads = 0;
+    entries = remote_zip::readCentralDirectory(far.size(), reader(far, &reads), "test.zip");
+    CHECK(entries.size() == 1 && entries[0].uncompressedSize == 0x20000);
+    CHECK(reads == 3);
+}
+
+TEST_CASE("remote_zip", "rejects damaged archives") {
+    zip_builder zip;
+    zip.add("a", "a");
+    std::string archive = zip.finish();
+    CHECK_THROWS(remote_zip::readCentralDirectory(10, reader(archive), "test.zip"));
+    std::string noEOCD = archive.substr(0, archive.size() - 22) + std::string(22, '\0');
+    CHECK_THROWS(remote_zip::readCentralDirectory(noEOCD.size(), reader(noEOCD), "test.zip"));
+    std::string badEntry = archive;
+    badEntry[32] = 'X';     // signature of the central directory entry, right after the 32 byte local entry
+    CHECK_THROWS(remote_zip::readCentralDirectory(badEntry.size(), reader(badEntry), "test.zip"));
+    // a short read on the central directory
+    auto truncating = [&archive](uint64_t offset, uint64_t length) {
+        auto data = reader(archive)(offset, length);
+        if (offset != archive.size() - data.size() && !data.empty()) data.pop_back();
+        return data;
+    };
+    CHECK_THROWS(remote_zip::readCentralDirectory(archive.size(), truncating, "test.zip"));
+
+    // counts and offsets of a damaged zip64 record must not reach reserve() or wrap around the archive size
+    std::string hugeCount = zip64Archive("Restore.dmg", "filesystem", 0);
+    size_t eocd64 = hugeCount.rfind(std::string("\x50\x4b\x06\x06", 4));
+    for (int i = 0; i < 8; i++) hugeCount[eocd64 + 32 + i] = '\xff';
+    CHECK_THROWS(remote_zip::readCentralDirectory(hugeCount.size(), reader(hugeCount), "test.zip"));
+    std::string wrappingOffset = zip64Archive("Restore.dmg", "filesystem", 0);
+    for (int i = 0; i < 8; i++) wrappingOffset[eocd64 + 48 + i] = '\xff';
+    CHECK_THROWS(remote_zip::readCentralDirectory(wrappingOffset.size(), reader(wrappingOffset), "test.zip"));
+}
+
+TEST_CASE("remote_zip", "trusts a saved index only while the validators match") {
+    zip_builder first;
+    first.add("Firmware/a.im4p", std::string(0x100, 'a'));
+    zip_builder replaced;
+    replaced.add("Firmware/b.im4p", std::string(0x100, 'b'));
+    http_server server(first.finish());
+    tests::temp_dir dir;
+
+    size_t ranges = server.rangeRequests();
+    CHECK(remote_zip::open(server.url(), dir.path())->getEntry("Firmware/a.im4p"));
+    CHECK(server.rangeRequests() > ranges);
+    // the handle is gone, the next open starts over but finds the index
+    ranges = server.rangeRequests();
+    CHECK(remote_zip::open(server.url(), dir.path())->getEntry("Firmware/a.im4p"));
+    CHECK(server.rangeRequests() == ranges);
+
+    // same URL and size, another archive
+    server.setBody(replaced.finish(), "\"2\"", "Wed, 21 Oct 2015 07:28:00 GMT");
+    auto zip = remote_zip::open(server.url(), dir.path());
+    CHECK(server.rangeRequests() > ranges);
+    CHECK(zip->getEntry("Firmware/b.im4p") && !zip->getEntry("Firmware/a.im4p"));
+    zip.reset();
+
+    server.setBody(first.finish(), "\"2\"", "Thu, 22 Oct 2015 07:28:00 GMT");
+    ranges = server.rangeRequests();
+    CHECK(remote_zip::open(server.url(), dir.path())->getEntry("Firmware/a.im4p"));
+    CHECK(server.rangeRequests() > ranges);
+
+    // nothing to validate an index with, so none is used
+    server.setBody(first.finish(), "", "");
+    for (int i = 0; i < 2; i++) {
+        ranges = server.rangeRequests();
+        CHECK(remote_zip::open(server.url(), dir.path())->getEntry("Firmware/a.im4p"));
+        CHECK(server.rangeRequests() > ranges);
+    }
+}
+
+TEST_CASE("remote_zip", "refetches the central directory over a damaged index") {
+    zip_builder builder;
+    builder.add("Firmware/a.im4p", std::string(0x100, 'a'));
+    http_server server(builder.finish());
+    tests::temp_dir dir;
+    CHECK(remote_zip::open(server.url(), dir.path())->getEntry("Firmware/a.im4p"));
+
+    std::string indexPath;
+    if (DIR *indexDir = opendir(dir.path().c_str())) {
+        while (struct dirent *file = readdir(indexDir)) {
+            if (file->d_name[0] != '.') indexPath = dir.file(file->d_name);
+        }
+        closedir(indexDir);
+    }
+    // the entry count follows the magic, URL, size and both validators
+    std::string index = tests::readFile(indexPath);
+    size_t countLine = 0;
+    for (int i = 0; i < 5; i++) countLine = index.find('\n', countLine) + 1;
+    index.replace(countLine, index.find('\n', countLine) - countLine, "18446744073709551615");
+    tests::writeFile(indexPath, index);
+
+    size_t ranges = server.rangeRequests();
+    CHECK(remote_zip::open(server.url(), dir.path())->getEntry("Firmware/a.im4p"));
+    CHECK(server.rangeRequests() > ranges);
+}
+
+TEST_CASE("remote_zip", "opens a URL once for concurrent callers") {
+    zip_builder builder;
+    builder.add("Firmware/a.im4p", std::string(0x100, 'a'));
+    http_server server(builder.finish());
+    std::vector<std::shared_ptr<remote_zip>> zips(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < zips.size(); i++) {
+        threads.emplace_back([&, i] {
+            zips[i] = remote_zip::open(server.url());
+        });
+    }
+    for (auto &thread: threads) thread.join();
+    CHECK(server.headRequests() == 1);
+    for (const auto &zip: zips) {
+        CHECK(zip && zip == zips[0]);
+    }
+}
+
+TEST_CASE("remote_zip", "coalesces neighbouring entries") {
+    zip_builder builder;
+    builder.add("Firmware/a.im4p", std::string(0x100, 'a'));
+    builder.add("Firmware/b.im4p", std::string(0x100, 'b'));
+    builder.add("Firmware/filler.bin", std::string(0x30000, 'f'));
+    builder.add("Firmware/c.im4p", std::string(0x100, 'c'));
+    builder.add("Firmware/d.im4p", std::string(0x100, 'd'));
+    http_server server(builder.finish());
+    auto zip = remote_zip::open(server.url());
+
+    std::vector<std::string> names = {"Firmware/c.im4p", "Firmware/a.im4p", "Firmware/missing.im4p",
+                                      "Firmware/b.im4p", "Firmware/d.im4p"};
+    // missing entries get a group of their own, the others are grouped in archive order across the gap limit
+    auto groups = zip->coalesce(names, 0x1000, 0x100000);
+    CHECK(groups == std::vector<std::vector<size_t>>({{2}, {1, 3}, {0, 4}}));
+
+    // the filler is small enough to skip over
+    groups = zip->coalesce(names, 0x40000, 0x100000);
+    CHECK(groups == std::vector<std::vector<size_t>>({{2}, {1, 3, 0, 4}}));
+
+    // but not if that makes the request too long
+    groups = zip->coalesce(names, 0x40000, 0x1000);
+    CHECK(groups == std::vector<std::vector<size_t>>({{2}, {1, 3}, {0, 4}}));
+
+    // every entry on its own
+    groups = zip->coalesce(names, 0, 0);
+    CHECK(groups.size() == names.size());
+}
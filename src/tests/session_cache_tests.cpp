@@ -0,0 +1,78 @@
+//
+//  session_cache_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <cstdlib>
+#include <thread>
+#include "test.hpp"
+#include "http_server.hpp"
+#include "manifest_builder.hpp"
+#include "zip_builder.hpp"
+#include "../digest_stream.hpp"
+#include "../futurerestore.hpp"
+#include "../simulated_device.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+namespace {
+    std::string sha384(const std::string &data) {
+        digest_stream digest(0);
+        digest.update(data.data(), data.size());
+        return digest.finish();
+    }
+}
+
+TEST_CASE("session_cache", "fetches a component two sessions need only once") {
+    tests::temp_dir dir;
+    // futurerestore keeps its store and index under $TMPDIR/futurerestore
+    setenv("TMPDIR", dir.path().c_str(), 1);
+    std::string rose;
+    for (size_t i = 0; i < 0x3000; i++) {
+        rose.push_back((char) (i * 7 + 1));
+    }
+    zip_builder zip;
+    zip.add("Firmware/rose.bin", rose);
+    http_server server(zip.finish());
+    manifest_builder manifest;
+    manifest.identity("d22ap", false).component("Rap,RTKitOS", "Firmware/rose.bin", sha384(rose));
+
+    // what the first session would have looked up, so no session goes to the network for it
+    auto cache = std::make_shared<session_cache>();
+    auto latest = cache->latestFirmware("d22ap||||");
+    latest->manifest = manifest.xml();
+    latest->url = server.url();
+    // holds the handle the sessions share, its central directory is fetched here
+    auto firmwareZip = remote_zip::open(server.url());
+    size_t ranges = server.rangeRequests();
+
+    std::vector<std::unique_ptr<futurerestore>> sessions;
+    for (uint64_t ecid : {0x1111, 0x2222}) {
+        simulated_device_backend::config config;
+        config.ecid = ecid;
+        auto session = std::make_unique<futurerestore>();
+        session->setDeviceBackend(std::make_shared<simulated_device_backend>(config));
+        session->selectDevice(ecid);
+        session->setSharedCache(cache);
+        CHECK(session->init());
+        sessions.push_back(std::move(session));
+    }
+    std::vector<std::thread> threads;
+    for (auto &session : sessions) {
+        threads.emplace_back([&session] { session->downloadLatestFirmwareComponents(); });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    CHECK(server.rangeRequests() - ranges == 1);
+    for (auto &session : sessions) {
+        session->attachComponents();
+        CHECK(session->_client->rosefwdatasize == rose.size());
+        CHECK(session->_client->rosefwdata && !memcmp(session->_client->rosefwdata, rose.data(), rose.size()));
+    }
+    unsetenv("TMPDIR");
+}
@@ -0,0 +1,36 @@
+//
+//  simulated_device_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include "test.hpp"
+#include "../simulated_device.hpp"
+
+TEST_CASE("simulated_device", "parses a device spec") {
+    auto config = simulated_device_backend::parseConfig(
+            "board=n71ap,ecid=0x1234,mode=dfu,link=40,disconnect=0,reboot=10,nonce-size=20,nonces=0011:aAbB");
+    CHECK(config.board == "n71ap");
+    CHECK(config.ecid == 0x1234);
+    CHECK(config.startInDfu);
+    CHECK(config.linkBytesPerSecond == 40e6);
+    CHECK(config.disconnectMs == 0 && config.rebootMs == 10);
+    CHECK(config.nonceSize == 20);
+    CHECK(config.nonces.size() == 2 && config.nonces[1] == "\xaa\xbb");
+}
+
+TEST_CASE("simulated_device", "rejects malformed values") {
+    CHECK_THROWS(simulated_device_backend::parseConfig("link=fast"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("link=0"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("link=10mbit"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("nonces=zz"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("nonces=abc"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("ecid=foo"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("ecid=0"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("reboot=-5"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("reboot=99999999999"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("nonce-size=16"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("mode=normal"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("speed=1"));
+    CHECK_THROWS(simulated_device_backend::parseConfig("board"));
+}
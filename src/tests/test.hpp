@@ -0,0 +1,126 @@
+//
+//  test.hpp
+//  futurerestore
+//
+
+#ifndef test_hpp
+#define test_hpp
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+/*
+ * Just enough of a harness for the parts of futurerestore that can be tested without a device or network.
+ * TEST_CASE registers a case under a suite, "futurerestore_tests <suite>" runs one suite, no argument runs all.
+ * A failed CHECK is reported and fails its case, the case keeps running.
+ */
+namespace tests {
+    struct test_case {
+        const char *suite;
+        const char *name;
+        void (*run)();
+    };
+
+    inline std::vector<test_case> &registry() {
+        static std::vector<test_case> cases;
+        return cases;
+    }
+
+    inline int &failedChecks() {
+        static int failed = 0;
+        return failed;
+    }
+
+    struct registrar {
+        registrar(const char *suite, const char *name, void (*run)()) {
+            registry().push_back({suite, name, run});
+        }
+    };
+
+    // a fresh directory, removed with everything in it when it goes out of scope
+    class temp_dir {
+        std::string _path;
+
+        static void removeTree(const std::string &path) {
+            if (DIR *dir = opendir(path.c_str())) {
+                while (struct dirent *file = readdir(dir)) {
+                    if (strcmp(file->d_name, ".") != 0 && strcmp(file->d_name, "..") != 0) {
+                        removeTree(path + "/" + file->d_name);
+                    }
+                }
+                closedir(dir);
+                rmdir(path.c_str());
+            } else {
+                remove(path.c_str());
+            }
+        }
+
+    public:
+        temp_dir() {
+            char tmpl[] = "/tmp/futurerestore_tests.XXXXXX";
+            if (mkdtemp(tmpl)) _path = tmpl;
+        }
+        temp_dir(const temp_dir &) = delete;
+        temp_dir &operator=(const temp_dir &) = delete;
+        ~temp_dir() {
+            // code under test names some files itself, e.g. cached indexes and store buckets
+            if (!_path.empty()) removeTree(_path);
+        }
+
+        const std::string &path() const {return _path;}
+        std::string file(const std::string &name) const {
+            return _path + "/" + name;
+        }
+    };
+
+    inline std::string readFile(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    inline void writeFile(const std::string &path, const std::string &data) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << data;
+    }
+
+    inline bool fileExists(const std::string &path) {
+        return access(path.c_str(), F_OK) == 0;
+    }
+}
+
+#define TEST_CONCAT_(a, b) a##b
+#define TEST_CONCAT(a, b) TEST_CONCAT_(a, b)
+
+#define TEST_CASE(suite, name) \
+    static void TEST_CONCAT(testCase, __LINE__)(); \
+    static tests::registrar TEST_CONCAT(testRegistrar, __LINE__)(suite, name, TEST_CONCAT(testCase, __LINE__)); \
+    static void TEST_CONCAT(testCase, __LINE__)()
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            tests::failedChecks()++; \
+        } \
+    } while (0)
+
+#define CHECK_THROWS(expr) do { \
+        bool threw = false; \
+        try { \
+            (void) (expr); \
+        } catch (...) { \
+            threw = true; \
+        } \
+        if (!threw) { \
+            printf("%s:%d: %s did not throw\n", __FILE__, __LINE__, #expr); \
+            tests::failedChecks()++; \
+        } \
+    } while (0)
+
+#endif /* test_hpp */
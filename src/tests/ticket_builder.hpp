@@ -0,0 +1,101 @@
+//
+//  ticket_builder.hpp
+//  futurerestore tests
+//
+
+#ifndef ticket_builder_hpp
+#define ticket_builder_hpp
+
+#include <cstdint>
+#include <string>
+#include <zlib.h>
+#include "test.hpp"
+
+/*
+ * Writes .shsh2 files holding an unsigned IM4M with the MANP properties futurerestore reads.
+ * Properties left at 0 or empty are left out of the ticket.
+ */
+struct ticket_builder {
+    uint64_t ecid = 0;
+    uint64_t boardId = 0;
+    uint64_t chipId = 0;
+    std::string nonce;
+    std::string generator;      // "0x..." as tsschecker saves it
+
+    static std::string derLength(size_t size) {
+        if (size < 0x80) return std::string(1, (char) size);
+        std::string bytes;
+        for (; size; size >>= 8) bytes.insert(bytes.begin(), (char) (size & 0xff));
+        return std::string(1, (char) (0x80 | bytes.size())) + bytes;
+    }
+
+    static std::string der(const std::string &tag, const std::string &content) {
+        return tag + derLength(content.size()) + content;
+    }
+
+    static std::string derInteger(uint64_t value) {
+        std::string bytes;
+        for (; value; value >>= 8) bytes.insert(bytes.begin(), (char) (value & 0xff));
+        if (bytes.empty() || (bytes[0] & 0x80)) bytes.insert(bytes.begin(), '\0');
+        return der("\x02", bytes);
+    }
+
+    // constructed private tag holding a SEQUENCE { IA5String name, value }
+    static std::string property(const char *name, const std::string &value) {
+        uint32_t number = (uint32_t) name[0] << 24 | (uint32_t) name[1] << 16 | (uint32_t) name[2] << 8 | (uint32_t) name[3];
+        std::string base128;
+        for (; number; number >>= 7) base128.insert(base128.begin(), (char) ((number & 0x7f) | (base128.empty() ? 0 : 0x80)));
+        return der(std::string(1, (char) 0xff) + base128, der("\x30", der("\x16", name) + value));
+    }
+
+    static std::string base64(const std::string &data) {
+        static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        for (size_t i = 0; i < data.size(); i += 3) {
+            uint32_t chunk = (uint8_t) data[i] << 16;
+            if (i + 1 < data.size()) chunk |= (uint8_t) data[i + 1] << 8;
+            if (i + 2 < data.size()) chunk |= (uint8_t) data[i + 2];
+            out += alphabet[chunk >> 18];
+            out += alphabet[(chunk >> 12) & 0x3f];
+            out += (i + 1 < data.size()) ? alphabet[(chunk >> 6) & 0x3f] : '=';
+            out += (i + 2 < data.size()) ? alphabet[chunk & 0x3f] : '=';
+        }
+        return out;
+    }
+
+    // filler where the signature and certificates go, so the signature never verifies
+    std::string im4m() const {
+        std::string properties;
+        if (boardId) properties += property("BORD", derInteger(boardId));
+        if (chipId) properties += property("CHIP", derInteger(chipId));
+        if (ecid) properties += property("ECID", derInteger(ecid));
+        if (!nonce.empty()) properties += property("BNCH", der("\x04", nonce));
+        std::string manb = property("MANB", der("\x31", property("MANP", der("\x31", properties))));
+        return der("\x30", der("\x16", "IM4M") + derInteger(0) + der("\x31", manb) + der("\x04", std::string(256, 's')) +
+                           der("\x30", der("\x04", std::string(64, 'c'))));
+    }
+
+    // key is ApImg4Ticket, or APTicket for a 32-bit device's ticket
+    std::string plist(const char *key = "ApImg4Ticket") const {
+        std::string plist = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                            "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" "
+                            "\"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+                            "<plist version=\"1.0\">\n<dict>\n"
+                            "\t<key>" + std::string(key) + "</key>\n\t<data>" + base64(im4m()) + "</data>\n";
+        if (!generator.empty()) plist += "\t<key>generator</key>\n\t<string>" + generator + "</string>\n";
+        return plist + "</dict>\n</plist>\n";
+    }
+
+    void write(const std::string &path, const char *key = "ApImg4Ticket") const {
+        tests::writeFile(path, plist(key));
+    }
+
+    void writeGzip(const std::string &path) const {
+        std::string data = plist();
+        gzFile out = gzopen(path.c_str(), "wb");
+        gzwrite(out, data.data(), (unsigned) data.size());
+        gzclose(out);
+    }
+};
+
+#endif /* ticket_builder_hpp */
@@ -0,0 +1,100 @@
+//
+//  ticket_files_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "test.hpp"
+#include "ticket_builder.hpp"
+#include "../futurerestore.hpp"
+
+namespace {
+    std::string gzip(const std::string &data) {
+        z_stream zs{};
+        deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        std::string out(deflateBound(&zs, (uLong) data.size()), '\0');
+        zs.next_in = (Bytef *) data.data();
+        zs.avail_in = (uInt) data.size();
+        zs.next_out = (Bytef *) out.data();
+        zs.avail_out = (uInt) out.size();
+        deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return out;
+    }
+}
+
+TEST_CASE("ticket_files", "expands directories to their sorted tickets") {
+    tests::temp_dir dir;
+    std::string tickets = dir.file("tickets");
+    mkdir(tickets.c_str(), 0755);
+    for (const char *name: {"b.shsh2", "a.shsh", "c.shsh2", "notes.txt", ".hidden.shsh2", "noext"}) {
+        tests::writeFile(tickets + "/" + name, "x");
+    }
+    std::string single = dir.file("single.shsh2");
+    tests::writeFile(single, "x");
+
+    auto paths = futurerestore::expandAPTicketPaths({single.c_str(), tickets.c_str()});
+    CHECK(paths.size() == 4);
+    CHECK(paths[0] == single);
+    CHECK(paths[1] == tickets + "/a.shsh");
+    CHECK(paths[2] == tickets + "/b.shsh2");
+    CHECK(paths[3] == tickets + "/c.shsh2");
+
+    std::string empty = dir.file("empty");
+    mkdir(empty.c_str(), 0755);
+    CHECK_THROWS(futurerestore::expandAPTicketPaths({empty.c_str()}));
+}
+
+TEST_CASE("ticket_files", "expands globs and passes other paths through") {
+    tests::temp_dir dir;
+    for (const char *name: {"2.shsh2", "1.shsh2", "1.plist"}) {
+        tests::writeFile(dir.file(name), "x");
+    }
+    std::string pattern = dir.file("*.shsh2");
+    // a missing file is left for loadAPTicket to report
+    std::string missing = dir.file("missing.shsh2");
+    auto paths = futurerestore::expandAPTicketPaths({pattern.c_str(), missing.c_str()});
+    CHECK(paths.size() == 3);
+    CHECK(paths[0] == dir.file("1.shsh2"));
+    CHECK(paths[1] == dir.file("2.shsh2"));
+    CHECK(paths[2] == missing);
+
+    std::string nothing = dir.file("*.shsh");
+    CHECK_THROWS(futurerestore::expandAPTicketPaths({nothing.c_str()}));
+}
+
+TEST_CASE("ticket_files", "reads gzip compressed and plain tickets") {
+    tests::temp_dir dir;
+    ticket_builder ticket;
+    ticket.ecid = 0x1234;
+    ticket.nonce = std::string(32, '\x11');
+    std::string plain = dir.file("plain.shsh2");
+    std::string compressed = dir.file("compressed.shsh2");
+    ticket.write(plain);
+    ticket.writeGzip(compressed);
+    CHECK(futurerestore::readGzipFile(plain) == ticket.plist());
+    CHECK(futurerestore::readGzipFile(compressed) == ticket.plist());
+
+    // concatenated members read as one stream, as with gzread; the trailer read sizes only the last one
+    std::string members = dir.file("members.gz");
+    tests::writeFile(members, gzip("first ") + gzip("second"));
+    CHECK(futurerestore::readGzipFile(members) == "first second");
+
+    std::string empty = dir.file("empty.shsh2");
+    tests::writeFile(empty, "");
+    CHECK(futurerestore::readGzipFile(empty).empty());
+    CHECK_THROWS(futurerestore::readGzipFile(dir.file("missing.shsh2")));
+}
+
+TEST_CASE("ticket_files", "rejects a truncated gzip ticket") {
+    tests::temp_dir dir;
+    ticket_builder ticket;
+    ticket.ecid = 0x1234;
+    std::string compressed = gzip(ticket.plist());
+    std::string truncated = dir.file("truncated.shsh2");
+    tests::writeFile(truncated, compressed.substr(0, compressed.size() / 2));
+    CHECK_THROWS(futurerestore::readGzipFile(truncated));
+}
@@ -0,0 +1,52 @@
+//
+//  ticket_table_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <cstring>
+#include "test.hpp"
+#include "../ticket_table.hpp"
+
+TEST_CASE("ticket_table", "finds tickets by nonce") {
+    ticket_table tickets;
+    std::string first(32, '\x11');
+    std::string second(32, '\x22');
+    std::string shorter(20, '\x22');
+    tickets.add(first.data(), first.size(), 0x1234, 0x1111111111111111);
+    tickets.add(second.data(), second.size(), 0x5678, 0x2222222222222222);
+    tickets.add(shorter.data(), shorter.size(), 0, 0);
+
+    CHECK(tickets.size() == 3);
+    CHECK(tickets.find(second.data(), second.size()) == 1);
+    CHECK(tickets.find(shorter.data(), shorter.size()) == 2);
+    CHECK(tickets.find(first.data(), 20) == ticket_table::npos);
+    CHECK(tickets.find(nullptr, 0) == ticket_table::npos);
+    CHECK(tickets.ecid(1) == 0x5678 && tickets.generator(1) == 0x2222222222222222);
+
+    auto nonce = tickets.nonce(0);
+    CHECK(nonce.second == 32 && !memcmp(nonce.first, first.data(), 32));
+    CHECK(tickets.firstWithoutNonce() == ticket_table::npos);
+}
+
+TEST_CASE("ticket_table", "keeps the first of duplicate nonces") {
+    ticket_table tickets;
+    std::string nonce(32, '\x33');
+    tickets.add(nonce.data(), nonce.size(), 1, 0);
+    tickets.add(nonce.data(), nonce.size(), 2, 0);
+    CHECK(tickets.find(nonce.data(), nonce.size()) == 0);
+}
+
+TEST_CASE("ticket_table", "remembers the first ticket without a nonce") {
+    ticket_table tickets;
+    std::string nonce(20, '\x44');
+    tickets.add(nonce.data(), nonce.size(), 0, 0);
+    tickets.add(nullptr, 0, 0xabcd, 0);
+    tickets.add(nullptr, 0, 0xef01, 0);
+    CHECK(tickets.firstWithoutNonce() == 1);
+    CHECK(tickets.nonce(1).second == 0);
+    CHECK(tickets.ecid(2) == 0xef01);
+    // nonces added after one without stay where they were added
+    tickets.add(nonce.data(), nonce.size(), 0, 0);
+    CHECK(!memcmp(tickets.nonce(3).first, nonce.data(), nonce.size()));
+}
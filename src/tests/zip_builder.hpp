@@ -0,0 +1,101 @@
+//
+//  zip_builder.hpp
+//  futurerestore tests
+//
+
+#ifndef zip_builder_hpp
+#define zip_builder_hpp
+
+#include <cstdint>
+#include <string>
+#include <zlib.h>
+
+/*
+ * Builds small zip archives in memory, stored or raw deflated, without zip64 records.
+ */
+class zip_builder {
+    std::string _data;
+    std::string _centralDirectory;
+    uint16_t _entryCount = 0;
+
+    static void putLE16(std::string &out, uint16_t v) {
+        out.push_back((char) (v & 0xff));
+        out.push_back((char) (v >> 8));
+    }
+
+    static void putLE32(std::string &out, uint32_t v) {
+        putLE16(out, (uint16_t) (v & 0xffff));
+        putLE16(out, (uint16_t) (v >> 16));
+    }
+
+    static std::string deflateRaw(const std::string &content) {
+        z_stream zs{};
+        deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        std::string out(deflateBound(&zs, (uLong) content.size()), '\0');
+        zs.next_in = (Bytef *) content.data();
+        zs.avail_in = (uInt) content.size();
+        zs.next_out = (Bytef *) &out[0];
+        zs.avail_out = (uInt) out.size();
+        deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return out;
+    }
+
+public:
+    // extraLength pads the local header only, like archivers that store different extra fields there
+    void add(const std::string &name, const std::string &content, bool compress = false, uint16_t extraLength = 0) {
+        std::string payload = compress ? deflateRaw(content) : content;
+        auto crc = (uint32_t) crc32(crc32(0, nullptr, 0), (const Bytef *) content.data(), (uInt) content.size());
+        auto offset = (uint32_t) _data.size();
+        uint16_t method = compress ? 8 : 0;
+
+        putLE32(_data, 0x04034b50);
+        putLE16(_data, 20);
+        putLE16(_data, 0);
+        putLE16(_data, method);
+        putLE32(_data, 0);
+        putLE32(_data, crc);
+        putLE32(_data, (uint32_t) payload.size());
+        putLE32(_data, (uint32_t) content.size());
+        putLE16(_data, (uint16_t) name.size());
+        putLE16(_data, extraLength);
+        _data += name;
+        _data.append(extraLength, '\0');
+        _data += payload;
+
+        putLE32(_centralDirectory, 0x02014b50);
+        putLE16(_centralDirectory, 20);
+        putLE16(_centralDirectory, 20);
+        putLE16(_centralDirectory, 0);
+        putLE16(_centralDirectory, method);
+        putLE32(_centralDirectory, 0);
+        putLE32(_centralDirectory, crc);
+        putLE32(_centralDirectory, (uint32_t) payload.size());
+        putLE32(_centralDirectory, (uint32_t) content.size());
+        putLE16(_centralDirectory, (uint16_t) name.size());
+        putLE16(_centralDirectory, 0);
+        putLE16(_centralDirectory, 0);
+        putLE16(_centralDirectory, 0);
+        putLE16(_centralDirectory, 0);
+        putLE32(_centralDirectory, 0);
+        putLE32(_centralDirectory, offset);
+        _centralDirectory += name;
+        _entryCount++;
+    }
+
+    std::string finish() const {
+        std::string archive = _data + _centralDirectory;
+        putLE32(archive, 0x06054b50);
+        putLE16(archive, 0);
+        putLE16(archive, 0);
+        putLE16(archive, _entryCount);
+        putLE16(archive, _entryCount);
+        putLE32(archive, (uint32_t) _centralDirectory.size());
+        putLE32(archive, (uint32_t) _data.size());
+        putLE16(archive, 0);
+        return archive;
+    }
+};
+
+#endif /* zip_builder_hpp */
@@ -0,0 +1,125 @@
+//
+//  zip_extractor_tests.cpp
+//  futurerestore tests
+//
+
+#include <libgeneral/macros.h>
+#include <thread>
+#include "test.hpp"
+#include "zip_builder.hpp"
+#include "../zip_extractor.hpp"
+
+namespace {
+    std::string pattern(size_t size, uint32_t seed) {
+        std::string out(size, '\0');
+        uint32_t x = seed * 2654435761u + 1;
+        for (size_t i = 0; i < size; i++) {
+            x = x * 1103515245 + 12345;
+            out[i] = (char) (x >> 16);
+        }
+        return out;
+    }
+
+    void putLE32(std::string &data, size_t offset, uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            data[offset + i] = (char) (v >> (8 * i));
+        }
+    }
+
+    // offset of the only central directory entry, found through the end of central directory record
+    size_t centralDirectoryOffset(const std::string &archive) {
+        size_t eocd = archive.size() - 22;
+        return (uint8_t) archive[eocd + 16] | (uint8_t) archive[eocd + 17] << 8 |
+               (uint8_t) archive[eocd + 18] << 16 | (size_t) (uint8_t) archive[eocd + 19] << 24;
+    }
+}
+
+TEST_CASE("zip_extractor", "extracts stored and deflated entries") {
+    tests::temp_dir dir;
+    // more than one read and write block each
+    std::string big = pattern(zip_extractor::defaultWriteChunk * 2 + 123, 1);
+    std::string text = std::string(0x100000, 'A') + pattern(0x1000, 2);
+    zip_builder zip;
+    zip.add("stored.bin", big);
+    zip.add("deflated.bin", text, true);
+    zip.add("empty.bin", "");
+    tests::writeFile(dir.file("fw.zip"), zip.finish());
+
+    zip_extractor extractor(dir.file("fw.zip"));
+    CHECK(extractor.getEntry("stored.bin") && extractor.getEntry("deflated.bin"));
+    CHECK(!extractor.getEntry("missing.bin"));
+
+    std::string seen;
+    zip_extractor::stats st = extractor.extract("stored.bin", dir.file("stored.bin"), [&](const uint8_t *data, size_t size) {
+        seen.append((const char *) data, size);
+    });
+    CHECK(tests::readFile(dir.file("stored.bin")) == big);
+    CHECK(seen == big);
+    CHECK(st.write.bytes == big.size());
+
+    st = extractor.extract("deflated.bin", dir.file("deflated.bin"));
+    CHECK(tests::readFile(dir.file("deflated.bin")) == text);
+    CHECK(st.read.bytes < text.size());
+    CHECK(st.inflate.bytes == text.size());
+
+    extractor.extract("empty.bin", dir.file("empty.bin"));
+    CHECK(tests::fileExists(dir.file("empty.bin")) && tests::readFile(dir.file("empty.bin")).empty());
+    CHECK_THROWS(extractor.extract("missing.bin", dir.file("missing.bin")));
+}
+
+TEST_CASE("zip_extractor", "removes the target on a crc mismatch") {
+    tests::temp_dir dir;
+    std::string content = pattern(0x20000, 3);
+    zip_builder zip;
+    zip.add("fs.dmg", content);
+    std::string archive = zip.finish();
+    // stored data starts after the 30 byte local header and the name
+    archive[30 + 6 + 0x1000] ^= 0x55;
+    tests::writeFile(dir.file("fw.zip"), archive);
+
+    zip_extractor extractor(dir.file("fw.zip"));
+    CHECK_THROWS(extractor.extract("fs.dmg", dir.file("fs.dmg")));
+    CHECK(!tests::fileExists(dir.file("fs.dmg")));
+}
+
+TEST_CASE("zip_extractor", "removes the target on a size mismatch") {
+    tests::temp_dir dir;
+    std::string content = pattern(0x20000, 4);
+    zip_builder zip;
+    zip.add("fs.dmg", content, true);
+    std::string archive = zip.finish();
+    // the central directory claims a byte more than the deflate stream holds
+    putLE32(archive, centralDirectoryOffset(archive) + 24, (uint32_t) content.size() + 1);
+    tests::writeFile(dir.file("fw.zip"), archive);
+
+    zip_extractor extractor(dir.file("fw.zip"));
+    CHECK(extractor.getEntry("fs.dmg")->uncompressedSize == content.size() + 1);
+    CHECK_THROWS(extractor.extract("fs.dmg", dir.file("fs.dmg")));
+    CHECK(!tests::fileExists(dir.file("fs.dmg")));
+}
+
+TEST_CASE("zip_extractor", "stops when cancelled from another thread") {
+    tests::temp_dir dir;
+    std::string content = pattern(zip_extractor::defaultWriteChunk * 4, 5);
+    zip_builder zip;
+    zip.add("fs.dmg", content);
+    tests::writeFile(dir.file("fw.zip"), zip.finish());
+    zip_extractor extractor(dir.file("fw.zip"));
+
+    std::atomic<bool> cancel{false};
+    std::atomic<bool> writing{false};
+    std::atomic<size_t> seen{0};
+    std::thread canceller([&] {
+        while (!writing) std::this_thread::yield();
+        cancel = true;
+    });
+    // the first block waits for the cancel, so it lands mid-way
+    CHECK_THROWS(extractor.extract("fs.dmg", dir.file("fs.dmg"), [&](const uint8_t *, size_t size) {
+        seen += size;
+        writing = true;
+        while (!cancel) std::this_thread::yield();
+    }, &cancel));
+    canceller.join();
+    CHECK(seen > 0 && seen < content.size());
+    CHECK(!tests::fileExists(dir.file("fs.dmg")));
+}
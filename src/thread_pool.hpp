@@ -0,0 +1,93 @@
+//
+//  thread_pool.hpp
+//  futurerestore
+//
+
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Minimal fixed-size worker pool.
+ * Tasks must not throw, wrap them and record the failure instead.
+ */
+class thread_pool {
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _lock;
+    std::condition_variable _taskCond;
+    std::condition_variable _idleCond;
+    size_t _busy = 0;
+    bool _stop = false;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lk(_lock);
+                _taskCond.wait(lk, [this] { return _stop || !_tasks.empty(); });
+                if (_tasks.empty()) return;
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+                _busy++;
+            }
+            task();
+            {
+                std::unique_lock<std::mutex> lk(_lock);
+                _busy--;
+                if (_tasks.empty() && !_busy) _idleCond.notify_all();
+            }
+        }
+    }
+
+public:
+    explicit thread_pool(size_t threads) {
+        if (!threads) threads = 1;
+        for (size_t i = 0; i < threads; i++) {
+            _workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    ~thread_pool() {
+        {
+            std::unique_lock<std::mutex> lk(_lock);
+            _stop = true;
+        }
+        _taskCond.notify_all();
+        for (auto &worker: _workers) {
+            if (worker.joinable()) worker.join();
+        }
+    }
+
+    size_t size() const {return _workers.size();}
+
+    void enqueue(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lk(_lock);
+            _tasks.push_back(std::move(task));
+        }
+        _taskCond.notify_one();
+    }
+
+    // blocks until every queued task has finished
+    void wait() {
+        std::unique_lock<std::mutex> lk(_lock);
+        _idleCond.wait(lk, [this] { return _tasks.empty() && !_busy; });
+    }
+
+    static size_t defaultThreadCount() {
+        size_t cnt = std::thread::hardware_concurrency();
+        return cnt ? cnt : 4;
+    }
+};
+
+#endif /* thread_pool_hpp */
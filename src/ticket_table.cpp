@@ -0,0 +1,26 @@
+//
+//  ticket_table.cpp
+//  futurerestore
+//
+
+#include "ticket_table.hpp"
+
+void ticket_table::add(const void *nonce, size_t nonceSize, uint64_t ecid, uint64_t generator) {
+    size_t i = size();
+    _nonceOffsets.push_back(_nonceData.size());
+    _nonceSizes.push_back((uint32_t) nonceSize);
+    _nonceData.insert(_nonceData.end(), (const uint8_t *) nonce, (const uint8_t *) nonce + nonceSize);
+    _ecids.push_back(ecid);
+    _generators.push_back(generator);
+    if (nonceSize) {
+        _nonceIndex.emplace(std::string((const char *) nonce, nonceSize), i);
+    } else if (_firstWithoutNonce == npos) {
+        _firstWithoutNonce = i;
+    }
+}
+
+size_t ticket_table::find(const void *nonce, size_t nonceSize) const {
+    if (!nonce || !nonceSize) return npos;
+    auto found = _nonceIndex.find(std::string((const char *) nonce, nonceSize));
+    return (found != _nonceIndex.end()) ? found->second : npos;
+}
@@ -0,0 +1,50 @@
+//
+//  ticket_table.hpp
+//  futurerestore
+//
+
+#ifndef ticket_table_hpp
+#define ticket_table_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * BNCH, ECID and generator of every loaded signing ticket, parsed once when the ticket is loaded.
+ * Ticket i here is ticket i in futurerestore's _im4ms/_aptickets. Nonces are stored back to back in one buffer
+ * and indexed by their bytes, so matching the device's ApNonce doesn't depend on the number of tickets.
+ */
+class ticket_table {
+    std::vector<uint8_t> _nonceData;
+    std::vector<size_t> _nonceOffsets;
+    std::vector<uint32_t> _nonceSizes;
+    std::vector<uint64_t> _ecids;
+    std::vector<uint64_t> _generators;
+    // nonce bytes -> first ticket carrying them
+    std::unordered_map<std::string, size_t> _nonceIndex;
+    size_t _firstWithoutNonce = npos;
+
+public:
+    static constexpr size_t npos = (size_t) -1;
+
+    // nonce may be empty (32-bit re-restore tickets), ecid and generator are 0 if unknown
+    void add(const void *nonce, size_t nonceSize, uint64_t ecid, uint64_t generator);
+
+    size_t size() const {return _ecids.size();}
+    // pointers stay valid until the next add()
+    std::pair<const unsigned char *, size_t> nonce(size_t i) const {
+        return {_nonceData.data() + _nonceOffsets[i], _nonceSizes[i]};
+    }
+    uint64_t ecid(size_t i) const {return _ecids[i];}
+    uint64_t generator(size_t i) const {return _generators[i];}
+
+    // first ticket whose nonce is exactly these bytes, npos if none
+    size_t find(const void *nonce, size_t nonceSize) const;
+    size_t firstWithoutNonce() const {return _firstWithoutNonce;}
+};
+
+#endif /* ticket_table_hpp */
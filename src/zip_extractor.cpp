@@ -0,0 +1,434 @@
+//
+//  zip_extractor.cpp
+//  futurerestore
+//
+
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "zip_extractor.hpp"
+
+#ifdef WIN32
+#include <io.h>
+#include <malloc.h>
+#endif
+
+extern "C" {
+#include "common.h"
+}
+
+using namespace tihmstar;
+
+#define ZIP_LOCAL_SIG           0x04034b50
+#define ZIP_LOCAL_SIZE          30
+
+#ifndef O_BINARY
+#define O_BINARY                0
+#endif
+
+#ifndef POSIX_FADV_SEQUENTIAL
+// no posix_fadvise on macOS and Windows, the hints are dropped there
+#define NO_FADVISE
+#define POSIX_FADV_SEQUENTIAL   0
+#define POSIX_FADV_WILLNEED     0
+#define POSIX_FADV_DONTNEED     0
+#endif
+
+namespace {
+    // page aligned, lets the kernel move whole pages and keeps O_DIRECT an option
+    constexpr size_t blockAlignment = 0x1000;
+
+    uint16_t readLE16(const uint8_t *p) {
+        return (uint16_t) (p[0] | (p[1] << 8));
+    }
+
+    uint32_t readLE32(const uint8_t *p) {
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    bool readFully(int fd, uint8_t *buf, size_t len, uint64_t offset) {
+#ifdef WIN32
+        // only one thread reads a given fd at a time, seeking is fine
+        if (_lseeki64(fd, (__int64) offset, SEEK_SET) < 0) return false;
+#endif
+        while (len) {
+            auto want = (unsigned int) std::min<size_t>(len, 0x40000000);
+#ifdef WIN32
+            int got = _read(fd, buf, want);
+#else
+            ssize_t got = pread(fd, buf, want, (off_t) offset);
+#endif
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            buf += got;
+            len -= (size_t) got;
+            offset += (uint64_t) got;
+        }
+        return true;
+    }
+
+    bool writeFully(int fd, const uint8_t *buf, size_t len) {
+        while (len) {
+            auto want = (unsigned int) std::min<size_t>(len, 0x40000000);
+            auto got = write(fd, buf, want);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            buf += got;
+            len -= (size_t) got;
+        }
+        return true;
+    }
+
+    void advise(int fd, uint64_t offset, uint64_t length, int advice) {
+#ifndef NO_FADVISE
+        posix_fadvise(fd, (off_t) offset, (off_t) length, advice);
+#endif
+    }
+
+    /*
+     * Reserves the space for the whole entry up front, so a full disk fails right away instead of
+     * after gigabytes were written, and the filesystem can hand out contiguous extents.
+     * The file size is left alone, other processes watch it to see an extraction making progress.
+     */
+    void preallocate(int fd, uint64_t size, const std::string &path) {
+        if (!size) return;
+        int err = 0;
+#if defined(__linux__)
+        if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t) size) == 0) return;
+        err = errno;
+#elif defined(__APPLE__)
+        fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t) size, 0};
+        if (fcntl(fd, F_PREALLOCATE, &store) != -1) return;
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(fd, F_PREALLOCATE, &store) != -1) return;
+        err = errno;
+#endif
+        retassure(err != ENOSPC, "%s: not enough space for %s (%" PRIu64 " bytes)\n", __func__, path.c_str(), size);
+        // e.g. a filesystem without preallocation support, the writes below still work
+        if (err) debug("%s: can't preallocate %s: %s\n", __func__, path.c_str(), strerror(err));
+    }
+
+    struct block {
+        uint8_t *data = nullptr;
+        size_t capacity = 0;
+        size_t len = 0;
+
+        explicit block(size_t size) : capacity(size) {
+#ifdef WIN32
+            data = (uint8_t *) _aligned_malloc(size, blockAlignment);
+#else
+            void *p = nullptr;
+            if (!posix_memalign(&p, blockAlignment, size)) data = (uint8_t *) p;
+#endif
+            retassure(data, "%s: failed to allocate %zu bytes\n", __func__, size);
+        }
+        block(const block &) = delete;
+        block &operator=(const block &) = delete;
+        ~block() {
+#ifdef WIN32
+            _aligned_free(data);
+#else
+            free(data);
+#endif
+        }
+    };
+
+    /*
+     * Hands blocks from one stage to the next.
+     * Never blocks on push, the number of blocks in circulation bounds every queue.
+     */
+    class block_queue {
+        std::deque<block *> _blocks;
+        std::mutex _lock;
+        std::condition_variable _cond;
+        bool _closed = false;
+        bool _aborted = false;
+
+    public:
+        void push(block *b) {
+            {
+                std::unique_lock<std::mutex> lk(_lock);
+                _blocks.push_back(b);
+            }
+            _cond.notify_one();
+        }
+
+        // false once the queue is closed and drained, or right away if it was aborted
+        bool pop(block *&b) {
+            std::unique_lock<std::mutex> lk(_lock);
+            _cond.wait(lk, [this] { return _closed || !_blocks.empty(); });
+            if (_aborted || _blocks.empty()) return false;
+            b = _blocks.front();
+            _blocks.pop_front();
+            return true;
+        }
+
+        void close(bool abort = false) {
+            {
+                std::unique_lock<std::mutex> lk(_lock);
+                _closed = true;
+                _aborted |= abort;
+            }
+            _cond.notify_all();
+        }
+    };
+
+    class stage_timer {
+        zip_extractor::stage_stats &_stats;
+        std::chrono::steady_clock::time_point _start;
+
+    public:
+        explicit stage_timer(zip_extractor::stage_stats &stats)
+            : _stats(stats), _start(std::chrono::steady_clock::now()) {}
+        ~stage_timer() {
+            _stats.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+        }
+    };
+}
+
+zip_extractor::zip_extractor(std::string path) : _path(std::move(path)) {
+    _fd = open(_path.c_str(), O_RDONLY | O_BINARY);
+    retassure(_fd >= 0, "%s: failed to open %s\n", __func__, _path.c_str());
+    bool ok = false;
+    cleanup([&] {
+        if (!ok) {
+            close(_fd);
+            _fd = -1;
+        }
+    });
+#ifdef WIN32
+    struct _stat64 st{0};
+    retassure(!_fstat64(_fd, &st), "%s: failed to get file size for %s\n", __func__, _path.c_str());
+#else
+    struct stat st{0};
+    retassure(!fstat(_fd, &st), "%s: failed to get file size for %s\n", __func__, _path.c_str());
+#endif
+    _archiveSize = (uint64_t) st.st_size;
+    _entries = remote_zip::readCentralDirectory(_archiveSize, [this](uint64_t offset, uint64_t length) {
+        return readAt(offset, length);
+    }, _path);
+    _entryIndex.reserve(_entries.size());
+    for (size_t i = 0; i < _entries.size(); i++) {
+        _entryIndex[_entries[i].name] = i;
+    }
+    ok = true;
+}
+
+zip_extractor::~zip_extractor() {
+    if (_fd >= 0) close(_fd);
+}
+
+std::vector<uint8_t> zip_extractor::readAt(uint64_t offset, uint64_t length) const {
+    retassure(offset <= _archiveSize && length <= _archiveSize - offset, "%s: range is out of bounds of %s\n",
+              __func__, _path.c_str());
+    std::vector<uint8_t> buf((size_t) length);
+    retassure(readFully(_fd, buf.data(), buf.size(), offset), "%s: failed to read %s\n", __func__, _path.c_str());
+    return buf;
+}
+
+uint64_t zip_extractor::dataOffset(const entry &e) const {
+    std::vector<uint8_t> header = readAt(e.localHeaderOffset, ZIP_LOCAL_SIZE);
+    retassure(readLE32(header.data()) == ZIP_LOCAL_SIG, "%s: bad local header for %s\n", __func__, e.name.c_str());
+    uint64_t offset = e.localHeaderOffset + ZIP_LOCAL_SIZE + readLE16(&header[26]) + readLE16(&header[28]);
+    retassure(offset <= _archiveSize && e.compressedSize <= _archiveSize - offset, "%s: %s is out of bounds\n",
+              __func__, e.name.c_str());
+    return offset;
+}
+
+const zip_extractor::entry *zip_extractor::getEntry(const std::string &name) const {
+    auto found = _entryIndex.find(name);
+    return (found != _entryIndex.end()) ? &_entries[found->second] : nullptr;
+}
+
+zip_extractor::stats zip_extractor::extract(const std::string &name, const std::string &dstPath,
+                                            const data_callback &sink, const std::atomic<bool> *cancel) const {
+    const entry *e = getEntry(name);
+    retassure(e, "%s: %s not found in %s\n", __func__, name.c_str(), _path.c_str());
+    retassure(e->method == 0 || e->method == 8, "%s: %s uses unsupported compression method %u\n", __func__,
+              name.c_str(), (unsigned int) e->method);
+    const uint64_t start = dataOffset(*e);
+    const uint64_t end = start + e->compressedSize;
+
+    int out = open(dstPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    retassure(out >= 0, "%s: failed to create %s\n", __func__, dstPath.c_str());
+    bool ok = false;
+    cleanup([&] {
+        if (out >= 0) close(out);
+        if (!ok) remove(dstPath.c_str());
+    });
+    preallocate(out, e->uncompressedSize, dstPath);
+
+    std::vector<std::unique_ptr<block>> blocks;
+    block_queue readFree, readFilled, writeFree, writeFilled;
+    for (size_t i = 0; i < defaultQueueDepth; i++) {
+        blocks.push_back(std::make_unique<block>(defaultReadChunk));
+        readFree.push(blocks.back().get());
+        blocks.push_back(std::make_unique<block>(defaultWriteChunk));
+        writeFree.push(blocks.back().get());
+    }
+
+    stats st;
+    uLong crc = crc32(0, nullptr, 0);
+    bool streamEnd = e->method == 0;
+    std::mutex failureLock;
+    std::exception_ptr failure;
+    auto runStage = [&](std::function<void()> body) {
+        return std::thread([&, body = std::move(body)] {
+            try {
+                body();
+            } catch (...) {
+                {
+                    std::unique_lock<std::mutex> lk(failureLock);
+                    if (!failure) failure = std::current_exception();
+                }
+                for (block_queue *q: {&readFree, &readFilled, &writeFree, &writeFilled}) {
+                    q->close(true);
+                }
+            }
+        });
+    };
+
+    // throwing from a stage aborts every queue, so the other stages stop at their next pop as well
+    auto checkCancelled = [&] {
+        retassure(!cancel || !cancel->load(), "extract: extraction of %s was cancelled\n", name.c_str());
+    };
+
+    auto started = std::chrono::steady_clock::now();
+
+    std::thread reader = runStage([&] {
+        // keep the kernel a few blocks ahead of us, and drop what was consumed so a 6GB
+        // filesystem doesn't push everything else out of the page cache
+        const uint64_t readAhead = (uint64_t) defaultReadChunk * defaultQueueDepth * 2;
+        advise(_fd, start, e->compressedSize, POSIX_FADV_SEQUENTIAL);
+        uint64_t advised = start;
+        for (uint64_t pos = start; pos < end;) {
+            checkCancelled();
+            block *b = nullptr;
+            if (!readFree.pop(b)) return;
+            b->len = (size_t) std::min<uint64_t>(b->capacity, end - pos);
+            uint64_t aheadEnd = std::min(end, pos + readAhead);
+            if (advised < aheadEnd) {
+                advise(_fd, advised, aheadEnd - advised, POSIX_FADV_WILLNEED);
+                advised = aheadEnd;
+            }
+            {
+                stage_timer timer(st.read);
+                retassure(readFully(_fd, b->data, b->len, pos), "extract: failed to read %s from %s\n", name.c_str(),
+                          _path.c_str());
+            }
+            advise(_fd, pos, b->len, POSIX_FADV_DONTNEED);
+            st.read.bytes += b->len;
+            pos += b->len;
+            readFilled.push(b);
+        }
+        readFilled.close();
+    });
+
+    std::thread inflater = runStage([&] {
+        z_stream zs{};
+        bool zsInit = false;
+        cleanup([&] {
+            if (zsInit) inflateEnd(&zs);
+        });
+        if (e->method == 8) {
+            retassure(inflateInit2(&zs, -MAX_WBITS) == Z_OK, "extract: inflateInit2 failed\n");
+            zsInit = true;
+        }
+        block *dst = nullptr;
+        if (!writeFree.pop(dst)) return;
+        dst->len = 0;
+        block *src = nullptr;
+        while (readFilled.pop(src)) {
+            checkCancelled();
+            size_t used = 0;
+            while (used < src->len) {
+                retassure(!streamEnd || e->method == 0, "extract: %s: data after end of deflate stream\n",
+                          name.c_str());
+                size_t produced = 0;
+                {
+                    stage_timer timer(st.inflate);
+                    if (e->method == 0) {
+                        produced = std::min(src->len - used, dst->capacity - dst->len);
+                        memcpy(dst->data + dst->len, src->data + used, produced);
+                        used += produced;
+                    } else {
+                        zs.next_in = src->data + used;
+                        zs.avail_in = (uInt) (src->len - used);
+                        zs.next_out = dst->data + dst->len;
+                        zs.avail_out = (uInt) (dst->capacity - dst->len);
+                        int ret = inflate(&zs, Z_NO_FLUSH);
+                        retassure(ret == Z_OK || ret == Z_STREAM_END, "extract: %s: inflate failed (%d)\n",
+                                  name.c_str(), ret);
+                        used = (size_t) (zs.next_in - src->data);
+                        produced = (size_t) (zs.next_out - (dst->data + dst->len));
+                        streamEnd = ret == Z_STREAM_END;
+                    }
+                }
+                dst->len += produced;
+                st.inflate.bytes += produced;
+                if (dst->len == dst->capacity) {
+                    writeFilled.push(dst);
+                    if (!writeFree.pop(dst)) return;
+                    dst->len = 0;
+                }
+            }
+            readFree.push(src);
+        }
+        if (dst->len) writeFilled.push(dst);
+        writeFilled.close();
+    });
+
+    std::thread writer = runStage([&] {
+        block *b = nullptr;
+        while (writeFilled.pop(b)) {
+            checkCancelled();
+            {
+                stage_timer timer(st.write);
+                crc = crc32(crc, b->data, (uInt) b->len);
+                if (sink) sink(b->data, b->len);
+                retassure(writeFully(out, b->data, b->len), "extract: failed to write %s: %s\n", dstPath.c_str(),
+                          strerror(errno));
+            }
+            st.write.bytes += b->len;
+            writeFree.push(b);
+        }
+    });
+
+    reader.join();
+    inflater.join();
+    writer.join();
+    st.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    if (failure) std::rethrow_exception(failure);
+
+    retassure(streamEnd, "%s: %s: deflate stream is truncated\n", __func__, name.c_str());
+    retassure(st.write.bytes == e->uncompressedSize, "%s: %s: size mismatch (%" PRIu64 " != %" PRIu64 ")\n",
+              __func__, name.c_str(), st.write.bytes, e->uncompressedSize);
+    retassure(crc == e->crc32, "%s: %s: crc32 mismatch\n", __func__, name.c_str());
+    int closed = close(out);
+    out = -1;
+    retassure(!closed, "%s: failed to write %s: %s\n", __func__, dstPath.c_str(), strerror(errno));
+    ok = true;
+    return st;
+}
+
+void zip_extractor::report(const std::string &name, const stats &st) {
+    auto mbps = [](const stage_stats &stage) {
+        return stage.throughput() / 1000000;
+    };
+    info("Extracted %s in %.1fs (%.1f MB/s): read %.1f MB/s, inflate %.1f MB/s, write %.1f MB/s\n", name.c_str(),
+         st.wallSeconds, st.wallSeconds > 0 ? st.write.bytes / st.wallSeconds / 1000000 : 0, mbps(st.read),
+         mbps(st.inflate), mbps(st.write));
+}
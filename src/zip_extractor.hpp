@@ -0,0 +1,76 @@
+//
+//  zip_extractor.hpp
+//  futurerestore
+//
+
+#ifndef zip_extractor_hpp
+#define zip_extractor_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "remote_zip.hpp"
+
+/*
+ * Extracts big entries (the OS filesystem) from a local zip archive.
+ * Reading, inflating and writing run on their own threads that hand a fixed set of blocks to each other,
+ * so a slow stage only stalls the others once all blocks between them are in use.
+ * The source is read ahead with posix_fadvise, the target is preallocated and written in large aligned blocks.
+ */
+class zip_extractor {
+public:
+    typedef remote_zip::entry entry;
+    // sees every decompressed byte in order, called from the write thread
+    typedef remote_zip::data_callback data_callback;
+
+    struct stage_stats {
+        uint64_t bytes = 0;
+        double busySeconds = 0;    // time spent working, without waiting on the neighbouring stages
+
+        double throughput() const {return busySeconds > 0 ? bytes / busySeconds : 0;}
+    };
+
+    struct stats {
+        stage_stats read;          // compressed bytes
+        stage_stats inflate;       // decompressed bytes
+        stage_stats write;         // decompressed bytes
+        double wallSeconds = 0;
+    };
+
+    static constexpr size_t defaultReadChunk = 0x400000;
+    static constexpr size_t defaultWriteChunk = 0x800000;
+    // chunks in flight between two stages
+    static constexpr size_t defaultQueueDepth = 4;
+
+private:
+    std::string _path;
+    int _fd = -1;
+    uint64_t _archiveSize = 0;
+    std::vector<entry> _entries;
+    std::unordered_map<std::string, size_t> _entryIndex;
+
+    std::vector<uint8_t> readAt(uint64_t offset, uint64_t length) const;
+    uint64_t dataOffset(const entry &e) const;
+
+public:
+    explicit zip_extractor(std::string path);
+    zip_extractor(const zip_extractor &) = delete;
+    zip_extractor &operator=(const zip_extractor &) = delete;
+    ~zip_extractor();
+
+    const std::string &path() const {return _path;}
+    const entry *getEntry(const std::string &name) const;
+
+    // extracts name to dstPath and crc checks it, dstPath is removed again on failure
+    // setting cancel stops all stages at their next block and makes extract throw
+    stats extract(const std::string &name, const std::string &dstPath, const data_callback &sink = nullptr,
+                  const std::atomic<bool> *cancel = nullptr) const;
+
+    // logs per stage throughput of an extraction
+    static void report(const std::string &name, const stats &st);
+};
+
+#endif /* zip_extractor_hpp */